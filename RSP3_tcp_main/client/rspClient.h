@@ -0,0 +1,163 @@
+/**
+** RSP3_tcp - TCP/IP I/Q Data Server for the sdrplay RSP devices
+** Copyright (C) 2017-2024 Clem Schmidt, softsyst, http://qirx.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#pragma once
+#include <stdint.h>
+
+// Sample formats as sent in byte 6 of the welcome string, see eBitWidth of the server
+enum eRspFormat
+{
+	  RSP_FORMAT_4 = 0
+	, RSP_FORMAT_8 = 1
+	, RSP_FORMAT_16 = 2
+	, RSP_FORMAT_BFP = 3
+	, RSP_FORMAT_LOSSLESS = 4
+	, RSP_FORMAT_12 = 5
+	, RSP_FORMAT_CF32 = 6		// I and Q as little endian floats, referred to the antenna input
+};
+
+// Flags of a frame header in framed mode, see eFrameFlags of the server
+enum eRspFrameFlags
+{
+	  RSP_FRAME_RF_CHANGED = 0x01
+	, RSP_FRAME_FS_CHANGED = 0x02
+	, RSP_FRAME_GR_CHANGED = 0x04
+	, RSP_FRAME_DISCONTINUITY = 0x08
+};
+
+// Header of a frame in framed mode (-H 1), see StreamFrame.h of the server
+struct rspFrameHeader
+{
+	int headerLength;		// the payload starts there
+	eRspFormat format;
+	int flags;				// eRspFrameFlags
+	int payloadLength;
+	int numSamples;
+	uint64_t sampleIndex;	// at the stream rate, a gap to the previous frame counts lost samples
+};
+
+// Header of a datagram of the UDP stream (-U), see UdpStreamer.h of the server
+struct rspDatagramHeader
+{
+	int headerLength;		// the payload starts there, it ends with the datagram
+	eRspFormat format;
+	int flags;				// eRspFrameFlags, in the first datagram of a server block
+	uint32_t sequence;		// counting the datagrams, a gap shows lost ones
+	int numSamples;
+	uint64_t sampleIndex;
+};
+
+/// <summary>
+/// Decoding helpers for clients of RSP_tcp, without dependencies on the server sources.
+/// Include this header into a decoder. The lossless frames are decoded by
+/// LosslessCodec::decode of the server sources.
+/// </summary>
+struct rspClient
+{
+	static const int c_welcomeLength = 100;
+
+	static eRspFormat format(const uint8_t* welcome) { return (eRspFormat)welcome[6]; }
+	static bool framed(const uint8_t* welcome) { return welcome[19] != 0; }
+
+	static const int c_frameHeaderLength = 24;
+
+	// Framed mode: parses the c_frameHeaderLength bytes starting a frame.
+	// Returns false if they don't, the client lost the framing then
+	static bool parseFrame(const uint8_t* p, rspFrameHeader& h)
+	{
+		if (p[0] != 'R' || p[1] != 'S' || p[2] != 'P' || p[3] != 'D')
+			return false;
+		h.headerLength = p[4] << 8 | p[5];
+		h.format = (eRspFormat)p[6];
+		h.flags = p[7];
+		h.payloadLength = (int)be32(p + 8);
+		h.numSamples = (int)be32(p + 12);
+		h.sampleIndex = (uint64_t)be32(p + 16) << 32 | be32(p + 20);
+		return h.headerLength >= c_frameHeaderLength && h.payloadLength >= 0;
+	}
+
+	static const int c_datagramHeaderLength = 24;
+
+	// UDP stream: parses the header of a received datagram of length bytes
+	static bool parseDatagram(const uint8_t* p, int length, rspDatagramHeader& h)
+	{
+		if (length < c_datagramHeaderLength || p[0] != 'R' || p[1] != 'S' || p[2] != 'P' || p[3] != 'U')
+			return false;
+		h.headerLength = p[4] << 8 | p[5];
+		h.format = (eRspFormat)p[6];
+		h.flags = p[7];
+		h.sequence = be32(p + 8);
+		h.numSamples = (int)be32(p + 12);
+		h.sampleIndex = (uint64_t)be32(p + 16) << 32 | be32(p + 20);
+		return h.headerLength >= c_datagramHeaderLength && h.headerLength <= length;
+	}
+
+	static uint32_t be32(const uint8_t* p)
+	{
+		return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+	}
+
+	// Bytes of numSamples I/Q pairs, numSamples a multiple of 16 for RSP_FORMAT_BFP,
+	// 0 for the variable length RSP_FORMAT_LOSSLESS
+	static int bytesFor(eRspFormat f, int numSamples)
+	{
+		switch (f)
+		{
+		case RSP_FORMAT_4: return numSamples;
+		case RSP_FORMAT_8: return 2 * numSamples;
+		case RSP_FORMAT_16: return 4 * numSamples;
+		case RSP_FORMAT_BFP: return numSamples / 16 * 33;
+		case RSP_FORMAT_12: return 3 * numSamples;
+		case RSP_FORMAT_CF32: return 8 * numSamples;
+		default: return 0;
+		}
+	}
+
+	// RSP_FORMAT_12: 3 bytes per I/Q pair, the 24 bit little endian value I | Q << 12 of
+	// unsigned 12 bit ADC values. xi, xq get the signed values -2048..2047;
+	// shifted left by 4 they have the scale of RSP_FORMAT_16
+	static void unpack12(const uint8_t* in, int numSamples, int16_t* xi, int16_t* xq)
+	{
+		for (int n = 0; n < numSamples; n++, in += 3)
+		{
+			uint32_t w = in[0] | ((uint32_t)in[1] << 8) | ((uint32_t)in[2] << 16);
+			xi[n] = (int16_t)((int)(w & 0xfff) - 2048);
+			xq[n] = (int16_t)((int)(w >> 12) - 2048);
+		}
+	}
+
+	// RSP_FORMAT_BFP: per 16 samples an exponent byte e, then I and Q as signed 8 bit
+	// mantissas m; the sample is m << e, in the scale of RSP_FORMAT_16.
+	// Decodes whole groups, returns the number of samples
+	static int unpackBfp(const uint8_t* in, int numBytes, int16_t* xi, int16_t* xq)
+	{
+		int n = 0;
+		for (; numBytes >= 33; numBytes -= 33, in += 33)
+		{
+			int e = in[0] > 8 ? 8 : in[0];
+			for (int k = 0; k < 16; k++, n++)
+			{
+				xi[n] = (int16_t)((int8_t)in[1 + 2 * k] * (1 << e));
+				xq[n] = (int16_t)((int8_t)in[2 + 2 * k] * (1 << e));
+			}
+		}
+		return n;
+	}
+};
@@ -0,0 +1,209 @@
+/**
+** RSP3_tcp - TCP/IP I/Q Data Server for the sdrplay RSP devices
+** Copyright (C) 2017-2024 Clem Schmidt, softsyst, http://qirx.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#pragma once
+#include <atomic>
+#include <string>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <climits>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+// Layout of the shared memory ring, see shmRingHeader and shmRecord in ShmRing.h of the server
+struct rspShmHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t headerBytes;
+	uint32_t capacity;
+	uint32_t format;			// eRspFormat
+	uint32_t sampleRateHz;
+	uint32_t session;
+	uint32_t reserved;
+	alignas(64) std::atomic<uint64_t> reservePos;
+	alignas(64) std::atomic<uint64_t> writePos;
+	alignas(64) std::atomic<uint32_t> futexSeq;
+	std::atomic<uint32_t> waiters;
+};
+
+struct rspShmRecord
+{
+	uint32_t length;
+	uint32_t payloadBytes;
+	uint64_t sampleIndex;
+	uint32_t numSamples;
+	uint8_t format;
+	uint8_t flags;				// eRspFrameFlags of rspClient.h
+	uint16_t reserved;
+};
+
+/// <summary>
+/// Reader of the shared memory ring of RSP_tcp (-X), Linux.
+/// The samples are read in place: next() returns the payload of the next block in the
+/// mapping, done() tells whether the server overwrote it meanwhile. A reader more than
+/// the ring capacity behind loses blocks, it continues with the newest one then and
+/// the sample index of the next block shows the gap.
+/// Commands go to the data port as usual; CMD_SET_RSP_TCP_SAMPLES (0x85) with value 0
+/// stops the samples on that connection.
+///   rspShmReader r;
+///   r.open(7890);
+///   rspShmRecord rec; const uint8_t* p;
+///   for (;;)
+///     if (r.next(rec, p)) { decode(p, rec.payloadBytes); if (!r.done()) discardDecoded(); }
+///     else r.wait(100);
+/// </summary>
+class rspShmReader
+{
+public:
+	~rspShmReader() { close(); }
+
+	bool open(int port)
+	{
+		std::string name = "/rsp_tcp_" + std::to_string(port);
+		int fd = shm_open(name.c_str(), O_RDWR, 0);
+		if (fd < 0)
+			return false;
+		struct stat st;
+		void* p = MAP_FAILED;
+		if (fstat(fd, &st) == 0 && st.st_size > (off_t)sizeof(rspShmHeader))
+			p = mmap(0, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (p == MAP_FAILED)
+			return false;
+		header = (rspShmHeader*)p;
+		mappedBytes = (size_t)st.st_size;
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (memcmp(header->magic, "RSPM", 4) != 0 || header->version != 1 ||
+			(size_t)header->headerBytes + header->capacity > mappedBytes)
+		{
+			close();
+			return false;
+		}
+		data = (const uint8_t*)p + header->headerBytes;
+		capacity = header->capacity;
+		// live from the newest block on
+		readPos = header->writePos.load(std::memory_order_acquire);
+		return true;
+	}
+
+	void close()
+	{
+		if (header != 0)
+			munmap(header, mappedBytes);
+		header = 0;
+	}
+
+	uint32_t format() const { return header->format; }
+	uint32_t sampleRateHz() const { return header->sampleRateHz; }
+	uint32_t session() const { return header->session; }
+	// Times the reader fell behind by more than the capacity, since open
+	uint64_t overruns() const { return overrunCount; }
+
+	// The next block, rec and payload point into the mapping until done().
+	// Returns false if there is none yet
+	bool next(rspShmRecord& rec, const uint8_t*& payload)
+	{
+		for (;;)
+		{
+			uint64_t w = header->writePos.load(std::memory_order_acquire);
+			if (readPos == w)
+				return false;
+			if (w - readPos > capacity)
+			{
+				overrun(w);
+				continue;
+			}
+			uint32_t offset = (uint32_t)(readPos & (capacity - 1));
+			uint32_t toEnd = capacity - offset;
+			if (toEnd < sizeof(rspShmRecord))
+			{
+				readPos += toEnd;
+				continue;
+			}
+			memcpy(&rec, data + offset, sizeof(rec));
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (header->reservePos.load(std::memory_order_relaxed) - readPos > capacity ||
+				rec.length < sizeof(rspShmRecord) || rec.length > toEnd)
+			{
+				overrun(header->writePos.load(std::memory_order_acquire));
+				continue;
+			}
+			if (rec.numSamples == 0)
+			{
+				readPos += rec.length;		// wrap record
+				continue;
+			}
+			payload = data + offset + sizeof(rspShmRecord);
+			current = rec.length;
+			return true;
+		}
+	}
+
+	// Ends the block of next(). Returns false if the server overwrote it while it was read,
+	// the data read from it are garbage then
+	bool done()
+	{
+		std::atomic_thread_fence(std::memory_order_acquire);
+		bool intact = header->reservePos.load(std::memory_order_relaxed) - readPos <= capacity;
+		readPos += current;
+		current = 0;
+		if (!intact)
+			overrun(header->writePos.load(std::memory_order_acquire));
+		return intact;
+	}
+
+	// Sleeps until the server published a block or timeoutMs passed
+	void wait(int timeoutMs)
+	{
+		header->waiters.fetch_add(1);
+		uint32_t seq = header->futexSeq.load();
+		if (header->writePos.load() == readPos)
+		{
+			struct timespec ts;
+			ts.tv_sec = timeoutMs / 1000;
+			ts.tv_nsec = (long)(timeoutMs % 1000) * 1000000;
+			syscall(SYS_futex, &header->futexSeq, FUTEX_WAIT, seq, &ts, 0, 0);
+		}
+		header->waiters.fetch_sub(1);
+	}
+
+private:
+	void overrun(uint64_t w)
+	{
+		overrunCount++;
+		readPos = w;
+		current = 0;
+	}
+
+	rspShmHeader* header = 0;
+	const uint8_t* data = 0;
+	size_t mappedBytes = 0;
+	uint32_t capacity = 0;
+	uint64_t readPos = 0;
+	uint32_t current = 0;
+	uint64_t overrunCount = 0;
+};
@@ -0,0 +1,76 @@
+/**
+** RSP3_tcp - TCP/IP I/Q Data Server for the sdrplay RSP devices
+** Copyright (C) 2017-2024 Clem Schmidt, softsyst, http://qirx.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#pragma once
+#include <vector>
+#include <atomic>
+
+/// <summary>
+/// Block adaptive gain in front of the 8 bit requantization, which keeps only the upper
+/// 8 bits of the 16 bit samples. Weak signals would use a few LSBs only.
+/// Per callback block the power and the peak of I and Q are measured and smoothed. The gain
+/// raises a weak signal to an RMS of c_targetRms, and reduces a strong one only as far as
+/// its smoothed peak must stay below c_peakLimit.
+/// A gain reduction applies to the whole block at once, an increase is limited to
+/// c_releaseDbPerSec and ramps linearly within the block, so there are no steps.
+/// The current gain is reported as an indication, clients divide by it to get back
+/// to absolute levels.
+/// </summary>
+class AutoScaler
+{
+public:
+	AutoScaler();
+
+	void setEnabled(bool on) { enabled = on; }
+	bool isEnabled() const { return enabled; }
+	// Only the 8 bit formats are scaled; any thread, takes effect with the next block
+	void setEngaged(bool on) { engaged.store(enabled && on, std::memory_order_relaxed); }
+	bool isActive() const { return engaged.load(std::memory_order_relaxed); }
+	// The rate of the blocks, scales the time constants
+	void setRate(int hz) { rateHz = hz; }
+
+	// Callback thread. outI and outQ point to the scaled samples, valid until the next call
+	void process(const short* xi, const short* xq, int numSamples, const short*& outI, const short*& outQ);
+
+	// The gain applied to the newest block, in dB
+	float getGainDb() const { return gainDb.load(std::memory_order_relaxed); }
+
+	static const int c_targetRms = 4096;		// -18 dB full scale
+	static const int c_peakLimit = 29491;		// 90% of full scale
+	static const int c_maxGainDb = 48;
+	static const int c_minGainDb = -12;
+	static const int c_releaseDbPerSec = 10;
+	static const int c_rmsTimeConstantMs = 200;
+	static const int c_peakTimeConstantMs = 500;
+
+private:
+	AutoScaler(AutoScaler const&);			// Don't Implement
+	void operator=(AutoScaler const&);		// Don't implement
+
+	bool enabled = false;
+	std::atomic<bool> engaged{ false };
+	int rateHz = 2048000;
+	bool first = true;
+	double power = 0;		// smoothed mean square
+	double peak = 0;		// decaying peak
+	double gain = 1;
+	std::vector<short> outBufI, outBufQ;
+	std::atomic<float> gainDb{ 0 };
+};
@@ -0,0 +1,86 @@
+/**
+** RSP3_tcp - TCP/IP I/Q Data Server for the sdrplay RSP devices
+** Copyright (C) 2017-2024 Clem Schmidt, softsyst, http://qirx.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#pragma once
+#include <vector>
+#include <stdint.h>
+#include "MemBlockPool.h"
+
+/// <summary>
+/// The blocks of the stream callback, kept for all clients of the device.
+/// The event loop moves each block once from the tx queue into the ring; every client
+/// reads it with its own cursor, a sequence number counting the blocks since the start.
+/// The ring holds one reference of each block, a client takes another one while its
+/// sender transmits it (MemBlock::refs), so a block returns to the pool when the ring
+/// and all clients are done with it.
+/// The ring keeps the blocks from the slowest cursor up to the newest one, bounded in bytes.
+/// If it is full, the oldest block is evicted and a client whose cursor is still behind
+/// loses it; that client accounts for the samples, the others are not affected.
+/// Only used by the event loop thread.
+/// </summary>
+class BroadcastRing
+{
+public:
+	BroadcastRing(int maxBlocks);
+	~BroadcastRing();
+
+	void configure(int64_t maxBytes);
+
+	// Adding a block of bytes would exceed the byte or the block limit
+	bool full(int bytes = 0) const;
+
+	// Takes over the reference of mb. Evicts the oldest blocks if it doesn't fit.
+	// Returns the number of evicted blocks
+	int push(MemBlock* mb, MemBlockPool& pool);
+
+	// Sequence numbers of the oldest block and of the next block to be pushed
+	uint64_t begin() const { return tail; }
+	uint64_t end() const { return head; }
+	// begin() <= seq < end()
+	MemBlock* at(uint64_t seq) const { return slots[seq % slots.size()].mb; }
+	// Number of the first sample of block seq, counted from the start. seq may be end()
+	uint64_t sampleAt(uint64_t seq) const;
+
+	// Drops the ring's references of all blocks before seq, e.g. read by all clients
+	void releaseBefore(uint64_t seq, MemBlockPool& pool);
+	// Drops all blocks. The sequence numbers continue
+	void clear(MemBlockPool& pool);
+
+	int getNumBlocks() const { return (int)(head - tail); }
+	int64_t getBytes() const { return bytes; }
+	uint64_t getEvictedBlocks() const { return evicted; }
+
+private:
+	BroadcastRing(BroadcastRing const&);	// Don't Implement
+	void operator=(BroadcastRing const&);	// Don't implement
+
+	struct slot
+	{
+		MemBlock* mb;
+		uint64_t firstSample;
+	};
+	std::vector<slot> slots;
+	uint64_t head = 0;
+	uint64_t tail = 0;
+	uint64_t nextSample = 0;
+	int64_t bytes = 0;
+	int64_t maxBytes;
+	uint64_t evicted = 0;
+};
@@ -0,0 +1,85 @@
+/**
+** RSP3_tcp - TCP/IP I/Q Data Server for the sdrplay RSP devices
+** Copyright (C) 2017-2024 Clem Schmidt, softsyst, http://qirx.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#pragma once
+#include <vector>
+#include "Fft.h"
+
+/// <summary>
+/// Splits the stream of the callback into numBins channels of equal spacing,
+/// rate / numBins apart; bin k is centered at k * spacing, bins above numBins / 2 are the
+/// negative frequencies. Each channel is shifted to DC and has twice the spacing as its
+/// rate, so the channels overlap and a signal between two bins is complete in one of them.
+/// Polyphase filter bank with an FFT: every numBins / 2 input samples, the windowed input
+/// is folded into numBins partial sums and one inverse FFT yields all channels at once,
+/// so the cost hardly depends on the number of channels served.
+/// 50% of the output band is passed flat, aliases into it are attenuated by
+/// Decimator::c_stopbandDb.
+/// </summary>
+class Channelizer
+{
+public:
+	Channelizer();
+	~Channelizer();
+
+	// numBins a power of two in c_minBins..c_maxBins, 0 switches the channelizer off.
+	// bins: the channels served, each < numBins
+	bool configure(int numBins, const std::vector<int>& bins);
+	bool isActive() const { return numBins > 0; }
+	int getNumBins() const { return numBins; }
+	int getDecimation() const { return numBins / 2; }
+	int getNumOutputs() const { return (int)bins.size(); }
+	int getBin(int ix) const { return bins[ix]; }
+	int getNumBranchTaps() const { return numBranchTaps; }
+	// Center of a bin relative to the tuner frequency, for the rate rateHz
+	static double binOffsetHz(int bin, int numBins, double rateHz);
+	void reset();
+
+	// Callback thread. Returns the number of samples of each output, valid until the next call
+	int process(const short* xi, const short* xq, int numSamples);
+	const short* getOutputI(int ix) const { return &outI[ix][0]; }
+	const short* getOutputQ(int ix) const { return &outQ[ix][0]; }
+
+	static const int c_minBins = 4;
+	static const int c_maxBins = 64;
+
+private:
+	Channelizer(Channelizer const&);		// Don't Implement
+	void operator=(Channelizer const&);		// Don't implement
+
+	void reserve(int numSamples);
+
+	// input samples converted per round, bounds the history buffers
+	static const int c_chunk = 4096;
+
+	int numBins = 0;
+	int numBranchTaps = 0;		// taps per polyphase branch
+	int numTaps = 0;			// numBins * numBranchTaps
+	std::vector<int> bins;
+	std::vector<float> taps;	// prototype lowpass, reversed
+	Fft* fft = 0;
+	// history (numTaps - 1 samples) followed by the current chunk
+	std::vector<float> bufI, bufQ;
+	int pos = 0;				// newest input sample of the next output's window, in buf
+	bool oddOutput = false;		// odd bins change their sign with every other output
+	std::vector<float> foldI, foldQ;
+	std::vector<float> re, im;
+	std::vector<std::vector<short> > outI, outQ;
+};
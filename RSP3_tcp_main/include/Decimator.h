@@ -0,0 +1,149 @@
+/**
+** RSP3_tcp - TCP/IP I/Q Data Server for the sdrplay RSP devices
+** Copyright (C) 2017-2024 Clem Schmidt, softsyst, http://qirx.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#pragma once
+#include <vector>
+#include "iqConvert.h"
+#include "Nco.h"
+
+// Sum of a[i] * taps[i] and b[i] * taps[i], n a multiple of 8
+typedef void(*dotFn)(const float* a, const float* b, const float* taps, int n, float& outA, float& outB);
+
+/// <summary>
+/// One decimating filter of the cascade, for I and Q.
+/// Only the retained outputs are computed, from contiguous windows of the input history,
+/// so a stage costs numTaps / factor multiplications per input sample.
+/// A halfband stage (factor 2) keeps its input split into the two phases: all taps but
+/// the center one fall onto one phase, the other phase contributes the center tap only.
+/// The history is kept across calls.
+/// </summary>
+class DecimatorStage
+{
+public:
+	// halfband: factor 2, taps from designHalfband
+	DecimatorStage(int factor, bool halfband, const std::vector<float>& taps);
+
+	// Returns the number of outputs written to outI, outQ
+	int process(const float* inI, const float* inQ, int n, float* outI, float* outQ, dotFn dot);
+	void reset();
+
+	int getFactor() const { return factor; }
+	int getNumTaps() const { return numTaps; }
+	bool isHalfband() const { return halfband; }
+
+private:
+	int factor;
+	bool halfband;
+	int numTaps;		// designed taps, without the zero padding
+	std::vector<float> taps;	// padded with leading zeros to a multiple of 8, reversed
+	float center = 0;	// halfband: the center tap
+	int centerDelay = 0;	// halfband: offset of the center sample in the other phase
+	int hist;			// samples of history in front of the new ones
+	// FIR: the input, halfband: the phase with the taps (A) and the center phase (B)
+	std::vector<float> bufI, bufQ, bufBI, bufBQ;
+	int numBuf = 0;		// valid samples in bufI/bufQ, history included
+	int numBufB = 0;
+	int skip = 0;		// FIR: input samples to the next output
+	bool nextIsA = true;	// halfband: phase of the next input sample
+};
+
+/// <summary>
+/// Integer decimation of the I/Q samples of the stream callback, for output rates which are
+/// an integer fraction of a device rate.
+/// The factor is split into a cascade: halfband stages for the factors of two, then one
+/// decimating FIR for the remaining factor, designed with a Kaiser window.
+/// 80% of the output band is passed, aliases into it are attenuated by c_stopbandDb.
+/// The filters run in float with vectorized dot products, the output is 16 bit again,
+/// so the converters of iqConvert apply unchanged.
+/// With a mixer set, the input is shifted by its NCO first, which makes the decimator
+/// a digital down converter. The mixer applies only with a factor > 1: factor 1 has
+/// no filter, which would leave the shifted band unselected.
+/// configure() must only be called while the callback is not running.
+/// </summary>
+class Decimator
+{
+public:
+	Decimator();
+	~Decimator();
+
+	// Selects the dot product kernel for the CPU
+	static void init();
+	static const char* getKernelName() { return kernelName; }
+	// The selected kernel, shared with the Resampler
+	static dotFn getKernel() { return dot; }
+
+	// factor 1 switches the decimation off
+	bool configure(int factor);
+	int getFactor() const { return factor; }
+	bool isActive() const { return factor > 1; }
+	// The NCO of the down converter, 0 for none. Only while the callback is not running
+	void setMixer(Nco* nco) { mixer = nco; }
+	// Clears the filter history, e.g. after a gap in the stream
+	void reset();
+
+	// Callback thread. Returns the number of output samples; outI and outQ point to them,
+	// valid until the next call
+	int process(const short* xi, const short* xq, int numSamples, const short*& outI, const short*& outQ);
+
+	// Designs the taps of a lowpass, cutoff in cycles per input sample
+	static void designLowpass(int numTaps, double cutoff, std::vector<float>& taps);
+	// Halfband lowpass (cutoff a quarter of the input rate) with transition width tw, in cycles per sample
+	static void designHalfband(double tw, std::vector<float>& taps);
+	// Number of taps reaching c_stopbandDb with transition width tw, in cycles per sample
+	static int kaiserTaps(double tw);
+	// Rounded and saturated
+	static inline short toShort(float x)
+	{
+		int v = (int)(x < 0 ? x - 0.5f : x + 0.5f);
+		if (v > 32767)
+			v = 32767;
+		else if (v < -32768)
+			v = -32768;
+		return (short)v;
+	}
+
+	static const int c_maxFactor = 256;
+	static const int c_stopbandDb = 80;
+
+	static void dot_scalar(const float* a, const float* b, const float* taps, int n, float& outA, float& outB);
+	static void dot_sse2(const float* a, const float* b, const float* taps, int n, float& outA, float& outB);
+	static void dot_avx2(const float* a, const float* b, const float* taps, int n, float& outA, float& outB);
+	static void dot_neon(const float* a, const float* b, const float* taps, int n, float& outA, float& outB);
+
+private:
+	Decimator(Decimator const&);			// Don't Implement
+	void operator=(Decimator const&);		// Don't implement
+
+	void clearStages();
+	void reserve(int numSamples);
+
+	// input samples converted per round, bounds the scratch buffers
+	static const int c_chunk = 4096;
+
+	int factor = 1;
+	Nco* mixer = 0;
+	std::vector<DecimatorStage*> stages;
+	// per chunk: the input as float, and two buffers alternating between the stages
+	std::vector<float> inI, inQ, tmpI[2], tmpQ[2];
+	std::vector<short> outBufI, outBufQ;
+
+	static dotFn dot;
+	static const char* kernelName;
+};
@@ -0,0 +1,45 @@
+/**
+** RSP3_tcp - TCP/IP I/Q Data Server for the sdrplay RSP devices
+** Copyright (C) 2017-2024 Clem Schmidt, softsyst, http://qirx.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#pragma once
+#include <vector>
+
+/// <summary>
+/// In-place complex FFT of a power of two size, radix 2, on separate real and imaginary
+/// arrays. The twiddle factors and the bit reversal are precomputed in the constructor,
+/// transform() doesn't allocate.
+/// Forward: X[k] = sum x[n] e^(-j 2 pi k n / N), inverse without the 1/N scaling.
+/// </summary>
+class Fft
+{
+public:
+	Fft(int size);
+
+	void transform(float* re, float* im, bool inverse) const;
+	int getSize() const { return size; }
+
+	static bool isPowerOfTwo(int n) { return n > 0 && (n & (n - 1)) == 0; }
+
+private:
+	int size;
+	std::vector<int> reversed;		// bit reversed index
+	std::vector<float> cosTable;	// cos(2 pi i / N), i < N / 2
+	std::vector<float> sinTable;
+};
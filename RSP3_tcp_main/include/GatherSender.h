@@ -0,0 +1,193 @@
+/**
+** RSP3_tcp - TCP/IP I/Q Data Server for the sdrplay RSP devices
+** Copyright (C) 2017-2024 Clem Schmidt, softsyst, http://qirx.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#pragma once
+#include <stdint.h>
+#include <vector>
+#include <chrono>
+#include "common.h"
+#include "MemBlockPool.h"
+#ifdef _WIN32
+typedef WSABUF txIoVec;
+#else
+#include <sys/uio.h>
+typedef struct iovec txIoVec;
+#endif
+
+/// <summary>
+/// Collects MemBlocks and transmits them with one gather call (writev, WSASend on Windows)
+/// instead of one send per block.
+/// A flush happens when the next block would exceed the byte or the block limit,
+/// or when the caller flushes explicitly. Sent blocks are returned to the pool.
+/// On Linux, sends may use MSG_ZEROCOPY: the kernel then reads the MemBlocks
+/// after sendmsg returned, so they go back to the pool only on its completion notification.
+/// On a nonblocking socket a flush sends what the socket takes and keeps the rest
+/// as backlog, to be continued with the next flush when the socket is writable again.
+/// </summary>
+class GatherSender
+{
+public:
+	static const int c_maxBlocks = 64;	// far below IOV_MAX
+	static const int c_maxInFlight = 1024;	// zero copy blocks and sends waiting for completion
+
+	GatherSender(MemBlockPool& pool, int maxBytes);
+	~GatherSender();
+
+	// Queues a block, flushes first if it doesn't fit anymore.
+	// After a socket error the block is only returned to the pool.
+	// In nonblocking mode the caller appends at most room() blocks.
+	void append(SOCKET s, MemBlock* mb);
+
+	// Sends all pending blocks. Returns false after a socket error.
+	// In nonblocking mode it returns as soon as the socket would block, see hasBacklog()
+	bool flush(SOCKET s);
+
+	// The socket is nonblocking, flush must not wait for it
+	void setNonBlocking(bool on) { nonBlocking = on; }
+	// A flush could not complete because the socket would block
+	bool hasBacklog() const { return blocked && numPending > 0; }
+	// Blocks which may be appended without a flush
+	int room() const { return c_maxBlocks - numPending; }
+	int getPendingBlocks() const { return numPending; }
+
+	// Returns the pending blocks to the pool without sending them, never blocks.
+	// With zero copy sends in flight the connection is reset, their blocks return with
+	// the completions, see ZeroCopyReaper. Call before closesocket
+	void discard();
+	// Zero copy blocks waiting for their completions
+	bool hasInFlight() const { return inFlightCount > 0; }
+	// Returns the blocks in flight to the pool without their completions, e.g. before the pool
+	// goes away. The kernel may still read them, only for a socket given up on
+	void forceRelease();
+
+	// Switches to MSG_ZEROCOPY sends on s, if the platform and the kernel support it.
+	// Not for a loopback peer, the kernel copies to it anyway and defers the completions
+	// until the peer read the data
+	bool enableZeroCopy(SOCKET s);
+	bool isZeroCopy() const { return zeroCopy; }
+
+	bool failed() const { return socketError; }
+	int getPendingBytes() const { return pendingBytes; }
+
+	// Returns the blocks of completed zero copy sends to the pool, without blocking
+	void reap() { if (zeroCopy) reapCompletions(); }
+
+	// Prints the batch statistics, at most every intervalSec seconds
+	void reportStats(int intervalSec);
+
+	uint64_t getFlushCount() const { return flushes; }
+	uint64_t getSyscallCount() const { return syscalls; }
+	uint64_t getBlockCount() const { return blocksSent; }
+	uint64_t getByteCount() const { return bytesSent; }
+	uint64_t getZeroCopyCount() const { return zcSends; }
+	uint64_t getZeroCopyCopiedCount() const { return zcCopied; }
+	uint64_t getZeroCopyFallbackCount() const { return zcFallbacks; }
+
+private:
+	GatherSender(GatherSender const&);		// Don't Implement
+	void operator=(GatherSender const&);	// Don't implement
+
+	int sendv(SOCKET s, txIoVec* iov, int count, bool& zc);
+	void reapCompletions();
+	bool waitCompletions(int timeoutMs);
+	void retire(MemBlock* mb, bool zc, uint32_t lastZcId);
+	void resetConnection();
+	static bool isLoopbackPeer(SOCKET s);
+
+	MemBlockPool& pool;
+	int maxBytes;
+	MemBlock* pending[c_maxBlocks];
+	txIoVec iov[c_maxBlocks];
+	int numPending = 0;
+	int pendingBytes = 0;	// not yet sent
+	int firstOffset = 0;	// bytes of pending[0] sent already
+	bool socketError = false;
+	bool nonBlocking = false;
+	bool blocked = false;
+
+	// zero copy state. Ids count the successful MSG_ZEROCOPY sends on the socket,
+	// the kernel reports completed id ranges on the error queue
+	bool zeroCopy = false;
+	SOCKET zcSocket = INVALID_SOCKET;
+	uint32_t nextZcId = 0;
+	uint32_t completedBelow = 0;			// all ids below are completed
+	bool zcDone[c_maxInFlight];				// by id % c_maxInFlight, ids >= completedBelow
+	MemBlock* inFlight[c_maxInFlight];		// FIFO of blocks waiting for completions
+	uint32_t inFlightLastId[c_maxInFlight];	// the last send reading the block
+	int inFlightHead = 0;
+	int inFlightCount = 0;
+	bool touchedByZc[c_maxBlocks];			// per pending block, read by a zero copy send
+	uint32_t lastZcId[c_maxBlocks];
+
+	uint64_t flushes = 0;
+	uint64_t syscalls = 0;
+	uint64_t blocksSent = 0;
+	uint64_t bytesSent = 0;
+	uint64_t zcSends = 0;
+	uint64_t zcCopied = 0;		// completions where the kernel copied nevertheless, e.g. on loopback
+	uint64_t zcFallbacks = 0;	// sends done without MSG_ZEROCOPY, e.g. on ENOBUFS
+	uint64_t zcForced = 0;		// blocks returned to the pool without completion, see forceRelease
+
+	// values at the last report
+	time_t lastReport = 0;
+	uint64_t lastFlushes = 0;
+	uint64_t lastSyscalls = 0;
+	uint64_t lastBlocks = 0;
+	uint64_t lastBytes = 0;
+};
+
+/// <summary>
+/// Takes over the senders of closed connections with zero copy blocks in flight, so a
+/// disconnect never waits for the kernel. Serviced by the event loop: a sender's blocks
+/// return to the pool with their completions, the socket is closed after the last one.
+/// After c_timeoutMs the blocks are forced back, the pool must outlive the senders,
+/// see releaseAll.
+/// </summary>
+class ZeroCopyReaper
+{
+public:
+	ZeroCopyReaper() {}
+	~ZeroCopyReaper() { releaseAll(); }
+
+	// Takes sender and its socket s, after GatherSender::discard
+	void adopt(SOCKET s, GatherSender* sender);
+	// Event loop. Reaps the completions without blocking
+	void service();
+	// Milliseconds until the next service is due, -1 if nothing is retired
+	int getTimeoutMs() const { return retired.empty() ? -1 : c_pollMs; }
+	// Forces all blocks back and closes the sockets, before the pool is deleted
+	void releaseAll();
+
+	static const int c_pollMs = 10;
+	static const int c_timeoutMs = 2000;
+
+private:
+	ZeroCopyReaper(ZeroCopyReaper const&);		// Don't Implement
+	void operator=(ZeroCopyReaper const&);		// Don't implement
+
+	struct retiredSender
+	{
+		SOCKET s;
+		GatherSender* sender;
+		std::chrono::steady_clock::time_point deadline;
+	};
+	void dispose(retiredSender& r);
+	std::vector<retiredSender> retired;
+};
@@ -0,0 +1,73 @@
+/**
+** RSP3_tcp - TCP/IP I/Q Data Server for the sdrplay RSP devices
+** Copyright (C) 2017-2024 Clem Schmidt, softsyst, http://qirx.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#pragma once
+#include <vector>
+#include <atomic>
+
+/// <summary>
+/// Removes the residual DC offset and the IQ gain and phase imbalance left by the
+/// hardware correction, blind, from the statistics of the stream.
+/// Per callback block the means, powers and the cross correlation of I and Q are measured
+/// in 8 lanes, so the loops vectorize. They update running estimates (time constants
+/// c_dcTimeConstantMs and c_iqTimeConstantMs) from which I and Q are corrected:
+///   I' = I - dcI,  Q' = g * ((Q - dcQ) - (E[IQ] / E[II]) * I'),
+/// with g making E[Q'Q'] equal to E[I'I']. This assumes a circular signal, which holds for
+/// a band with many signals or noise. The estimates may be read by any thread.
+/// </summary>
+class IqCorrector
+{
+public:
+	IqCorrector();
+
+	void setEnabled(bool on) { enabled = on; }
+	bool isActive() const { return enabled; }
+	// The rate of the callback, scales the time constants; the estimates restart
+	void setRate(int rateHz);
+
+	// Callback thread. outI and outQ point to the corrected samples, valid until the next call
+	void process(const short* xi, const short* xq, int numSamples, const short*& outI, const short*& outQ);
+
+	// Current estimates: DC in LSB, Q to I gain in dB, phase error in degrees
+	float getDcI() const { return dcI.load(std::memory_order_relaxed); }
+	float getDcQ() const { return dcQ.load(std::memory_order_relaxed); }
+	float getGainDb() const { return gainDb.load(std::memory_order_relaxed); }
+	float getPhaseDeg() const { return phaseDeg.load(std::memory_order_relaxed); }
+
+	static const int c_dcTimeConstantMs = 100;
+	static const int c_iqTimeConstantMs = 1000;
+
+private:
+	IqCorrector(IqCorrector const&);		// Don't Implement
+	void operator=(IqCorrector const&);		// Don't implement
+
+	bool enabled = false;
+	int rateHz = 2048000;
+	bool first = true;
+	// running estimates
+	double meanI = 0, meanQ = 0;
+	double powI = 0, powQ = 0, crossIQ = 0;		// around the means
+	std::vector<short> outBufI, outBufQ;
+
+	std::atomic<float> dcI{ 0 };
+	std::atomic<float> dcQ{ 0 };
+	std::atomic<float> gainDb{ 0 };
+	std::atomic<float> phaseDeg{ 0 };
+};
@@ -0,0 +1,124 @@
+/**
+** RSP3_tcp - TCP/IP I/Q Data Server for the sdrplay RSP devices
+** Copyright (C) 2017-2024 Clem Schmidt, softsyst, http://qirx.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#pragma once
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <stdint.h>
+#include "common.h"
+#include "TxQueue.h"
+
+/// <summary>
+/// Lossless compression of 16 bit I/Q blocks into independently decodable frames.
+/// I and Q are predicted separately by a fixed polynomial predictor of order 0, 1 or 2,
+/// chosen per frame and component for the smallest residuals. The residuals are
+/// zigzag mapped and Rice coded in partitions of c_partition samples, each with its own
+/// parameter; a partition which would not get smaller is stored verbatim.
+/// The predictor restarts in every frame, so any frame decodes on its own.
+/// Frame, network byte order:
+///   4 bytes "RSPL", 4 bytes frame length, 4 bytes first sample number, 4 bytes samples,
+///   1 byte predictor order of I, 1 byte of Q, 2 bytes samples per partition,
+///   then the bit stream, most significant bit first: the partitions of I, then of Q,
+///   padded with zeros to a whole byte. Each partition starts with a 5 bit parameter k:
+///   k = 31: the samples follow as 16 bit two's complement values,
+///   else per sample the residual r, as u = r >= 0 ? 2r : -2r-1: u >> k one bits,
+///   a zero bit and the k low order bits of u.
+///   The prediction of sample n is 0, x[n-1] or 2x[n-1]-x[n-2], at the start of a frame
+///   the orders available so far.
+/// decode() is the reference decoder for clients.
+/// </summary>
+class LosslessCodec
+{
+public:
+	// Upper bound of the frame length of numSamples
+	static int maxFrameBytes(int numSamples);
+
+	// iq: numSamples interleaved I/Q pairs of 16 bit little endian values, the 16 bit format.
+	// Returns the frame length written to out, at most maxFrameBytes(numSamples)
+	static int encode(const BYTE* iq, int numSamples, unsigned int firstSampleNum, BYTE* out);
+
+	// Decodes one frame of length bytes into xi, xq. Returns the number of samples,
+	// or -1 if the frame is invalid or holds more than maxSamples
+	static int decode(const BYTE* frame, int length, short* xi, short* xq, int maxSamples,
+		unsigned int& firstSampleNum);
+
+	// Frame length from the first c_headerLength bytes, 0 if they don't start a frame
+	static int frameLength(const BYTE* header);
+
+	static const int c_headerLength = 20;
+	static const int c_partition = 64;
+	static const int c_maxOrder = 2;
+	static const int c_verbatim = 31;
+};
+
+/// <summary>
+/// The stage running the LosslessCodec for the stream on its own thread,
+/// so the callback only converts to 16 bit and queues.
+/// Its input queue takes the place of the transmit queue for the callback: it is bounded
+/// and applies the overload policy there. The worker compresses each block in place and
+/// passes it to the transmit queue, waiting while that one is full, so it never drops.
+/// </summary>
+class LosslessEncoder
+{
+public:
+	LosslessEncoder(int maxBlocks);
+	~LosslessEncoder();
+
+	void configure(int64_t maxBytes, eOverloadPolicy policy) { input.configure(maxBytes, policy); }
+	void setEnabled(bool on) { enabled = on; }
+	bool isActive() const { return enabled; }
+
+	// Callback thread. mb holds 16 bit samples, its capacity must be at least
+	// LosslessCodec::maxFrameBytes(mb->numSamples). Returns false if the block was dropped
+	bool push(MemBlock* mb, MemBlockPool& pool, const bool& cancel) { return input.push(mb, pool, cancel); }
+
+	// The worker passes the frames to out
+	void start(TxQueue* out);
+	void stop();
+	// After stop, on the transmit side: returns the blocks not passed to out
+	void empty(MemBlockPool& pool);
+
+	uint64_t getDroppedSamples() const { return input.getDroppedSamples(); }
+	void resetCounters() { input.resetCounters(); }
+
+private:
+	LosslessEncoder(LosslessEncoder const&);		// Don't Implement
+	void operator=(LosslessEncoder const&);		// Don't implement
+
+	void run();
+	// Waits until out takes bytes more, false on stop
+	bool waitForRoom(int bytes);
+
+	bool enabled = false;
+	TxQueue input;
+	TxQueue* output = 0;
+	std::thread* worker = 0;
+	std::atomic<bool> stopRequest{ false };
+	std::vector<BYTE> frame;
+	// blocks the worker could not pass on when stopped, the transmit side returns them to the pool
+	std::vector<MemBlock*> unsent;
+
+	// statistics of the worker, reported at stop
+	uint64_t rawBytes = 0;
+	uint64_t codedBytes = 0;
+	uint64_t codedSamples = 0;
+	double busySeconds = 0;
+};
@@ -0,0 +1,101 @@
+/**
+** RSP3_tcp - TCP/IP I/Q Data Server for the sdrplay RSP devices
+** Copyright (C) 2017-2024 Clem Schmidt, softsyst, http://qirx.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#pragma once
+#include <atomic>
+#include <vector>
+#include <stdint.h>
+#include "common.h"
+#include "SpscQueue.h"
+
+struct MemBlock
+{
+	BYTE* Mem;
+	int length;		// valid bytes in Mem
+	int capacity;	// allocated bytes of Mem
+	int numSamples;
+	unsigned int firstSampleNum;	// from the stream callback, to account for lost samples
+	uint64_t sampleIndex;	// at the rate of the stream, lost samples counted, see StreamFrame.h
+	int headerLength;	// reserved at the start of Mem for the frame header, the samples follow
+	BYTE flags;		// eFrameFlags
+	int refs;		// holders on the transmit side, e.g. the broadcast ring and the clients' senders
+
+	MemBlock(int cap) :
+		Mem(new BYTE[cap]),
+		length(0),
+		capacity(cap),
+		numSamples(0),
+		firstSampleNum(0),
+		sampleIndex(0),
+		headerLength(0),
+		flags(0),
+		refs(1)
+	{
+	}
+
+	~MemBlock()
+	{
+		delete[] Mem;
+	}
+};
+
+/// <summary>
+/// Preallocated, fixed capacity MemBlocks, circulating between the stream callback
+/// and the transmit side.
+/// The callback acquires, the transmit side releases. Released blocks are returned
+/// via a lock-free queue, so neither side takes a lock nor touches the heap in steady state.
+/// A block acquired has one reference. The transmit side may share it between several
+/// holders by incrementing MemBlock::refs, only that side touches the count.
+/// </summary>
+class MemBlockPool
+{
+public:
+	MemBlockPool(int maxBlocks);
+	~MemBlockPool();
+
+	// Must only be called while the callback is not running, e.g. before sdrplay_api_Init
+	void prepare(int blockBytes, int numBlocks);
+
+	// Callback thread. Falls back to the heap only if the pool is exhausted or too small
+	MemBlock* acquire(int bytes);
+
+	// Transmit side. Drops one reference, the last one returns the block to the pool.
+	// The only producer of the free queue: never from the callback, which uses recycle
+	void release(MemBlock* mb);
+
+	// Callback thread. Returns a block the callback did not pass on, e.g. when dropping
+	void recycle(MemBlock* mb);
+
+	// Number of MemBlocks allocated on the heap since program start
+	uint64_t getAllocationCount() const { return allocations.load(); }
+	int getBlockBytes() const { return blockBytes.load(); }
+
+private:
+	MemBlockPool(MemBlockPool const&);		// Don't Implement
+	void operator=(MemBlockPool const&);	// Don't implement
+
+	MemBlock* allocate(int bytes);
+
+	SpscQueue<MemBlock*> freeQ;			// transmit side -> callback
+	std::vector<MemBlock*> spare;		// owned by the callback side
+	std::atomic<int> blockBytes;
+	std::atomic<uint64_t> allocations;
+	unsigned int exhaustedCount = 0;
+};
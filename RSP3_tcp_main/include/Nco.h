@@ -0,0 +1,68 @@
+/**
+** RSP3_tcp - TCP/IP I/Q Data Server for the sdrplay RSP devices
+** Copyright (C) 2017-2024 Clem Schmidt, softsyst, http://qirx.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#pragma once
+#include <atomic>
+#include <stdint.h>
+#include "iqConvert.h"
+
+// Mixes groups of 8 samples: out = x * rot per lane, then rot *= step, n a multiple of 8.
+// rot holds the phasors of the next 8 samples
+typedef void(*mixFn)(const short* xi, const short* xq, int n, float* outI, float* outQ,
+	float* rotI, float* rotQ, float stepI, float stepQ);
+
+/// <summary>
+/// Numerically controlled oscillator of the digital down converter.
+/// Shifts the samples by -frequency, so a signal at the offset moves to DC.
+/// The phase is a 32 bit accumulator, continuous across frequency changes; at the start of
+/// each call the 8 lane phasors are computed from it exactly, within a call they rotate,
+/// vectorized. The frequency may be changed by any thread while the callback runs.
+/// </summary>
+class Nco
+{
+public:
+	// Selects the mixing kernel for the CPU
+	static void init();
+	static const char* getKernelName() { return kernelName; }
+
+	// Any thread. Frequency in cycles per sample, -0.5 .. 0.5; 0 stops the mixing
+	void setFrequency(double cyclesPerSample);
+	bool isActive() const { return increment.load(std::memory_order_relaxed) != 0; }
+	void reset() { phase = 0; }
+
+	// Callback thread. Converts to float and mixes
+	void mix(const short* xi, const short* xq, int n, float* outI, float* outQ);
+
+	static void mix_scalar(const short* xi, const short* xq, int n, float* outI, float* outQ,
+		float* rotI, float* rotQ, float stepI, float stepQ);
+	static void mix_sse2(const short* xi, const short* xq, int n, float* outI, float* outQ,
+		float* rotI, float* rotQ, float stepI, float stepQ);
+	static void mix_avx2(const short* xi, const short* xq, int n, float* outI, float* outQ,
+		float* rotI, float* rotQ, float stepI, float stepQ);
+	static void mix_neon(const short* xi, const short* xq, int n, float* outI, float* outQ,
+		float* rotI, float* rotQ, float stepI, float stepQ);
+
+private:
+	std::atomic<uint32_t> increment{ 0 };	// phase per sample, 2^32 is a full cycle
+	uint32_t phase = 0;
+
+	static mixFn kernel;
+	static const char* kernelName;
+};
@@ -0,0 +1,101 @@
+/**
+** RSP3_tcp - TCP/IP I/Q Data Server for the sdrplay RSP devices
+** Copyright (C) 2017-2024 Clem Schmidt, softsyst, http://qirx.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#pragma once
+#include <atomic>
+#include <vector>
+#include "common.h"
+#ifdef __linux__
+#define REACTOR_EPOLL
+#elif !defined(_WIN32)
+#include <poll.h>
+#endif
+
+enum eReactorEvents
+{
+	EV_READ = 1
+	, EV_WRITE = 2
+	, EV_ERROR = 4		// error or hangup, always reported
+};
+
+/// <summary>
+/// Receives the events dispatched by Reactor::poll
+/// </summary>
+class ReactorHandler
+{
+public:
+	virtual ~ReactorHandler() {}
+	virtual void onEvent(SOCKET s, int events) = 0;
+	// wakeup() was called
+	virtual void onWakeup() = 0;
+};
+
+/// <summary>
+/// Readiness notification for the sockets of the server, all handled by one thread.
+/// epoll on Linux, poll() resp. WSAPoll elsewhere.
+/// Other threads, e.g. the stream callback, interrupt a waiting poll with wakeup().
+/// </summary>
+class Reactor
+{
+public:
+	Reactor();
+	~Reactor();
+
+	bool init();
+	bool add(SOCKET s, int events);
+	bool modify(SOCKET s, int events);
+	void remove(SOCKET s);
+
+	// Waits at most timeoutMs (-1: forever) and dispatches the events.
+	// Returns the number of sockets with events, -1 on error
+	int poll(ReactorHandler* handler, int timeoutMs);
+
+	// Any thread. Wakeups before the next poll are coalesced
+	void wakeup();
+	// Adapter for the notifier of the SpscQueue, context is the Reactor
+	static void notify(void* context) { ((Reactor*)context)->wakeup(); }
+
+private:
+	Reactor(Reactor const&);			// Don't Implement
+	void operator=(Reactor const&);		// Don't implement
+
+	void drainWakeup();
+	bool isRemoved(SOCKET s) const;
+
+	static const int c_maxEvents = 16;
+
+	// eventfd on Linux (wakeRx == wakeTx), a connected loopback UDP socket elsewhere
+	SOCKET wakeRx = INVALID_SOCKET;
+	SOCKET wakeTx = INVALID_SOCKET;
+	std::atomic<bool> wakePending{ false };
+#ifdef REACTOR_EPOLL
+	int epfd = -1;
+#else
+	struct watched
+	{
+		SOCKET s;
+		int events;
+	};
+	std::vector<watched> sockets;
+#endif
+	// sockets removed while events are dispatched, their remaining events are skipped
+	std::vector<SOCKET> removed;
+	bool dispatching = false;
+};
@@ -0,0 +1,87 @@
+/**
+** RSP3_tcp - TCP/IP I/Q Data Server for the sdrplay RSP devices
+** Copyright (C) 2017-2024 Clem Schmidt, softsyst, http://qirx.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#pragma once
+#include <vector>
+#include <atomic>
+#include <stdint.h>
+#include "rsp_tcp.h"
+
+enum eRequantMode
+{
+	RQ_OFF = 0,
+	RQ_DITHER = 1,			// TPDF dither
+	RQ_SHAPE1 = 2,			// dither, first order noise shaping
+	RQ_SHAPE2 = 3,			// dither, second order noise shaping
+	NUM_RQ_MODES = 4
+};
+
+/// <summary>
+/// Requantization to the 8 and 4 bit formats with dither and noise shaping, in front of
+/// the converters of iqConvert, which truncate.
+/// The samples are quantized here to the levels of the output format and written back as
+/// 16 bit values the converter maps exactly onto these levels, so the converters and
+/// their vectorized kernels stay unchanged.
+/// TPDF dither of +-1 output LSB decorrelates the error from the signal: no spurs and no
+/// harmonics, at the cost of a slightly higher noise floor. Noise shaping feeds the error
+/// back with (1 - z^-1) or (1 - z^-1)^2, moving the noise from the center of the band
+/// to its edges.
+/// The random numbers come from 8 lane xorshift generators, which vectorize; with
+/// noise shaping the feedback loop itself is sequential per sample.
+/// </summary>
+class Requantizer
+{
+public:
+	Requantizer();
+
+	void setMode(eRequantMode m) { mode = m; }
+	eRequantMode getMode() const { return mode; }
+	// The output format, any thread, takes effect with the next block. 16 bit isn't requantized
+	void setFormat(eBitWidth bitWidth, bool adsbMode);
+	bool isActive() const { return mode != RQ_OFF && format.load(std::memory_order_relaxed) >= 0; }
+
+	// Callback thread. outI and outQ point to the requantized samples, valid until the next call
+	void process(const short* xi, const short* xq, int numSamples, const short*& outI, const short*& outQ);
+
+private:
+	Requantizer(Requantizer const&);		// Don't Implement
+	void operator=(Requantizer const&);		// Don't implement
+
+	// quantizer of one output format: level = round(x / step + bias), lo..hi,
+	// written back as mul * level + add
+	struct levels
+	{
+		float step;
+		float bias;
+		int lo, hi;
+		int mul, add;
+	};
+	static const levels formats[3];
+
+	void fillDither(int n);
+
+	eRequantMode mode = RQ_OFF;
+	std::atomic<int> format{ -1 };		// index into formats, -1: none
+	uint32_t rng[8];
+	// error feedback of I and Q, the last two errors
+	float errI[2], errQ[2];
+	std::vector<float> ditherI, ditherQ;
+	std::vector<short> outBufI, outBufQ;
+};
@@ -0,0 +1,77 @@
+/**
+** RSP3_tcp - TCP/IP I/Q Data Server for the sdrplay RSP devices
+** Copyright (C) 2017-2024 Clem Schmidt, softsyst, http://qirx.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#pragma once
+#include <vector>
+#include "Decimator.h"
+
+/// <summary>
+/// Rational resampling of the I/Q samples by up / down, for output rates which are no
+/// integer fraction of a device rate.
+/// Polyphase form: the lowpass, designed for the rate up times the input rate, is split
+/// into up phases of numPhaseTaps taps. Each output sample takes one phase, applied to
+/// a contiguous window of the input, so no zeros are inserted and nothing is computed
+/// for discarded samples. 80% of the lower of the two rates is passed.
+/// Large ratios are best preceded by the Decimator, keeping up and the filter short.
+/// configure() must only be called while the callback is not running.
+/// </summary>
+class Resampler
+{
+public:
+	Resampler();
+
+	// up and down are reduced by their gcd, 1/1 switches the resampling off
+	bool configure(int up, int down);
+	int getUp() const { return up; }
+	int getDown() const { return down; }
+	int getNumPhaseTaps() const { return numPhaseTaps; }
+	bool isActive() const { return up != down; }
+	// Clears the filter history
+	void reset();
+
+	// Callback thread. Returns the number of output samples; outI and outQ point to them,
+	// valid until the next call
+	int process(const short* xi, const short* xq, int numSamples, const short*& outI, const short*& outQ);
+
+	// Upper bound of the output samples for numSamples input samples
+	int maxOutput(int numSamples) const { return (int)((long long)numSamples * up / down) + 2; }
+
+	// Bounds the size of the phase bank
+	static const int c_maxUp = 1024;
+
+private:
+	Resampler(Resampler const&);			// Don't Implement
+	void operator=(Resampler const&);		// Don't implement
+
+	void reserve(int numSamples);
+
+	// input samples converted per round, bounds the history buffers
+	static const int c_chunk = 4096;
+
+	int up = 1;
+	int down = 1;
+	int numPhaseTaps = 0;		// multiple of 8, the taps of a phase reversed and zero padded
+	std::vector<float> bank;	// up * numPhaseTaps
+	// history (numPhaseTaps - 1 samples) followed by the current chunk
+	std::vector<float> bufI, bufQ;
+	int pos = 0;				// newest input sample of the next output's window, in buf
+	int phase = 0;				// phase of the next output, 0..up-1
+	std::vector<short> outBufI, outBufQ;
+};
@@ -0,0 +1,120 @@
+/**
+** RSP3_tcp - TCP/IP I/Q Data Server for the sdrplay RSP devices
+** Copyright (C) 2017-2024 Clem Schmidt, softsyst, http://qirx.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#pragma once
+#include <atomic>
+#include <string>
+#include <stdint.h>
+#include "common.h"
+#include "BroadcastRing.h"
+#ifdef __linux__
+#define SHM_RING
+#endif
+
+/// <summary>
+/// Layout of the shared memory ring, mapped by the server and by the local readers,
+/// see client/rspShmReader.h. Host byte order.
+/// The data area holds records, each a shmRecord and its payload, padded to 8 bytes.
+/// A record which would not fit before the end of the area is preceded by a wrap record
+/// (numSamples 0) filling the rest; less than a shmRecord left means a wrap without one.
+/// The writer never waits for readers: it first moves reservePos over the bytes it is
+/// going to overwrite, then copies, then moves writePos. A reader got a record intact
+/// if reservePos did not pass its start by more than the capacity meanwhile.
+/// futexSeq counts the published records, readers wait on it.
+/// </summary>
+struct shmRingHeader
+{
+	char magic[4];				// "RSPM"
+	uint32_t version;
+	uint32_t headerBytes;		// offset of the data area
+	uint32_t capacity;			// bytes of the data area, a power of two
+	uint32_t format;			// eBitWidth of the payloads
+	uint32_t sampleRateHz;
+	uint32_t session;			// counts the sessions, the sample index restarts with each
+	uint32_t reserved;
+	alignas(64) std::atomic<uint64_t> reservePos;
+	alignas(64) std::atomic<uint64_t> writePos;
+	alignas(64) std::atomic<uint32_t> futexSeq;
+	std::atomic<uint32_t> waiters;	// readers sleeping on futexSeq, the writer wakes only if any
+};
+
+struct shmRecord
+{
+	uint32_t length;			// of the record, header and padding included
+	uint32_t payloadBytes;
+	uint64_t sampleIndex;		// see StreamFrame.h
+	uint32_t numSamples;		// 0: wrap record
+	uint8_t format;
+	uint8_t flags;				// eFrameFlags
+	uint16_t reserved;
+};
+
+/// <summary>
+/// Shared memory transport of the full stream (-X) for clients on the same host.
+/// A POSIX shared memory object /rsp_tcp_[port], living as long as the server.
+/// During a session the event loop copies each block of the broadcast ring once into it,
+/// then wakes the waiting readers with a futex. The readers read the samples in place,
+/// any number of them, without a socket; they send their commands on the data port
+/// and switch off its samples with CMD_SET_RSP_TCP_SAMPLES.
+/// Linux only.
+/// </summary>
+class ShmRingWriter
+{
+public:
+	static const uint32_t c_version = 1;
+	static const uint32_t c_headerBytes = 4096;
+	static const int c_minMBytes = 1;
+	static const int c_maxMBytes = 1024;
+
+	ShmRingWriter();
+	~ShmRingWriter();
+
+	// Creates the object of about megaBytes, rounded up to a power of two
+	bool create(int port, int megaBytes);
+	// Unmaps and removes the object
+	void destroy();
+	bool isOpen() const { return header != 0; }
+
+	// The readers continue with the newest block of the ring
+	void beginSession(const BroadcastRing& ring, int format);
+	// Copies the blocks of the ring from the cursor on into the shared memory
+	void onTransmit(const BroadcastRing& ring, double rateHz);
+	// First block of the ring still to be read
+	uint64_t getCursor() const { return cursor; }
+
+	static std::string objectName(int port) { return "/rsp_tcp_" + std::to_string(port); }
+
+private:
+	ShmRingWriter(ShmRingWriter const&);	// Don't Implement
+	void operator=(ShmRingWriter const&);	// Don't implement
+
+	void publish(const MemBlock* mb);
+	void wake();
+
+	std::string name;
+	shmRingHeader* header = 0;
+	BYTE* data = 0;
+	size_t mappedBytes = 0;
+	uint32_t capacity = 0;
+	uint64_t cursor = 0;
+	uint64_t expectedIndex = 0;
+	bool expectedValid = false;
+	uint64_t oversized = 0;
+};
@@ -0,0 +1,119 @@
+/**
+** RSP3_tcp - TCP/IP I/Q Data Server for the sdrplay RSP devices
+** Copyright (C) 2017-2024 Clem Schmidt, softsyst, http://qirx.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#pragma once
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <stdint.h>
+#include "Fft.h"
+
+/// <summary>
+/// Averaged power spectrum of the callback stream, computed on a worker thread and
+/// published as compact frames for the spectrum port.
+/// The callback only copies its samples into a history buffer. framesPerSec times a
+/// second the worker takes the newest samples, windows each FFT frame of size samples
+/// with Blackman-Harris, overlapping the FFT frames by overlapPercent, and averages the
+/// power over averages FFT frames, quantized to one byte per bin.
+/// The cost therefore depends on the frame rate only, not on the sampling rate;
+/// samples between the published frames are skipped.
+/// Frame, network byte order:
+///   4 bytes "RSPF", 4 bytes frame length, 4 bytes sequence number,
+///   4 bytes center frequency [Hz], 4 bytes span [Hz], 2 bytes bins, 2 bytes averages,
+///   then one byte per bin from -span/2 to +span/2: -2 * dBFS, saturated to 0..255,
+///   i.e. 0 to -127.5 dB full scale in 0.5 dB steps.
+/// </summary>
+class SpectrumWorker
+{
+public:
+	SpectrumWorker();
+	~SpectrumWorker();
+
+	// size a power of two in c_minSize..c_maxSize, 0 switches the spectrum off.
+	// Only while the worker is stopped
+	bool configure(int size, int overlapPercent, int averages, int framesPerSec);
+	bool isActive() const { return size > 0; }
+	int getSize() const { return size; }
+
+	// The rate of the callback samples, the history restarts
+	void setRate(int rateHz);
+	// The tuner frequency, written into the frames
+	void setCenter(int hz) { centerHz.store(hz); }
+
+	// notify is called from the worker thread for each new frame
+	void start(void(*notify)(void*), void* context);
+	void stop();
+
+	// Callback thread
+	void push(const short* xi, const short* xq, int numSamples);
+
+	// The newest frame, if its sequence number differs from seq. seq is updated
+	bool getFrame(uint32_t& seq, std::vector<uint8_t>& frame);
+
+	static const int c_minSize = 64;
+	static const int c_maxSize = 32768;
+	static const int c_maxOverlap = 90;
+	static const int c_maxAverages = 256;
+	static const int c_maxFrameRate = 50;
+	// samples of the FFTs of one frame, bounds the history
+	static const int c_maxSpan = 1 << 20;
+	static const int c_headerLength = 24;
+
+private:
+	SpectrumWorker(SpectrumWorker const&);		// Don't Implement
+	void operator=(SpectrumWorker const&);		// Don't implement
+
+	void run();
+	// Returns false if the history doesn't hold enough samples yet
+	bool computeFrame();
+
+	int size = 0;
+	int hop = 0;				// samples between the starts of two FFTs
+	int averages = 1;
+	int framesPerSec = 10;
+	int span = 0;				// samples of one frame: (averages - 1) * hop + size
+	Fft* fft = 0;
+	std::vector<float> window;
+	float scaleDb = 0;			// power of a full scale tone, in dB
+
+	// history, a power of two, written by the callback
+	std::vector<short> histI, histQ;
+	uint32_t histMask = 0;
+	std::atomic<uint64_t> written{ 0 };
+	std::atomic<int> rateHz{ 0 };
+	std::atomic<int> centerHz{ 0 };
+
+	// worker
+	std::vector<short> snapI, snapQ;
+	std::vector<float> re, im, power;
+	std::thread* worker = 0;
+	bool stopRequest = false;
+	std::mutex waitMutex;
+	std::condition_variable waitCond;
+	void(*notify)(void*) = 0;
+	void* notifyContext = 0;
+
+	// the published frame
+	std::mutex frameMutex;
+	std::vector<uint8_t> frame;
+	uint32_t frameSeq = 0;
+};
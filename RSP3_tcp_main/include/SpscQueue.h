@@ -0,0 +1,253 @@
+/**
+** RSP3_tcp - TCP/IP I/Q Data Server for the sdrplay RSP devices
+** Copyright (C) 2017-2024 Clem Schmidt, softsyst, http://qirx.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#ifndef SPSC_QUEUE
+#define SPSC_QUEUE
+
+#include <atomic>
+#include <stddef.h>
+#include <errno.h>
+#include <semaphore.h>
+#include <time.h>
+#include <chrono>
+
+// Bounded single-producer / single-consumer queue.
+// The producer (the sdrplay stream callback) never blocks and never takes a lock,
+// a full queue is reported back to the caller.
+// Only the consumer may block, using a semaphore which the producer posts
+// only when the consumer announced that it is going to sleep.
+// head is advanced with a CAS, so that the producer may discard the oldest element.
+template <class T>
+class SpscQueue
+{
+public:
+    // capacity is rounded up to the next power of two
+    SpscQueue(int capacity = 4096)
+    {
+        int cap = 2;
+        while (cap < capacity)
+            cap <<= 1;
+        mask = cap - 1;
+        slots = new T[cap];
+        head.store(0, std::memory_order_relaxed);
+        tail.store(0, std::memory_order_relaxed);
+        consumerWaiting.store(false, std::memory_order_relaxed);
+        cachedHead = 0;
+        cachedTail = 0;
+        sem_init(&sem, 0, 0);
+    }
+
+    ~SpscQueue(void)
+    {
+        sem_destroy(&sem);
+        delete[] slots;
+    }
+
+    // Producer only. Returns false if the queue is full.
+    bool tryEnqueue(T t)
+    {
+        size_t t0 = tail.load(std::memory_order_relaxed);
+        if (t0 - cachedHead > mask)
+        {
+            cachedHead = head.load(std::memory_order_acquire);
+            if (t0 - cachedHead > mask)
+                return false;
+        }
+        slots[t0 & mask] = t;
+        // seq_cst pairs with the consumer's store to consumerWaiting (no lost wakeup)
+        tail.store(t0 + 1, std::memory_order_seq_cst);
+        if (consumerWaiting.load(std::memory_order_seq_cst) &&
+            consumerWaiting.exchange(false, std::memory_order_seq_cst))
+        {
+            if (notifier != 0)
+                notifier(notifierContext);
+            else
+                sem_post(&sem);
+        }
+        return true;
+    }
+
+    // Consumer only. Non-blocking, returns the number of elements copied to out.
+    int dequeueBatch(T* out, int maxCount)
+    {
+        // head may also be advanced by the producer, see tryDiscardOldest
+        size_t h0 = head.load(std::memory_order_acquire);
+        for (;;)
+        {
+            if ((ptrdiff_t)(cachedTail - h0) <= 0)
+            {
+                cachedTail = tail.load(std::memory_order_acquire);
+                if ((ptrdiff_t)(cachedTail - h0) <= 0)
+                    return 0;
+            }
+            size_t avail = cachedTail - h0;
+            int n = avail < (size_t)maxCount ? (int)avail : maxCount;
+            for (int i = 0; i < n; i++)
+                out[i] = slots[(h0 + i) & mask];
+            if (head.compare_exchange_weak(h0, h0 + n, std::memory_order_acq_rel, std::memory_order_acquire))
+                return n;
+        }
+    }
+
+    // Producer only. Takes the oldest element out of the queue, to make room for a newer one.
+    // Returns false if the queue is empty.
+    bool tryDiscardOldest(T& out)
+    {
+        size_t h0 = head.load(std::memory_order_acquire);
+        size_t t0 = tail.load(std::memory_order_relaxed);
+        while (h0 != t0)
+        {
+            // the consumer only reads the slots, the producer writes them only beyond tail
+            T t = slots[h0 & mask];
+            if (head.compare_exchange_weak(h0, h0 + 1, std::memory_order_acq_rel, std::memory_order_acquire))
+            {
+                out = t;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Consumer only. Blocks until at least one element is available,
+    // or until wakeConsumer() was called; then 0 may be returned.
+    int waitDequeueBatch(T* out, int maxCount)
+    {
+        return waitDequeueBatchFor(out, maxCount, -1);
+    }
+
+    // Consumer only. As waitDequeueBatch, but returns 0 at the latest after timeoutUs.
+    // A negative timeout waits forever.
+    int waitDequeueBatchFor(T* out, int maxCount, int timeoutUs)
+    {
+        struct timespec deadline;
+        if (timeoutUs >= 0)
+        {
+            // sem_timedwait takes an absolute CLOCK_REALTIME time
+            long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count() + (long long)timeoutUs * 1000;
+            deadline.tv_sec = (time_t)(ns / 1000000000);
+            deadline.tv_nsec = (long)(ns % 1000000000);
+        }
+        for (;;)
+        {
+            int n = dequeueBatch(out, maxCount);
+            if (n > 0)
+                return n;
+            if (wakeRequested.exchange(false))
+                return 0;
+
+            consumerWaiting.store(true, std::memory_order_seq_cst);
+            if (tail.load(std::memory_order_seq_cst) != head.load(std::memory_order_relaxed) ||
+                wakeRequested.load())
+            {
+                consumerWaiting.store(false, std::memory_order_relaxed);
+                continue;
+            }
+            if (timeoutUs < 0)
+            {
+                while (sem_wait(&sem) != 0 && errno == EINTR)
+                    ;
+                continue;
+            }
+            int res;
+            while ((res = sem_timedwait(&sem, &deadline)) != 0 && errno == EINTR)
+                ;
+            if (res != 0)
+            {
+                // timed out. If the producer took the flag in the meantime,
+                // it posts the semaphore: consume that post, it is not needed anymore
+                if (!consumerWaiting.exchange(false))
+                    while (sem_wait(&sem) != 0 && errno == EINTR)
+                        ;
+                return dequeueBatch(out, maxCount);
+            }
+        }
+    }
+
+    // Consumer only. For a consumer waiting elsewhere, e.g. in an event loop:
+    // the producer calls the notifier once, when the next element is enqueued.
+    // Returns false if elements arrived in the meantime, the consumer must not wait then.
+    bool armNotify()
+    {
+        consumerWaiting.store(true, std::memory_order_seq_cst);
+        if (tail.load(std::memory_order_seq_cst) != head.load(std::memory_order_relaxed))
+        {
+            consumerWaiting.store(false, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    // Replaces the semaphore post by fn(context). Set before the producer starts.
+    void setNotifier(void(*fn)(void*), void* context)
+    {
+        notifierContext = context;
+        notifier = fn;
+    }
+
+    // Get the "front"-element.
+    // If the queue is empty, wait till an element is available.
+    T dequeue(void)
+    {
+        T val;
+        while (waitDequeueBatch(&val, 1) == 0)
+            ;
+        return val;
+    }
+
+    // Any thread. Lets a waiting consumer return from waitDequeueBatch, e.g. on exit.
+    void wakeConsumer()
+    {
+        wakeRequested.store(true);
+        consumerWaiting.store(false);
+        sem_post(&sem);
+    }
+
+    int getNumEntries() const
+    {
+        return (int)(tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire));
+    }
+    int getCapacity() const { return (int)mask + 1; }
+
+private:
+    SpscQueue(SpscQueue const&);          // Don't Implement
+    void operator=(SpscQueue const&);     // Don't implement
+
+    // head and tail are kept on separate cache lines, each together with
+    // the private copy of the other index used by the same side
+    static const int CACHE_LINE = 64;
+
+    char pad0[CACHE_LINE];
+    std::atomic<size_t> head;       // written by the consumer, by the producer when discarding
+    size_t cachedTail;              // consumer's view of tail
+    char pad1[CACHE_LINE];
+    std::atomic<size_t> tail;       // written by the producer
+    size_t cachedHead;              // producer's view of head
+    char pad2[CACHE_LINE];
+    std::atomic<bool> consumerWaiting;
+    std::atomic<bool> wakeRequested{ false };
+    sem_t sem;
+    void(*notifier)(void*) = 0;
+    void* notifierContext = 0;
+
+    T* slots;
+    size_t mask;
+};
+#endif
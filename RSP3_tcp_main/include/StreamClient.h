@@ -0,0 +1,116 @@
+/**
+** RSP3_tcp - TCP/IP I/Q Data Server for the sdrplay RSP devices
+** Copyright (C) 2017-2024 Clem Schmidt, softsyst, http://qirx.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#pragma once
+#include <chrono>
+#include <string>
+#include <stdint.h>
+#include "common.h"
+#include "Reactor.h"
+#include "BroadcastRing.h"
+#include "rsp_cmdLineArgs.h"
+
+class GatherSender;
+class ZeroCopyReaper;
+class sdrplay_device;
+
+/// <summary>
+/// One client on the data port. All clients of a device receive the same stream
+/// from the broadcast ring, each with its own cursor and its own sender, so a slow client
+/// only falls behind itself. Blocks evicted from the ring before this client read them
+/// are counted as dropped for this client.
+/// Only the client with the tuning authority has its commands executed.
+/// A client of a channelizer port reads the ring of its channel instead of the device ring.
+/// With the UDP stream, a client of the main port only sends commands: its cursor follows
+/// the ring without sending. A client may switch off its samples with CMD_SET_RSP_TCP_SAMPLES,
+/// e.g. reading them from the shared memory ring.
+/// Driven by the event loop of devices.
+/// </summary>
+class StreamClient
+{
+public:
+	// channel: index into the channels of the device, -1 for the main port
+	StreamClient(SOCKET s, const sockaddr_in& addr, int id, int channel = -1);
+	~StreamClient();
+
+	// Switches the socket to nonblocking and registers it. The client reads from the newest
+	// block of the ring on. reaper takes the sender on disconnect while zero copy sends are in flight
+	bool start(Reactor* r, ZeroCopyReaper* reaper, MemBlockPool& pool, const BroadcastRing& ring, rsp_cmdLineArgs* args);
+	// Unregisters and closes the socket, returns the blocks not sent
+	void disconnect();
+
+	// Commands are readable. Commands of a client without authority are discarded.
+	// Returns false if the client closed the connection or on a socket error
+	bool onReceive(sdrplay_device* dev, bool authority);
+	// Transmits the blocks of the ring from the cursor on, as far as the socket takes them.
+	// Returns false on a socket error
+	bool onTransmit(const BroadcastRing& ring);
+	// Milliseconds until the pending blocks are due (0: now), -1 if nothing is pending
+	int getTransmitTimeoutMs() const;
+
+	SOCKET getSocket() const { return clientSocket; }
+	int getId() const { return id; }
+	int getChannel() const { return channel; }
+	const std::string& getAddress() const { return address; }
+	// First block of the ring still to be read by this client
+	uint64_t getCursor() const { return cursor; }
+	// Samples evicted from the ring before this client read them
+	uint64_t getDroppedSamples() const { return droppedSamples; }
+
+	// Prints the lag and the drops, at most every intervalSec seconds
+	void reportStats(int intervalSec);
+
+	// rtl_tcp command: 1 byte command, 4 bytes value
+	static const int c_cmdLength = 5;
+	// CMD_SET_RSP_TCP_SAMPLES of sdrplay_device, handled per client
+	static const BYTE c_cmdTcpSamples = 0x85;
+
+private:
+	StreamClient(StreamClient const&);		// Don't Implement
+	void operator=(StreamClient const&);	// Don't implement
+
+	void setWriteInterest(bool on);
+
+	SOCKET clientSocket;
+	std::string address;
+	int id;
+	int channel;
+	Reactor* reactor = 0;
+	ZeroCopyReaper* reaper = 0;
+	GatherSender* sender = 0;
+	int latencyUs = 0;
+	BYTE cmdBuf[c_cmdLength];
+	int cmdLen = 0;
+	unsigned int ignoredCommands = 0;
+	bool writeInterest = false;
+	bool commandOnly = false;
+	bool udpStream = false;
+	std::chrono::steady_clock::time_point flushDeadline;
+
+	uint64_t cursor = 0;
+	uint64_t cursorSample = 0;		// number of the first sample of the cursor block
+	uint64_t droppedSamples = 0;
+	uint64_t droppedBlocks = 0;
+	unsigned int dropReports = 0;
+	// samples in the ring not yet read, maximum since the last report
+	uint64_t lagSamples = 0;
+	uint64_t maxLagSamples = 0;
+	time_t lastReport = 0;
+};
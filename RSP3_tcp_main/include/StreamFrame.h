@@ -0,0 +1,109 @@
+/**
+** RSP3_tcp - TCP/IP I/Q Data Server for the sdrplay RSP devices
+** Copyright (C) 2017-2024 Clem Schmidt, softsyst, http://qirx.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#pragma once
+#include <stdint.h>
+#include "common.h"
+#include "rsp_tcp.h"
+#include "MemBlockPool.h"
+
+// Flags of a frame header, the events which took effect with the first sample of the frame
+enum eFrameFlags
+{
+	  FRAME_RF_CHANGED = 0x01		// the tuner frequency changed
+	, FRAME_FS_CHANGED = 0x02		// the sampling rate changed
+	, FRAME_GR_CHANGED = 0x04		// the gain reduction changed
+	, FRAME_DISCONTINUITY = 0x08	// samples were lost before the frame, its index skips them
+};
+
+/// <summary>
+/// Framed stream mode (-H 1): each block is sent with a header in front, network byte order:
+///    0  4 bytes "RSPD"
+///    4  2 bytes header length, the payload starts there
+///    6  1 byte format, eBitWidth of the payload
+///    7  1 byte flags, eFrameFlags
+///    8  4 bytes payload length
+///   12  4 bytes samples in the payload
+///   16  8 bytes index of the first sample
+/// The index counts the samples of the stream at its output rate from the start of the
+/// session, lost samples included: samples the API dropped before the callback and
+/// blocks the server dropped are skipped by the index of the next frame. A client lapped
+/// by the broadcast ring sees the gap in the index only, the flag is set by the server
+/// side for all clients. Clients parse the header with rspClient::parseFrame.
+/// </summary>
+struct StreamFrame
+{
+	static const int c_headerLength = 24;
+
+	// Writes the header into the first c_headerLength bytes of mb, reserved by the callback
+	static void write(MemBlock* mb, int format);
+};
+
+/// <summary>
+/// Callback side: numbers the samples of one stream and collects the events
+/// until its next block, a callback may end without one
+/// </summary>
+struct frameCounter
+{
+	uint64_t nextIndex = 0;
+	double lost = 0;		// at the stream rate, not yet skipped
+	BYTE flags = 0;
+
+	void clear() { nextIndex = 0; lost = 0; flags = 0; }
+
+	// lostSamples at the device rate, ratio: stream rate / device rate
+	void onCallback(int events, unsigned int lostSamples, double ratio)
+	{
+		flags |= (BYTE)events;
+		lost += lostSamples * ratio;
+	}
+
+	// Sets index and flags of the block converted last
+	void stamp(MemBlock* mb)
+	{
+		uint64_t skipped = (uint64_t)(lost + 0.5);
+		lost -= (double)skipped;
+		nextIndex += skipped;
+		mb->sampleIndex = nextIndex;
+		mb->flags = flags;
+		flags = 0;
+		nextIndex += mb->numSamples;
+	}
+};
+
+/// <summary>
+/// Transmit side: writes the headers of one stream while the blocks are moved into its
+/// ring, after the lossless stage has fixed the payload length
+/// </summary>
+class StreamFramer
+{
+public:
+	void configure(bool on, eBitWidth f) { enabled = on; format = f; }
+	bool isEnabled() const { return enabled; }
+	// at the start of a session
+	void reset() { expectedValid = false; }
+	void frame(MemBlock* mb);
+
+private:
+	bool enabled = false;
+	eBitWidth format = BITS_16;
+	bool expectedValid = false;
+	uint64_t expectedIndex = 0;
+};
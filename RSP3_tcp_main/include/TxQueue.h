@@ -0,0 +1,93 @@
+/**
+** RSP3_tcp - TCP/IP I/Q Data Server for the sdrplay RSP devices
+** Copyright (C) 2017-2024 Clem Schmidt, softsyst, http://qirx.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#pragma once
+#include <atomic>
+#include <stdint.h>
+#include "SpscQueue.h"
+#include "MemBlockPool.h"
+
+// What the stream callback does if the queue to the transmit side is full
+enum eOverloadPolicy
+{
+	  OVL_DROP_NEWEST = 0	// discard the block just converted
+	, OVL_DROP_OLDEST = 1	// discard the oldest queued blocks, the client gets the most recent samples
+	, OVL_BLOCK = 2			// wait in the callback, the API then loses samples, which is reported
+};
+
+/// <summary>
+/// Queue between the stream callback and the transmit side (the event loop), bounded in bytes.
+/// Blocks not transmitted are counted with their exact number of samples.
+/// All drops happen on the callback side, the counters are read by other threads.
+/// </summary>
+class TxQueue
+{
+public:
+	TxQueue(int maxBlocks);
+
+	void configure(int64_t maxBytes, eOverloadPolicy policy);
+
+	// Callback thread. Returns false if the block was dropped; it is then returned to the pool.
+	// In OVL_BLOCK mode, waits until there is room, cancel is set, or c_maxBlockMs elapsed
+	bool push(MemBlock* mb, MemBlockPool& pool, const bool& cancel);
+	// Producer thread other than the callback, e.g. the lossless encoder: never drops, the pool's
+	// recycle is callback only. Returns false if the block does not fit now, the caller keeps it
+	bool tryPush(MemBlock* mb);
+
+	// Transmit side
+	int dequeueBatch(MemBlock** out, int maxCount);
+	int waitDequeueBatch(MemBlock** out, int maxCount);
+	int waitDequeueBatchFor(MemBlock** out, int maxCount, int timeoutUs);
+	void wakeConsumer() { q.wakeConsumer(); }
+	bool armNotify() { return q.armNotify(); }
+	void setNotifier(void(*fn)(void*), void* context) { q.setNotifier(fn, context); }
+
+	int getNumEntries() const { return q.getNumEntries(); }
+	int getCapacity() const { return q.getCapacity(); }
+	int64_t getQueuedBytes() const { return queuedBytes.load(); }
+	int64_t getMaxBytes() const { return maxBytes; }
+	eOverloadPolicy getPolicy() const { return policy; }
+
+	uint64_t getDroppedBlocks() const { return droppedBlocks.load(std::memory_order_relaxed); }
+	uint64_t getDroppedSamples() const { return droppedSamples.load(std::memory_order_relaxed); }
+	void resetCounters();
+
+	static const char* policyName(eOverloadPolicy p);
+
+	// longest wait of the callback in OVL_BLOCK mode, the block is dropped then
+	static const int c_maxBlockMs = 500;
+
+private:
+	TxQueue(TxQueue const&);			// Don't Implement
+	void operator=(TxQueue const&);		// Don't implement
+
+	bool fits(int bytes) const;
+	void dropped(MemBlock* mb, MemBlockPool& pool, const char* reason);
+	int dequeued(MemBlock** out, int n);
+
+	SpscQueue<MemBlock*> q;
+	std::atomic<int64_t> queuedBytes;
+	int64_t maxBytes;
+	eOverloadPolicy policy = OVL_DROP_NEWEST;
+
+	std::atomic<uint64_t> droppedBlocks;
+	std::atomic<uint64_t> droppedSamples;
+	unsigned int dropReports = 0;
+};
@@ -0,0 +1,140 @@
+/**
+** RSP3_tcp - TCP/IP I/Q Data Server for the sdrplay RSP devices
+** Copyright (C) 2017-2024 Clem Schmidt, softsyst, http://qirx.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#pragma once
+#include <chrono>
+#include <string>
+#include <stdint.h>
+#include "common.h"
+#include "MemBlockPool.h"
+#include "BroadcastRing.h"
+#include "iqConvert.h"
+#ifdef _WIN32
+typedef WSABUF udpIoVec;
+#else
+#include <sys/uio.h>
+typedef struct iovec udpIoVec;
+#endif
+
+/// <summary>
+/// UDP transport of the full stream (-U), to one unicast or multicast destination.
+/// Reads the broadcast ring with its own cursor like a client, and cuts each block once
+/// into datagrams of whole sample groups, at most mtu bytes including the IP and UDP headers.
+/// A datagram is a header and a slice of the block, sent as two buffers without copying;
+/// on Linux a batch of datagrams goes out with one sendmmsg.
+/// Datagram header, network byte order:
+///    0  4 bytes "RSPU"
+///    4  2 bytes header length, the payload starts there
+///    6  1 byte format, eBitWidth of the payload
+///    7  1 byte flags, eFrameFlags, set in the first datagram of a block
+///    8  4 bytes sequence number, counting the datagrams of the session
+///   12  4 bytes samples in the payload
+///   16  8 bytes index of the first sample, see StreamFrame.h
+/// The sequence number shows lost datagrams, the sample index the samples to fill in.
+/// With pacing the datagrams leave at pacePercent of the output rate instead of in bursts
+/// of a callback block, smoothing the load of switches and receivers.
+/// Commands and indications stay on the TCP ports. Driven by the event loop of devices.
+/// </summary>
+class UdpStreamer
+{
+public:
+	static const int c_headerLength = 24;
+	static const int c_maxBatch = 64;		// datagrams per sendmmsg
+	static const int c_ipUdpHeaders = 28;
+	static const int c_minMtu = 576;
+	static const int c_maxMtu = 65535;
+	static const int c_sendBufferBytes = 4194304;
+	static const int c_multicastTtl = 1;	// the local network
+	static const int c_burstMs = 2;			// pacing: the most sent at once after an idle time
+
+	UdpStreamer(MemBlockPool& pool);
+	~UdpStreamer();
+
+	// pacePercent: 0 sends as fast as the blocks come, else the rate in percent of the output rate.
+	// Starts at the newest block of the ring
+	bool start(const BroadcastRing& ring, const std::string& address, int port, int mtu, int pacePercent, int format);
+	// Returns the blocks still referenced to the pool and closes the socket
+	void stop();
+
+	// Sends the blocks of the ring from the cursor on, as far as the pacing and the socket allow.
+	// conv: the converter of the blocks, for the sample groups; rateHz the output rate
+	void onTransmit(const BroadcastRing& ring, const iqConverterEntry* conv, double rateHz);
+	// Milliseconds until the pacing or a full socket buffer allow the next datagram, -1 if idle
+	int getTransmitTimeoutMs() const;
+	// First block of the ring still to be read
+	uint64_t getCursor() const { return cursor; }
+
+	// Prints the datagram statistics, at most every intervalSec seconds
+	void reportStats(int intervalSec);
+
+private:
+	UdpStreamer(UdpStreamer const&);		// Don't Implement
+	void operator=(UdpStreamer const&);		// Don't implement
+
+	struct datagram
+	{
+		BYTE header[c_headerLength];
+		MemBlock* mb;
+		int offset;			// of the payload in mb->Mem
+		int bytes;
+		bool last;			// the last slice of mb, its reference is dropped when sent
+	};
+
+	bool cut(const BroadcastRing& ring, const iqConverterEntry* conv, double rateHz);
+	int sendBatch();
+	void retire(int count);
+	bool takeTokens(int numSamples, double rateHz);
+	void writeHeader(datagram& d, int numSamples, uint64_t sampleIndex, BYTE flags);
+
+	MemBlockPool& pool;
+	SOCKET udpSocket = INVALID_SOCKET;
+	sockaddr_in dest;
+	int maxPayload = 0;
+	int pacePercent = 0;
+	BYTE format = 0;
+
+	uint64_t cursor = 0;
+	uint64_t expectedIndex = 0;
+	bool expectedValid = false;
+	// the block being cut, with a reference of its own
+	MemBlock* current = 0;
+	int currentOffset = 0;
+	int currentSamples = 0;
+	BYTE currentFlags = 0;		// for its first datagram
+	uint32_t sequence = 0;
+	datagram batch[c_maxBatch];
+	udpIoVec iov[c_maxBatch][2];
+	int numPending = 0;
+
+	// pacing, in samples
+	double tokens = 0;
+	std::chrono::steady_clock::time_point lastRefill;
+	std::chrono::steady_clock::time_point retryAt;
+	bool waiting = false;
+
+	uint64_t datagrams = 0;
+	uint64_t syscalls = 0;
+	uint64_t bytesSent = 0;
+	uint64_t sendErrors = 0;
+	uint64_t lappedBlocks = 0;
+	uint64_t lastDatagrams = 0;
+	uint64_t lastSyscalls = 0;
+	time_t lastReport = 0;
+};
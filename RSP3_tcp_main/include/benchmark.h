@@ -0,0 +1,58 @@
+/**
+** RSP3_tcp - TCP/IP I/Q Data Server for the sdrplay RSP devices
+** Copyright (C) 2017-2024 Clem Schmidt, softsyst, http://qirx.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#pragma once
+#include <string>
+#include <vector>
+#include "common.h"
+#include "rsp_cmdLineArgs.h"
+
+typedef int(*benchmarkFn)(rsp_cmdLineArgs* pargs);
+
+struct benchmarkEntry
+{
+	const char* name;
+	benchmarkFn run;
+	const char* description;
+};
+
+/// <summary>
+/// Benchmarks of the processing stages, running without a device,
+/// started with the command line option -b name
+/// </summary>
+class benchmark
+{
+public:
+	// Returns 0 on success, -1 if the name is unknown or the benchmark failed
+	static int run(const std::string& name, rsp_cmdLineArgs* pargs);
+
+private:
+	static void list();
+	static int transmit(rsp_cmdLineArgs* pargs);
+	static double transmitRun(bool zeroCopy, int maxBytes, int seconds);
+	static int decimate(rsp_cmdLineArgs* pargs);
+	static int resample(rsp_cmdLineArgs* pargs);
+	static int channelize(rsp_cmdLineArgs* pargs);
+	static int lossless(rsp_cmdLineArgs* pargs);
+	static void losslessRun(const std::string& name, const std::vector<BYTE>& capture);
+	static int verify(rsp_cmdLineArgs*);
+
+	static const benchmarkEntry entries[];
+};
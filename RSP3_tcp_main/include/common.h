@@ -67,6 +67,9 @@ public:
 	static bool checkRange(int val, int minval, int maxval);
 
 	static bool isLittleEndian();
+	static bool setNonBlocking(SOCKET s, bool on);
+	// The last socket call failed only because a nonblocking socket was not ready
+	static bool socketWouldBlock();
 	static timespec getRelativeTimeoutValue(int relativeTimeoutSec);
 	#ifdef _WIN32
 	static int gettimeofday(struct timeval *tv, void* ignored);
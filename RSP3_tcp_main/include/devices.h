@@ -23,13 +23,36 @@
 #pragma warning(disable:4996)
 #endif
 #include <map>
+#include <vector>
+#include <atomic>
+#include <chrono>
 #include "sdrplay_device.h"
+#include "Reactor.h"
+#include "StreamClient.h"
+#include "GatherSender.h"
+#include "UdpStreamer.h"
+#include "ShmRing.h"
 #include "sdrplay_api.h"
 #include "rsp_cmdLineArgs.h"
 
 class crc32;
 
-class devices
+/// <summary>
+/// The server. One thread runs the event loop for the data sockets with the commands,
+/// the control socket with the indications and the listening sockets.
+/// The sample conversion runs on the stream callback of the API.
+/// Up to MaxClients clients share the device, all receiving the same stream. One of them
+/// has the tuning authority: the one from ControlAddress if given, else the oldest client.
+/// With the channelizer, each channel has its own port. Its clients join the session of
+/// the main port, they never get the tuning authority.
+/// The spectrum port (data port + 2) publishes the frames of the spectrum worker, each client
+/// gets the newest frame once it has taken the previous one.
+/// With -U the full stream goes out by UDP while a session is running; the clients of the
+/// data port hold the session and send the commands.
+/// With -X the full stream of a session is also copied into a shared memory ring for local
+/// clients, which switch off the samples of their data port connection.
+/// </summary>
+class devices : public ReactorHandler
 {
 
 	// Singleton pattern
@@ -64,12 +87,81 @@ public:
 	int getNumDevices() { return numDevices; }
 	uint32_t* getSerialCRCs() { return &serialCRCs[0]; }
 	sdrplay_api_DeviceT* getSdrplayDevices() { return &sdrplayDevices[0]; }
+
+	// ReactorHandler
+	void onEvent(SOCKET s, int events);
+	void onWakeup();
 private:
 	void initListener();
+	void initControlListener();
 	void doListen();
+	void acceptClient();
+	void acceptControlClient();
+	void initChannelListeners();
+	void acceptChannelClient(int ix);
+	int countClients(int channel) const;
+	void initSpectrumListener();
+	void acceptSpectrumClient();
+	void sendSpectrum();
+	bool flushSpectrum(size_t ix);
+	void closeSpectrumClient(size_t ix);
+	void dropClient(StreamClient* c);
+	void assignController();
+	void updateListening();
+	void distribute();
+	void releaseRing();
+	void releaseRing(int channel);
+	int getTransmitTimeoutMs() const;
+	void endSession();
+	void sendIndications();
+	void flushControl();
+	void closeControlClient();
 
+	Reactor reactor;
 	SOCKET listenSocket = INVALID_SOCKET;
-	SOCKET clientSocket = INVALID_SOCKET;
+	bool listening = false;
+	// the clients of the current session, oldest first
+	std::vector<StreamClient*> clients;
+	StreamClient* controller = 0;
+	// the UDP stream of the session, 0 without -U
+	UdpStreamer* udp = 0;
+	// the shared memory ring, open from Start on with -X
+	ShmRingWriter shm;
+	// senders of disconnected clients waiting for their zero copy completions
+	ZeroCopyReaper reaper;
+	int nextClientId = 1;
+	// control client, port + 1, receives the indications
+	SOCKET ctrlListenSocket = INVALID_SOCKET;
+	SOCKET ctrlSocket = INVALID_SOCKET;
+	BYTE ctrlBuf[TX_BUF_LEN];
+	int ctrlLen = 0;
+	int ctrlSent = 0;
+	// channelizer ports, in the order of the channels of the device
+	struct channelListener
+	{
+		int bin;
+		SOCKET listenSocket;
+		bool listening;
+	};
+	std::vector<channelListener> channelListeners;
+	// spectrum port, port + 2
+	struct spectrumClient
+	{
+		SOCKET s;
+		std::vector<uint8_t> frame;
+		size_t sent;
+		uint32_t seq;
+		bool writeInterest;
+	};
+	SOCKET specListenSocket = INVALID_SOCKET;
+	std::vector<spectrumClient> spectrumClients;
+	std::vector<uint8_t> spectrumFrame;		// the newest frame of the worker
+	uint32_t spectrumSeq = 0;
+	bool ctrlWriteInterest = false;
+	static const int c_indicationIntervalMs = 500;
+	std::chrono::steady_clock::time_point nextIndication;
+	// CloseClient, from another thread
+	std::atomic<bool> closeRequested{ false };
 	sdrplay_device* currentDevice;
 	sockaddr_in local;
 	sockaddr_in remote;
@@ -0,0 +1,376 @@
+/**
+** RSP3_tcp - TCP/IP I/Q Data Server for the sdrplay RSP devices
+** Copyright (C) 2017-2024 Clem Schmidt, softsyst, http://qirx.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#pragma once
+#include <string.h>
+#include <stdint.h>
+#include <atomic>
+#include "common.h"
+#include "rsp_tcp.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define IQ_X86
+#include <emmintrin.h>
+#include <immintrin.h>
+#if defined(__GNUC__)
+#define IQ_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define IQ_TARGET_AVX2
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define IQ_NEON
+#include <arm_neon.h>
+#endif
+
+typedef void(*interleaveFn)(const short* idata, const short* qdata, int numSamples, BYTE* out);
+
+/// <summary>
+/// Factor of the complex float format: 1 / 32768 at 0 dB system gain, and the gain divided out,
+/// so the float values are referred to the antenna input and don't jump with the AGC.
+/// Set whenever the gain changes, the converters read it once per block
+/// </summary>
+struct iqFloatScale
+{
+	static void setGain(float gainDb);
+	static float get() { return factor.load(std::memory_order_relaxed); }
+
+private:
+	static std::atomic<float> factor;
+};
+
+/// <summary>
+/// Scalar converters, one instance per output format, ADS-B mode and host byte order.
+/// All decisions are taken at compile time, the inner loops are branch free.
+/// </summary>
+template <eBitWidth W, bool Adsb, bool LittleEndianHost>
+struct iqConverter;
+
+// 16 bit, host independent: I and Q interleaved, each as little endian short
+template <bool Adsb>
+struct iqConverter<BITS_16, Adsb, false>
+{
+	static const int bytesPerSample = 4;
+	static const int samplesPerGroup = 1;
+	static const int bytesPerGroup = 4;
+	static void convert(const short* idata, const short* qdata, int numSamples, BYTE* out)
+	{
+		for (int i = 0, j = 0; i < numSamples; i++)
+		{
+			out[j++] = (BYTE)(idata[i] & 0xff);
+			out[j++] = (BYTE)((idata[i] & 0xff00) >> 8);
+
+			out[j++] = (BYTE)(qdata[i] & 0xff);
+			out[j++] = (BYTE)((qdata[i] & 0xff00) >> 8);
+		}
+	}
+};
+
+// 16 bit, little endian hosts: one 32 bit store per I/Q pair
+template <bool Adsb>
+struct iqConverter<BITS_16, Adsb, true>
+{
+	static const int bytesPerSample = 4;
+	static const int samplesPerGroup = 1;
+	static const int bytesPerGroup = 4;
+	static void convert(const short* idata, const short* qdata, int numSamples, BYTE* out)
+	{
+		for (int i = 0; i < numSamples; i++)
+		{
+			uint32_t v = (uint16_t)idata[i] | ((uint32_t)(uint16_t)qdata[i] << 16);
+			memcpy(out + 4 * i, &v, 4);
+		}
+	}
+};
+
+// Complex float, host independent: I and Q interleaved, each as little endian IEEE float
+template <bool Adsb>
+struct iqConverter<BITS_CF32, Adsb, false>
+{
+	static const int bytesPerSample = 8;
+	static const int samplesPerGroup = 1;
+	static const int bytesPerGroup = 8;
+	static void convert(const short* idata, const short* qdata, int numSamples, BYTE* out)
+	{
+		float scale = iqFloatScale::get();
+		for (int i = 0, j = 0; i < numSamples; i++, j += 8)
+		{
+			float fi = idata[i] * scale;
+			float fq = qdata[i] * scale;
+			uint32_t ui, uq;
+			memcpy(&ui, &fi, 4);
+			memcpy(&uq, &fq, 4);
+			for (int b = 0; b < 4; b++)
+			{
+				out[j + b] = (BYTE)(ui >> (8 * b));
+				out[j + 4 + b] = (BYTE)(uq >> (8 * b));
+			}
+		}
+	}
+};
+
+// Complex float, little endian hosts
+template <bool Adsb>
+struct iqConverter<BITS_CF32, Adsb, true>
+{
+	static const int bytesPerSample = 8;
+	static const int samplesPerGroup = 1;
+	static const int bytesPerGroup = 8;
+	static void convert(const short* idata, const short* qdata, int numSamples, BYTE* out)
+	{
+		float scale = iqFloatScale::get();
+		for (int i = 0; i < numSamples; i++)
+		{
+			float v[2] = { idata[i] * scale, qdata[i] * scale };
+			memcpy(out + 8 * i, v, 8);
+		}
+	}
+};
+
+// 8 bit, restored unsigned 12 bit ADC value without the four low order bits
+// assume the 12 Bit ADC values are mapped onto signed 16-Bit values covering the whole range
+template <bool LittleEndianHost>
+struct iqConverter<BITS_8, false, LittleEndianHost>
+{
+	static const int bytesPerSample = 2;
+	static const int samplesPerGroup = 1;
+	static const int bytesPerGroup = 2;
+	static void convert(const short* idata, const short* qdata, int numSamples, BYTE* out)
+	{
+		for (int i = 0, j = 0; i < numSamples; i++)
+		{
+			//restore the unsigned 12-Bit signal
+			int tmpi = (idata[i] >> 4) + 2048;
+			int tmpq = (qdata[i] >> 4) + 2048;
+
+			// cut the four low order bits
+			tmpi >>= 4;
+			tmpq >>= 4;
+
+			out[j++] = (BYTE)tmpi;
+			out[j++] = (BYTE)tmpq;
+		}
+	}
+};
+
+// 8 bit, ADS-B mode: 14 bit ADC value / 64 + 127
+template <bool LittleEndianHost>
+struct iqConverter<BITS_8, true, LittleEndianHost>
+{
+	static const int bytesPerSample = 2;
+	static const int samplesPerGroup = 1;
+	static const int bytesPerGroup = 2;
+	static void convert(const short* idata, const short* qdata, int numSamples, BYTE* out)
+	{
+		for (int i = 0, j = 0; i < numSamples; i++)
+		{
+			out[j++] = (BYTE)(idata[i] / 64 + 127);
+			out[j++] = (BYTE)(qdata[i] / 64 + 127);
+		}
+	}
+};
+
+// 4 bit: high nibble of the I byte in the low nibble, high nibble of the Q byte in the high nibble
+template <bool Adsb, bool LittleEndianHost>
+struct iqConverter<BITS_4, Adsb, LittleEndianHost>
+{
+	static const int bytesPerSample = 1;
+	static const int samplesPerGroup = 1;
+	static const int bytesPerGroup = 1;
+	static void convert(const short* idata, const short* qdata, int numSamples, BYTE* out)
+	{
+		for (int i = 0; i < numSamples; i++)
+		{
+			//I-Byte
+			BYTE b = (BYTE)(idata[i] / 64 + 127);
+			// Low order nibble
+			BYTE b2 = b >> 4;
+			b2 &= 0x0f;
+
+			//Q-Byte
+			b = (BYTE)(qdata[i] / 64 + 127);
+			// High order nibble
+			BYTE b3 = b & 0xf0;
+
+			out[i] = b2 | b3;
+		}
+	}
+};
+
+// 12 bit, the unsigned ADC values as restored for 8 bit, an I/Q pair in 3 bytes:
+// I bits 0-7, I bits 8-11 in the low and Q bits 0-3 in the high nibble, Q bits 4-11.
+// That is the 24 bit little endian value I | Q << 12. The same in ADS-B mode
+template <bool Adsb, bool LittleEndianHost>
+struct iqConverter<BITS_12, Adsb, LittleEndianHost>
+{
+	static const int bytesPerSample = 3;
+	static const int samplesPerGroup = 1;
+	static const int bytesPerGroup = 3;
+	static void convert(const short* idata, const short* qdata, int numSamples, BYTE* out)
+	{
+		for (int i = 0, j = 0; i < numSamples; i++)
+		{
+			int tmpi = (idata[i] >> 4) + 2048;
+			int tmpq = (qdata[i] >> 4) + 2048;
+			out[j++] = (BYTE)tmpi;
+			out[j++] = (BYTE)((tmpi >> 8) | (tmpq << 4));
+			out[j++] = (BYTE)(tmpq >> 4);
+		}
+	}
+};
+
+// Block floating point: per group of 16 samples one exponent byte e (0..8), then I and Q
+// interleaved as signed 8 bit mantissas m, the sample is m << e. 33 bytes per 16 samples.
+// The mantissas are rounded, e is the smallest exponent the largest magnitude fits with
+static inline int bfpExponent(int maxAbs)
+{
+	int e = 0;
+	while ((maxAbs >> e) > 127 && e < 8)
+		e++;
+	return e;
+}
+
+template <bool Adsb, bool LittleEndianHost>
+struct iqConverter<BITS_BFP, Adsb, LittleEndianHost>
+{
+	static const int bytesPerSample = 3;	// rounded up, for the buffer sizes
+	static const int samplesPerGroup = 16;
+	static const int bytesPerGroup = 33;
+	// Only whole groups are converted
+	static void convert(const short* idata, const short* qdata, int numSamples, BYTE* out)
+	{
+		for (int g = 0; g + samplesPerGroup <= numSamples; g += samplesPerGroup)
+		{
+			int maxAbs = 0;
+			for (int i = g; i < g + samplesPerGroup; i++)
+			{
+				int a = idata[i] < 0 ? -idata[i] : idata[i];
+				int b = qdata[i] < 0 ? -qdata[i] : qdata[i];
+				maxAbs = a > maxAbs ? a : maxAbs;
+				maxAbs = b > maxAbs ? b : maxAbs;
+			}
+			if (maxAbs > 32767)
+				maxAbs = 32767;
+			int e = bfpExponent(maxAbs);
+			int round = e == 0 ? 0 : 1 << (e - 1);
+			*out++ = (BYTE)e;
+			for (int i = g; i < g + samplesPerGroup; i++)
+			{
+				int mi = (idata[i] + round) >> e;
+				int mq = (qdata[i] + round) >> e;
+				*out++ = (BYTE)(mi > 127 ? 127 : mi < -128 ? -128 : mi);
+				*out++ = (BYTE)(mq > 127 ? 127 : mq < -128 ? -128 : mq);
+			}
+		}
+	}
+};
+
+/// <summary>
+/// One output format in one mode, as used by the stream callback.
+/// Most formats have whole bytes per sample (samplesPerGroup 1); a format with groups
+/// converts whole groups only, see iqGroupCarry
+/// </summary>
+struct iqConverterEntry
+{
+	interleaveFn convert;
+	int bytesPerSample;
+	int samplesPerGroup;
+	int bytesPerGroup;
+	const char* kernel;
+
+	int bytesFor(int numSamples) const { return numSamples / samplesPerGroup * bytesPerGroup; }
+	// Largest output of one call of iqGroupCarry::convert with numSamples new samples
+	int maxBytes(int numSamples) const { return (numSamples + samplesPerGroup - 1) / samplesPerGroup * bytesPerGroup; }
+};
+
+/// <summary>
+/// The samples of an incomplete group, kept for the next block of the stream.
+/// One per stream; callback thread
+/// </summary>
+struct iqGroupCarry
+{
+	static const int c_maxGroup = 16;
+	short i[c_maxGroup];
+	short q[c_maxGroup];
+	int n = 0;
+
+	// Converts the kept samples and the new ones, as far as they fill whole groups.
+	// Returns the number of samples written to out, conv->bytesFor() of it are bytes
+	int convert(const iqConverterEntry* conv, const short* xi, const short* xq, int numSamples, BYTE* out);
+	void clear() { n = 0; }
+};
+
+/// <summary>
+/// Conversion kernels from the sdrplay I/Q sample arrays into the transmitted formats.
+/// init() fills a table with the scalar converter instances for the host byte order
+/// and replaces them by vectorized kernels where the CPU supports them.
+/// New output formats are added here, the callback only calls the selected entry.
+/// </summary>
+class iqConvert
+{
+public:
+	static void init();
+	static const char* getKernelName() { return kernelName; }
+
+	// The converter for a format and mode, never 0
+	static const iqConverterEntry* select(eBitWidth bitWidth, bool adsbMode);
+
+	static void interleave16_sse2(const short* idata, const short* qdata, int numSamples, BYTE* out);
+	static void interleave16_avx2(const short* idata, const short* qdata, int numSamples, BYTE* out);
+	static void requant8_sse2(const short* idata, const short* qdata, int numSamples, BYTE* out);
+	static void requant8_avx2(const short* idata, const short* qdata, int numSamples, BYTE* out);
+	static void requant8Adsb_sse2(const short* idata, const short* qdata, int numSamples, BYTE* out);
+	static void requant8Adsb_avx2(const short* idata, const short* qdata, int numSamples, BYTE* out);
+	static void pack4_sse2(const short* idata, const short* qdata, int numSamples, BYTE* out);
+	static void pack4_avx2(const short* idata, const short* qdata, int numSamples, BYTE* out);
+	static void bfp_sse2(const short* idata, const short* qdata, int numSamples, BYTE* out);
+	static void pack12_sse2(const short* idata, const short* qdata, int numSamples, BYTE* out);
+	static void float32_sse2(const short* idata, const short* qdata, int numSamples, BYTE* out);
+	static void float32_avx2(const short* idata, const short* qdata, int numSamples, BYTE* out);
+
+	static void interleave16_neon(const short* idata, const short* qdata, int numSamples, BYTE* out);
+	static void requant8_neon(const short* idata, const short* qdata, int numSamples, BYTE* out);
+	static void requant8Adsb_neon(const short* idata, const short* qdata, int numSamples, BYTE* out);
+	static void pack4_neon(const short* idata, const short* qdata, int numSamples, BYTE* out);
+	static void bfp_neon(const short* idata, const short* qdata, int numSamples, BYTE* out);
+	static void pack12_neon(const short* idata, const short* qdata, int numSamples, BYTE* out);
+	static void float32_neon(const short* idata, const short* qdata, int numSamples, BYTE* out);
+
+	// Exhaustive comparison of the installed kernels with the scalar ones, -b verify.
+	// Returns the number of kernels which differ
+	static int verifyKernels();
+
+	// CPU features, also used by the other vectorized stages
+	static bool hasSse2();
+	static bool hasAvx2();
+
+private:
+	template <bool LittleEndianHost>
+	static void fillScalar();
+	static void setKernel(eBitWidth bitWidth, bool adsbMode, interleaveFn kernel, const char* name);
+	static bool verify(interleaveFn kernel, interleaveFn reference, int bytesPerSample, const char* name, int numValues);
+	// sample values compared when a kernel is installed, and by verifyKernels
+	static const int c_quickValues = 1024;
+	static const int c_allValues = 0x10000;
+
+	// [format][adsbMode]
+	static iqConverterEntry converters[NUM_BIT_WIDTHS][2];
+	static iqConverterEntry references[NUM_BIT_WIDTHS][2];
+	static const char* kernelName;
+};
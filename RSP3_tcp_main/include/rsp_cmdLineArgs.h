@@ -21,6 +21,7 @@
 #pragma once
 #include <map>
 #include <string>
+#include <vector>
 #include "IPAddress.h"
 using namespace std;
 
@@ -35,6 +36,9 @@ private:
 	int intValue(int index, string error, int minval, int maxval);
 	string stringValue(int index, string error, int minlen, int maxlen);
 	IPAddress* ipAddValue(int index, string error);
+	int parseChannels(const string& list);
+	int parseSpectrum(const string& settings);
+	int parseUdp(const string& settings);
 
 public:
 	IPAddress  Address{ 127,0,0,1 };
@@ -55,6 +59,69 @@ public:
 	int Antenna = 5; 
 	int requestedDeviceIndex = 0;
 
+	// Transmit batching: a gather send is issued at the latest when this many bytes are collected,
+	// or when the oldest collected block waited MaxSendLatencyUs for more blocks
+	int MaxSendBytes = 262144;
+	int MaxSendLatencyUs = 0;
+
+	// Bound of the queue to the transmit side, and what to drop if it is reached.
+	// 0: drop newest, 1: drop oldest, 2: block the callback (the API drops then)
+	int MaxQueueBytes = 33554432;
+	int OverloadPolicy = 0;
+
+	// Linux: transmit with MSG_ZEROCOPY
+	bool ZeroCopy = false;
+
+	// Clients sharing the device. The one connecting from ControlAddress has the tuning authority,
+	// without ControlAddress the first client has it
+	int MaxClients = 4;
+	string ControlAddress;
+
+	// Channelizer: number of bins (0: off) and the bins served, each on its own port
+	int ChannelizerBins = 0;
+	vector<int> Channels;
+	static const int c_channelPortOffset = 10;
+	int channelPort(int bin) const { return Port + c_channelPortOffset + bin; }
+
+	// Software DC offset and IQ imbalance correction, after the one of the hardware
+	bool IqCorrection = false;
+
+	// Adaptive gain in front of the 8 bit requantization
+	bool AutoScale8 = false;
+
+	// Requantization to 8 and 4 bit, see eRequantMode: 0 truncation, 1 dither,
+	// 2 and 3 dither with first and second order noise shaping
+	int Requantization = 0;
+
+	// Framed stream: a header in front of each block, see StreamFrame.h
+	bool Framed = false;
+
+	// Spectrum port: FFT size (0: off), overlap of the FFTs in percent, FFTs averaged per frame,
+	// frames per second
+	int SpectrumSize = 0;
+	int SpectrumOverlap = 50;
+	int SpectrumAverages = 4;
+	int SpectrumRate = 10;
+	static const int c_spectrumPortOffset = 2;
+	int spectrumPort() const { return Port + c_spectrumPortOffset; }
+
+	// UDP transport of the full stream (UdpPort 0: off): destination, unicast or multicast,
+	// largest datagram, pacing in percent of the output rate (0: off).
+	// The clients of the data port then only send commands
+	string UdpAddress;
+	int UdpPort = 0;
+	int UdpMtu = 1500;
+	int UdpPacing = 0;
+	static const int c_minPacing = 100;
+	static const int c_maxPacing = 400;
+
+	// Shared memory ring for local clients, size in MB, 0: off. See ShmRing.h
+	int ShmMBytes = 0;
+
+	// Name of a benchmark to run instead of the server, see benchmark.cpp, and its input if it takes one
+	string Benchmark;
+	string BenchmarkInput;
+
 	rsp_cmdLineArgs(int argc, char** argv);
 	int parse();
 	virtual ~rsp_cmdLineArgs();
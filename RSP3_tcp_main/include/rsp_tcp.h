@@ -22,7 +22,12 @@
 #include <string>
 #include "sdrplay_api.h"
 
-enum eBitWidth { BITS_4= 0, BITS_8 = 1, BITS_16 = 2 };
+// BITS_BFP: block floating point, 8 bit mantissas with an exponent per 16 samples, see iqConvert.h
+// BITS_LOSSLESS: 16 bit, compressed by the LosslessEncoder stage, see LosslessCodec.h.
+// BITS_12: the unsigned 12 bit ADC values, an I/Q pair packed into 3 bytes, see iqConvert.h
+// BITS_CF32: complex float, scaled by the current gain, see iqFloatScale
+enum eBitWidth { BITS_4= 0, BITS_8 = 1, BITS_16 = 2, BITS_BFP = 3, BITS_LOSSLESS = 4, BITS_12 = 5, BITS_CF32 = 6 };
+const int NUM_BIT_WIDTHS = 7;
 enum eErrors
 {
 	 E_OK = 0
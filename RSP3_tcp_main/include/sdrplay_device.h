@@ -19,13 +19,26 @@
 **/
 
 #pragma once
-#include <pthread.h>
 #include "rsp_tcp.h"
 #include "common.h"
 #include "IPAddress.h"
 #include "rsp_cmdLineArgs.h"
 //#define HAVE_STRUCT_TIMESPEC
-#include "SafeQueue.h"
+#include "SpscQueue.h"
+#include "MemBlockPool.h"
+#include "TxQueue.h"
+#include "BroadcastRing.h"
+#include "iqConvert.h"
+#include "Decimator.h"
+#include "Resampler.h"
+#include "Channelizer.h"
+#include "SpectrumWorker.h"
+#include "IqCorrector.h"
+#include "AutoScaler.h"
+#include "Requantizer.h"
+#include "LosslessCodec.h"
+#include "StreamFrame.h"
+#include "Reactor.h"
 #ifdef _WIN32
 #define sleep(n) Sleep(n*1000)
 #define usleep(n) Sleep(n/1000)
@@ -66,35 +79,9 @@ enum eNotch
 	, NOTCH_DAB = 3
 };
 
-struct MemBlock
-{
-	BYTE* Mem;
-	int length;
-	int numSamples;
-	bool exitMsg;
-
-	MemBlock(BYTE* buf, int buflen, int numsmp) : 
-		Mem(buf), 
-		length(buflen),
-		numSamples(numsmp),
-		exitMsg(false)
-	{
-	}
-
-	~MemBlock()
-	{
-		if (exitMsg)
-			return;
-		delete[] Mem;
-	}
-};
-
 static bool VERBOSE = true;
 const int MAX_TUNERS = 2;
 
-void* receive(void* md);
-void* sendStream(void* md);
-
 void streamACallback(short *xi, short *xq, sdrplay_api_StreamCbParamsT *params,
 	unsigned int numSamples, unsigned int reset, void *cbContext);
 
@@ -121,16 +108,42 @@ struct samplingConfiguration
 	}
 };
 
-typedef struct
+// Rate conversion in software behind a table rate: decimation, then resampling by up / down
+struct softResampling
+{
+	int decimation = 1;
+	int up = 1;
+	int down = 1;
+
+	bool isActive() const { return decimation > 1 || up != down; }
+	// output rate / callback rate
+	double ratio() const { return (double)up / ((double)decimation * down); }
+};
+
+#define TX_BUF_LEN (1024) //tbd
+
+class sdrplay_device;
+// Prepares the indications due for the current state into tx, returns their length or 0
+int buildIndications(sdrplay_device* dev, BYTE* tx);
+
+class StreamClient;
+
+/// <summary>
+/// One served bin of the channelizer, transported like the full stream:
+/// its own tx queue from the callback and its own ring for the clients of its port
+/// </summary>
+struct channelOutput
 {
-	void *dev;
-	int port;
-	int wait;
-	const char *addr;
-	bool* pDoExit;
-}
-ctrl_thread_data_t;
-void *ctrl_thread_fn(void *arg);
+	const int bin;
+	TxQueue queue;
+	BroadcastRing ring;
+	unsigned int nextSampleNum = 0;	// counted at the channel rate, for MemBlock::firstSampleNum
+	iqGroupCarry carry;
+	frameCounter frames;	// callback
+	StreamFramer framer;	// event loop
+
+	channelOutput(int b, int maxBlocks) : bin(b), queue(maxBlocks), ring(maxBlocks) {}
+};
 
 class sdrplay_device
 {
@@ -143,14 +156,10 @@ private:
 	sdrplay_device() {}
 
 	int getSamplingConfigurationTableIndex(int requestedSrHz);
-	void writeWelcomeString() const;
-	void cleanup();
+	int getSamplingConfiguration(int requestedSrHz, softResampling& soft);
 	sdrplay_api_DeviceT* pDevice=0;
 	rsp_cmdLineArgs* pargs=0;
 
-	friend void* receive(void* p);
-	friend void* sendStream(void* p);
-
 	friend void streamACallback(short* xi, short* xq, sdrplay_api_StreamCbParamsT* params,
 		unsigned int numSamples, unsigned int reset, void *cbContext);
 
@@ -166,16 +175,23 @@ private:
 
 public:
 	eCommState CommState = ST_IDLE;
-	pthread_mutex_t mutex_rxThreadStarted;
-	pthread_cond_t started_cond = PTHREAD_COND_INITIALIZER;
-	pthread_t* thrdRx = 0;
-	pthread_t* thrdTx = 0;
-	pthread_t* thrdCtrl = 0;
-	ctrl_thread_data_t ctrlThreadData;
-	bool ctrlThreadExitFlag = false;
-
-	SafeQueue<MemBlock*> SafeQ;
-	bool doExitTxThread = false;
+
+	// Transport between the stream callback (producer) and the event loop (consumer),
+	// bounded in bytes, see rsp_cmdLineArgs::MaxQueueBytes
+	TxQueue SafeQ{ c_txQueueCapacity };
+	// Recycled sample buffers, large enough to hold all blocks the tx queue can hold
+	MemBlockPool Pool{ c_txQueueCapacity };
+	// The blocks of the tx queue, read by all clients, bounded by MaxQueueBytes as well
+	BroadcastRing Ring{ c_txQueueCapacity };
+	// The channels of the channelizer, see rsp_cmdLineArgs::Channels
+	std::vector<channelOutput*> Channels;
+	// channel -1 is the full stream
+	BroadcastRing& getRing(int channel) { return channel < 0 ? Ring : Channels[channel]->ring; }
+	// Power spectrum of the full band for the spectrum port, see rsp_cmdLineArgs::SpectrumSize
+	SpectrumWorker Spectrum;
+	// The client with the tuning authority, its drops are reported in the indications
+	const StreamClient* Controller = 0;
+	bool doExitTxThread = false;	// the session ends, the callback stops queueing
 	bool basicMode = false;
 	/// <summary>
 	/// Current values, to be sent to the host
@@ -198,26 +214,31 @@ public:
 
 	int RequestedGain; // the gain requested from the user, NOT the gain reduction used by the RSP
 	bool started = false;
-	//The socket of the remote app
-	SOCKET remoteClient;
 	eRxType rxType= RSP1; // 0
 	bool dxHDRmode = false;
 
 	DWORD _oldNumSamples;
 	DWORD _oldExpectedFirstSampleNum;
 	DWORD _expectedFirstSampleNum;
+	bool _firstSampleNumValid = false;	// false until the first callback after sdrplay_api_Init
 
 	bool DeviceSelected = false;
 	bool Initialized = false;
 
-	//Callbacks per second, for a "timer" to discard samples 
-	//to prevent overrun in the device in the error case
-	int cbksPerSecond = 0;
-	bool cbkTimerStarted = false;
 	double currentSamplingRateHz;
 
 	const int c_welcomeMessageLength = 100;
 
+	// Blocks in the tx queue. At 10Msps this is far more than a second of samples
+	static const int c_txQueueCapacity = 16384;
+	// Blocks in the queue of a channel, at most half the rate of the full stream
+	static const int c_channelQueueCapacity = 4096;
+	// Samples lost before the callback, detected from gaps in firstSampleNum
+	std::atomic<uint64_t> deviceLostSamples{ 0 };
+	// Pool sizing: expected samples per callback, and the queueing time to preallocate for
+	static const int c_nominalSamplesPerCallback = 2016;
+	static const int c_poolPreallocMs = 250;
+
 private:
 	sdrplay_api_DeviceT* sdrplayDevices;
 	uint32_t* serialCRCs;
@@ -229,9 +250,15 @@ private:
 	void selectChannel(sdrplay_api_TunerSelectT tunerId);
 	void emptyQ();
 
-	BYTE* mergeIQ(const short* idata, const short* qdata, int samplesPerPacket, int& buflen, int startIx);
+	int bytesPerSample() const;
+	void preparePool(int srTableIx);
+	void selectConverter();
 	sdrplay_api_ErrT createChannels();
-	sdrplay_api_ErrT createChannels(int srTableIx);
+	sdrplay_api_ErrT createChannels(int srTableIx, const softResampling& soft = softResampling());
+	bool configureSoftResampling(const softResampling& soft);
+	void configureOffsetTuning();
+	bool isValidOffset(int offsetHz) const;
+	sdrplay_api_Bw_MHzT channelBandwidth() const;
 	sdrplay_api_ErrT setFrequency(int valueHz);
 	sdrplay_api_ErrT setFrequencyCorrection(int value);
 	sdrplay_api_ErrT setFrequencyCorrection100(int value);
@@ -243,6 +270,7 @@ private:
 	sdrplay_api_ErrT setAGC(bool on);
 	sdrplay_api_ErrT setGain(int value);
 	sdrplay_api_ErrT setSamplingRate(int requestedSrHz);
+	sdrplay_api_ErrT setOffsetTuning(int offsetHz);
 	sdrplay_api_ErrT stream_Uninit();
 	sdrplay_api_ErrT setAdsbMode(srADSB sr);
 	sdrplay_api_ErrT setRSPduoHiZ(int value);
@@ -259,7 +287,7 @@ private:
 		, CMD_SET_IF_GAIN = 6                 //int stage, int gain
 		, CMD_SET_AGC_MODE = 8                //int on
 		, CMD_SET_DIRECT_SAMPLING = 9         //int on
-		, CMD_SET_OFFSET_TUNING = 10          //int on
+		, CMD_SET_OFFSET_TUNING = 10          //int on, rtl_tcp tuner option: ignored, see CMD_SET_RSP_DDC_OFFSET
 		, CMD_SET_TUNER_GAIN_BY_INDEX = 13
 		, CMD_SET_BIAS_T = 14				  //int on
 		, CMD_SET_RSP2_ANTENNA_CONTROL = 33   //int Antenna Select
@@ -278,7 +306,11 @@ private:
 												//	, NOTCH_AM = 2
 												//	, NOTCH_DAB = 3
 												//};
-
+		, CMD_SET_RSP_TCP_SAMPLES = 0x85      // 1/0: samples on this data port connection on/off, handled by
+											  // StreamClient for each client, e.g. off for a reader of the shared memory
+		, CMD_SET_RSP_DDC_OFFSET = 0x86       // int offset (Hz) of the down converted channel from the tuner
+											  // frequency, 0: off. Needs software decimation, i.e. a sampling rate
+											  // below the one of the table entry used
 	};
 
 	// This server is able to stream native 16-bit data (of "short" type)
@@ -288,8 +320,8 @@ private:
 
 	// Reasonable number of possible bandwidth/sampling rate combinations
 	//samplingConfiguration(int srHz, int devSrHz, sdrplay_api_Bw_MHzT bw, int decimFact, bool doDecim)
-		const int c_numSamplingConfigs = 11;
-		samplingConfiguration samplingConfigs[11] = {
+		const int c_numSamplingConfigs = 12;
+		samplingConfiguration samplingConfigs[12] = {
 		samplingConfiguration(512000, 2048000,  sdrplay_api_BW_0_300, 4, true),
 		samplingConfiguration(1024000, 2048000, sdrplay_api_BW_0_600, 2, true),
 		samplingConfiguration(2048000, 2048000, sdrplay_api_BW_1_536, 1, false),
@@ -300,7 +332,8 @@ private:
 		samplingConfiguration(2400000, 2400000, sdrplay_api_BW_1_536, 1, false),
 		samplingConfiguration(2500000, 2500000, sdrplay_api_BW_1_536, 1, false),
 		samplingConfiguration(2000000, 8000000, sdrplay_api_BW_5_000, 4, true),
-		samplingConfiguration(8000000, 8000000, sdrplay_api_BW_5_000, 1, false)
+		samplingConfiguration(8000000, 8000000, sdrplay_api_BW_5_000, 1, false),
+		samplingConfiguration(6000000, 6000000, sdrplay_api_BW_5_000, 1, false)
 	};
 
 
@@ -318,11 +351,47 @@ private:
 
 	bool _rspDuoHiZ = false;
 	bool _isAdsbMode = false;
+	// Output converter for bitWidth and _isAdsbMode, read by the callback
+	std::atomic<const iqConverterEntry*> converter{ 0 };
+	// samples of an incomplete group of the block floating point format, callback only
+	iqGroupCarry carry;
+	// framed mode: bytes reserved in front of each block, 0 if off. The callback numbers the
+	// samples, the event loop writes the headers when it moves the blocks into the ring
+	int frameHeaderLength = 0;
+	frameCounter frames;
+	StreamFramer framer;
+	// BITS_LOSSLESS: compresses the 16 bit blocks of the callback on its own thread,
+	// then queues them to SafeQ
+	LosslessEncoder lossless{ c_txQueueCapacity };
+	// Software rate conversion for rates not in the table, see getSamplingConfiguration
+	// DC and IQ imbalance correction of the full band, the first stage
+	IqCorrector iqCorrector;
+	Decimator decimator;
+	// gain in front of the 8 bit requantization, the last stage
+	AutoScaler scaler;
+	// dither and noise shaping for the 8 and 4 bit formats, after the scaler
+	Requantizer requantizer;
+	Resampler resampler;
+	// Digital down conversion: the channel at offsetTuningHz from the tuner frequency is
+	// shifted to DC by the NCO, then decimated. Retuning within the band only changes the NCO
+	Nco nco;
+	int offsetTuningHz = 0;
+	// Splits the full stream into the Channels, before the rate conversion
+	Channelizer channelizer;
+	void channelize(const short* xi, const short* xq, int numSamples, const iqConverterEntry* conv);
+	void reportChannels(int rateHz) const;
+	bool fillRing(TxQueue& q, BroadcastRing& ring, StreamFramer& framer);
+	// the configuration streamed, set in createChannels
+	int currentConfigIx = -1;
+	softResampling currentSoft;
 	bool _reportDabNotchControlError = true;
 	bool _reportRfNotchControlError = true;
 	
 	sdrplay_api_RxChannelParamsT* pCurCh;
 
+	// The event loop, woken up by the callback
+	Reactor* reactor = 0;
+
 
 public:
 	sdrplay_api_DeviceT* getDevice()
@@ -337,6 +406,14 @@ public:
 	{
 		_frequencyAfterCbkChange = freq;
 	}
+	const IqCorrector& getIqCorrector() const
+	{
+		return iqCorrector;
+	}
+	const AutoScaler& getScaler() const
+	{
+		return scaler;
+	}
 	int getFreqAfterCbkChange()
 	{
 		return _frequencyAfterCbkChange;
@@ -344,15 +421,31 @@ public:
 	//bool collectDevices();	// called from the controlThread, on clients request
 	int prepareSerialsList(BYTE* buf);
 	void init(rsp_cmdLineArgs* pargs);
-	void start(SOCKET client);
+	// The session, from the first client connected until the last one left.
+	// Driven by the event loop of devices
+	bool start(Reactor* r);
 	void stop();
-	void createCtrlThread(const char* addr, int port);
+	// Sent to each client on connect
+	// channel: the channelizer output the client gets, -1 the full stream
+	void writeWelcomeString(SOCKET s, int channel = -1) const;
+	// Executes one command of the client with the tuning authority
+	void processCommand(const BYTE* rxBuf);
+	// Moves the blocks queued by the callback into the rings, of the full stream and the channels.
+	// Returns true if blocks are left in a queue because its ring is full in OVL_BLOCK mode
+	bool fillRing();
 	sdrplay_api_GainValuesT* getGainValues();
 	int getLNAState();
 	bool getBiasTState();
 	int getRxString(char* s ) const;
 	int getExportedRxType() const { return rxType + 7 ; }
 	int getBitWidth() const { return bitWidth; }
+	double getSamplingRateHz() const { return currentSamplingRateHz; }
+	const iqConverterEntry* getConverter() const { return converter.load(std::memory_order_acquire); }
+	// Samples not transmitted to the controlling client because of a full tx queue
+	// or because it fell behind the ring, since the session started
+	uint64_t getDroppedSamples() const;
+	// Samples the API did not deliver, since the client connected
+	uint64_t getDeviceLostSamples() const { return deviceLostSamples.load(); }
 	int deviceCount() const { return numDevices; }
 	bool releaseDevice()
 	{
@@ -0,0 +1,120 @@
+/**
+** RSP3_tcp - TCP/IP I/Q Data Server for the sdrplay RSP devices
+** Copyright (C) 2017-2024 Clem Schmidt, softsyst, http://qirx.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#include <math.h>
+#include <stdlib.h>
+#include "AutoScaler.h"
+#include "Decimator.h"
+
+AutoScaler::AutoScaler()
+{
+}
+
+void AutoScaler::process(const short* xi, const short* xq, int numSamples, const short*& outI, const short*& outQ)
+{
+	if ((int)outBufI.size() < numSamples)
+	{
+		outBufI.resize(numSamples);
+		outBufQ.resize(numSamples);
+	}
+	outI = &outBufI[0];
+	outQ = &outBufQ[0];
+	if (numSamples == 0)
+		return;
+
+	// block power and peak, 8 lanes
+	float sum[8] = { 0 };
+	int maxAbs[8] = { 0 };
+	int n8 = numSamples & ~7;
+	for (int i = 0; i < n8; i += 8)
+	{
+		for (int j = 0; j < 8; j++)
+		{
+			int a = xi[i + j];
+			int b = xq[i + j];
+			sum[j] += (float)a * a + (float)b * b;
+			int m = abs(a) > abs(b) ? abs(a) : abs(b);
+			maxAbs[j] = m > maxAbs[j] ? m : maxAbs[j];
+		}
+	}
+	for (int i = n8; i < numSamples; i++)
+	{
+		int a = xi[i];
+		int b = xq[i];
+		sum[0] += (float)a * a + (float)b * b;
+		int m = abs(a) > abs(b) ? abs(a) : abs(b);
+		maxAbs[0] = m > maxAbs[0] ? m : maxAbs[0];
+	}
+	double blockPower = 0;
+	int blockPeak = 0;
+	for (int j = 0; j < 8; j++)
+	{
+		blockPower += sum[j];
+		if (maxAbs[j] > blockPeak)
+			blockPeak = maxAbs[j];
+	}
+	blockPower /= 2.0 * numSamples;
+
+	double blockMs = numSamples * 1000.0 / rateHz;
+	bool start = first;
+	first = false;
+	if (start)
+	{
+		power = blockPower;
+		peak = blockPeak;
+	}
+	else
+	{
+		double a = blockMs / c_rmsTimeConstantMs;
+		power += (a > 1 ? 1 : a) * (blockPower - power);
+		peak *= exp(-blockMs / c_peakTimeConstantMs);
+		if (blockPeak > peak)
+			peak = blockPeak;
+	}
+
+	// weak signals are raised to the target RMS, strong ones only reduced if their peaks need it
+	double maxGain = pow(10.0, c_maxGainDb / 20.0);
+	double minGain = pow(10.0, c_minGainDb / 20.0);
+	double target = maxGain;
+	if (power > 0)
+		target = c_targetRms / sqrt(power);
+	if (target < 1)
+		target = 1;
+	if (peak > 0 && target * peak > c_peakLimit)
+		target = c_peakLimit / peak;
+	double maxUp = gain * pow(10.0, c_releaseDbPerSec * blockMs / 20000.0);
+	if (!start && target > maxUp)
+		target = maxUp;
+	target = target < minGain ? minGain : target > maxGain ? maxGain : target;
+
+	// a reduction applies to the whole block, an increase ramps
+	float g = (float)(target < gain ? target : gain);
+	float step = (float)((target - g) / numSamples);
+	short* oI = &outBufI[0];
+	short* oQ = &outBufQ[0];
+	for (int i = 0; i < numSamples; i++)
+	{
+		float gi = g + step * (i + 1);
+		oI[i] = Decimator::toShort(xi[i] * gi);
+		oQ[i] = Decimator::toShort(xq[i] * gi);
+	}
+	gain = target;
+	gainDb.store((float)(20 * log10(gain)), std::memory_order_relaxed);
+}
@@ -0,0 +1,94 @@
+/**
+** RSP3_tcp - TCP/IP I/Q Data Server for the sdrplay RSP devices
+** Copyright (C) 2017-2024 Clem Schmidt, softsyst, http://qirx.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#include "BroadcastRing.h"
+#include <iostream>
+using namespace std;
+
+BroadcastRing::BroadcastRing(int maxBlocks)
+{
+	slot empty = { 0, 0 };
+	slots.assign(maxBlocks, empty);
+	maxBytes = (int64_t)1 << 62;
+}
+
+BroadcastRing::~BroadcastRing()
+{
+	// the pool may be gone already, clear(pool) must have been called
+	for (uint64_t seq = tail; seq < head; seq++)
+		delete at(seq);
+}
+
+void BroadcastRing::configure(int64_t maxBytes)
+{
+	this->maxBytes = maxBytes;
+	std::cout << "Broadcast ring: max " << maxBytes << " bytes, " << slots.size() << " blocks" << endl;
+}
+
+bool BroadcastRing::full(int blockBytes) const
+{
+	// an empty ring always takes a block, whatever its size
+	if (head == tail)
+		return false;
+	return head - tail >= slots.size() || bytes + blockBytes > maxBytes;
+}
+
+int BroadcastRing::push(MemBlock* mb, MemBlockPool& pool)
+{
+	int n = 0;
+	while (full(mb->length))
+	{
+		releaseBefore(tail + 1, pool);
+		n++;
+	}
+	evicted += n;
+	slot& s = slots[head % slots.size()];
+	s.mb = mb;
+	s.firstSample = nextSample;
+	nextSample += mb->numSamples;
+	bytes += mb->length;
+	head++;
+	return n;
+}
+
+uint64_t BroadcastRing::sampleAt(uint64_t seq) const
+{
+	if (seq >= head)
+		return nextSample;
+	return slots[seq % slots.size()].firstSample;
+}
+
+void BroadcastRing::releaseBefore(uint64_t seq, MemBlockPool& pool)
+{
+	if (seq > head)
+		seq = head;
+	for (; tail < seq; tail++)
+	{
+		slot& s = slots[tail % slots.size()];
+		bytes -= s.mb->length;
+		pool.release(s.mb);
+		s.mb = 0;
+	}
+}
+
+void BroadcastRing::clear(MemBlockPool& pool)
+{
+	releaseBefore(head, pool);
+}
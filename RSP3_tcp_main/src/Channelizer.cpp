@@ -0,0 +1,196 @@
+/**
+** RSP3_tcp - TCP/IP I/Q Data Server for the sdrplay RSP devices
+** Copyright (C) 2017-2024 Clem Schmidt, softsyst, http://qirx.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#include "Channelizer.h"
+#include "Decimator.h"
+#include <algorithm>
+#include <iostream>
+using namespace std;
+
+Channelizer::Channelizer()
+{
+}
+
+Channelizer::~Channelizer()
+{
+	delete fft;
+}
+
+double Channelizer::binOffsetHz(int bin, int numBins, double rateHz)
+{
+	int k = bin < numBins / 2 ? bin : bin - numBins;
+	return k * rateHz / numBins;
+}
+
+bool Channelizer::configure(int n, const std::vector<int>& served)
+{
+	numBins = 0;
+	delete fft;
+	fft = 0;
+	bins.clear();
+	if (n == 0)
+		return true;
+	if (!Fft::isPowerOfTwo(n) || n < c_minBins || n > c_maxBins)
+	{
+		std::cout << "*** Channelizer: " << n << " bins, must be a power of two from " << c_minBins
+			<< " to " << c_maxBins << endl;
+		return false;
+	}
+	for (size_t i = 0; i < served.size(); i++)
+	{
+		if (served[i] < 0 || served[i] >= n)
+		{
+			std::cout << "*** Channelizer: bin " << served[i] << " out of range 0.." << n - 1 << endl;
+			return false;
+		}
+	}
+	numBins = n;
+	bins = served;
+
+	// cycles per input sample: passband edge half the spacing, stopband edge the spacing,
+	// which is the Nyquist frequency of the channel rate
+	double spacing = 1.0 / numBins;
+	int minTaps = Decimator::kaiserTaps(0.5 * spacing);
+	numBranchTaps = (minTaps + numBins - 1) / numBins;
+	numTaps = numBins * numBranchTaps;
+	std::vector<float> h;
+	Decimator::designLowpass(numTaps, 0.75 * spacing, h);
+	taps.resize(numTaps);
+	for (int i = 0; i < numTaps; i++)
+		taps[i] = h[numTaps - 1 - i];
+
+	fft = new Fft(numBins);
+	foldI.resize(numBins);
+	foldQ.resize(numBins);
+	re.resize(numBins);
+	im.resize(numBins);
+	outI.resize(bins.size());
+	outQ.resize(bins.size());
+	bufI.assign(numTaps - 1 + c_chunk, 0.0f);
+	bufQ.assign(numTaps - 1 + c_chunk, 0.0f);
+	reserve(c_chunk);
+	reset();
+	std::cout << "Channelizer: " << numBins << " bins, " << numBranchTaps << " taps per branch, "
+		<< bins.size() << " served" << endl;
+	return true;
+}
+
+void Channelizer::reserve(int numSamples)
+{
+	int maxOut = numSamples / getDecimation() + 2;
+	for (size_t c = 0; c < bins.size(); c++)
+	{
+		if ((int)outI[c].size() < maxOut)
+		{
+			outI[c].resize(maxOut);
+			outQ[c].resize(maxOut);
+		}
+	}
+}
+
+void Channelizer::reset()
+{
+	std::fill(bufI.begin(), bufI.end(), 0.0f);
+	std::fill(bufQ.begin(), bufQ.end(), 0.0f);
+	pos = numTaps - 1;
+	oddOutput = false;
+}
+
+int Channelizer::process(const short* xi, const short* xq, int numSamples)
+{
+	if (bins.empty())
+		return 0;
+	// only if the callback delivers more than ever before
+	if ((int)outI[0].size() < numSamples / getDecimation() + 2)
+		reserve(numSamples);
+	int decimation = getDecimation();
+	int hist = numTaps - 1;
+	int total = 0;
+	for (int done = 0; done < numSamples; )
+	{
+		int n = numSamples - done;
+		if (n > c_chunk)
+			n = c_chunk;
+		for (int i = 0; i < n; i++)
+		{
+			bufI[hist + i] = xi[done + i];
+			bufQ[hist + i] = xq[done + i];
+		}
+		done += n;
+		int numBuf = hist + n;
+		while (pos < numBuf)
+		{
+			// fold[r] = sum over the branches of taps[r + p * numBins] * window[r + p * numBins]
+			// local sums, not aliased by the inputs, so the compiler vectorizes the loop over r
+			const float* wI = &bufI[pos - hist];
+			const float* wQ = &bufQ[pos - hist];
+			float sumI[c_maxBins];
+			float sumQ[c_maxBins];
+			for (int r = 0; r < numBins; r++)
+			{
+				sumI[r] = 0;
+				sumQ[r] = 0;
+			}
+			for (int p = 0; p < numTaps; p += numBins)
+			{
+				const float* t = &taps[p];
+				const float* a = wI + p;
+				const float* b = wQ + p;
+				for (int r = 0; r < numBins; r++)
+				{
+					sumI[r] += t[r] * a[r];
+					sumQ[r] += t[r] * b[r];
+				}
+			}
+			// branch k holds the input k samples before the newest one
+			for (int k = 0; k < numBins; k++)
+			{
+				re[k] = sumI[numBins - 1 - k];
+				im[k] = sumQ[numBins - 1 - k];
+			}
+			fft->transform(&re[0], &im[0], true);
+			for (size_t c = 0; c < bins.size(); c++)
+			{
+				int k = bins[c];
+				float vi = re[k];
+				float vq = im[k];
+				// the decimation by numBins / 2 leaves the phase e^(-j pi k m) per output m
+				if (oddOutput && (k & 1))
+				{
+					vi = -vi;
+					vq = -vq;
+				}
+				outI[c][total] = Decimator::toShort(vi);
+				outQ[c][total] = Decimator::toShort(vq);
+			}
+			total++;
+			oddOutput = !oddOutput;
+			pos += decimation;
+		}
+		// the newest samples become the history of the next chunk
+		for (int i = 0; i < hist; i++)
+		{
+			bufI[i] = bufI[n + i];
+			bufQ[i] = bufQ[n + i];
+		}
+		pos -= n;
+	}
+	return total;
+}
@@ -0,0 +1,493 @@
+/**
+** RSP3_tcp - TCP/IP I/Q Data Server for the sdrplay RSP devices
+** Copyright (C) 2017-2024 Clem Schmidt, softsyst, http://qirx.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#include "Decimator.h"
+#include <math.h>
+#include <iostream>
+using namespace std;
+
+dotFn Decimator::dot = Decimator::dot_scalar;
+const char* Decimator::kernelName = "scalar";
+
+static int roundUp8(int n)
+{
+	return (n + 7) & ~7;
+}
+
+DecimatorStage::DecimatorStage(int factor, bool halfband, const std::vector<float>& h) :
+	factor(factor),
+	halfband(halfband),
+	numTaps((int)h.size())
+{
+	// window element i, the newest sample last, gets tap padded - 1 - i
+	if (halfband)
+	{
+		// the taps of the A phase are the even ones, tap 2m applies to A[q - m]
+		int k = (numTaps + 1) / 4;
+		int padded = roundUp8(2 * k);
+		taps.assign(padded, 0.0f);
+		for (int i = 0; i < padded; i++)
+		{
+			int m = padded - 1 - i;
+			if (m < 2 * k)
+				taps[i] = h[2 * m];
+		}
+		center = h[2 * k - 1];
+		centerDelay = k;
+		hist = padded - 1;
+	}
+	else
+	{
+		int padded = roundUp8(numTaps);
+		taps.assign(padded, 0.0f);
+		for (int i = 0; i < padded; i++)
+		{
+			int j = padded - 1 - i;
+			if (j < numTaps)
+				taps[i] = h[j];
+		}
+		hist = padded - 1;
+	}
+	reset();
+}
+
+void DecimatorStage::reset()
+{
+	numBuf = numBufB = hist;
+	bufI.assign(hist, 0.0f);
+	bufQ.assign(hist, 0.0f);
+	bufBI.assign(halfband ? hist : 0, 0.0f);
+	bufBQ.assign(halfband ? hist : 0, 0.0f);
+	skip = 0;
+	nextIsA = true;
+}
+
+int DecimatorStage::process(const float* inI, const float* inQ, int n, float* outI, float* outQ, dotFn dot)
+{
+	int numOut = 0;
+	if (halfband)
+	{
+		int maxA = numBuf + n / 2 + 1;
+		if ((int)bufI.size() < maxA)
+		{
+			bufI.resize(maxA);
+			bufQ.resize(maxA);
+			bufBI.resize(maxA);
+			bufBQ.resize(maxA);
+		}
+		int firstNew = numBuf;
+		for (int i = 0; i < n; i++)
+		{
+			if (nextIsA)
+			{
+				bufI[numBuf] = inI[i];
+				bufQ[numBuf++] = inQ[i];
+			}
+			else
+			{
+				bufBI[numBufB] = inI[i];
+				bufBQ[numBufB++] = inQ[i];
+			}
+			nextIsA = !nextIsA;
+		}
+		int len = (int)taps.size();
+		for (int q = firstNew; q < numBuf; q++)
+		{
+			float yi, yq;
+			dot(&bufI[q - len + 1], &bufQ[q - len + 1], &taps[0], len, yi, yq);
+			outI[numOut] = yi + center * bufBI[q - centerDelay];
+			outQ[numOut++] = yq + center * bufBQ[q - centerDelay];
+		}
+		// keep the history, A and B stay aligned pairwise
+		int shift = numBuf - hist;
+		memmove(&bufI[0], &bufI[shift], hist * sizeof(float));
+		memmove(&bufQ[0], &bufQ[shift], hist * sizeof(float));
+		memmove(&bufBI[0], &bufBI[shift], (numBufB - shift) * sizeof(float));
+		memmove(&bufBQ[0], &bufBQ[shift], (numBufB - shift) * sizeof(float));
+		numBuf = hist;
+		numBufB -= shift;
+	}
+	else
+	{
+		int total = numBuf + n;
+		if ((int)bufI.size() < total)
+		{
+			bufI.resize(total);
+			bufQ.resize(total);
+		}
+		memcpy(&bufI[numBuf], inI, n * sizeof(float));
+		memcpy(&bufQ[numBuf], inQ, n * sizeof(float));
+		int len = (int)taps.size();
+		// e: index of the newest sample of the window of the next output
+		int e = numBuf + skip;
+		for (; e < total; e += factor)
+		{
+			dot(&bufI[e - len + 1], &bufQ[e - len + 1], &taps[0], len, outI[numOut], outQ[numOut]);
+			numOut++;
+		}
+		skip = e - total;
+		memmove(&bufI[0], &bufI[total - hist], hist * sizeof(float));
+		memmove(&bufQ[0], &bufQ[total - hist], hist * sizeof(float));
+	}
+	return numOut;
+}
+
+Decimator::Decimator()
+{
+}
+
+Decimator::~Decimator()
+{
+	clearStages();
+}
+
+void Decimator::clearStages()
+{
+	for (size_t i = 0; i < stages.size(); i++)
+		delete stages[i];
+	stages.clear();
+}
+
+/// <summary>
+/// Plans the cascade for a factor. 80% of the output band is the passband; a stage only has to
+/// suppress what would alias into it, so the early halfbands get a wide transition
+/// band and few taps. The last stage is the sharp one, running at the lowest rate.
+/// </summary>
+bool Decimator::configure(int f)
+{
+	clearStages();
+	factor = 1;
+	if (f <= 1)
+		return true;
+	if (f > c_maxFactor)
+	{
+		std::cout << "*** Decimation factor " << f << " too large, max " << c_maxFactor << endl;
+		return false;
+	}
+	factor = f;
+	int numHalfbands = 0;
+	int rest = f;
+	while (rest % 2 == 0)
+	{
+		rest /= 2;
+		numHalfbands++;
+	}
+	// rates relative to the device rate
+	double passband = 0.4 / f;
+	double rateIn = 1.0;
+	std::cout << "Decimation by " << f << ":";
+	for (int i = 0; i < numHalfbands; i++)
+	{
+		bool last = i == numHalfbands - 1 && rest == 1;
+		// stopband from half the input rate minus the passband
+		double tw = last ? 0.1 : 0.5 - 2 * passband / rateIn;
+		std::vector<float> h;
+		designHalfband(tw, h);
+		stages.push_back(new DecimatorStage(2, true, h));
+		std::cout << " halfband " << h.size() << " taps,";
+		rateIn /= 2;
+	}
+	if (rest > 1)
+	{
+		// passband edge 0.4, stopband edge 0.6 of the output rate
+		double tw = 0.2 / rest;
+		std::vector<float> h;
+		designLowpass(kaiserTaps(tw), 0.5 / rest, h);
+		stages.push_back(new DecimatorStage(rest, false, h));
+		std::cout << " FIR/" << rest << " " << h.size() << " taps,";
+	}
+	std::cout << " kernel " << kernelName << endl;
+	reserve(c_chunk);
+	return true;
+}
+
+void Decimator::reserve(int numSamples)
+{
+	inI.resize(c_chunk);
+	inQ.resize(c_chunk);
+	for (int i = 0; i < 2; i++)
+	{
+		tmpI[i].resize(c_chunk);
+		tmpQ[i].resize(c_chunk);
+	}
+	int maxOut = numSamples / factor + 2;
+	if ((int)outBufI.size() < maxOut)
+	{
+		outBufI.resize(maxOut);
+		outBufQ.resize(maxOut);
+	}
+}
+
+void Decimator::reset()
+{
+	for (size_t i = 0; i < stages.size(); i++)
+		stages[i]->reset();
+}
+
+int Decimator::process(const short* xi, const short* xq, int numSamples, const short*& outI, const short*& outQ)
+{
+	// only if the callback delivers more than ever before
+	if ((int)outBufI.size() < numSamples / factor + 2)
+		reserve(numSamples);
+	int total = 0;
+	for (int done = 0; done < numSamples; )
+	{
+		int n = numSamples - done;
+		if (n > c_chunk)
+			n = c_chunk;
+		if (mixer != 0 && mixer->isActive())
+			mixer->mix(xi + done, xq + done, n, &inI[0], &inQ[0]);
+		else
+		{
+			for (int i = 0; i < n; i++)
+			{
+				inI[i] = xi[done + i];
+				inQ[i] = xq[done + i];
+			}
+		}
+		done += n;
+		const float* srcI = &inI[0];
+		const float* srcQ = &inQ[0];
+		for (size_t s = 0; s < stages.size() && n > 0; s++)
+		{
+			float* dstI = &tmpI[s % 2][0];
+			float* dstQ = &tmpQ[s % 2][0];
+			n = stages[s]->process(srcI, srcQ, n, dstI, dstQ, dot);
+			srcI = dstI;
+			srcQ = dstQ;
+		}
+		for (int i = 0; i < n; i++)
+		{
+			outBufI[total + i] = toShort(srcI[i]);
+			outBufQ[total + i] = toShort(srcQ[i]);
+		}
+		total += n;
+	}
+	outI = &outBufI[0];
+	outQ = &outBufQ[0];
+	return total;
+}
+
+// Kaiser's estimate of the length for c_stopbandDb and the transition width
+int Decimator::kaiserTaps(double tw)
+{
+	int n = (int)ceil((c_stopbandDb - 7.95) / (14.36 * tw)) + 1;
+	return n < 3 ? 3 : n;
+}
+
+static double besselI0(double x)
+{
+	double sum = 1, term = 1;
+	for (int k = 1; k < 50; k++)
+	{
+		term *= (x / (2 * k)) * (x / (2 * k));
+		sum += term;
+		if (term < sum * 1e-12)
+			break;
+	}
+	return sum;
+}
+
+void Decimator::designLowpass(int numTaps, double cutoff, std::vector<float>& taps)
+{
+	const double pi = 3.14159265358979323846;
+	double beta = 0.1102 * (c_stopbandDb - 8.7);
+	double mid = (numTaps - 1) / 2.0;
+	std::vector<double> h(numTaps);
+	double sum = 0;
+	for (int i = 0; i < numTaps; i++)
+	{
+		double t = i - mid;
+		double sinc = t == 0 ? 2 * cutoff : sin(2 * pi * cutoff * t) / (pi * t);
+		double r = mid == 0 ? 0 : t / mid;
+		double w = besselI0(beta * sqrt(1 - r * r)) / besselI0(beta);
+		h[i] = sinc * w;
+		sum += h[i];
+	}
+	taps.resize(numTaps);
+	for (int i = 0; i < numTaps; i++)
+		taps[i] = (float)(h[i] / sum);
+}
+
+void Decimator::designHalfband(double tw, std::vector<float>& taps)
+{
+	// 4k - 1 taps, the center one odd, every second tap beside it exactly 0
+	int k = (kaiserTaps(tw) + 4) / 4;
+	if (k < 1)
+		k = 1;
+	int n = 4 * k - 1;
+	designLowpass(n, 0.25, taps);
+	int c = 2 * k - 1;
+	double sum = 0;
+	for (int i = 0; i < n; i++)
+	{
+		if ((i - c) % 2 == 0 && i != c)
+			taps[i] = 0;
+		sum += taps[i];
+	}
+	for (int i = 0; i < n; i++)
+		taps[i] = (float)(taps[i] / sum);
+}
+
+void Decimator::dot_scalar(const float* a, const float* b, const float* taps, int n, float& outA, float& outB)
+{
+	float sa = 0, sb = 0;
+	for (int i = 0; i < n; i++)
+	{
+		sa += a[i] * taps[i];
+		sb += b[i] * taps[i];
+	}
+	outA = sa;
+	outB = sb;
+}
+
+#ifdef IQ_X86
+static inline float hsum_sse(__m128 v)
+{
+	__m128 s = _mm_add_ps(v, _mm_movehl_ps(v, v));
+	s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+	return _mm_cvtss_f32(s);
+}
+
+void Decimator::dot_sse2(const float* a, const float* b, const float* taps, int n, float& outA, float& outB)
+{
+	__m128 sa0 = _mm_setzero_ps(), sa1 = _mm_setzero_ps();
+	__m128 sb0 = _mm_setzero_ps(), sb1 = _mm_setzero_ps();
+	for (int i = 0; i < n; i += 8)
+	{
+		__m128 t0 = _mm_loadu_ps(taps + i);
+		__m128 t1 = _mm_loadu_ps(taps + i + 4);
+		sa0 = _mm_add_ps(sa0, _mm_mul_ps(_mm_loadu_ps(a + i), t0));
+		sa1 = _mm_add_ps(sa1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), t1));
+		sb0 = _mm_add_ps(sb0, _mm_mul_ps(_mm_loadu_ps(b + i), t0));
+		sb1 = _mm_add_ps(sb1, _mm_mul_ps(_mm_loadu_ps(b + i + 4), t1));
+	}
+	outA = hsum_sse(_mm_add_ps(sa0, sa1));
+	outB = hsum_sse(_mm_add_ps(sb0, sb1));
+}
+
+IQ_TARGET_AVX2
+void Decimator::dot_avx2(const float* a, const float* b, const float* taps, int n, float& outA, float& outB)
+{
+	__m256 sa = _mm256_setzero_ps();
+	__m256 sb = _mm256_setzero_ps();
+	for (int i = 0; i < n; i += 8)
+	{
+		__m256 t = _mm256_loadu_ps(taps + i);
+		sa = _mm256_add_ps(sa, _mm256_mul_ps(_mm256_loadu_ps(a + i), t));
+		sb = _mm256_add_ps(sb, _mm256_mul_ps(_mm256_loadu_ps(b + i), t));
+	}
+	__m128 ra = _mm_add_ps(_mm256_castps256_ps128(sa), _mm256_extractf128_ps(sa, 1));
+	__m128 rb = _mm_add_ps(_mm256_castps256_ps128(sb), _mm256_extractf128_ps(sb, 1));
+	outA = hsum_sse(ra);
+	outB = hsum_sse(rb);
+}
+#else
+void Decimator::dot_sse2(const float* a, const float* b, const float* taps, int n, float& outA, float& outB)
+{
+	dot_scalar(a, b, taps, n, outA, outB);
+}
+void Decimator::dot_avx2(const float* a, const float* b, const float* taps, int n, float& outA, float& outB)
+{
+	dot_scalar(a, b, taps, n, outA, outB);
+}
+#endif
+
+#ifdef IQ_NEON
+static inline float hsum_neon(float32x4_t v)
+{
+	float32x2_t s = vadd_f32(vget_low_f32(v), vget_high_f32(v));
+	s = vpadd_f32(s, s);
+	return vget_lane_f32(s, 0);
+}
+
+void Decimator::dot_neon(const float* a, const float* b, const float* taps, int n, float& outA, float& outB)
+{
+	float32x4_t sa0 = vdupq_n_f32(0), sa1 = vdupq_n_f32(0);
+	float32x4_t sb0 = vdupq_n_f32(0), sb1 = vdupq_n_f32(0);
+	for (int i = 0; i < n; i += 8)
+	{
+		float32x4_t t0 = vld1q_f32(taps + i);
+		float32x4_t t1 = vld1q_f32(taps + i + 4);
+		sa0 = vmlaq_f32(sa0, vld1q_f32(a + i), t0);
+		sa1 = vmlaq_f32(sa1, vld1q_f32(a + i + 4), t1);
+		sb0 = vmlaq_f32(sb0, vld1q_f32(b + i), t0);
+		sb1 = vmlaq_f32(sb1, vld1q_f32(b + i + 4), t1);
+	}
+	outA = hsum_neon(vaddq_f32(sa0, sa1));
+	outB = hsum_neon(vaddq_f32(sb0, sb1));
+}
+#else
+void Decimator::dot_neon(const float* a, const float* b, const float* taps, int n, float& outA, float& outB)
+{
+	dot_scalar(a, b, taps, n, outA, outB);
+}
+#endif
+
+/// <summary>
+/// Uses the widest dot product kernel of the CPU, if it matches the scalar one
+/// within the rounding differences of the changed summation order
+/// </summary>
+void Decimator::init()
+{
+	dotFn kernel = dot_scalar;
+	const char* name = "scalar";
+#ifdef IQ_X86
+	if (iqConvert::hasAvx2())
+	{
+		kernel = dot_avx2;
+		name = "AVX2";
+	}
+	else if (iqConvert::hasSse2())
+	{
+		kernel = dot_sse2;
+		name = "SSE2";
+	}
+#endif
+#ifdef IQ_NEON
+	kernel = dot_neon;
+	name = "NEON";
+#endif
+	if (kernel != dot_scalar)
+	{
+		const int n = 256;
+		float a[n], b[n], t[n];
+		unsigned int seed = 1;
+		for (int i = 0; i < n; i++)
+		{
+			seed = seed * 1103515245 + 12345;
+			a[i] = (float)((int)(seed >> 16) % 32768 - 16384);
+			b[i] = (float)((int)(seed >> 8) % 32768 - 16384);
+			t[i] = (float)sin(i * 0.1) / n;
+		}
+		float ra, rb, ka, kb;
+		dot_scalar(a, b, t, n, ra, rb);
+		kernel(a, b, t, n, ka, kb);
+		if (fabs(ra - ka) > 0.01f || fabs(rb - kb) > 0.01f)
+		{
+			std::cout << "*** Decimation kernel " << name << " differs from the reference, using the scalar kernel" << endl;
+			kernel = dot_scalar;
+			name = "scalar";
+		}
+	}
+	dot = kernel;
+	kernelName = name;
+	std::cout << "Decimation kernel: " << kernelName << endl;
+}
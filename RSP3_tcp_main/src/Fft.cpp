@@ -0,0 +1,86 @@
+/**
+** RSP3_tcp - TCP/IP I/Q Data Server for the sdrplay RSP devices
+** Copyright (C) 2017-2024 Clem Schmidt, softsyst, http://qirx.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#include "Fft.h"
+#include <math.h>
+
+Fft::Fft(int n) :
+	size(n),
+	reversed(n),
+	cosTable(n / 2),
+	sinTable(n / 2)
+{
+	const double pi = 3.14159265358979323846;
+	int bits = 0;
+	while ((1 << bits) < n)
+		bits++;
+	for (int i = 0; i < n; i++)
+	{
+		int r = 0;
+		for (int b = 0; b < bits; b++)
+			if (i & (1 << b))
+				r |= 1 << (bits - 1 - b);
+		reversed[i] = r;
+	}
+	for (int i = 0; i < n / 2; i++)
+	{
+		cosTable[i] = (float)cos(2 * pi * i / n);
+		sinTable[i] = (float)sin(2 * pi * i / n);
+	}
+}
+
+void Fft::transform(float* re, float* im, bool inverse) const
+{
+	for (int i = 0; i < size; i++)
+	{
+		int r = reversed[i];
+		if (r > i)
+		{
+			float t = re[i];
+			re[i] = re[r];
+			re[r] = t;
+			t = im[i];
+			im[i] = im[r];
+			im[r] = t;
+		}
+	}
+	float sign = inverse ? 1.0f : -1.0f;
+	for (int len = 2; len <= size; len *= 2)
+	{
+		int half = len / 2;
+		int step = size / len;
+		for (int start = 0; start < size; start += len)
+		{
+			for (int k = 0; k < half; k++)
+			{
+				float wr = cosTable[k * step];
+				float wi = sign * sinTable[k * step];
+				int a = start + k;
+				int b = a + half;
+				float tr = re[b] * wr - im[b] * wi;
+				float ti = re[b] * wi + im[b] * wr;
+				re[b] = re[a] - tr;
+				im[b] = im[a] - ti;
+				re[a] += tr;
+				im[a] += ti;
+			}
+		}
+	}
+}
@@ -0,0 +1,476 @@
+/**
+** RSP3_tcp - TCP/IP I/Q Data Server for the sdrplay RSP devices
+** Copyright (C) 2017-2024 Clem Schmidt, softsyst, http://qirx.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#include "GatherSender.h"
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <iostream>
+#ifdef __linux__
+#define GS_ZEROCOPY
+#include <poll.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+#endif
+using namespace std;
+
+GatherSender::GatherSender(MemBlockPool& pool, int maxBytes) : pool(pool), maxBytes(maxBytes)
+{
+	lastReport = time(0);
+	for (int i = 0; i < c_maxInFlight; i++)
+		zcDone[i] = false;
+}
+
+GatherSender::~GatherSender()
+{
+	discard();
+	// the reaper deletes a sender when its completions arrived or it gave up on the socket
+	forceRelease();
+}
+
+bool GatherSender::isLoopbackPeer(SOCKET s)
+{
+#ifdef GS_ZEROCOPY
+	struct sockaddr_storage peer;
+	socklen_t len = sizeof(peer);
+	if (getpeername(s, (struct sockaddr*)&peer, &len) != 0)
+		return false;
+	if (peer.ss_family == AF_UNIX)
+		return true;
+	if (peer.ss_family == AF_INET)
+		return (ntohl(((struct sockaddr_in*)&peer)->sin_addr.s_addr) >> 24) == 127;
+	if (peer.ss_family == AF_INET6)
+	{
+		const struct in6_addr& a = ((struct sockaddr_in6*)&peer)->sin6_addr;
+		return IN6_IS_ADDR_LOOPBACK(&a) ||
+			(IN6_IS_ADDR_V4MAPPED(&a) && a.s6_addr[12] == 127);
+	}
+#else
+	(void)s;
+#endif
+	return false;
+}
+
+bool GatherSender::enableZeroCopy(SOCKET s)
+{
+#ifdef GS_ZEROCOPY
+	if (isLoopbackPeer(s))
+	{
+		std::cout << "MSG_ZEROCOPY not used for a loopback peer, using plain sends" << endl;
+		return false;
+	}
+	int one = 1;
+	if (setsockopt(s, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) != 0)
+	{
+		std::cout << "MSG_ZEROCOPY not supported (" << common::getSocketErrorString() << "), using plain sends" << endl;
+		return false;
+	}
+	zeroCopy = true;
+	zcSocket = s;
+	std::cout << "Transmitting with MSG_ZEROCOPY" << endl;
+	return true;
+#else
+	std::cout << "MSG_ZEROCOPY not available on this platform, using plain sends" << endl;
+	return false;
+#endif
+}
+
+void GatherSender::append(SOCKET s, MemBlock* mb)
+{
+	if (socketError)
+	{
+		pool.release(mb);
+		return;
+	}
+	// with a backlog, the next flush is due when the socket is writable again
+	if (numPending == c_maxBlocks ||
+		(!blocked && numPending > 0 && pendingBytes + mb->length > maxBytes))
+	{
+		if (!flush(s))
+		{
+			pool.release(mb);
+			return;
+		}
+		if (numPending == c_maxBlocks)
+		{
+			// nonblocking and the caller exceeded room()
+			std::cout << "*** GatherSender: no room for a block, discarded" << endl;
+			pool.release(mb);
+			return;
+		}
+	}
+	touchedByZc[numPending] = false;
+	pending[numPending++] = mb;
+	pendingBytes += mb->length;
+}
+
+/// <summary>
+/// One gather call over all iovecs.
+/// zc: in: try MSG_ZEROCOPY, out: the send was done with MSG_ZEROCOPY
+/// </summary>
+/// <returns>Bytes sent or SOCKET_ERROR</returns>
+int GatherSender::sendv(SOCKET s, txIoVec* v, int count, bool& zc)
+{
+	syscalls++;
+#ifdef _WIN32
+	zc = false;
+	DWORD sent = 0;
+	if (WSASend(s, v, (DWORD)count, &sent, 0, NULL, NULL) != 0)
+		return SOCKET_ERROR;
+	return (int)sent;
+#else
+	ssize_t sent;
+#ifdef GS_ZEROCOPY
+	if (zc)
+	{
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = v;
+		msg.msg_iovlen = count;
+		while ((sent = sendmsg(s, &msg, MSG_ZEROCOPY)) < 0 && errno == EINTR)
+			;
+		if (sent >= 0)
+			return (int)sent;
+		if (errno != ENOBUFS)
+			return SOCKET_ERROR;
+		// locked memory limit reached, this one goes the ordinary way
+		zcFallbacks++;
+		syscalls++;
+	}
+#endif
+	zc = false;
+	while ((sent = writev(s, v, count)) < 0 && errno == EINTR)
+		;
+	return sent < 0 ? SOCKET_ERROR : (int)sent;
+#endif
+}
+
+bool GatherSender::flush(SOCKET s)
+{
+	if (numPending == 0)
+	{
+		blocked = false;
+		return !socketError;
+	}
+	if (socketError)
+	{
+		discard();
+		return false;
+	}
+
+	// a blocking socket takes everything, but a signal may still end a call early
+	while (numPending > 0)
+	{
+		for (int i = 0; i < numPending; i++)
+		{
+			int offset = i == 0 ? firstOffset : 0;
+#ifdef _WIN32
+			iov[i].buf = (CHAR*)pending[i]->Mem + offset;
+			iov[i].len = (ULONG)(pending[i]->length - offset);
+#else
+			iov[i].iov_base = pending[i]->Mem + offset;
+			iov[i].iov_len = pending[i]->length - offset;
+#endif
+		}
+		bool zc = zeroCopy;
+		if (zc && (nextZcId - completedBelow >= (uint32_t)c_maxInFlight || inFlightCount + numPending > c_maxInFlight))
+			zc = waitCompletions(nonBlocking ? 0 : 1000);
+		int sent = sendv(s, iov, numPending, zc);
+		if (sent == SOCKET_ERROR)
+		{
+			if (nonBlocking && common::socketWouldBlock())
+			{
+				blocked = true;
+				return true;
+			}
+			std::cout << "Socket tx Error : " << common::getSocketErrorString() << endl;
+			socketError = true;
+			break;
+		}
+		bytesSent += sent;
+		pendingBytes -= sent;
+
+		// count the blocks sent completely, advance into a partially sent one
+		int done = 0;
+		int last = 0;
+		while (done < numPending)
+		{
+			int left = pending[done]->length - firstOffset;
+			if (sent == 0 && left > 0)
+				break;
+			last = done;
+			if (sent < left)
+			{
+				firstOffset += sent;
+				sent = 0;
+				break;
+			}
+			sent -= left;
+			firstOffset = 0;
+			done++;
+		}
+		if (zc)
+		{
+			// blocks 0 .. last are read by send nextZcId
+			for (int i = 0; i <= last && i < numPending; i++)
+			{
+				touchedByZc[i] = true;
+				lastZcId[i] = nextZcId;
+			}
+			nextZcId++;
+			zcSends++;
+		}
+		for (int i = 0; i < done; i++)
+			retire(pending[i], touchedByZc[i], lastZcId[i]);
+		numPending -= done;
+		memmove(pending, pending + done, numPending * sizeof(pending[0]));
+		memmove(touchedByZc, touchedByZc + done, numPending * sizeof(touchedByZc[0]));
+		memmove(lastZcId, lastZcId + done, numPending * sizeof(lastZcId[0]));
+		blocksSent += done;
+	}
+
+	if (!socketError)
+		flushes++;
+	for (int i = 0; i < numPending; i++)
+		retire(pending[i], touchedByZc[i], lastZcId[i]);
+	numPending = 0;
+	pendingBytes = 0;
+	firstOffset = 0;
+	blocked = false;
+	if (zeroCopy)
+		reapCompletions();
+	return !socketError;
+}
+
+/// <summary>
+/// A block is sent. If the kernel may still read it, it waits for the completion
+/// </summary>
+void GatherSender::retire(MemBlock* mb, bool zc, uint32_t lastId)
+{
+	if (!zc)
+	{
+		pool.release(mb);
+		return;
+	}
+	int ix = (inFlightHead + inFlightCount) % c_maxInFlight;
+	inFlight[ix] = mb;
+	inFlightLastId[ix] = lastId;
+	inFlightCount++;
+}
+
+/// <summary>
+/// Reads the completion notifications from the error queue, without blocking,
+/// and returns the blocks no longer used by the kernel to the pool
+/// </summary>
+void GatherSender::reapCompletions()
+{
+#ifdef GS_ZEROCOPY
+	for (;;)
+	{
+		char control[128];
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(zcSocket, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+			break;
+		for (struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm != 0; cm = CMSG_NXTHDR(&msg, cm))
+		{
+			if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+				(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)))
+				continue;
+			struct sock_extended_err* serr = (struct sock_extended_err*)CMSG_DATA(cm);
+			if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+				continue;
+			uint32_t lo = serr->ee_info;
+			uint32_t hi = serr->ee_data;
+			if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+				zcCopied += hi - lo + 1;
+			for (uint32_t id = lo; id != hi + 1; id++)
+			{
+				if (id - completedBelow < (uint32_t)c_maxInFlight)
+					zcDone[id % c_maxInFlight] = true;
+			}
+		}
+	}
+	while (completedBelow != nextZcId && zcDone[completedBelow % c_maxInFlight])
+	{
+		zcDone[completedBelow % c_maxInFlight] = false;
+		completedBelow++;
+	}
+#endif
+	// a block is free when the last send reading it is completed
+	while (inFlightCount > 0 && (int32_t)(inFlightLastId[inFlightHead] - completedBelow) < 0)
+	{
+		pool.release(inFlight[inFlightHead]);
+		inFlightHead = (inFlightHead + 1) % c_maxInFlight;
+		inFlightCount--;
+	}
+}
+
+/// <summary>
+/// Waits until there is room for another zero copy send and its blocks.
+/// </summary>
+/// <returns>false if the next send should not use MSG_ZEROCOPY</returns>
+bool GatherSender::waitCompletions(int timeoutMs)
+{
+#ifdef GS_ZEROCOPY
+	for (int waited = 0; ; waited += 10)
+	{
+		reapCompletions();
+		if (nextZcId - completedBelow < (uint32_t)c_maxInFlight && inFlightCount + numPending <= c_maxInFlight)
+			return true;
+		if (waited >= timeoutMs)
+			break;
+		// the error queue signals POLLERR
+		struct pollfd pfd;
+		pfd.fd = zcSocket;
+		pfd.events = 0;
+		pfd.revents = 0;
+		poll(&pfd, 1, 10);
+	}
+	zcFallbacks++;
+#endif
+	return false;
+}
+
+/// <summary>
+/// The connection ends with zero copy sends in flight. It is reset with the socket kept
+/// open: the kernel drops the data not yet sent, and the completions of those sends
+/// arrive on its error queue, which is gone with the socket.
+/// </summary>
+void GatherSender::resetConnection()
+{
+#ifdef GS_ZEROCOPY
+	// connect with AF_UNSPEC disconnects a TCP socket, without closing it
+	struct sockaddr unspec;
+	memset(&unspec, 0, sizeof(unspec));
+	unspec.sa_family = AF_UNSPEC;
+	connect(zcSocket, &unspec, sizeof(unspec));
+#endif
+}
+
+void GatherSender::forceRelease()
+{
+	if (inFlightCount == 0)
+		return;
+	zcForced += inFlightCount;
+	std::cout << "Tx zero copy: " << inFlightCount << " blocks returned without completion, "
+		<< zcForced << " in total" << endl;
+	while (inFlightCount > 0)
+	{
+		pool.release(inFlight[inFlightHead]);
+		inFlightHead = (inFlightHead + 1) % c_maxInFlight;
+		inFlightCount--;
+	}
+}
+
+void GatherSender::discard()
+{
+	// a partially sent block may still be read by a zero copy send
+	for (int i = 0; i < numPending; i++)
+		retire(pending[i], touchedByZc[i], lastZcId[i]);
+	numPending = 0;
+	pendingBytes = 0;
+	firstOffset = 0;
+	blocked = false;
+	if (inFlightCount == 0)
+		return;
+	resetConnection();
+	reapCompletions();
+}
+
+void GatherSender::reportStats(int intervalSec)
+{
+	if (zeroCopy)
+		reapCompletions();
+	time_t now = time(0);
+	if (now - lastReport < intervalSec)
+		return;
+	uint64_t f = flushes - lastFlushes;
+	if (f > 0)
+	{
+		double secs = (double)(now - lastReport);
+		std::cout << "Tx: " << (uint64_t)(f / secs) << " sends/s, "
+			<< (double)(blocksSent - lastBlocks) / f << " blocks/send, "
+			<< (bytesSent - lastBytes) / f << " bytes/send, "
+			<< (double)(syscalls - lastSyscalls) / f << " syscalls/send" << endl;
+		if (zeroCopy)
+			std::cout << "Tx zero copy: " << zcSends << " sends, " << zcCopied << " copied by the kernel, "
+				<< zcFallbacks << " fallbacks, " << inFlightCount << " blocks in flight" << endl;
+	}
+	lastReport = now;
+	lastFlushes = flushes;
+	lastSyscalls = syscalls;
+	lastBlocks = blocksSent;
+	lastBytes = bytesSent;
+}
+
+void ZeroCopyReaper::adopt(SOCKET s, GatherSender* sender)
+{
+	retiredSender r;
+	r.s = s;
+	r.sender = sender;
+	r.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(c_timeoutMs);
+	retired.push_back(r);
+}
+
+void ZeroCopyReaper::service()
+{
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < retired.size(); )
+	{
+		retiredSender& r = retired[i];
+		r.sender->reap();
+		if (r.sender->hasInFlight() && now < r.deadline)
+		{
+			i++;
+			continue;
+		}
+		dispose(r);
+		retired.erase(retired.begin() + i);
+	}
+}
+
+void ZeroCopyReaper::releaseAll()
+{
+	for (size_t i = 0; i < retired.size(); i++)
+		dispose(retired[i]);
+	retired.clear();
+}
+
+// the sender forces back what is still in flight
+void ZeroCopyReaper::dispose(retiredSender& r)
+{
+	delete r.sender;
+	closesocket(r.s);
+}
@@ -0,0 +1,135 @@
+/**
+** RSP3_tcp - TCP/IP I/Q Data Server for the sdrplay RSP devices
+** Copyright (C) 2017-2024 Clem Schmidt, softsyst, http://qirx.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#include <math.h>
+#include "IqCorrector.h"
+#include "Decimator.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+IqCorrector::IqCorrector()
+{
+}
+
+void IqCorrector::setRate(int hz)
+{
+	rateHz = hz;
+	first = true;
+}
+
+void IqCorrector::process(const short* xi, const short* xq, int numSamples, const short*& outI, const short*& outQ)
+{
+	if ((int)outBufI.size() < numSamples)
+	{
+		outBufI.resize(numSamples);
+		outBufQ.resize(numSamples);
+	}
+	outI = &outBufI[0];
+	outQ = &outBufQ[0];
+	if (numSamples == 0)
+		return;
+
+	// block statistics, 8 lanes
+	float sI[8] = { 0 }, sQ[8] = { 0 }, sII[8] = { 0 }, sQQ[8] = { 0 }, sIQ[8] = { 0 };
+	int n8 = numSamples & ~7;
+	for (int i = 0; i < n8; i += 8)
+	{
+		for (int j = 0; j < 8; j++)
+		{
+			float a = xi[i + j];
+			float b = xq[i + j];
+			sI[j] += a;
+			sQ[j] += b;
+			sII[j] += a * a;
+			sQQ[j] += b * b;
+			sIQ[j] += a * b;
+		}
+	}
+	for (int i = n8; i < numSamples; i++)
+	{
+		float a = xi[i];
+		float b = xq[i];
+		sI[0] += a;
+		sQ[0] += b;
+		sII[0] += a * a;
+		sQQ[0] += b * b;
+		sIQ[0] += a * b;
+	}
+	double tI = 0, tQ = 0, tII = 0, tQQ = 0, tIQ = 0;
+	for (int j = 0; j < 8; j++)
+	{
+		tI += sI[j];
+		tQ += sQ[j];
+		tII += sII[j];
+		tQQ += sQQ[j];
+		tIQ += sIQ[j];
+	}
+	double mI = tI / numSamples;
+	double mQ = tQ / numSamples;
+	double pI = tII / numSamples - mI * mI;
+	double pQ = tQQ / numSamples - mQ * mQ;
+	double cIQ = tIQ / numSamples - mI * mQ;
+
+	// running estimates, first order lowpass per block
+	double aDc = 1, aIq = 1;
+	if (!first)
+	{
+		aDc = (double)numSamples * 1000 / ((double)c_dcTimeConstantMs * rateHz);
+		aIq = (double)numSamples * 1000 / ((double)c_iqTimeConstantMs * rateHz);
+		if (aDc > 1)
+			aDc = 1;
+		if (aIq > 1)
+			aIq = 1;
+	}
+	first = false;
+	meanI += aDc * (mI - meanI);
+	meanQ += aDc * (mQ - meanQ);
+	powI += aIq * (pI - powI);
+	powQ += aIq * (pQ - powQ);
+	crossIQ += aIq * (cIQ - crossIQ);
+
+	// Q' = kQ * Q + kI * I + k0
+	float kQ = 1, kI = 0;
+	double residual = powI > 0 ? powQ - crossIQ * crossIQ / powI : 0;
+	if (powI >= 1 && residual > 0)
+	{
+		double g = sqrt(powI / residual);
+		kQ = (float)g;
+		kI = (float)(-g * crossIQ / powI);
+		gainDb.store((float)(10 * log10(powQ / powI)), std::memory_order_relaxed);
+		phaseDeg.store((float)(asin(crossIQ / sqrt(powI * powQ)) * 180 / M_PI), std::memory_order_relaxed);
+	}
+	float k0 = -(kQ * (float)meanQ + kI * (float)meanI);
+	float offI = -(float)meanI;
+	dcI.store((float)meanI, std::memory_order_relaxed);
+	dcQ.store((float)meanQ, std::memory_order_relaxed);
+
+	short* oI = &outBufI[0];
+	short* oQ = &outBufQ[0];
+	for (int i = 0; i < numSamples; i++)
+	{
+		float a = xi[i];
+		float b = xq[i];
+		oI[i] = Decimator::toShort(a + offI);
+		oQ[i] = Decimator::toShort(kQ * b + kI * a + k0);
+	}
+}
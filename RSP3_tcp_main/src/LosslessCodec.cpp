@@ -0,0 +1,446 @@
+/**
+** RSP3_tcp - TCP/IP I/Q Data Server for the sdrplay RSP devices
+** Copyright (C) 2017-2024 Clem Schmidt, softsyst, http://qirx.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#include <iostream>
+#include <chrono>
+#include <string.h>
+#include "LosslessCodec.h"
+using namespace std;
+
+namespace
+{
+	// MSB first bit stream, written 32 bits at a time
+	struct bitWriter
+	{
+		BYTE* p;
+		uint64_t acc = 0;
+		int n = 0;
+
+		bitWriter(BYTE* out) : p(out) {}
+
+		// bits 1..32, v < 2^bits
+		void put(uint32_t v, int bits)
+		{
+			acc = (acc << bits) | v;
+			n += bits;
+			if (n >= 32)
+			{
+				n -= 32;
+				uint32_t w = (uint32_t)(acc >> n);
+				p[0] = (BYTE)(w >> 24);
+				p[1] = (BYTE)(w >> 16);
+				p[2] = (BYTE)(w >> 8);
+				p[3] = (BYTE)w;
+				p += 4;
+			}
+		}
+
+		void putRice(uint32_t u, int k)
+		{
+			uint32_t q = u >> k;
+			if (q + 1 + k <= 32)
+			{
+				put((((1u << q) - 1) << (k + 1)) | (u & ((1u << k) - 1)), q + 1 + k);
+				return;
+			}
+			while (q >= 32)
+			{
+				put(0xFFFFFFFFu, 32);
+				q -= 32;
+			}
+			put(((1u << q) - 1) << 1, q + 1);
+			if (k != 0)
+				put(u & ((1u << k) - 1), k);
+		}
+
+		// pads to a whole byte, returns the end of the stream
+		BYTE* finish()
+		{
+			if (n % 8 != 0)
+			{
+				int pad = 8 - n % 8;
+				acc <<= pad;
+				n += pad;
+			}
+			while (n > 0)
+			{
+				n -= 8;
+				*p++ = (BYTE)(acc >> n);
+			}
+			return p;
+		}
+	};
+
+	struct bitReader
+	{
+		const BYTE* p;
+		const BYTE* end;
+		uint64_t window = 0;	// left aligned
+		int avail = 0;
+		uint64_t consumed = 0;	// bits, to detect reading beyond the end
+
+		bitReader(const BYTE* begin, const BYTE* e) : p(begin), end(e) {}
+
+		// beyond the end, zeros are read
+		void refill()
+		{
+			while (avail <= 56)
+			{
+				if (p < end)
+					window |= (uint64_t)*p++ << (56 - avail);
+				avail += 8;
+			}
+		}
+
+		uint32_t get(int bits)
+		{
+			if (bits == 0)
+				return 0;
+			if (avail < bits)
+				refill();
+			uint32_t v = (uint32_t)(window >> (64 - bits));
+			window <<= bits;
+			avail -= bits;
+			consumed += bits;
+			return v;
+		}
+
+		uint32_t getRice(int k)
+		{
+			uint32_t q = 0;
+			for (;;)
+			{
+				if (avail == 0)
+					refill();
+				bool one = (window >> 63) != 0;
+				window <<= 1;
+				avail--;
+				consumed++;
+				if (!one)
+					break;
+				q++;
+			}
+			return (q << k) | get(k);
+		}
+	};
+
+	inline short sampleAt(const BYTE* iq, int n, int component)
+	{
+		const BYTE* s = iq + 4 * n + 2 * component;
+		return (short)(s[0] | (s[1] << 8));
+	}
+
+	inline int32_t predict(int32_t x1, int32_t x2, int order)
+	{
+		return order == 0 ? 0 : order == 1 ? x1 : 2 * x1 - x2;
+	}
+
+	inline uint32_t zigzag(int32_t r)
+	{
+		return r >= 0 ? (uint32_t)r << 1 : ((uint32_t)(-(r + 1)) << 1) | 1;
+	}
+
+	inline int32_t unzigzag(uint32_t u)
+	{
+		return (u & 1) != 0 ? -(int32_t)(u >> 1) - 1 : (int32_t)(u >> 1);
+	}
+
+	void putBE32(BYTE* p, uint32_t v)
+	{
+		p[0] = (BYTE)(v >> 24);
+		p[1] = (BYTE)(v >> 16);
+		p[2] = (BYTE)(v >> 8);
+		p[3] = (BYTE)v;
+	}
+
+	uint32_t getBE32(const BYTE* p)
+	{
+		return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+	}
+
+	// The order with the smallest sum of absolute residuals
+	int chooseOrder(const BYTE* iq, int numSamples, int component)
+	{
+		uint64_t sum[LosslessCodec::c_maxOrder + 1] = { 0, 0, 0 };
+		int32_t x1 = 0, x2 = 0;
+		for (int n = 0; n < numSamples; n++)
+		{
+			int32_t x = sampleAt(iq, n, component);
+			int32_t d1 = x - x1;
+			sum[0] += (uint32_t)(x < 0 ? -x : x);
+			sum[1] += (uint32_t)(d1 < 0 ? -d1 : d1);
+			int32_t d2 = d1 - (x1 - x2);
+			sum[2] += (uint32_t)(d2 < 0 ? -d2 : d2);
+			x2 = x1;
+			x1 = x;
+		}
+		int order = 0;
+		for (int o = 1; o <= LosslessCodec::c_maxOrder; o++)
+			if (sum[o] < sum[order])
+				order = o;
+		return order;
+	}
+
+	void encodeComponent(bitWriter& bw, const BYTE* iq, int numSamples, int component, int order)
+	{
+		uint32_t u[LosslessCodec::c_partition];
+		int32_t x1 = 0, x2 = 0;
+		for (int start = 0; start < numSamples; start += LosslessCodec::c_partition)
+		{
+			int count = numSamples - start;
+			if (count > LosslessCodec::c_partition)
+				count = LosslessCodec::c_partition;
+			uint64_t sum = 0;
+			for (int i = 0; i < count; i++)
+			{
+				int n = start + i;
+				int32_t x = sampleAt(iq, n, component);
+				// at the start of the frame, only the samples available
+				int o = n < order ? n : order;
+				u[i] = zigzag(x - predict(x1, x2, o));
+				sum += u[i];
+				x2 = x1;
+				x1 = x;
+			}
+
+			// the parameter near log2 of the mean, and its neighbours
+			int k0 = 0;
+			while (k0 < 18 && ((uint64_t)count << (k0 + 1)) <= sum)
+				k0++;
+			int bestK = LosslessCodec::c_verbatim;
+			uint64_t bestBits = (uint64_t)count * 16;
+			for (int k = (k0 > 0 ? k0 - 1 : 0); k <= k0 + 1 && k <= 18; k++)
+			{
+				uint64_t bits = (uint64_t)count * (k + 1);
+				for (int i = 0; i < count; i++)
+					bits += u[i] >> k;
+				if (bits < bestBits)
+				{
+					bestBits = bits;
+					bestK = k;
+				}
+			}
+
+			bw.put((uint32_t)bestK, 5);
+			if (bestK == LosslessCodec::c_verbatim)
+			{
+				for (int i = 0; i < count; i++)
+					bw.put((uint16_t)sampleAt(iq, start + i, component), 16);
+			}
+			else
+			{
+				for (int i = 0; i < count; i++)
+					bw.putRice(u[i], bestK);
+			}
+		}
+	}
+
+	bool decodeComponent(bitReader& br, int numSamples, int partition, int order, short* x)
+	{
+		int32_t x1 = 0, x2 = 0;
+		for (int start = 0; start < numSamples; start += partition)
+		{
+			int count = numSamples - start;
+			if (count > partition)
+				count = partition;
+			int k = (int)br.get(5);
+			if (k == LosslessCodec::c_verbatim)
+			{
+				for (int i = 0; i < count; i++)
+				{
+					x[start + i] = (short)br.get(16);
+					x2 = x1;
+					x1 = x[start + i];
+				}
+				continue;
+			}
+			if (k > 18)
+				return false;
+			for (int i = 0; i < count; i++)
+			{
+				int n = start + i;
+				int o = n < order ? n : order;
+				int32_t v = predict(x1, x2, o) + unzigzag(br.getRice(k));
+				if (v < -32768 || v > 32767)
+					return false;
+				x[n] = (short)v;
+				x2 = x1;
+				x1 = v;
+			}
+		}
+		return true;
+	}
+}
+
+int LosslessCodec::maxFrameBytes(int numSamples)
+{
+	int partitions = (numSamples + c_partition - 1) / c_partition;
+	int64_t bits = 2 * ((int64_t)partitions * 5 + (int64_t)numSamples * 16);
+	return c_headerLength + (int)((bits + 7) / 8);
+}
+
+int LosslessCodec::frameLength(const BYTE* header)
+{
+	if (memcmp(header, "RSPL", 4) != 0)
+		return 0;
+	return (int)getBE32(header + 4);
+}
+
+int LosslessCodec::encode(const BYTE* iq, int numSamples, unsigned int firstSampleNum, BYTE* out)
+{
+	int orderI = chooseOrder(iq, numSamples, 0);
+	int orderQ = chooseOrder(iq, numSamples, 1);
+
+	bitWriter bw(out + c_headerLength);
+	encodeComponent(bw, iq, numSamples, 0, orderI);
+	encodeComponent(bw, iq, numSamples, 1, orderQ);
+	int length = (int)(bw.finish() - out);
+
+	memcpy(out, "RSPL", 4);
+	putBE32(out + 4, (uint32_t)length);
+	putBE32(out + 8, firstSampleNum);
+	putBE32(out + 12, (uint32_t)numSamples);
+	out[16] = (BYTE)orderI;
+	out[17] = (BYTE)orderQ;
+	out[18] = (BYTE)(c_partition >> 8);
+	out[19] = (BYTE)c_partition;
+	return length;
+}
+
+int LosslessCodec::decode(const BYTE* frame, int length, short* xi, short* xq, int maxSamples,
+	unsigned int& firstSampleNum)
+{
+	if (length < c_headerLength || frameLength(frame) != length)
+		return -1;
+	uint32_t numSamples = getBE32(frame + 12);
+	int orderI = frame[16];
+	int orderQ = frame[17];
+	int partition = (frame[18] << 8) | frame[19];
+	if (numSamples > (uint32_t)maxSamples || orderI > c_maxOrder || orderQ > c_maxOrder || partition == 0)
+		return -1;
+
+	bitReader br(frame + c_headerLength, frame + length);
+	if (!decodeComponent(br, (int)numSamples, partition, orderI, xi) ||
+		!decodeComponent(br, (int)numSamples, partition, orderQ, xq))
+		return -1;
+	if (br.consumed > (uint64_t)(length - c_headerLength) * 8)
+		return -1;
+	firstSampleNum = getBE32(frame + 8);
+	return (int)numSamples;
+}
+
+LosslessEncoder::LosslessEncoder(int maxBlocks) : input(maxBlocks)
+{
+}
+
+LosslessEncoder::~LosslessEncoder()
+{
+	stop();
+}
+
+void LosslessEncoder::start(TxQueue* out)
+{
+	if (!enabled || worker != 0)
+		return;
+	output = out;
+	rawBytes = codedBytes = codedSamples = 0;
+	busySeconds = 0;
+	stopRequest = false;
+	worker = new std::thread(&LosslessEncoder::run, this);
+}
+
+void LosslessEncoder::stop()
+{
+	if (worker == 0)
+		return;
+	stopRequest = true;
+	input.wakeConsumer();
+	worker->join();
+	delete worker;
+	worker = 0;
+	if (codedBytes != 0)
+		std::cout << "Lossless: " << codedSamples << " samples, compressed to "
+			<< (double)codedBytes * 100 / rawBytes << "% of 16 bit, encoder "
+			<< (busySeconds > 0 ? codedSamples / busySeconds / 1e6 : 0) << " MS/s" << endl;
+}
+
+void LosslessEncoder::empty(MemBlockPool& pool)
+{
+	MemBlock* mb;
+	while (input.dequeueBatch(&mb, 1) > 0)
+		pool.release(mb);
+	for (size_t i = 0; i < unsent.size(); i++)
+		pool.release(unsent[i]);
+	unsent.clear();
+}
+
+bool LosslessEncoder::waitForRoom(int bytes)
+{
+	while (!stopRequest.load())
+	{
+		int64_t queued = output->getQueuedBytes();
+		if ((queued == 0 || queued + bytes <= output->getMaxBytes()) &&
+			output->getNumEntries() < output->getCapacity() - 1)
+			return true;
+		std::this_thread::sleep_for(std::chrono::microseconds(200));
+	}
+	return false;
+}
+
+/// <summary>
+/// Worker thread. The drops happen in the callback, on the input queue, the worker never
+/// drops: MemBlockPool::recycle is callback only, release is the transmit side's.
+/// After stop, the blocks not passed on are left to empty()
+/// </summary>
+void LosslessEncoder::run()
+{
+	const int c_batch = 16;
+	MemBlock* batch[c_batch];
+	while (!stopRequest.load())
+	{
+		int n = input.waitDequeueBatchFor(batch, c_batch, 100000);
+		for (int i = 0; i < n; i++)
+		{
+			MemBlock* mb = batch[i];
+			std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+			int maxBytes = LosslessCodec::maxFrameBytes(mb->numSamples);
+			if ((int)frame.size() < maxBytes)
+				frame.resize(maxBytes);
+			// the samples follow the frame header of the framed mode, if reserved
+			BYTE* iq = mb->Mem + mb->headerLength;
+			int length = LosslessCodec::encode(iq, mb->numSamples, mb->firstSampleNum, &frame[0]);
+			memcpy(iq, &frame[0], length);
+			rawBytes += mb->length - mb->headerLength;
+			codedBytes += length;
+			codedSamples += mb->numSamples;
+			mb->length = mb->headerLength + length;
+			busySeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+			while (!output->tryPush(mb))
+			{
+				if (!waitForRoom(mb->length))
+				{
+					unsent.push_back(mb);
+					break;
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,137 @@
+/**
+** RSP3_tcp - TCP/IP I/Q Data Server for the sdrplay RSP devices
+** Copyright (C) 2017-2024 Clem Schmidt, softsyst, http://qirx.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#include "MemBlockPool.h"
+#include <iostream>
+using namespace std;
+
+MemBlockPool::MemBlockPool(int maxBlocks) : freeQ(maxBlocks)
+{
+	blockBytes.store(0);
+	allocations.store(0);
+}
+
+MemBlockPool::~MemBlockPool()
+{
+	MemBlock* mb;
+	while (freeQ.dequeueBatch(&mb, 1) > 0)
+		delete mb;
+	for (size_t i = 0; i < spare.size(); i++)
+		delete spare[i];
+	spare.clear();
+}
+
+MemBlock* MemBlockPool::allocate(int bytes)
+{
+	allocations++;
+	return new MemBlock(bytes);
+}
+
+/// <summary>
+/// Sizes the pool for the current sampling configuration.
+/// Blocks already in the pool are kept if they are large enough,
+/// so the pool only grows if the sampling rate or the bit width require it.
+/// </summary>
+void MemBlockPool::prepare(int bytes, int numBlocks)
+{
+	if (numBlocks > freeQ.getCapacity())
+		numBlocks = freeQ.getCapacity();
+	if (bytes > blockBytes.load())
+		blockBytes.store(bytes);
+	int cap = blockBytes.load();
+
+	// the callback is stopped, so the free Q may be consumed here
+	std::vector<MemBlock*> keep;
+	keep.reserve(numBlocks);
+	MemBlock* mb;
+	while (freeQ.dequeueBatch(&mb, 1) > 0)
+		spare.push_back(mb);
+	for (size_t i = 0; i < spare.size(); i++)
+	{
+		if (spare[i]->capacity >= cap && (int)keep.size() < numBlocks)
+			keep.push_back(spare[i]);
+		else
+			delete spare[i];
+	}
+	spare.swap(keep);
+
+	uint64_t before = allocations.load();
+	while ((int)spare.size() < numBlocks)
+		spare.push_back(allocate(cap));
+
+	std::cout << "MemBlock pool: " << spare.size() << " blocks of " << cap << " bytes, "
+		<< allocations.load() - before << " newly allocated, "
+		<< allocations.load() << " heap allocations in total" << endl;
+}
+
+MemBlock* MemBlockPool::acquire(int bytes)
+{
+	MemBlock* mb = 0;
+	if (!spare.empty())
+	{
+		mb = spare.back();
+		spare.pop_back();
+	}
+	else if (freeQ.dequeueBatch(&mb, 1) == 0)
+		mb = 0;
+
+	if (mb != 0 && mb->capacity < bytes)
+	{
+		delete mb;
+		mb = 0;
+	}
+	if (mb == 0)
+	{
+		if (exhaustedCount++ % 1000 == 0)
+			std::cout << "MemBlock pool exhausted or too small, allocating " << bytes << " bytes" << endl;
+		if (bytes > blockBytes.load())
+			blockBytes.store(bytes);
+		mb = allocate(blockBytes.load());
+	}
+	mb->length = 0;
+	mb->numSamples = 0;
+	mb->firstSampleNum = 0;
+	mb->sampleIndex = 0;
+	mb->headerLength = 0;
+	mb->flags = 0;
+	mb->refs = 1;
+	return mb;
+}
+
+void MemBlockPool::release(MemBlock* mb)
+{
+	if (mb == 0)
+		return;
+	if (--mb->refs > 0)
+		return;		// still read by another client or kept in the ring
+	if (mb->capacity < blockBytes.load() || !freeQ.tryEnqueue(mb))
+		delete mb;
+}
+
+void MemBlockPool::recycle(MemBlock* mb)
+{
+	if (mb == 0)
+		return;
+	// spare never grows beyond its capacity from prepare, so this doesn't allocate
+	if (mb->capacity < blockBytes.load() || spare.size() >= spare.capacity())
+		delete mb;
+	else
+		spare.push_back(mb);
+}
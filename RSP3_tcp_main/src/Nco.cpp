@@ -0,0 +1,236 @@
+/**
+** RSP3_tcp - TCP/IP I/Q Data Server for the sdrplay RSP devices
+** Copyright (C) 2017-2024 Clem Schmidt, softsyst, http://qirx.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#include "Nco.h"
+#include <math.h>
+#include <iostream>
+using namespace std;
+
+mixFn Nco::kernel = Nco::mix_scalar;
+const char* Nco::kernelName = "scalar";
+
+static const double c_twoPi = 6.28318530717958647692;
+static const double c_phaseToRad = c_twoPi / 4294967296.0;
+
+void Nco::setFrequency(double cyclesPerSample)
+{
+	long long inc = (long long)floor(cyclesPerSample * 4294967296.0 + 0.5);
+	increment.store((uint32_t)inc, std::memory_order_relaxed);
+}
+
+void Nco::mix(const short* xi, const short* xq, int n, float* outI, float* outQ)
+{
+	uint32_t inc = increment.load(std::memory_order_relaxed);
+	float rotI[8], rotQ[8];
+	for (int k = 0; k < 8; k++)
+	{
+		double a = -c_phaseToRad * (uint32_t)(phase + k * inc);
+		rotI[k] = (float)cos(a);
+		rotQ[k] = (float)sin(a);
+	}
+	double s = -c_phaseToRad * (uint32_t)(8 * inc);
+	int groups = n & ~7;
+	kernel(xi, xq, groups, outI, outQ, rotI, rotQ, (float)cos(s), (float)sin(s));
+	for (int k = 0; groups + k < n; k++)
+	{
+		float i = xi[groups + k];
+		float q = xq[groups + k];
+		outI[groups + k] = i * rotI[k] - q * rotQ[k];
+		outQ[groups + k] = i * rotQ[k] + q * rotI[k];
+	}
+	phase += (uint32_t)n * inc;
+}
+
+void Nco::mix_scalar(const short* xi, const short* xq, int n, float* outI, float* outQ,
+	float* rotI, float* rotQ, float stepI, float stepQ)
+{
+	for (int j = 0; j < n; j += 8)
+	{
+		for (int k = 0; k < 8; k++)
+		{
+			float i = xi[j + k];
+			float q = xq[j + k];
+			outI[j + k] = i * rotI[k] - q * rotQ[k];
+			outQ[j + k] = i * rotQ[k] + q * rotI[k];
+			float ri = rotI[k] * stepI - rotQ[k] * stepQ;
+			rotQ[k] = rotI[k] * stepQ + rotQ[k] * stepI;
+			rotI[k] = ri;
+		}
+	}
+}
+
+#ifdef IQ_X86
+void Nco::mix_sse2(const short* xi, const short* xq, int n, float* outI, float* outQ,
+	float* rotI, float* rotQ, float stepI, float stepQ)
+{
+	__m128 ri[2] = { _mm_loadu_ps(rotI), _mm_loadu_ps(rotI + 4) };
+	__m128 rq[2] = { _mm_loadu_ps(rotQ), _mm_loadu_ps(rotQ + 4) };
+	__m128 si = _mm_set1_ps(stepI);
+	__m128 sq = _mm_set1_ps(stepQ);
+	for (int j = 0; j < n; j += 8)
+	{
+		__m128i vi = _mm_loadu_si128((const __m128i*)(xi + j));
+		__m128i vq = _mm_loadu_si128((const __m128i*)(xq + j));
+		// sign extension of the shorts
+		__m128 fi[2] = { _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(vi, vi), 16)),
+			_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(vi, vi), 16)) };
+		__m128 fq[2] = { _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(vq, vq), 16)),
+			_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(vq, vq), 16)) };
+		for (int h = 0; h < 2; h++)
+		{
+			_mm_storeu_ps(outI + j + 4 * h, _mm_sub_ps(_mm_mul_ps(fi[h], ri[h]), _mm_mul_ps(fq[h], rq[h])));
+			_mm_storeu_ps(outQ + j + 4 * h, _mm_add_ps(_mm_mul_ps(fi[h], rq[h]), _mm_mul_ps(fq[h], ri[h])));
+			__m128 t = _mm_sub_ps(_mm_mul_ps(ri[h], si), _mm_mul_ps(rq[h], sq));
+			rq[h] = _mm_add_ps(_mm_mul_ps(ri[h], sq), _mm_mul_ps(rq[h], si));
+			ri[h] = t;
+		}
+	}
+	_mm_storeu_ps(rotI, ri[0]);
+	_mm_storeu_ps(rotI + 4, ri[1]);
+	_mm_storeu_ps(rotQ, rq[0]);
+	_mm_storeu_ps(rotQ + 4, rq[1]);
+}
+
+IQ_TARGET_AVX2
+void Nco::mix_avx2(const short* xi, const short* xq, int n, float* outI, float* outQ,
+	float* rotI, float* rotQ, float stepI, float stepQ)
+{
+	__m256 ri = _mm256_loadu_ps(rotI);
+	__m256 rq = _mm256_loadu_ps(rotQ);
+	__m256 si = _mm256_set1_ps(stepI);
+	__m256 sq = _mm256_set1_ps(stepQ);
+	for (int j = 0; j < n; j += 8)
+	{
+		__m256 fi = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(xi + j))));
+		__m256 fq = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(xq + j))));
+		_mm256_storeu_ps(outI + j, _mm256_sub_ps(_mm256_mul_ps(fi, ri), _mm256_mul_ps(fq, rq)));
+		_mm256_storeu_ps(outQ + j, _mm256_add_ps(_mm256_mul_ps(fi, rq), _mm256_mul_ps(fq, ri)));
+		__m256 t = _mm256_sub_ps(_mm256_mul_ps(ri, si), _mm256_mul_ps(rq, sq));
+		rq = _mm256_add_ps(_mm256_mul_ps(ri, sq), _mm256_mul_ps(rq, si));
+		ri = t;
+	}
+	_mm256_storeu_ps(rotI, ri);
+	_mm256_storeu_ps(rotQ, rq);
+}
+#else
+void Nco::mix_sse2(const short* xi, const short* xq, int n, float* outI, float* outQ,
+	float* rotI, float* rotQ, float stepI, float stepQ)
+{
+	mix_scalar(xi, xq, n, outI, outQ, rotI, rotQ, stepI, stepQ);
+}
+void Nco::mix_avx2(const short* xi, const short* xq, int n, float* outI, float* outQ,
+	float* rotI, float* rotQ, float stepI, float stepQ)
+{
+	mix_scalar(xi, xq, n, outI, outQ, rotI, rotQ, stepI, stepQ);
+}
+#endif
+
+#ifdef IQ_NEON
+void Nco::mix_neon(const short* xi, const short* xq, int n, float* outI, float* outQ,
+	float* rotI, float* rotQ, float stepI, float stepQ)
+{
+	float32x4_t ri[2] = { vld1q_f32(rotI), vld1q_f32(rotI + 4) };
+	float32x4_t rq[2] = { vld1q_f32(rotQ), vld1q_f32(rotQ + 4) };
+	for (int j = 0; j < n; j += 8)
+	{
+		int16x8_t vi = vld1q_s16(xi + j);
+		int16x8_t vq = vld1q_s16(xq + j);
+		float32x4_t fi[2] = { vcvtq_f32_s32(vmovl_s16(vget_low_s16(vi))), vcvtq_f32_s32(vmovl_s16(vget_high_s16(vi))) };
+		float32x4_t fq[2] = { vcvtq_f32_s32(vmovl_s16(vget_low_s16(vq))), vcvtq_f32_s32(vmovl_s16(vget_high_s16(vq))) };
+		for (int h = 0; h < 2; h++)
+		{
+			vst1q_f32(outI + j + 4 * h, vmlsq_f32(vmulq_f32(fi[h], ri[h]), fq[h], rq[h]));
+			vst1q_f32(outQ + j + 4 * h, vmlaq_f32(vmulq_f32(fi[h], rq[h]), fq[h], ri[h]));
+			float32x4_t t = vmlsq_n_f32(vmulq_n_f32(ri[h], stepI), rq[h], stepQ);
+			rq[h] = vmlaq_n_f32(vmulq_n_f32(ri[h], stepQ), rq[h], stepI);
+			ri[h] = t;
+		}
+	}
+	vst1q_f32(rotI, ri[0]);
+	vst1q_f32(rotI + 4, ri[1]);
+	vst1q_f32(rotQ, rq[0]);
+	vst1q_f32(rotQ + 4, rq[1]);
+}
+#else
+void Nco::mix_neon(const short* xi, const short* xq, int n, float* outI, float* outQ,
+	float* rotI, float* rotQ, float stepI, float stepQ)
+{
+	mix_scalar(xi, xq, n, outI, outQ, rotI, rotQ, stepI, stepQ);
+}
+#endif
+
+/// <summary>
+/// Uses the widest mixing kernel of the CPU, if it matches the scalar one
+/// </summary>
+void Nco::init()
+{
+	mixFn k = mix_scalar;
+	const char* name = "scalar";
+#ifdef IQ_X86
+	if (iqConvert::hasAvx2())
+	{
+		k = mix_avx2;
+		name = "AVX2";
+	}
+	else if (iqConvert::hasSse2())
+	{
+		k = mix_sse2;
+		name = "SSE2";
+	}
+#endif
+#ifdef IQ_NEON
+	k = mix_neon;
+	name = "NEON";
+#endif
+	if (k != mix_scalar)
+	{
+		const int n = 64;
+		short xi[n], xq[n];
+		float ri[2][8], rq[2][8], oi[2][n], oq[2][n];
+		for (int i = 0; i < n; i++)
+		{
+			xi[i] = (short)(i * 997 - 32000);
+			xq[i] = (short)(30000 - i * 911);
+		}
+		for (int j = 0; j < 2; j++)
+		{
+			for (int i = 0; i < 8; i++)
+			{
+				ri[j][i] = (float)cos(0.3 * i);
+				rq[j][i] = (float)sin(0.3 * i);
+			}
+		}
+		mix_scalar(xi, xq, n, oi[0], oq[0], ri[0], rq[0], (float)cos(2.4), (float)sin(2.4));
+		k(xi, xq, n, oi[1], oq[1], ri[1], rq[1], (float)cos(2.4), (float)sin(2.4));
+		for (int i = 0; i < n; i++)
+		{
+			if (fabs(oi[0][i] - oi[1][i]) > 0.1f || fabs(oq[0][i] - oq[1][i]) > 0.1f)
+			{
+				std::cout << "*** Mixing kernel " << name << " differs from the reference, using the scalar kernel" << endl;
+				k = mix_scalar;
+				name = "scalar";
+				break;
+			}
+		}
+	}
+	kernel = k;
+	kernelName = name;
+	std::cout << "Mixing kernel: " << kernelName << endl;
+}
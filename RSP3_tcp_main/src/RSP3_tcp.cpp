@@ -32,6 +32,9 @@
 #include "rsp_cmdLineArgs.h"
 #include "devices.h"
 #include "sdrGainTable.h"
+#include "iqConvert.h"
+#include "Decimator.h"
+#include "benchmark.h"
 #ifndef _WIN32
 #include <signal.h>
 #endif
@@ -57,7 +60,6 @@ using namespace std;
 string Version = "0.3.13";
 
 bool exitRequest = false;
-pthread_mutex_t stateLock;
 
 map<eErrors, string> returnErrorStrings =
 {
@@ -158,10 +160,47 @@ int main(int argc, char* argv[])
 	std::cout << "Tuner = " + to_string(pargs->Tuner) << endl;
 	std::cout << "Master = " + to_string(pargs->Master) << endl;
 	std::cout << "Basic Mode (rtl_tcp compatible) = " + to_string(pargs->BasicMode) << endl;
+	std::cout << "Max Bytes per Transmit = " + to_string(pargs->MaxSendBytes) << endl;
+	std::cout << "Max Transmit Latency (us) = " + to_string(pargs->MaxSendLatencyUs) << endl;
+	std::cout << "Max Queued Bytes = " + to_string(pargs->MaxQueueBytes) << endl;
+	std::cout << "Overload Policy = " + to_string(pargs->OverloadPolicy) << endl;
+	std::cout << "Zero Copy Transmit = " + to_string(pargs->ZeroCopy) << endl;
+	std::cout << "IQ Correction = " + to_string(pargs->IqCorrection) << endl;
+	std::cout << "Adaptive 8 Bit Scaling = " + to_string(pargs->AutoScale8) << endl;
+	std::cout << "Requantization = " + to_string(pargs->Requantization) << endl;
+	std::cout << "Framed Stream = " + to_string(pargs->Framed) << endl;
+	if (pargs->UdpPort != 0)
+		std::cout << "UDP Stream = " << pargs->UdpAddress << ":" << pargs->UdpPort << ", MTU " << pargs->UdpMtu
+			<< ", Pacing " << pargs->UdpPacing << "%" << endl;
+	if (pargs->ShmMBytes != 0)
+		std::cout << "Shared Memory Ring (MB) = " + to_string(pargs->ShmMBytes) << endl;
+	std::cout << "Max Clients = " + to_string(pargs->MaxClients) << endl;
+	if (pargs->ControlAddress != "")
+		std::cout << "Tuning Authority = " + pargs->ControlAddress << endl;
+	if (pargs->ChannelizerBins != 0)
+	{
+		std::cout << "Channelizer Bins = " + to_string(pargs->ChannelizerBins) << ", Channels =";
+		for (size_t i = 0; i < pargs->Channels.size(); i++)
+			std::cout << " " << pargs->Channels[i];
+		std::cout << endl;
+	}
+	if (pargs->SpectrumSize != 0)
+		std::cout << "Spectrum = " << pargs->SpectrumSize << " bins, " << pargs->SpectrumOverlap << "% overlap, "
+			<< pargs->SpectrumAverages << " averages, " << pargs->SpectrumRate << " frames/s" << endl;
 
 	std::cout << "\nStarting sdrplay...\n";
 
-	pthread_mutex_init(&stateLock, NULL);
+	iqConvert::init();
+	Decimator::init();
+	Nco::init();
+
+	if (pargs->Benchmark != "")
+	{
+		retCode = benchmark::run(pargs->Benchmark, pargs) == 0 ? E_OK : E_PARAMETER;
+		if (retCode == E_OK)
+			delete pargs;
+		goto exitapp;
+	}
 
 	gainConfiguration::createGainConfigTables();
 	gainConfiguration::createGainConfigTable_RSP1B();
@@ -252,7 +291,6 @@ exitapp:
 #ifdef _WIN32
 	WSACleanup();
 #endif
-	pthread_mutex_destroy(&stateLock);
 
 	return retCode;
 
@@ -0,0 +1,269 @@
+/**
+** RSP3_tcp - TCP/IP I/Q Data Server for the sdrplay RSP devices
+** Copyright (C) 2017-2024 Clem Schmidt, softsyst, http://qirx.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#include "Reactor.h"
+#include <errno.h>
+#include <string.h>
+#include <iostream>
+#ifdef REACTOR_EPOLL
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+using namespace std;
+
+#ifdef _WIN32
+typedef WSAPOLLFD reactorPollFd;
+#define poll_sockets WSAPoll
+#elif !defined(REACTOR_EPOLL)
+typedef struct pollfd reactorPollFd;
+#define poll_sockets ::poll
+#endif
+
+Reactor::Reactor()
+{
+}
+
+Reactor::~Reactor()
+{
+#ifdef REACTOR_EPOLL
+	if (epfd >= 0)
+		close(epfd);
+#endif
+	if (wakeRx != INVALID_SOCKET)
+		closesocket(wakeRx);
+}
+
+bool Reactor::init()
+{
+#ifdef REACTOR_EPOLL
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0)
+	{
+		std::cout << "epoll_create1 failed: " << common::getSocketErrorString() << endl;
+		return false;
+	}
+	wakeRx = wakeTx = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (wakeRx < 0)
+	{
+		std::cout << "eventfd failed: " << common::getSocketErrorString() << endl;
+		wakeRx = wakeTx = INVALID_SOCKET;
+		return false;
+	}
+#else
+	// a UDP socket connected to itself, datagrams sent to it wake up the poll
+	wakeRx = wakeTx = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (wakeRx == INVALID_SOCKET)
+		return false;
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = 0;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t len = sizeof(addr);
+	if (::bind(wakeRx, (struct sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR ||
+		getsockname(wakeRx, (struct sockaddr*)&addr, &len) == SOCKET_ERROR ||
+		connect(wakeRx, (struct sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR)
+	{
+		std::cout << "Reactor wakeup socket failed: " << common::getSocketErrorString() << endl;
+		return false;
+	}
+	common::setNonBlocking(wakeRx, true);
+#endif
+	return add(wakeRx, EV_READ);
+}
+
+bool Reactor::add(SOCKET s, int events)
+{
+#ifdef REACTOR_EPOLL
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = ((events & EV_READ) ? (uint32_t)EPOLLIN : (uint32_t)0) | ((events & EV_WRITE) ? (uint32_t)EPOLLOUT : (uint32_t)0);
+	ev.data.fd = s;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, s, &ev) != 0)
+	{
+		std::cout << "epoll_ctl add failed: " << common::getSocketErrorString() << endl;
+		return false;
+	}
+#else
+	watched w;
+	w.s = s;
+	w.events = events;
+	sockets.push_back(w);
+#endif
+	// the socket number may be reused from one just removed
+	for (size_t i = 0; i < removed.size(); i++)
+		if (removed[i] == s)
+			removed[i] = INVALID_SOCKET;
+	return true;
+}
+
+bool Reactor::modify(SOCKET s, int events)
+{
+#ifdef REACTOR_EPOLL
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = ((events & EV_READ) ? (uint32_t)EPOLLIN : (uint32_t)0) | ((events & EV_WRITE) ? (uint32_t)EPOLLOUT : (uint32_t)0);
+	ev.data.fd = s;
+	return epoll_ctl(epfd, EPOLL_CTL_MOD, s, &ev) == 0;
+#else
+	for (size_t i = 0; i < sockets.size(); i++)
+	{
+		if (sockets[i].s == s)
+		{
+			sockets[i].events = events;
+			return true;
+		}
+	}
+	return false;
+#endif
+}
+
+void Reactor::remove(SOCKET s)
+{
+#ifdef REACTOR_EPOLL
+	struct epoll_event ev;	// non-null for kernels before 2.6.9
+	epoll_ctl(epfd, EPOLL_CTL_DEL, s, &ev);
+#else
+	for (size_t i = 0; i < sockets.size(); i++)
+	{
+		if (sockets[i].s == s)
+		{
+			sockets.erase(sockets.begin() + i);
+			break;
+		}
+	}
+#endif
+	if (dispatching)
+		removed.push_back(s);
+}
+
+bool Reactor::isRemoved(SOCKET s) const
+{
+	for (size_t i = 0; i < removed.size(); i++)
+		if (removed[i] == s)
+			return true;
+	return false;
+}
+
+void Reactor::wakeup()
+{
+	if (wakePending.exchange(true))
+		return;
+#ifdef REACTOR_EPOLL
+	uint64_t one = 1;
+	if (write(wakeTx, &one, sizeof(one)) < 0)
+	{
+		// EAGAIN: the counter is pending anyway
+	}
+#else
+	char one = 1;
+	send(wakeTx, &one, 1, 0);
+#endif
+}
+
+void Reactor::drainWakeup()
+{
+#ifdef REACTOR_EPOLL
+	uint64_t count;
+	if (read(wakeRx, &count, sizeof(count)) < 0)
+	{
+		// EAGAIN: nothing pending
+	}
+#else
+	char buf[16];
+	while (recv(wakeRx, buf, sizeof(buf), 0) > 0)
+		;
+#endif
+	// cleared before the handler runs, a wakeup during onWakeup is not lost
+	wakePending.store(false);
+}
+
+int Reactor::poll(ReactorHandler* handler, int timeoutMs)
+{
+	int numReady = 0;
+	bool woken = false;
+	removed.clear();
+	dispatching = true;
+#ifdef REACTOR_EPOLL
+	struct epoll_event events[c_maxEvents];
+	int n = epoll_wait(epfd, events, c_maxEvents, timeoutMs);
+	if (n < 0)
+	{
+		dispatching = false;
+		return errno == EINTR ? 0 : -1;
+	}
+	for (int i = 0; i < n; i++)
+	{
+		SOCKET s = events[i].data.fd;
+		if (s == wakeRx)
+		{
+			woken = true;
+			continue;
+		}
+		if (isRemoved(s))
+			continue;
+		uint32_t e = events[i].events;
+		int ev = ((e & EPOLLIN) ? EV_READ : 0) | ((e & EPOLLOUT) ? EV_WRITE : 0) |
+			((e & (EPOLLERR | EPOLLHUP)) ? EV_ERROR : 0);
+		numReady++;
+		handler->onEvent(s, ev);
+	}
+#else
+	// the set may change in the handler, so a copy is polled
+	std::vector<reactorPollFd> fds(sockets.size());
+	for (size_t i = 0; i < sockets.size(); i++)
+	{
+		fds[i].fd = sockets[i].s;
+		fds[i].events = ((sockets[i].events & EV_READ) ? POLLIN : 0) | ((sockets[i].events & EV_WRITE) ? POLLOUT : 0);
+		fds[i].revents = 0;
+	}
+	int n = poll_sockets(&fds[0], (unsigned long)fds.size(), timeoutMs);
+	if (n < 0)
+	{
+		dispatching = false;
+		return errno == EINTR ? 0 : -1;
+	}
+	for (size_t i = 0; i < fds.size() && n > 0; i++)
+	{
+		short e = fds[i].revents;
+		if (e == 0)
+			continue;
+		SOCKET s = fds[i].fd;
+		if (s == wakeRx)
+		{
+			woken = true;
+			continue;
+		}
+		if (isRemoved(s))
+			continue;
+		int ev = ((e & POLLIN) ? EV_READ : 0) | ((e & POLLOUT) ? EV_WRITE : 0) |
+			((e & (POLLERR | POLLHUP | POLLNVAL)) ? EV_ERROR : 0);
+		numReady++;
+		handler->onEvent(s, ev);
+	}
+#endif
+	dispatching = false;
+	if (woken)
+	{
+		drainWakeup();
+		handler->onWakeup();
+	}
+	return numReady;
+}
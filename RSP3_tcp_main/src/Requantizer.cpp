@@ -0,0 +1,151 @@
+/**
+** RSP3_tcp - TCP/IP I/Q Data Server for the sdrplay RSP devices
+** Copyright (C) 2017-2024 Clem Schmidt, softsyst, http://qirx.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#include "Requantizer.h"
+
+// The converters: 8 bit: (x >> 8) + 128, 8 bit ADS-B: x / 64 + 127,
+// 4 bit: the high nibble of x / 64 + 127, which the clients read back as (nibble << 4)
+const Requantizer::levels Requantizer::formats[3] =
+{
+	{ 1024.0f, 127.0f / 16, 0, 15, 1024, -64 * 119 },
+	{ 256.0f, 0.0f, -128, 127, 256, 0 },
+	{ 64.0f, 0.0f, -127, 128, 64, 0 },
+};
+
+Requantizer::Requantizer()
+{
+	for (int j = 0; j < 8; j++)
+		rng[j] = 0x9e3779b9u * (j + 1);
+	errI[0] = errI[1] = errQ[0] = errQ[1] = 0;
+}
+
+void Requantizer::setFormat(eBitWidth bitWidth, bool adsbMode)
+{
+	int f = -1;
+	if (bitWidth == BITS_4)
+		f = 0;
+	else if (bitWidth == BITS_8)
+		f = adsbMode ? 2 : 1;
+	format.store(f, std::memory_order_relaxed);
+}
+
+/// <summary>
+/// TPDF dither in output LSB, the difference of two uniform numbers from one 32 bit
+/// xorshift output
+/// </summary>
+void Requantizer::fillDither(int n)
+{
+	int n8 = (n + 7) & ~7;
+	if ((int)ditherI.size() < n8)
+	{
+		ditherI.resize(n8);
+		ditherQ.resize(n8);
+	}
+	uint32_t s[8];
+	for (int j = 0; j < 8; j++)
+		s[j] = rng[j];
+	const float scale = 1.0f / 65536;
+	for (int i = 0; i < n8; i += 8)
+	{
+		for (int j = 0; j < 8; j++)
+		{
+			uint32_t x = s[j];
+			x ^= x << 13;
+			x ^= x >> 17;
+			x ^= x << 5;
+			ditherI[i + j] = ((int)(x >> 16) - (int)(x & 0xffff)) * scale;
+			x ^= x << 13;
+			x ^= x >> 17;
+			x ^= x << 5;
+			ditherQ[i + j] = ((int)(x >> 16) - (int)(x & 0xffff)) * scale;
+			s[j] = x;
+		}
+	}
+	for (int j = 0; j < 8; j++)
+		rng[j] = s[j];
+}
+
+void Requantizer::process(const short* xi, const short* xq, int numSamples, const short*& outI, const short*& outQ)
+{
+	if ((int)outBufI.size() < numSamples)
+	{
+		outBufI.resize(numSamples);
+		outBufQ.resize(numSamples);
+	}
+	outI = &outBufI[0];
+	outQ = &outBufQ[0];
+	int f = format.load(std::memory_order_relaxed);
+	if (numSamples == 0 || f < 0)
+		return;
+	const levels& lv = formats[f];
+	fillDither(numSamples);
+
+	const float inv = 1.0f / lv.step;
+	const float bias = lv.bias + 0.5f;	// round by truncation
+	// keeps the argument of the truncation positive
+	const float lift = 4096.0f;
+	short* oI = &outBufI[0];
+	short* oQ = &outBufQ[0];
+	const float* dI = &ditherI[0];
+	const float* dQ = &ditherQ[0];
+
+	if (mode == RQ_DITHER)
+	{
+		for (int i = 0; i < numSamples; i++)
+		{
+			int li = (int)(xi[i] * inv + bias + dI[i] + lift) - (int)lift;
+			int lq = (int)(xq[i] * inv + bias + dQ[i] + lift) - (int)lift;
+			li = li < lv.lo ? lv.lo : li > lv.hi ? lv.hi : li;
+			lq = lq < lv.lo ? lv.lo : lq > lv.hi ? lv.hi : lq;
+			oI[i] = (short)(lv.mul * li + lv.add);
+			oQ[i] = (short)(lv.mul * lq + lv.add);
+		}
+		return;
+	}
+
+	// error feedback: v = u - h1 * e[n-1] - h2 * e[n-2], e = level - v
+	const float h1 = mode == RQ_SHAPE1 ? 1.0f : 2.0f;
+	const float h2 = mode == RQ_SHAPE1 ? 0.0f : -1.0f;
+	float eI1 = errI[0], eI2 = errI[1], eQ1 = errQ[0], eQ2 = errQ[1];
+	for (int i = 0; i < numSamples; i++)
+	{
+		float vi = xi[i] * inv + lv.bias - h1 * eI1 - h2 * eI2;
+		float vq = xq[i] * inv + lv.bias - h1 * eQ1 - h2 * eQ2;
+		int li = (int)(vi + 0.5f + dI[i] + lift) - (int)lift;
+		int lq = (int)(vq + 0.5f + dQ[i] + lift) - (int)lift;
+		li = li < lv.lo ? lv.lo : li > lv.hi ? lv.hi : li;
+		lq = lq < lv.lo ? lv.lo : lq > lv.hi ? lv.hi : lq;
+		// limited, a clipped level must not drive the loop unstable
+		float ei = li - vi;
+		float eq = lq - vq;
+		ei = ei < -1.5f ? -1.5f : ei > 1.5f ? 1.5f : ei;
+		eq = eq < -1.5f ? -1.5f : eq > 1.5f ? 1.5f : eq;
+		eI2 = eI1;
+		eI1 = ei;
+		eQ2 = eQ1;
+		eQ1 = eq;
+		oI[i] = (short)(lv.mul * li + lv.add);
+		oQ[i] = (short)(lv.mul * lq + lv.add);
+	}
+	errI[0] = eI1;
+	errI[1] = eI2;
+	errQ[0] = eQ1;
+	errQ[1] = eQ2;
+}
@@ -0,0 +1,151 @@
+/**
+** RSP3_tcp - TCP/IP I/Q Data Server for the sdrplay RSP devices
+** Copyright (C) 2017-2024 Clem Schmidt, softsyst, http://qirx.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#include "Resampler.h"
+#include <algorithm>
+#include <iostream>
+using namespace std;
+
+static int gcd(int a, int b)
+{
+	while (b != 0)
+	{
+		int t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+Resampler::Resampler()
+{
+}
+
+bool Resampler::configure(int u, int d)
+{
+	up = down = 1;
+	numPhaseTaps = 0;
+	bank.clear();
+	if (u <= 0 || d <= 0)
+		return false;
+	int g = gcd(u, d);
+	u /= g;
+	d /= g;
+	if (u == d)
+		return true;
+	if (u > c_maxUp)
+	{
+		std::cout << "*** Resampling " << u << "/" << d << ": interpolation factor too large, max " << c_maxUp << endl;
+		return false;
+	}
+	up = u;
+	down = d;
+
+	// cycles per sample at up times the input rate: passband edge 0.4, stopband edge 0.6
+	// of the lower rate
+	double lower = up < down ? 1.0 / down : 1.0 / up;
+	double tw = 0.2 * lower;
+	int numTaps = Decimator::kaiserTaps(tw);
+	numTaps = ((numTaps + up - 1) / up) * up;
+	std::vector<float> h;
+	Decimator::designLowpass(numTaps, 0.5 * lower, h);
+
+	// phase p gets taps p, p + up, ..., tap k applies to the k-th newest input sample
+	int k = numTaps / up;
+	numPhaseTaps = (k + 7) & ~7;
+	bank.assign((size_t)up * numPhaseTaps, 0.0f);
+	for (int p = 0; p < up; p++)
+	{
+		float* taps = &bank[(size_t)p * numPhaseTaps];
+		for (int j = 0; j < k; j++)
+			taps[numPhaseTaps - 1 - j] = h[p + j * up] * up;	// the gain lost by the zero stuffing
+	}
+	std::cout << "Resampling by " << up << "/" << down << ": " << up << " phases of " << numPhaseTaps
+		<< " taps, kernel " << Decimator::getKernelName() << endl;
+	reserve(c_chunk);
+	reset();
+	return true;
+}
+
+void Resampler::reserve(int numSamples)
+{
+	bufI.resize(numPhaseTaps - 1 + c_chunk);
+	bufQ.resize(numPhaseTaps - 1 + c_chunk);
+	int maxOut = maxOutput(numSamples);
+	if ((int)outBufI.size() < maxOut)
+	{
+		outBufI.resize(maxOut);
+		outBufQ.resize(maxOut);
+	}
+}
+
+void Resampler::reset()
+{
+	std::fill(bufI.begin(), bufI.end(), 0.0f);
+	std::fill(bufQ.begin(), bufQ.end(), 0.0f);
+	pos = numPhaseTaps - 1;
+	phase = 0;
+}
+
+int Resampler::process(const short* xi, const short* xq, int numSamples, const short*& outI, const short*& outQ)
+{
+	// only if the callback delivers more than ever before
+	if ((int)outBufI.size() < maxOutput(numSamples))
+		reserve(numSamples);
+	dotFn dot = Decimator::getKernel();
+	int hist = numPhaseTaps - 1;
+	int total = 0;
+	for (int done = 0; done < numSamples; )
+	{
+		int n = numSamples - done;
+		if (n > c_chunk)
+			n = c_chunk;
+		for (int i = 0; i < n; i++)
+		{
+			bufI[hist + i] = xi[done + i];
+			bufQ[hist + i] = xq[done + i];
+		}
+		done += n;
+		int numBuf = hist + n;
+		while (pos < numBuf)
+		{
+			const float* taps = &bank[(size_t)phase * numPhaseTaps];
+			int start = pos - hist;
+			float vi, vq;
+			dot(&bufI[start], &bufQ[start], taps, numPhaseTaps, vi, vq);
+			outBufI[total] = Decimator::toShort(vi);
+			outBufQ[total] = Decimator::toShort(vq);
+			total++;
+			phase += down;
+			pos += phase / up;
+			phase %= up;
+		}
+		// the newest samples become the history of the next chunk
+		for (int i = 0; i < hist; i++)
+		{
+			bufI[i] = bufI[n + i];
+			bufQ[i] = bufQ[n + i];
+		}
+		pos -= n;
+	}
+	outI = &outBufI[0];
+	outQ = &outBufQ[0];
+	return total;
+}
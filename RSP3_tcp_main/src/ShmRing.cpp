@@ -0,0 +1,186 @@
+/**
+** RSP3_tcp - TCP/IP I/Q Data Server for the sdrplay RSP devices
+** Copyright (C) 2017-2024 Clem Schmidt, softsyst, http://qirx.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#include "ShmRing.h"
+#include "StreamFrame.h"
+#include <string.h>
+#include <iostream>
+#include <new>
+#ifdef SHM_RING
+#include <climits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+using namespace std;
+
+ShmRingWriter::ShmRingWriter()
+{
+}
+
+ShmRingWriter::~ShmRingWriter()
+{
+	destroy();
+}
+
+bool ShmRingWriter::create(int port, int megaBytes)
+{
+#ifdef SHM_RING
+	capacity = 1;
+	while (capacity < (uint32_t)megaBytes * 1048576u)
+		capacity <<= 1;
+	name = objectName(port);
+	mappedBytes = c_headerBytes + (size_t)capacity;
+	// a leftover of a server which did not exit cleanly
+	shm_unlink(name.c_str());
+	int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0660);
+	if (fd < 0)
+	{
+		cout << "shm_open " << name << " failed: " << strerror(errno) << endl;
+		return false;
+	}
+	void* p = MAP_FAILED;
+	if (ftruncate(fd, (off_t)mappedBytes) == 0)
+		p = mmap(0, mappedBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+	{
+		cout << "Cannot map " << name << ": " << strerror(errno) << endl;
+		shm_unlink(name.c_str());
+		return false;
+	}
+	header = new (p) shmRingHeader();
+	data = (BYTE*)p + c_headerBytes;
+	header->version = c_version;
+	header->headerBytes = c_headerBytes;
+	header->capacity = capacity;
+	header->reservePos.store(0);
+	header->writePos.store(0);
+	header->futexSeq.store(0);
+	header->waiters.store(0);
+	std::atomic_thread_fence(std::memory_order_release);
+	memcpy(header->magic, "RSPM", 4);
+	cout << "Shared memory ring " << name << ", " << capacity / 1048576 << " MB" << endl;
+	return true;
+#else
+	cout << "The shared memory ring is not available on this platform" << endl;
+	return false;
+#endif
+}
+
+void ShmRingWriter::destroy()
+{
+#ifdef SHM_RING
+	if (header == 0)
+		return;
+	munmap(header, mappedBytes);
+	shm_unlink(name.c_str());
+	header = 0;
+	data = 0;
+#endif
+}
+
+void ShmRingWriter::beginSession(const BroadcastRing& ring, int format)
+{
+	if (header == 0)
+		return;
+	cursor = ring.end();
+	expectedValid = false;
+	header->format = (uint32_t)format;
+	header->session++;
+}
+
+/// <summary>
+/// Event loop. Never waits: a reader which falls behind by more than the capacity
+/// is overrun and resynchronizes, see client/rspShmReader.h
+/// </summary>
+void ShmRingWriter::onTransmit(const BroadcastRing& ring, double rateHz)
+{
+	if (header == 0)
+		return;
+	if (cursor < ring.begin())
+		cursor = ring.begin();
+	if (cursor == ring.end())
+		return;
+	header->sampleRateHz = (uint32_t)rateHz;
+	while (cursor < ring.end())
+		publish(ring.at(cursor++));
+	// the counter changes also if nobody waits, a reader about to wait sees it
+	header->futexSeq.fetch_add(1);
+	if (header->waiters.load() > 0)
+		wake();
+}
+
+void ShmRingWriter::publish(const MemBlock* mb)
+{
+	const BYTE* payload = mb->Mem + mb->headerLength;
+	uint32_t bytes = (uint32_t)(mb->length - mb->headerLength);
+	uint32_t length = (uint32_t)(sizeof(shmRecord) + bytes + 7) & ~7u;
+	if (length > capacity / 2)
+	{
+		if (oversized++ % 1000 == 0)
+			cout << "Shared memory ring too small for a block of " << bytes << " bytes" << endl;
+		return;
+	}
+	uint64_t pos = header->writePos.load(std::memory_order_relaxed);
+	uint32_t offset = (uint32_t)(pos & (capacity - 1));
+	uint32_t toEnd = capacity - offset;
+	uint64_t next = pos + length + (toEnd < length ? toEnd : 0);
+	// the readers see the bytes as overwritten before they change
+	header->reservePos.store(next, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	if (toEnd < length)
+	{
+		if (toEnd >= sizeof(shmRecord))
+		{
+			shmRecord wrap;
+			memset(&wrap, 0, sizeof(wrap));
+			wrap.length = toEnd;
+			memcpy(data + offset, &wrap, sizeof(wrap));
+		}
+		offset = 0;
+	}
+	shmRecord rec;
+	rec.length = length;
+	rec.payloadBytes = bytes;
+	rec.sampleIndex = mb->sampleIndex;
+	rec.numSamples = (uint32_t)mb->numSamples;
+	rec.format = (uint8_t)header->format;
+	rec.flags = mb->flags;
+	if (expectedValid && mb->sampleIndex != expectedIndex)
+		rec.flags |= FRAME_DISCONTINUITY;
+	expectedIndex = mb->sampleIndex + mb->numSamples;
+	expectedValid = true;
+	rec.reserved = 0;
+	memcpy(data + offset, &rec, sizeof(rec));
+	memcpy(data + offset + sizeof(rec), payload, bytes);
+	header->writePos.store(next, std::memory_order_release);
+}
+
+void ShmRingWriter::wake()
+{
+#ifdef SHM_RING
+	// not FUTEX_PRIVATE_FLAG, the readers are other processes
+	syscall(SYS_futex, &header->futexSeq, FUTEX_WAKE, INT_MAX, 0, 0, 0);
+#endif
+}
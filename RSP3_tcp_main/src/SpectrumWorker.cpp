@@ -0,0 +1,242 @@
+/**
+** RSP3_tcp - TCP/IP I/Q Data Server for the sdrplay RSP devices
+** Copyright (C) 2017-2024 Clem Schmidt, softsyst, http://qirx.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#include <iostream>
+#include <math.h>
+#include <string.h>
+#include "SpectrumWorker.h"
+using namespace std;
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+SpectrumWorker::SpectrumWorker()
+{
+}
+
+SpectrumWorker::~SpectrumWorker()
+{
+	stop();
+	delete fft;
+}
+
+bool SpectrumWorker::configure(int n, int overlapPercent, int numAverages, int rate)
+{
+	size = 0;
+	delete fft;
+	fft = 0;
+	if (n == 0)
+		return true;
+	if (!Fft::isPowerOfTwo(n) || n < c_minSize || n > c_maxSize ||
+		overlapPercent < 0 || overlapPercent > c_maxOverlap ||
+		numAverages < 1 || numAverages > c_maxAverages ||
+		rate < 1 || rate > c_maxFrameRate ||
+		(numAverages - 1) * (n - n * overlapPercent / 100) + n > c_maxSpan)
+	{
+		std::cout << "*** Spectrum: invalid settings " << n << ", " << overlapPercent << "%, "
+			<< numAverages << ", " << rate << "/s" << endl;
+		return false;
+	}
+	hop = n - n * overlapPercent / 100;
+	averages = numAverages;
+	framesPerSec = rate;
+	span = (averages - 1) * hop + n;
+
+	// the blocks of the callback may be written while a frame is copied
+	uint32_t histLen = 65536;
+	while (histLen < 4 * (uint32_t)span)
+		histLen <<= 1;
+	histI.assign(histLen, 0);
+	histQ.assign(histLen, 0);
+	histMask = histLen - 1;
+	written.store(0);
+
+	// Blackman-Harris, 92 dB sidelobes
+	window.resize(n);
+	double sum = 0;
+	for (int i = 0; i < n; i++)
+	{
+		double x = 2 * M_PI * i / n;
+		window[i] = (float)(0.35875 - 0.48829 * cos(x) + 0.14128 * cos(2 * x) - 0.01168 * cos(3 * x));
+		sum += window[i];
+	}
+	scaleDb = (float)(20 * log10(32768.0 * sum));
+
+	fft = new Fft(n);
+	snapI.resize(span);
+	snapQ.resize(span);
+	re.resize(n);
+	im.resize(n);
+	power.resize(n);
+	size = n;
+	std::cout << "Spectrum: " << size << " bins, " << overlapPercent << "% overlap, " << averages
+		<< " averages, " << framesPerSec << " frames/s" << endl;
+	return true;
+}
+
+void SpectrumWorker::setRate(int hz)
+{
+	rateHz.store(hz);
+}
+
+void SpectrumWorker::start(void(*fn)(void*), void* context)
+{
+	if (!isActive() || worker != 0)
+		return;
+	notify = fn;
+	notifyContext = context;
+	stopRequest = false;
+	worker = new std::thread(&SpectrumWorker::run, this);
+}
+
+void SpectrumWorker::stop()
+{
+	if (worker == 0)
+		return;
+	{
+		std::lock_guard<std::mutex> lock(waitMutex);
+		stopRequest = true;
+	}
+	waitCond.notify_one();
+	worker->join();
+	delete worker;
+	worker = 0;
+}
+
+void SpectrumWorker::push(const short* xi, const short* xq, int numSamples)
+{
+	uint64_t w = written.load(std::memory_order_relaxed);
+	uint32_t histLen = histMask + 1;
+	// more than the history holds: only the newest samples
+	if ((uint32_t)numSamples > histLen)
+	{
+		w += numSamples - histLen;
+		xi += numSamples - histLen;
+		xq += numSamples - histLen;
+		numSamples = histLen;
+	}
+	uint32_t pos = (uint32_t)w & histMask;
+	int first = numSamples;
+	if (pos + first > histLen)
+		first = histLen - pos;
+	memcpy(&histI[pos], xi, first * sizeof(short));
+	memcpy(&histQ[pos], xq, first * sizeof(short));
+	memcpy(&histI[0], xi + first, (numSamples - first) * sizeof(short));
+	memcpy(&histQ[0], xq + first, (numSamples - first) * sizeof(short));
+	written.store(w + numSamples, std::memory_order_release);
+}
+
+bool SpectrumWorker::getFrame(uint32_t& seq, std::vector<uint8_t>& out)
+{
+	std::lock_guard<std::mutex> lock(frameMutex);
+	if (frame.empty() || seq == frameSeq)
+		return false;
+	out = frame;
+	seq = frameSeq;
+	return true;
+}
+
+void SpectrumWorker::run()
+{
+	std::chrono::steady_clock::duration period = std::chrono::microseconds(1000000 / framesPerSec);
+	std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+	std::unique_lock<std::mutex> lock(waitMutex);
+	while (!stopRequest)
+	{
+		next += period;
+		if (waitCond.wait_until(lock, next, [this] { return stopRequest; }))
+			break;
+		lock.unlock();
+		bool published = computeFrame();
+		if (published && notify != 0)
+			notify(notifyContext);
+		// no catching up after a stall
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if (now > next + period)
+			next = now;
+		lock.lock();
+	}
+}
+
+static void putInt(uint8_t* p, uint32_t v)
+{
+	p[0] = (uint8_t)(v >> 24);
+	p[1] = (uint8_t)(v >> 16);
+	p[2] = (uint8_t)(v >> 8);
+	p[3] = (uint8_t)v;
+}
+
+bool SpectrumWorker::computeFrame()
+{
+	uint64_t w = written.load(std::memory_order_acquire);
+	if (w < (uint64_t)span)
+		return false;
+	uint64_t start = w - span;
+	for (int i = 0; i < span; i++)
+	{
+		uint32_t pos = (uint32_t)(start + i) & histMask;
+		snapI[i] = histI[pos];
+		snapQ[i] = histQ[pos];
+	}
+	// the callback overwrote the oldest samples while they were copied
+	if (written.load(std::memory_order_acquire) - start > histMask + 1)
+		return false;
+
+	for (int k = 0; k < size; k++)
+		power[k] = 0;
+	for (int a = 0; a < averages; a++)
+	{
+		const short* xi = &snapI[a * hop];
+		const short* xq = &snapQ[a * hop];
+		for (int i = 0; i < size; i++)
+		{
+			re[i] = xi[i] * window[i];
+			im[i] = xq[i] * window[i];
+		}
+		fft->transform(&re[0], &im[0], false);
+		for (int k = 0; k < size; k++)
+			power[k] += re[k] * re[k] + im[k] * im[k];
+	}
+
+	std::lock_guard<std::mutex> lock(frameMutex);
+	frame.resize(c_headerLength + size);
+	uint8_t* p = &frame[0];
+	memcpy(p, "RSPF", 4);
+	putInt(p + 4, (uint32_t)frame.size());
+	putInt(p + 8, ++frameSeq);
+	putInt(p + 12, (uint32_t)centerHz.load());
+	putInt(p + 16, (uint32_t)rateHz.load());
+	p[20] = (uint8_t)(size >> 8);
+	p[21] = (uint8_t)size;
+	p[22] = (uint8_t)(averages >> 8);
+	p[23] = (uint8_t)averages;
+	p += c_headerLength;
+	// negative frequencies first
+	float avgDb = (float)(10 * log10((double)averages));
+	for (int i = 0; i < size; i++)
+	{
+		int k = (i + size / 2) & (size - 1);
+		float db = 10 * log10f(power[k] + 1e-20f) - avgDb - scaleDb;
+		int v = (int)(-2 * db + 0.5f);
+		p[i] = (uint8_t)(v < 0 ? 0 : v > 255 ? 255 : v);
+	}
+	return true;
+}
@@ -0,0 +1,258 @@
+/**
+** RSP3_tcp - TCP/IP I/Q Data Server for the sdrplay RSP devices
+** Copyright (C) 2017-2024 Clem Schmidt, softsyst, http://qirx.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#include "StreamClient.h"
+#include "GatherSender.h"
+#include "sdrplay_device.h"
+#include <iostream>
+#ifndef _WIN32
+#include <arpa/inet.h>
+#endif
+using namespace std;
+
+StreamClient::StreamClient(SOCKET s, const sockaddr_in& addr, int id, int channel) :
+	clientSocket(s),
+	id(id),
+	channel(channel)
+{
+	address = inet_ntoa(addr.sin_addr);
+}
+
+StreamClient::~StreamClient()
+{
+	disconnect();
+}
+
+bool StreamClient::start(Reactor* r, ZeroCopyReaper* reaper, MemBlockPool& pool, const BroadcastRing& ring, rsp_cmdLineArgs* args)
+{
+	reactor = r;
+	this->reaper = reaper;
+	latencyUs = args->MaxSendLatencyUs;
+	udpStream = channel < 0 && args->UdpPort != 0;
+	commandOnly = udpStream;
+	sender = new GatherSender(pool, args->MaxSendBytes);
+	if (args->ZeroCopy)
+		sender->enableZeroCopy(clientSocket);
+	sender->setNonBlocking(true);
+	common::setNonBlocking(clientSocket, true);
+	// live from here, the older blocks in the ring belong to the other clients
+	cursor = ring.end();
+	cursorSample = ring.sampleAt(cursor);
+	lastReport = time(0);
+	return reactor->add(clientSocket, EV_READ);
+}
+
+void StreamClient::disconnect()
+{
+	if (clientSocket == INVALID_SOCKET)
+		return;
+	if (reactor != 0)
+		reactor->remove(clientSocket);
+	if (sender != 0)
+	{
+		// before closesocket: zero copy completions arrive only on the open socket
+		sender->discard();
+		if (sender->hasInFlight() && reaper != 0)
+		{
+			// the reaper closes the socket once the kernel is done with the blocks
+			reaper->adopt(clientSocket, sender);
+			sender = 0;
+			clientSocket = INVALID_SOCKET;
+			return;
+		}
+		delete sender;
+		sender = 0;
+	}
+	closesocket(clientSocket);
+	clientSocket = INVALID_SOCKET;
+}
+
+/// <summary>
+/// Reads the commands from the nonblocking socket.
+/// A command may arrive in pieces, the bytes are collected until it is complete.
+/// </summary>
+bool StreamClient::onReceive(sdrplay_device* dev, bool authority)
+{
+	// level triggered: commands beyond this count are read in the next round
+	const int maxCommands = 64;
+	try
+	{
+		for (int n = 0; n < maxCommands; )
+		{
+			int rcvd = recv(clientSocket, (char*)cmdBuf + cmdLen, c_cmdLength - cmdLen, 0); //read 5 bytes (cmd + value)
+			if (rcvd == 0)
+			{
+				std::cout << "Client " << id << " closed the connection" << endl;
+				return false;
+			}
+			if (rcvd == SOCKET_ERROR)
+			{
+				if (common::socketWouldBlock())
+					return true;
+				std::cout << "Socket rx Error on client " << id << " : " << GETSOCKETERRNO() << endl;
+				return false;
+			}
+			cmdLen += rcvd;
+			if (cmdLen < c_cmdLength)
+				continue;
+			cmdLen = 0;
+			n++;
+			// a setting of this connection, not of the device
+			if (cmdBuf[0] == c_cmdTcpSamples)
+			{
+				bool on = (cmdBuf[1] | cmdBuf[2] | cmdBuf[3] | cmdBuf[4]) != 0;
+				commandOnly = !on || udpStream;
+				std::cout << "Client " << id << ": samples on the data port " << (commandOnly ? "off" : "on") << endl;
+			}
+			else if (authority)
+				dev->processCommand(cmdBuf);
+			else if (ignoredCommands++ % 100 == 0)
+				std::cout << "Client " << id << " has no tuning authority, command 0x" << hex << (int)cmdBuf[0] << dec
+					<< " ignored" << endl;
+		}
+	}
+	catch (exception& e)
+	{
+		std::cout << "*** Exception in receive :" << e.what() << endl;
+		return false;
+	}
+	return true;
+}
+
+/// <summary>
+/// Catches up with the ring: blocks which were evicted before they were read are
+/// counted as dropped, then the blocks from the cursor on are handed to the sender.
+/// It never blocks, what the socket doesn't take stays in the sender, and the cursor
+/// stays where it is until the sender has room again.
+/// With a max latency configured, a batch which has not reached the max byte count yet
+/// is sent only when that time passed since its first block.
+/// </summary>
+/// <returns>false after a socket error</returns>
+bool StreamClient::onTransmit(const BroadcastRing& ring)
+{
+	const int statsIntervalSec = 10;
+	if (sender == 0)
+		return true;
+	if (commandOnly)
+	{
+		// the samples go out by UDP
+		cursor = ring.end();
+		cursorSample = ring.sampleAt(cursor);
+		return true;
+	}
+	try
+	{
+		if (cursor < ring.begin())
+		{
+			uint64_t lost = ring.sampleAt(ring.begin()) - cursorSample;
+			droppedSamples += lost;
+			droppedBlocks += ring.begin() - cursor;
+			if (dropReports++ % 1000 == 0)
+				std::cout << "Client " << id << " too slow: " << lost << " samples dropped, "
+					<< droppedSamples << " samples dropped in total" << endl;
+			cursor = ring.begin();
+			cursorSample = ring.sampleAt(cursor);
+		}
+
+		sender->reap();
+		for (;;)
+		{
+			if (sender->hasBacklog() || sender->room() == 0)
+			{
+				if (!sender->flush(clientSocket))
+					break;
+				if (sender->hasBacklog())
+					break;		// continued when the socket is writable
+			}
+			if (cursor < ring.end())
+			{
+				if (sender->getPendingBlocks() == 0)
+					flushDeadline = std::chrono::steady_clock::now() + std::chrono::microseconds(latencyUs);
+				int numBlocks = sender->room();
+				for (int ix = 0; ix < numBlocks && cursor < ring.end(); ix++)
+				{
+					MemBlock* mb = ring.at(cursor++);
+					cursorSample += mb->numSamples;
+					mb->refs++;		// the sender's reference, released when sent
+					sender->append(clientSocket, mb);
+				}
+				if (sender->failed())
+					break;
+				continue;
+			}
+			if (sender->getPendingBlocks() > 0 && getTransmitTimeoutMs() == 0)
+			{
+				if (!sender->flush(clientSocket))
+					break;
+				continue;
+			}
+			break;
+		}
+	}
+	catch (exception& e)
+	{
+		cout << "*** Error in transmit :" << e.what() << endl;
+		return false;
+	}
+	if (sender->failed())
+		return false;
+	lagSamples = ring.sampleAt(ring.end()) - cursorSample;
+	if (lagSamples > maxLagSamples)
+		maxLagSamples = lagSamples;
+	setWriteInterest(sender->hasBacklog());
+	reportStats(statsIntervalSec);
+	return true;
+}
+
+int StreamClient::getTransmitTimeoutMs() const
+{
+	if (sender == 0 || sender->getPendingBlocks() == 0 || sender->hasBacklog())
+		return -1;
+	long long us = std::chrono::duration_cast<std::chrono::microseconds>(
+		flushDeadline - std::chrono::steady_clock::now()).count();
+	if (us <= 0)
+		return 0;
+	return (int)((us + 999) / 1000);
+}
+
+/// <summary>
+/// EV_WRITE is only of interest while the socket has a backlog
+/// </summary>
+void StreamClient::setWriteInterest(bool on)
+{
+	if (on == writeInterest)
+		return;
+	if (reactor->modify(clientSocket, on ? EV_READ | EV_WRITE : EV_READ))
+		writeInterest = on;
+}
+
+void StreamClient::reportStats(int intervalSec)
+{
+	if (sender == 0)
+		return;
+	time_t now = time(0);
+	if (now - lastReport < intervalSec)
+		return;
+	sender->reportStats(intervalSec);
+	std::cout << "Client " << id << " (" << address << "): lag " << lagSamples << " samples, max "
+		<< maxLagSamples << ", " << droppedSamples << " samples in " << droppedBlocks << " blocks dropped" << endl;
+	maxLagSamples = lagSamples;
+	lastReport = now;
+}
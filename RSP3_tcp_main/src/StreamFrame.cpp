@@ -0,0 +1,63 @@
+/**
+** RSP3_tcp - TCP/IP I/Q Data Server for the sdrplay RSP devices
+** Copyright (C) 2017-2024 Clem Schmidt, softsyst, http://qirx.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#include "StreamFrame.h"
+
+namespace
+{
+	void putBE16(BYTE* p, uint16_t v)
+	{
+		p[0] = (BYTE)(v >> 8);
+		p[1] = (BYTE)v;
+	}
+
+	void putBE32(BYTE* p, uint32_t v)
+	{
+		putBE16(p, (uint16_t)(v >> 16));
+		putBE16(p + 2, (uint16_t)v);
+	}
+}
+
+void StreamFrame::write(MemBlock* mb, int format)
+{
+	BYTE* p = mb->Mem;
+	p[0] = 'R'; p[1] = 'S'; p[2] = 'P'; p[3] = 'D';
+	putBE16(p + 4, (uint16_t)c_headerLength);
+	p[6] = (BYTE)format;
+	p[7] = mb->flags;
+	putBE32(p + 8, (uint32_t)(mb->length - c_headerLength));
+	putBE32(p + 12, (uint32_t)mb->numSamples);
+	putBE32(p + 16, (uint32_t)(mb->sampleIndex >> 32));
+	putBE32(p + 20, (uint32_t)mb->sampleIndex);
+}
+
+/// <summary>
+/// Event loop. Flags a gap in the index, whether the API or the tx queue lost the samples
+/// </summary>
+void StreamFramer::frame(MemBlock* mb)
+{
+	if (mb->headerLength < StreamFrame::c_headerLength)
+		return;
+	if (expectedValid && mb->sampleIndex != expectedIndex)
+		mb->flags |= FRAME_DISCONTINUITY;
+	expectedIndex = mb->sampleIndex + mb->numSamples;
+	expectedValid = true;
+	StreamFrame::write(mb, format);
+}
@@ -0,0 +1,171 @@
+/**
+** RSP3_tcp - TCP/IP I/Q Data Server for the sdrplay RSP devices
+** Copyright (C) 2017-2024 Clem Schmidt, softsyst, http://qirx.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#include "TxQueue.h"
+#include <iostream>
+#include <thread>
+#include <chrono>
+using namespace std;
+
+TxQueue::TxQueue(int maxBlocks) : q(maxBlocks)
+{
+	queuedBytes.store(0);
+	maxBytes = (int64_t)1 << 62;
+	droppedBlocks.store(0);
+	droppedSamples.store(0);
+}
+
+void TxQueue::configure(int64_t maxBytes, eOverloadPolicy policy)
+{
+	this->maxBytes = maxBytes;
+	this->policy = policy;
+	std::cout << "Tx queue: max " << maxBytes << " bytes, overload policy " << policyName(policy) << endl;
+}
+
+const char* TxQueue::policyName(eOverloadPolicy p)
+{
+	switch (p)
+	{
+	case OVL_DROP_NEWEST:
+		return "drop newest";
+	case OVL_DROP_OLDEST:
+		return "drop oldest";
+	case OVL_BLOCK:
+		return "block";
+	default:
+		return "?";
+	}
+}
+
+void TxQueue::resetCounters()
+{
+	droppedBlocks.store(0);
+	droppedSamples.store(0);
+}
+
+bool TxQueue::fits(int bytes) const
+{
+	// an empty queue always takes a block, whatever its size
+	int64_t queued = queuedBytes.load(std::memory_order_acquire);
+	return queued == 0 || queued + bytes <= maxBytes;
+}
+
+void TxQueue::dropped(MemBlock* mb, MemBlockPool& pool, const char* reason)
+{
+	droppedBlocks.fetch_add(1, std::memory_order_relaxed);
+	uint64_t total = droppedSamples.fetch_add(mb->numSamples, std::memory_order_relaxed) + mb->numSamples;
+	if (dropReports++ % 1000 == 0)
+		std::cout << "Tx queue full (" << reason << "): " << mb->numSamples << " samples from sample number "
+			<< mb->firstSampleNum << " dropped, " << total << " samples dropped in total" << endl;
+	pool.recycle(mb);
+}
+
+bool TxQueue::push(MemBlock* mb, MemBlockPool& pool, const bool& cancel)
+{
+	int bytes = mb->length;
+	switch (policy)
+	{
+	case OVL_DROP_OLDEST:
+		while (!fits(bytes))
+		{
+			MemBlock* old;
+			if (!q.tryDiscardOldest(old))
+				break;	// the consumer took them in the meantime
+			queuedBytes.fetch_sub(old->length);
+			dropped(old, pool, "oldest");
+		}
+		break;
+	case OVL_BLOCK:
+		for (int waitedUs = 0; !fits(bytes) && !cancel; waitedUs += 200)
+		{
+			if (waitedUs >= c_maxBlockMs * 1000)
+			{
+				dropped(mb, pool, "blocked too long");
+				return false;
+			}
+			std::this_thread::sleep_for(std::chrono::microseconds(200));
+		}
+		break;
+	case OVL_DROP_NEWEST:
+	default:
+		if (!fits(bytes))
+		{
+			dropped(mb, pool, "newest");
+			return false;
+		}
+		break;
+	}
+
+	// counted before the block becomes visible, the consumer subtracts after taking it
+	queuedBytes.fetch_add(bytes);
+	if (q.tryEnqueue(mb))
+		return true;
+	if (policy == OVL_DROP_OLDEST)
+	{
+		MemBlock* old;
+		if (q.tryDiscardOldest(old))
+		{
+			queuedBytes.fetch_sub(old->length);
+			dropped(old, pool, "oldest");
+			if (q.tryEnqueue(mb))
+				return true;
+		}
+	}
+	queuedBytes.fetch_sub(bytes);
+	dropped(mb, pool, "no free slot");
+	return false;
+}
+
+bool TxQueue::tryPush(MemBlock* mb)
+{
+	int bytes = mb->length;
+	if (!fits(bytes))
+		return false;
+	queuedBytes.fetch_add(bytes);
+	if (q.tryEnqueue(mb))
+		return true;
+	queuedBytes.fetch_sub(bytes);
+	return false;
+}
+
+int TxQueue::dequeued(MemBlock** out, int n)
+{
+	int64_t bytes = 0;
+	for (int i = 0; i < n; i++)
+		bytes += out[i]->length;
+	if (bytes != 0)
+		queuedBytes.fetch_sub(bytes);
+	return n;
+}
+
+int TxQueue::dequeueBatch(MemBlock** out, int maxCount)
+{
+	return dequeued(out, q.dequeueBatch(out, maxCount));
+}
+
+int TxQueue::waitDequeueBatch(MemBlock** out, int maxCount)
+{
+	return dequeued(out, q.waitDequeueBatch(out, maxCount));
+}
+
+int TxQueue::waitDequeueBatchFor(MemBlock** out, int maxCount, int timeoutUs)
+{
+	return dequeued(out, q.waitDequeueBatchFor(out, maxCount, timeoutUs));
+}
@@ -0,0 +1,371 @@
+/**
+** RSP3_tcp - TCP/IP I/Q Data Server for the sdrplay RSP devices
+** Copyright (C) 2017-2024 Clem Schmidt, softsyst, http://qirx.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#include "UdpStreamer.h"
+#include "StreamFrame.h"
+#include "IPAddress.h"
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <iostream>
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+using namespace std;
+
+UdpStreamer::UdpStreamer(MemBlockPool& pool) : pool(pool)
+{
+	memset(&dest, 0, sizeof(dest));
+}
+
+UdpStreamer::~UdpStreamer()
+{
+	stop();
+}
+
+bool UdpStreamer::start(const BroadcastRing& ring, const string& address, int port, int mtu, int pace, int fmt)
+{
+	IPAddress ip(address);
+	if (!ip.valid)
+	{
+		cout << "Invalid UDP destination " << address << endl;
+		return false;
+	}
+	dest.sin_family = AF_INET;
+	dest.sin_port = htons((unsigned short)port);
+	dest.sin_addr.s_addr = inet_addr(ip.sIPAddress.c_str());
+	bool multicast = ip.b1 >= 224 && ip.b1 <= 239;
+
+	udpSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (udpSocket == INVALID_SOCKET)
+	{
+		cout << "UDP socket error: " << common::getSocketErrorString() << endl;
+		return false;
+	}
+	int sndbuf = c_sendBufferBytes;
+	if (setsockopt(udpSocket, SOL_SOCKET, SO_SNDBUF, (char*)&sndbuf, sizeof(sndbuf)) < 0)
+		cout << "Error on setting SO_SNDBUF of the UDP socket" << endl;
+	if (multicast)
+	{
+		int ttl = c_multicastTtl;
+		if (setsockopt(udpSocket, IPPROTO_IP, IP_MULTICAST_TTL, (char*)&ttl, sizeof(ttl)) < 0)
+			cout << "Error on setting IP_MULTICAST_TTL" << endl;
+	}
+	common::setNonBlocking(udpSocket, true);
+
+	maxPayload = mtu - c_ipUdpHeaders - c_headerLength;
+	pacePercent = pace;
+	format = (BYTE)fmt;
+	// live from here, like a client
+	cursor = ring.end();
+	expectedValid = false;
+	sequence = 0;
+	tokens = 0;
+	lastRefill = std::chrono::steady_clock::now();
+	waiting = false;
+	lastReport = time(0);
+	cout << "UDP stream to " << ip.sIPAddress << ":" << port << (multicast ? " (multicast)" : "")
+		<< ", " << maxPayload << " payload bytes per datagram, pacing "
+		<< (pacePercent == 0 ? string("off") : to_string(pacePercent) + "%") << endl;
+	return true;
+}
+
+void UdpStreamer::stop()
+{
+	for (int i = 0; i < numPending; i++)
+		if (batch[i].last)
+			pool.release(batch[i].mb);
+	numPending = 0;
+	if (current != 0)
+	{
+		pool.release(current);
+		current = 0;
+	}
+	if (udpSocket != INVALID_SOCKET)
+	{
+		closesocket(udpSocket);
+		udpSocket = INVALID_SOCKET;
+	}
+}
+
+/// <summary>
+/// Cuts and sends until the ring is read, the pacing holds back the next datagram or
+/// the socket buffer is full. A block evicted before it was read is lost for the
+/// receivers, the sample index of the next datagram skips it.
+/// </summary>
+void UdpStreamer::onTransmit(const BroadcastRing& ring, const iqConverterEntry* conv, double rateHz)
+{
+	const int statsIntervalSec = 10;
+	if (udpSocket == INVALID_SOCKET)
+		return;
+	if (cursor < ring.begin())
+	{
+		lappedBlocks += ring.begin() - cursor;
+		cursor = ring.begin();
+	}
+	if (waiting && std::chrono::steady_clock::now() < retryAt)
+		return;
+	waiting = false;
+	for (;;)
+	{
+		bool more = cut(ring, conv, rateHz);
+		if (numPending == 0)
+			break;
+		int done = sendBatch();
+		if (done == 0)
+		{
+			// the socket buffer is full, UDP sockets don't report writability reliably
+			waiting = true;
+			retryAt = std::chrono::steady_clock::now() + std::chrono::milliseconds(1);
+			break;
+		}
+		retire(done);
+		if (numPending > 0 || !more)
+		{
+			if (numPending > 0 && !waiting)
+			{
+				waiting = true;
+				retryAt = std::chrono::steady_clock::now() + std::chrono::milliseconds(1);
+			}
+			break;
+		}
+	}
+	reportStats(statsIntervalSec);
+}
+
+int UdpStreamer::getTransmitTimeoutMs() const
+{
+	if (!waiting)
+		return -1;
+	long long us = std::chrono::duration_cast<std::chrono::microseconds>(
+		retryAt - std::chrono::steady_clock::now()).count();
+	if (us <= 0)
+		return 0;
+	return (int)((us + 999) / 1000);
+}
+
+/// <summary>
+/// Fills the batch with the next slices of the blocks, each of whole sample groups.
+/// Returns false if it stopped before the batch was full: the ring is read or the
+/// pacing holds back the next datagram
+/// </summary>
+bool UdpStreamer::cut(const BroadcastRing& ring, const iqConverterEntry* conv, double rateHz)
+{
+	int groups = maxPayload / conv->bytesPerGroup;
+	if (groups < 1)
+		groups = 1;
+	while (numPending < c_maxBatch)
+	{
+		if (current == 0)
+		{
+			if (cursor >= ring.end())
+				return false;
+			current = ring.at(cursor++);
+			current->refs++;	// kept while its datagrams are pending, the ring may evict it
+			currentOffset = current->headerLength;
+			currentSamples = 0;
+			currentFlags = current->flags;
+			if (expectedValid && current->sampleIndex != expectedIndex)
+				currentFlags |= FRAME_DISCONTINUITY;
+			expectedIndex = current->sampleIndex + current->numSamples;
+			expectedValid = true;
+		}
+		int bytes = current->length - currentOffset;
+		if (bytes > groups * conv->bytesPerGroup)
+			bytes = groups * conv->bytesPerGroup;
+		int numSamples = bytes / conv->bytesPerGroup * conv->samplesPerGroup;
+		if (numSamples <= 0)
+		{
+			// nothing left of whole groups
+			pool.release(current);
+			current = 0;
+			continue;
+		}
+		if (!takeTokens(numSamples, rateHz))
+			return false;
+		datagram& d = batch[numPending++];
+		writeHeader(d, numSamples, current->sampleIndex + currentSamples, currentFlags);
+		d.mb = current;
+		d.offset = currentOffset;
+		d.bytes = bytes;
+		currentFlags = 0;
+		currentOffset += bytes;
+		currentSamples += numSamples;
+		d.last = currentOffset >= current->length;
+		if (d.last)
+			current = 0;
+	}
+	return true;
+}
+
+void UdpStreamer::writeHeader(datagram& d, int numSamples, uint64_t sampleIndex, BYTE flags)
+{
+	BYTE* p = d.header;
+	uint32_t seq = sequence++;
+	p[0] = 'R'; p[1] = 'S'; p[2] = 'P'; p[3] = 'U';
+	p[4] = 0; p[5] = (BYTE)c_headerLength;
+	p[6] = format;
+	p[7] = flags;
+	for (int i = 0; i < 4; i++)
+	{
+		p[8 + i] = (BYTE)(seq >> (24 - 8 * i));
+		p[12 + i] = (BYTE)((uint32_t)numSamples >> (24 - 8 * i));
+	}
+	for (int i = 0; i < 8; i++)
+		p[16 + i] = (BYTE)(sampleIndex >> (56 - 8 * i));
+}
+
+/// <summary>
+/// Token bucket of samples, filled at pacePercent of the output rate, holding c_burstMs of it
+/// </summary>
+bool UdpStreamer::takeTokens(int numSamples, double rateHz)
+{
+	if (pacePercent == 0 || rateHz <= 0)
+		return true;
+	double rate = rateHz * pacePercent / 100.0;
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	tokens += rate * std::chrono::duration<double>(now - lastRefill).count();
+	lastRefill = now;
+	double burst = rate * c_burstMs / 1000.0;
+	if (burst < numSamples)
+		burst = numSamples;
+	if (tokens > burst)
+		tokens = burst;
+	if (tokens >= numSamples)
+	{
+		tokens -= numSamples;
+		return true;
+	}
+	waiting = true;
+	retryAt = now + std::chrono::microseconds((long long)((numSamples - tokens) / rate * 1e6) + 1);
+	return false;
+}
+
+/// <summary>
+/// Sends the pending datagrams, on Linux with one sendmmsg.
+/// Returns the number of datagrams done, sent or dropped after a send error;
+/// 0 if the socket would block
+/// </summary>
+int UdpStreamer::sendBatch()
+{
+	for (int i = 0; i < numPending; i++)
+	{
+#ifdef _WIN32
+		iov[i][0].buf = (CHAR*)batch[i].header;
+		iov[i][0].len = c_headerLength;
+		iov[i][1].buf = (CHAR*)batch[i].mb->Mem + batch[i].offset;
+		iov[i][1].len = (ULONG)batch[i].bytes;
+#else
+		iov[i][0].iov_base = batch[i].header;
+		iov[i][0].iov_len = c_headerLength;
+		iov[i][1].iov_base = batch[i].mb->Mem + batch[i].offset;
+		iov[i][1].iov_len = batch[i].bytes;
+#endif
+	}
+	int done = 0;
+	bool error = false;
+#if defined(__linux__)
+	struct mmsghdr msgs[c_maxBatch];
+	memset(msgs, 0, numPending * sizeof(msgs[0]));
+	for (int i = 0; i < numPending; i++)
+	{
+		msgs[i].msg_hdr.msg_name = &dest;
+		msgs[i].msg_hdr.msg_namelen = sizeof(dest);
+		msgs[i].msg_hdr.msg_iov = iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 2;
+	}
+	int n;
+	while ((n = sendmmsg(udpSocket, msgs, numPending, 0)) < 0 && errno == EINTR)
+		;
+	syscalls++;
+	if (n > 0)
+		done = n;
+	else if (!common::socketWouldBlock() && errno != ENOBUFS)
+		error = true;
+#else
+	for (; done < numPending; done++)
+	{
+		int res;
+#ifdef _WIN32
+		DWORD sent = 0;
+		res = WSASendTo(udpSocket, iov[done], 2, &sent, 0, (const sockaddr*)&dest, sizeof(dest), 0, 0);
+#else
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_name = &dest;
+		msg.msg_namelen = sizeof(dest);
+		msg.msg_iov = iov[done];
+		msg.msg_iovlen = 2;
+		while ((res = (int)sendmsg(udpSocket, &msg, 0)) < 0 && errno == EINTR)
+			;
+#endif
+		syscalls++;
+		if (res == SOCKET_ERROR)
+		{
+			if (!common::socketWouldBlock())
+				error = true;
+			break;
+		}
+	}
+#endif
+	for (int i = 0; i < done; i++)
+		bytesSent += c_headerLength + batch[i].bytes;
+	datagrams += done;
+	if (error)
+	{
+		// a datagram transport: the failed one is lost, the stream goes on
+		if (sendErrors++ % 1000 == 0)
+			cout << "UDP tx Error : " << common::getSocketErrorString() << endl;
+		done++;
+	}
+	return done;
+}
+
+/// <summary>
+/// Drops the first count datagrams, with the references of the blocks they finished
+/// </summary>
+void UdpStreamer::retire(int count)
+{
+	for (int i = 0; i < count; i++)
+		if (batch[i].last)
+			pool.release(batch[i].mb);
+	numPending -= count;
+	memmove(batch, batch + count, numPending * sizeof(batch[0]));
+}
+
+void UdpStreamer::reportStats(int intervalSec)
+{
+	time_t now = time(0);
+	if (now - lastReport < intervalSec)
+		return;
+	uint64_t calls = syscalls - lastSyscalls;
+	if (calls > 0)
+	{
+		double secs = (double)(now - lastReport);
+		std::cout << "UDP: " << (uint64_t)((datagrams - lastDatagrams) / secs) << " datagrams/s, "
+			<< (double)(datagrams - lastDatagrams) / calls << " datagrams/syscall, "
+			<< bytesSent << " bytes, " << sendErrors << " errors, " << lappedBlocks << " blocks lapped" << endl;
+	}
+	lastReport = now;
+	lastDatagrams = datagrams;
+	lastSyscalls = syscalls;
+}
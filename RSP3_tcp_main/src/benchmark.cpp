@@ -0,0 +1,431 @@
+/**
+** RSP3_tcp - TCP/IP I/Q Data Server for the sdrplay RSP devices
+** Copyright (C) 2017-2024 Clem Schmidt, softsyst, http://qirx.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#include "benchmark.h"
+#include "common.h"
+#include "MemBlockPool.h"
+#include "GatherSender.h"
+#include "Decimator.h"
+#include "Resampler.h"
+#include "Channelizer.h"
+#include "LosslessCodec.h"
+#include "iqConvert.h"
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <string.h>
+#include <time.h>
+#include <stdlib.h>
+#include <math.h>
+#include <fstream>
+#include <vector>
+using namespace std;
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+const benchmarkEntry benchmark::entries[] =
+{
+	{ "tx", benchmark::transmit, "16 bit blocks over loopback TCP, plain and zero copy sends" },
+	{ "decim", benchmark::decimate, "software decimation of callback blocks, input MS/s per factor" },
+	{ "resample", benchmark::resample, "rational resampling of callback blocks, MS/s per core for some rate pairs" },
+	{ "chan", benchmark::channelize, "polyphase channelizer with all bins served, input MS/s per core per number of bins" },
+	{ "lossless", benchmark::lossless, "lossless compression, ratio and MS/s per core; lossless:file takes a 16 bit capture" },
+	{ "verify", benchmark::verify, "compares the vectorized I/Q converters with the scalar ones for all sample values, fails on a difference" },
+	{ 0, 0, 0 }
+};
+
+int benchmark::run(const std::string& name, rsp_cmdLineArgs* pargs)
+{
+	for (int i = 0; entries[i].name != 0; i++)
+	{
+		if (name == entries[i].name)
+		{
+			std::cout << "\nBenchmark " << name << ": " << entries[i].description << endl;
+			return entries[i].run(pargs);
+		}
+	}
+	if (name != "list")
+		std::cout << "Unknown benchmark " << name << endl;
+	list();
+	return name == "list" ? 0 : -1;
+}
+
+void benchmark::list()
+{
+	std::cout << "Benchmarks:" << endl;
+	for (int i = 0; entries[i].name != 0; i++)
+		std::cout << "\t" << entries[i].name << "\t" << entries[i].description << endl;
+}
+
+/// <summary>
+/// Transmits 16 bit blocks of the nominal callback size to a local receiver.
+/// On loopback the kernel copies zero copy sends nevertheless (and reports it),
+/// the numbers show the overhead of the completion handling then.
+/// </summary>
+/// <returns>MB/s, or a negative value on a socket error</returns>
+double benchmark::transmitRun(bool zeroCopy, int maxBytes, int seconds)
+{
+	const int samplesPerBlock = 2016;
+	const int blockBytes = samplesPerBlock * 4;
+
+	SOCKET listenSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	struct sockaddr_in local;
+	memset(&local, 0, sizeof(local));
+	local.sin_family = AF_INET;
+	local.sin_port = 0;
+	local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t len = sizeof(local);
+	if (bind(listenSocket, (SOCKADDR*)&local, sizeof(local)) == SOCKET_ERROR ||
+		listen(listenSocket, 1) == SOCKET_ERROR ||
+		getsockname(listenSocket, (SOCKADDR*)&local, &len) == SOCKET_ERROR)
+	{
+		std::cout << "Cannot listen on loopback: " << common::getSocketErrorString() << endl;
+		closesocket(listenSocket);
+		return -1;
+	}
+	SOCKET tx = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (connect(tx, (SOCKADDR*)&local, sizeof(local)) == SOCKET_ERROR)
+	{
+		std::cout << "Cannot connect on loopback: " << common::getSocketErrorString() << endl;
+		closesocket(tx);
+		closesocket(listenSocket);
+		return -1;
+	}
+	SOCKET rx = accept(listenSocket, 0, 0);
+	closesocket(listenSocket);
+
+	uint64_t received = 0;
+	std::thread receiver([rx, &received]()
+	{
+		char* buf = new char[1 << 20];
+		int n;
+		while ((n = recv(rx, buf, 1 << 20, 0)) > 0)
+			received += n;
+		delete[] buf;
+	});
+
+	MemBlockPool pool(4096);
+	pool.prepare(blockBytes, 2048);
+	double mbs = -1;
+	{
+		GatherSender sender(pool, maxBytes);
+		if (zeroCopy && !sender.enableZeroCopy(tx))
+		{
+			std::cout << "  zero copy: not used, see above" << endl;
+			zeroCopy = false;
+		}
+		clock_t cpu0 = clock();
+		std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+		std::chrono::steady_clock::time_point end = t0 + std::chrono::seconds(seconds);
+		// 16 blocks per batch, about what the transmit side drains at 10 MS/s
+		while (!sender.failed() && std::chrono::steady_clock::now() < end)
+		{
+			for (int i = 0; i < 16; i++)
+			{
+				MemBlock* mb = pool.acquire(blockBytes);
+				mb->length = blockBytes;
+				mb->numSamples = samplesPerBlock;
+				sender.append(tx, mb);
+			}
+			sender.flush(tx);
+		}
+		sender.flush(tx);
+		double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+		double cpu = (double)(clock() - cpu0) / CLOCKS_PER_SEC;
+		if (!sender.failed())
+		{
+			mbs = sender.getByteCount() / secs / 1e6;
+			std::cout << "  " << (zeroCopy ? "zero copy" : "plain    ") << ": " << mbs << " MB/s, "
+				<< mbs / 4 << " MS/s at 16 bit, "
+				<< (double)sender.getBlockCount() / sender.getSyscallCount() << " blocks/syscall, "
+				<< "cpu " << cpu / secs * 100 << "% (both threads)" << endl;
+			if (zeroCopy)
+				std::cout << "             " << sender.getZeroCopyCount() << " zero copy sends, "
+					<< sender.getZeroCopyCopiedCount() << " copied by the kernel, "
+					<< sender.getZeroCopyFallbackCount() << " fallbacks" << endl;
+		}
+		sender.discard();
+	}
+#ifdef _WIN32
+	shutdown(tx, SD_SEND);
+#else
+	shutdown(tx, SHUT_WR);
+#endif
+	receiver.join();
+	closesocket(tx);
+	closesocket(rx);
+	std::cout << "             " << received << " bytes received, " << pool.getAllocationCount() << " blocks allocated" << endl;
+	return mbs;
+}
+
+int benchmark::transmit(rsp_cmdLineArgs* pargs)
+{
+	const int seconds = 3;
+	if (transmitRun(false, pargs->MaxSendBytes, seconds) < 0)
+		return -1;
+	transmitRun(true, pargs->MaxSendBytes, seconds);
+	return 0;
+}
+
+/// <summary>
+/// Decimates blocks of the nominal callback size, for power of two factors (halfbands only)
+/// and for factors with a FIR stage
+/// </summary>
+int benchmark::decimate(rsp_cmdLineArgs*)
+{
+	const int samplesPerBlock = 2016;
+	const int seconds = 1;
+	const int factors[] = { 2, 8, 16, 10, 50 };
+	std::vector<short> xi(samplesPerBlock), xq(samplesPerBlock);
+	for (int i = 0; i < samplesPerBlock; i++)
+	{
+		xi[i] = (short)(rand() % 8192 - 4096);
+		xq[i] = (short)(rand() % 8192 - 4096);
+	}
+	std::cout << "  kernel " << Decimator::getKernelName() << endl;
+	for (size_t f = 0; f < sizeof(factors) / sizeof(factors[0]); f++)
+	{
+		Decimator decimator;
+		if (!decimator.configure(factors[f]))
+			return -1;
+		uint64_t samples = 0;
+		std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+		std::chrono::steady_clock::time_point end = t0 + std::chrono::seconds(seconds);
+		while (std::chrono::steady_clock::now() < end)
+		{
+			const short* outI;
+			const short* outQ;
+			for (int i = 0; i < 64; i++)
+				decimator.process(&xi[0], &xq[0], samplesPerBlock, outI, outQ);
+			samples += 64 * samplesPerBlock;
+		}
+		double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+		std::cout << "  factor " << factors[f] << ": " << samples / secs / 1e6 << " MS/s in" << endl;
+	}
+	return 0;
+}
+
+/// <summary>
+/// Converts blocks of the nominal callback size from a device rate to a client rate,
+/// decimating first as the server does. One thread, so the numbers are per core
+/// </summary>
+int benchmark::resample(rsp_cmdLineArgs*)
+{
+	const int samplesPerBlock = 2016;
+	const int seconds = 1;
+	// device rate, decimation, client rate
+	const int pairs[][3] = {
+		{ 2400000, 1, 1920000 },
+		{ 6000000, 2, 2048000 },
+		{ 8192000, 4, 1920000 },
+		{ 2048000, 8, 250000 },
+		{ 3000000, 1, 2880000 }
+	};
+	std::vector<short> xi(samplesPerBlock), xq(samplesPerBlock);
+	for (int i = 0; i < samplesPerBlock; i++)
+	{
+		xi[i] = (short)(rand() % 8192 - 4096);
+		xq[i] = (short)(rand() % 8192 - 4096);
+	}
+	std::cout << "  kernel " << Decimator::getKernelName() << endl;
+	for (size_t p = 0; p < sizeof(pairs) / sizeof(pairs[0]); p++)
+	{
+		int rateIn = pairs[p][0] / pairs[p][1];
+		Decimator decimator;
+		Resampler resampler;
+		if (!decimator.configure(pairs[p][1]) || !resampler.configure(pairs[p][2], rateIn))
+			return -1;
+		uint64_t samplesIn = 0;
+		uint64_t samplesOut = 0;
+		std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+		std::chrono::steady_clock::time_point end = t0 + std::chrono::seconds(seconds);
+		while (std::chrono::steady_clock::now() < end)
+		{
+			for (int i = 0; i < 64; i++)
+			{
+				const short* outI = &xi[0];
+				const short* outQ = &xq[0];
+				int n = samplesPerBlock;
+				if (decimator.isActive())
+					n = decimator.process(outI, outQ, n, outI, outQ);
+				samplesOut += resampler.process(outI, outQ, n, outI, outQ);
+			}
+			samplesIn += 64 * samplesPerBlock;
+		}
+		double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+		std::cout << "  " << pairs[p][0] << " -> " << pairs[p][2] << " Hz: " << samplesIn / secs / 1e6 << " MS/s in, "
+			<< samplesOut / secs / 1e6 << " MS/s out, " << samplesIn / secs / pairs[p][0] << " x real time" << endl;
+	}
+	return 0;
+}
+
+/// <summary>
+/// Splits blocks of the nominal callback size into all bins. One thread, so the numbers
+/// are per core; the cores needed for an 8 MS/s device rate follow from them
+/// </summary>
+int benchmark::channelize(rsp_cmdLineArgs*)
+{
+	const int samplesPerBlock = 2016;
+	const int seconds = 1;
+	const int binCounts[] = { 4, 8, 16, 32, 64 };
+	std::vector<short> xi(samplesPerBlock), xq(samplesPerBlock);
+	for (int i = 0; i < samplesPerBlock; i++)
+	{
+		xi[i] = (short)(rand() % 8192 - 4096);
+		xq[i] = (short)(rand() % 8192 - 4096);
+	}
+	for (size_t b = 0; b < sizeof(binCounts) / sizeof(binCounts[0]); b++)
+	{
+		std::vector<int> bins;
+		for (int i = 0; i < binCounts[b]; i++)
+			bins.push_back(i);
+		Channelizer channelizer;
+		if (!channelizer.configure(binCounts[b], bins))
+			return -1;
+		uint64_t samples = 0;
+		std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+		std::chrono::steady_clock::time_point end = t0 + std::chrono::seconds(seconds);
+		while (std::chrono::steady_clock::now() < end)
+		{
+			for (int i = 0; i < 64; i++)
+				channelizer.process(&xi[0], &xq[0], samplesPerBlock);
+			samples += 64 * samplesPerBlock;
+		}
+		double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+		double msps = samples / secs / 1e6;
+		std::cout << "  " << binCounts[b] << " bins: " << msps << " MS/s in, " << 8.0 / msps << " cores at 8 MS/s" << endl;
+	}
+	return 0;
+}
+
+/// <summary>
+/// Compresses a capture in blocks of the nominal callback size, decodes it again and
+/// compares. The capture is raw 16 bit I/Q as sent with -W 2, without the welcome string,
+/// e.g. recorded by a client. Without a file, synthesized noise with some carriers at
+/// several noise levels is used
+/// </summary>
+int benchmark::lossless(rsp_cmdLineArgs* pargs)
+{
+	if (pargs->BenchmarkInput != "")
+	{
+		std::ifstream f(pargs->BenchmarkInput.c_str(), std::ios::binary);
+		if (!f)
+		{
+			std::cout << "Cannot open " << pargs->BenchmarkInput << endl;
+			return -1;
+		}
+		const size_t c_maxCapture = (size_t)1 << 26;
+		std::vector<BYTE> capture(c_maxCapture);
+		f.read((char*)&capture[0], c_maxCapture);
+		capture.resize((size_t)f.gcount() & ~(size_t)3);
+		if (capture.empty())
+		{
+			std::cout << "Empty capture " << pargs->BenchmarkInput << endl;
+			return -1;
+		}
+		losslessRun(pargs->BenchmarkInput, capture);
+		return 0;
+	}
+
+	const int numSamples = 1 << 20;
+	const double noiseLevels[] = { 3, 30, 300, 3000 };
+	for (size_t l = 0; l < sizeof(noiseLevels) / sizeof(noiseLevels[0]); l++)
+	{
+		std::vector<BYTE> capture(4 * numSamples);
+		for (int n = 0; n < numSamples; n++)
+		{
+			// gaussian noise, Box-Muller
+			double r = noiseLevels[l] * sqrt(-2 * log((rand() + 1.0) / (RAND_MAX + 2.0)));
+			double phi = 2 * M_PI * rand() / RAND_MAX;
+			double i = r * cos(phi) + 4000 * cos(0.013 * n) + 1000 * cos(-0.31 * n);
+			double q = r * sin(phi) + 4000 * sin(0.013 * n) + 1000 * sin(-0.31 * n);
+			short si = (short)(i < -32768 ? -32768 : i > 32767 ? 32767 : floor(i + 0.5));
+			short sq = (short)(q < -32768 ? -32768 : q > 32767 ? 32767 : floor(q + 0.5));
+			capture[4 * n] = (BYTE)si;
+			capture[4 * n + 1] = (BYTE)(si >> 8);
+			capture[4 * n + 2] = (BYTE)sq;
+			capture[4 * n + 3] = (BYTE)(sq >> 8);
+		}
+		losslessRun("noise rms " + std::to_string((int)noiseLevels[l]), capture);
+	}
+	return 0;
+}
+
+void benchmark::losslessRun(const std::string& name, const std::vector<BYTE>& capture)
+{
+	const int samplesPerBlock = 2016;
+	int numSamples = (int)(capture.size() / 4);
+	int numBlocks = (numSamples + samplesPerBlock - 1) / samplesPerBlock;
+	std::vector<BYTE> frames((size_t)numBlocks * LosslessCodec::maxFrameBytes(samplesPerBlock));
+	std::vector<int> offsets(numBlocks + 1);
+
+	std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+	offsets[0] = 0;
+	for (int b = 0; b < numBlocks; b++)
+	{
+		int n = numSamples - b * samplesPerBlock;
+		if (n > samplesPerBlock)
+			n = samplesPerBlock;
+		offsets[b + 1] = offsets[b] + LosslessCodec::encode(&capture[(size_t)4 * b * samplesPerBlock], n,
+			b * samplesPerBlock, &frames[offsets[b]]);
+	}
+	double encSecs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+	std::vector<short> xi(samplesPerBlock), xq(samplesPerBlock);
+	bool exact = true;
+	double decSecs = 0;
+	for (int b = 0; b < numBlocks; b++)
+	{
+		unsigned int first;
+		std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+		int n = LosslessCodec::decode(&frames[offsets[b]], offsets[b + 1] - offsets[b], &xi[0], &xq[0], samplesPerBlock, first);
+		decSecs += std::chrono::duration<double>(std::chrono::steady_clock::now() - t1).count();
+		if (n < 0 || first != (unsigned int)(b * samplesPerBlock))
+		{
+			exact = false;
+			break;
+		}
+		const BYTE* raw = &capture[(size_t)4 * b * samplesPerBlock];
+		for (int i = 0; i < n; i++)
+		{
+			if (xi[i] != (short)(raw[4 * i] | (raw[4 * i + 1] << 8)) ||
+				xq[i] != (short)(raw[4 * i + 2] | (raw[4 * i + 3] << 8)))
+				exact = false;
+		}
+	}
+
+	std::cout << "  " << name << ": " << numSamples << " samples, " << (double)offsets[numBlocks] * 100 / capture.size()
+		<< "% of 16 bit, encode " << numSamples / encSecs / 1e6 << " MS/s, decode " << numSamples / decSecs / 1e6
+		<< " MS/s, " << (exact ? "bit exact" : "*** MISMATCH ***") << endl;
+}
+
+int benchmark::verify(rsp_cmdLineArgs*)
+{
+	int failed = iqConvert::verifyKernels();
+	if (failed != 0)
+	{
+		std::cout << failed << " converters differ from the scalar ones" << endl;
+		return -1;
+	}
+	std::cout << "All converters identical to the scalar ones" << endl;
+	return 0;
+}
@@ -72,6 +72,29 @@ int common::gettimeofday(struct timeval *tv, void* ignored)
 		return true;
 	}
 
+	bool common::setNonBlocking(SOCKET s, bool on)
+	{
+#ifdef _WIN32
+		u_long mode = on ? 1 : 0;
+		return ioctlsocket(s, FIONBIO, &mode) == 0;
+#else
+		int flags = fcntl(s, F_GETFL, 0);
+		if (flags < 0)
+			return false;
+		flags = on ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+		return fcntl(s, F_SETFL, flags) == 0;
+#endif
+	}
+
+	bool common::socketWouldBlock()
+	{
+#ifdef _WIN32
+		return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+		return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+	}
+
 	timespec common::getRelativeTimeoutValue(int relativeTimeoutSec)
 	{
 		struct timeval now;
@@ -25,6 +25,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <climits>
+#include <math.h>
 
 #ifndef _WIN32
 #include <unistd.h>
@@ -68,6 +69,15 @@ enum eIndications
 	, IND_ANTENNA_SELECTED  = 0x8F			  // 1 byte -> 5,6: RSPII or RSPduo TunerSelect
 											  //           0,1,2: RSPdx A, B, C
 											  // 7 && 0-60MHz : HiZ
+	, IND_SAMPLES_DROPPED   = 0x90			  // 4 bytes, samples discarded by the server because of a full tx queue,
+											  //          since the client connected (modulo 2^32)
+	, IND_SAMPLES_LOST      = 0x91			  // 4 bytes, samples the device / API did not deliver, same counting
+	, IND_DC_OFFSET         = 0x92			  // 4 bytes, software DC estimate in LSB: I in the upper, Q in the lower
+											  //          16 bits, signed. Only with the IQ correction (-I 1)
+	, IND_IQ_GAIN           = 0x93			  // 2 bytes, signed, Q to I gain imbalance in 0.001 dB
+	, IND_IQ_PHASE          = 0x94			  // 2 bytes, signed, phase imbalance in 0.001 degree
+	, IND_SCALE             = 0x95			  // 2 bytes, signed, gain of the adaptive 8 bit scaling in 0.01 dB.
+											  //          Only while it is active (-G 1 and 8 bit)
 };
 
 #ifdef _WIN32
@@ -80,13 +90,7 @@ typedef int socklen_t;
 #define SOCKET int
 #define SOCKET_ERROR -1
 #endif
-extern pthread_mutex_t stateLock;
-
 #define MAX_LEN  (1024)
-#define TX_BUF_LEN (1024) //tbd
-
-ctrl_thread_data_t ctrl_thread_data;
-unsigned char txbuf[TX_BUF_LEN];
 
 //https://stackoverflow.com/questions/105252/how-do-i-convert-between-big-endian-and-little-endian-values-in-c
 template <typename T>
@@ -114,8 +118,8 @@ int prepareIntCommand(BYTE* tx, int startIx, int indic, int value, uint16_t leng
 	int ix = startIx;
 
 	tx[ix++] = BYTE(indic & 0xff);
-	txbuf[ix++] = BYTE((length >> 8) & 0xff);
-	txbuf[ix++] = BYTE(length & 0xff);
+	tx[ix++] = BYTE((length >> 8) & 0xff);
+	tx[ix++] = BYTE(length & 0xff);
 	uint16_t val = 0;
 	switch (length)
 	{
@@ -145,234 +149,136 @@ int prepareStringCommand(BYTE* tx, int startIx, int indic, BYTE* value, uint16_t
 	int ix = startIx;
 
 	tx[ix++] = BYTE(indic & 0xff);
-	txbuf[ix++] = BYTE((length >> 8) & 0xff);
-	txbuf[ix++] = BYTE(length & 0xff);
+	tx[ix++] = BYTE((length >> 8) & 0xff);
+	tx[ix++] = BYTE(length & 0xff);
 
 	for (int i = 0; i < length; i++)
-		txbuf[ix++] = value[i];
+		tx[ix++] = value[i];
 	return ix;
 }
 
-bool sendBuffer(const SOCKET& socket, void* buf, int len, bool* do_exit)
-{
-	/* now start (possibly blocking) transmission */
-	struct timeval tv = { 1,0 };
-	int bytessent = 0;
-	int bytesleft = len;
-	int index = 0;
-	fd_set writefds;
-
-	while (bytesleft > 0) {
-		FD_ZERO(&writefds);
-		FD_SET(socket, &writefds);
-		tv.tv_sec = 1;
-		tv.tv_usec = 0;
-		int r = select(socket + 1, NULL, &writefds, NULL, &tv);
-		if (r) {
-			bytessent = (int)send(socket, (const char*)&txbuf[index], bytesleft, 0);
-			bytesleft -= bytessent;
-			index += bytessent;
-		}
-		if (bytessent == SOCKET_ERROR || *do_exit) {
-			return false;
-		}
-	}
-	return true;
-}
-
-void *ctrl_thread_fn(void *arg)
+/// <summary>
+/// Prepares the indications for the current communication state, sent to the
+/// control client every 0.5s by the event loop of devices.
+/// Two bytes total length, followed by the indications.
+/// </summary>
+/// <param name="tx">At least TX_BUF_LEN bytes</param>
+/// <returns>Length of the buffer, 0 if there is nothing to send</returns>
+int buildIndications(sdrplay_device* dev, BYTE* tx)
 {
-	int r = 1;
-	struct timeval tv = { 1,0 };
-	struct linger ling = { 1,0 };
-	SOCKET listensocket;
-	SOCKET controlSocket;
-	int haveControlSocket = 0;
-	struct sockaddr_in local, remote;
-	socklen_t rlen;
-
-	int len, total_gain=123;
-	fd_set connfds;
-	fd_set writefds;
-
-	ctrl_thread_data_t *data = (ctrl_thread_data_t *)arg;
-
-	sdrplay_device *dev = (sdrplay_device *)data->dev;
-	int port = data->port;
-	int wait = data->wait;
-	const char *addr = data->addr;
-	bool* do_exit = data->pDoExit;
-	int retval;
-#ifdef _WIN32
-	u_long blockmode = 1;
-#endif
+	int len = 2;
+	int total_gain = 123;
+
+	sdrplay_api_GainValuesT* gvals = 0;
+	float gain = 0;
+	int lnastate = 0;
+	int biasT = 0;
+	bool bias = false;
+	bool overload_a = false, overload_b = false;
+	bool rspDuoHiZ = false;
+	int buflen = 0;
+	int frequencyFromCallback = 0;
+
+	int antennaValue = 0;
+	bool dabNotch = false;
+	bool rfNotch = false;
+	//bool amNotch = false;
+
+	switch (dev->CommState)
+	{
+	case ST_IDLE:
+	case ST_SERIALS_PREPARED:
+		return 0;
 
-	memset(&local, 0, sizeof(local));
-	local.sin_family = AF_INET;
-	local.sin_port = htons((uint16_t)port);
-	local.sin_addr.s_addr = inet_addr(addr);
+	case ST_DEVICE_RELEASED:
+		len = prepareIntCommand(tx, len, IND_DEVICE_RELEASED, 1, 1);
+		dev->CommState = ST_IDLE; // wait for socket to close
+		break;
 
-	listensocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	case ST_SERIALS_REQUESTED: // 1st command
+		BYTE tmp[MAX_LEN];
+		buflen = dev->prepareSerialsList(tmp);
+		len = prepareStringCommand(tx, len, IND_SERIAL, tmp, (uint16_t)buflen);
+		dev->CommState = ST_SERIALS_PREPARED; // wait for the next command changing the state
+		break;
 
-	setsockopt(listensocket, SOL_SOCKET, SO_REUSEADDR, (char *)&r, sizeof(int));
-	setsockopt(listensocket, SOL_SOCKET, SO_LINGER, (char *)&ling, sizeof(ling));
-	retval = bind(listensocket, (struct sockaddr *)&local, sizeof(local));
-	if (retval == SOCKET_ERROR)
-		goto close;
+	case ST_DEVICE_CREATED:
+		len = prepareStringCommand(tx, len, IND_MAGIC_STRING, (BYTE*)"RTL0", 4);
+		char s[5];
 #ifdef _WIN32
-	ioctlsocket(listensocket, FIONBIO, &blockmode);
+		strncpy_s(s, "RSPx", 4);
 #else
-	r = fcntl(listensocket, F_GETFL, 0);
-	r = fcntl(listensocket, F_SETFL, r | O_NONBLOCK);
+		strncpy(s, "RSPx", 4);
 #endif
-
-	while (1) 
-	{
-		printf("\n\nlistening on Control port %d...\n", port);
-		retval = listen(listensocket, 1);
-		if (retval == SOCKET_ERROR)
-			goto close;
-		while (1) 
+		s[4] = 0;
+		buflen = dev->getRxString(s);
+		len = prepareStringCommand(tx, len, IND_RX_STRING, (BYTE*)s, (uint16_t)buflen);
+		len = prepareIntCommand(tx, len, IND_RX_TYPE, dev->getExportedRxType(), 1);
+		len = prepareIntCommand(tx, len, IND_BIT_WIDTH, dev->getBitWidth(), 1);
+		len = prepareIntCommand(tx, len, IND_WELCOME, 1, 1);
+		dev->CommState = ST_WELCOME_SENT;
+		//fall through
+	case ST_WELCOME_SENT:
+		gvals = dev->getGainValues();
+		if (gvals == 0)	// too early, but the welcome indications are due
 		{
-			FD_ZERO(&connfds);
-			FD_SET(listensocket, &connfds);
-			tv.tv_sec = 1;
-			tv.tv_usec = 0;
-			r = select(listensocket + 1, &connfds, NULL, NULL, &tv);
-			if (*do_exit) {
-				goto close;
-			}
-			else if (r) {
-				rlen = sizeof(remote);
-				controlSocket = accept(listensocket, (struct sockaddr *)&remote, &rlen);
-				haveControlSocket = 1;
-				break;
-			}
+			if (len == 2)
+				return 0;
+			break;
 		}
+		lnastate = dev->getLNAState();
+		bias = dev->getBiasTState();
+		biasT = bias ? 1 : 0;
 
-		setsockopt(controlSocket, SOL_SOCKET, SO_LINGER, (char *)&ling, sizeof(ling));
-
-		printf("\nControl client accepted!\n");
-
-		while (1) 
-		{
-			len = 2;
-			total_gain = 123;
-			
-			sdrplay_api_GainValuesT* gvals = 0;
-			float gain = 0;
-			int lnastate = 0;
-			int biasT = 0;
-			bool bias = false;
-			bool overload_a = false, overload_b = false;
-			bool rspDuoHiZ = false;
-			int buflen = 0;
-			int frequencyFromCallback = 0;
-
-			int antennaValue = 0;
-			bool dabNotch = false;
-			bool rfNotch = false;
-			bool amNotch = false;
-
-			pthread_mutex_lock(&stateLock);
-
-			switch (dev->CommState)
-			{
-			case ST_IDLE:
-			case ST_SERIALS_PREPARED:
-				goto sleep;
+		gain = gvals->curr;
+		if (gain > 0)
+			total_gain = (int)(gain * 10.0f);
 
-			case ST_DEVICE_RELEASED:
-				len = prepareIntCommand(txbuf, len, IND_DEVICE_RELEASED, 1, 1);
-				dev->CommState = ST_IDLE; // wait for socket to close
-				break;
+		len = prepareIntCommand(tx, len, IND_GAIN, total_gain, 2);
+		len = prepareIntCommand(tx, len, IND_LNA_STATE, lnastate, 1);
+		len = prepareIntCommand(tx, len, IND_BIAST_STATE, biasT, 1);
 
-			case ST_SERIALS_REQUESTED: // 1st command
-				BYTE tmp[1024];
-				buflen = dev->prepareSerialsList(tmp);
-				len = prepareStringCommand(txbuf, len, IND_SERIAL, tmp, (uint16_t)buflen);
-				dev->CommState = ST_SERIALS_PREPARED; // wait for the next command changing the state
-				break;
+		dev->getOverload(overload_a, overload_b);
+		len = prepareIntCommand(tx, len, IND_OVERLOAD_A, overload_a ? 1 : 0, 1);
+		len = prepareIntCommand(tx, len, IND_OVERLOAD_B, overload_b ? 1 : 0, 1);
 
-			case ST_DEVICE_CREATED:
-				len = prepareStringCommand(txbuf, len, IND_MAGIC_STRING, (BYTE*)"RTL0", 4);
-				char s[5];
-#ifdef _WIN32
-				strncpy_s(s, "RSPx", 4);
-#else
-				strncpy(s, "RSPx", 4);
-#endif
-				s[4] = 0;
-				buflen = dev->getRxString(s);
-				len = prepareStringCommand(txbuf, len, IND_RX_STRING, (BYTE*)s, (uint16_t)buflen);
-				len = prepareIntCommand(txbuf, len, IND_RX_TYPE, dev->getExportedRxType(), 1);
-				len = prepareIntCommand(txbuf, len, IND_BIT_WIDTH, dev->getBitWidth(), 1);
-				len = prepareIntCommand(txbuf, len, IND_WELCOME, 1, 1);
-				dev->CommState = ST_WELCOME_SENT;
-				//fall through
-			case ST_WELCOME_SENT:
-				gvals = dev->getGainValues();
-				if (gvals == 0)	// too early
-					goto sleep;
-				lnastate = dev->getLNAState();
-				bias = dev->getBiasTState();
-				biasT = bias ? 1 : 0;
+		rspDuoHiZ = dev->getRspDuoHiZ();
+		len = prepareIntCommand(tx, len, IND_RSPDUO_HiZ, rspDuoHiZ ? 1 : 0, 1);
 
-				gain = gvals->curr;
-				if (gain > 0)
-					total_gain = (int)(gain * 10.0f);
+		frequencyFromCallback = (uint32_t)dev->getFreqAfterCbkChange();
+		len = prepareIntCommand(tx, len, IND_RF_CHANGED, frequencyFromCallback, 4);
 
-				len = prepareIntCommand(txbuf, len, IND_GAIN, total_gain, 2);
-				len = prepareIntCommand(txbuf, len, IND_LNA_STATE, lnastate, 1);
-				len = prepareIntCommand(txbuf, len, IND_BIAST_STATE, biasT, 1);
+		antennaValue = dev->getAntenna();
+		len = prepareIntCommand(tx, len, IND_ANTENNA_SELECTED, antennaValue, 1);
 
-				dev->getOverload(overload_a, overload_b);
-				len = prepareIntCommand(txbuf, len, IND_OVERLOAD_A, overload_a ? 1 : 0, 1);
-				len = prepareIntCommand(txbuf, len, IND_OVERLOAD_B, overload_b ? 1 : 0, 1);
+		dabNotch = dev->getDabNotch();
+		len = prepareIntCommand(tx, len, IND_DAB_NOTCH, dabNotch ? 1 : 0, 1);
 
-				rspDuoHiZ = dev->getRspDuoHiZ();
-				len = prepareIntCommand(txbuf, len, IND_RSPDUO_HiZ, rspDuoHiZ ? 1 : 0, 1);
-			
-				frequencyFromCallback = (uint32_t)dev->getFreqAfterCbkChange();
-				len = prepareIntCommand(txbuf, len, IND_RF_CHANGED, frequencyFromCallback, 4);
-			
-				antennaValue = dev->getAntenna();
-				len = prepareIntCommand(txbuf, len, IND_ANTENNA_SELECTED, antennaValue, 1);
-			
-				dabNotch = dev->getDabNotch();
-				len = prepareIntCommand(txbuf, len, IND_DAB_NOTCH, dabNotch ? 1 : 0, 1);
-			
-				rfNotch = dev->getRfNotch();
-				len = prepareIntCommand(txbuf, len, IND_RF_NOTCH, rfNotch ? 1 : 0, 1);
+		rfNotch = dev->getRfNotch();
+		len = prepareIntCommand(tx, len, IND_RF_NOTCH, rfNotch ? 1 : 0, 1);
 
-				//amNotch = dev->getAmNotch();
-				//len = prepareIntCommand(txbuf, len, IND_AM_NOTCH, amNotch ? 1 : 0, 1);
-				break;
-			default:
-				goto sleep;
-				break;
-			}
-			txbuf[0] = BYTE((len >> 8) & 0xff);
-			txbuf[1] = BYTE(len & 0xff);
+		len = prepareIntCommand(tx, len, IND_SAMPLES_DROPPED, (int)(uint32_t)dev->getDroppedSamples(), 4);
+		len = prepareIntCommand(tx, len, IND_SAMPLES_LOST, (int)(uint32_t)dev->getDeviceLostSamples(), 4);
 
-			if (!sendBuffer(controlSocket, txbuf, len, do_exit))
-				break;
-		sleep:
-			pthread_mutex_unlock(&stateLock);
-
-			if (*do_exit)
-				break;
-			usleep(wait);
-		}
-	close:
-		if (haveControlSocket)
-			closesocket(controlSocket);
-		if (*do_exit)
+		if (dev->getIqCorrector().isActive())
 		{
-			closesocket(listensocket);
-			printf("Control Thread terminates\n");
-			break;
+			const IqCorrector& iqc = dev->getIqCorrector();
+			int dcI = (int)lrintf(iqc.getDcI());
+			int dcQ = (int)lrintf(iqc.getDcQ());
+			len = prepareIntCommand(tx, len, IND_DC_OFFSET, (int)(((uint32_t)(dcI & 0xffff) << 16) | (uint32_t)(dcQ & 0xffff)), 4);
+			len = prepareIntCommand(tx, len, IND_IQ_GAIN, (int)lrintf(iqc.getGainDb() * 1000), 2);
+			len = prepareIntCommand(tx, len, IND_IQ_PHASE, (int)lrintf(iqc.getPhaseDeg() * 1000), 2);
 		}
+		if (dev->getScaler().isActive())
+			len = prepareIntCommand(tx, len, IND_SCALE, (int)lrintf(dev->getScaler().getGainDb() * 100), 2);
+
+		//amNotch = dev->getAmNotch();
+		//len = prepareIntCommand(tx, len, IND_AM_NOTCH, amNotch ? 1 : 0, 1);
+		break;
+	default:
+		return 0;
 	}
-	return 0;
+	tx[0] = BYTE((len >> 8) & 0xff);
+	tx[1] = BYTE(len & 0xff);
+	return len;
 }
@@ -96,6 +96,8 @@ void devices::Start(rsp_cmdLineArgs*  args)
 
 		listenerAddress = pargs->Address;
 		listenerPort = pargs->Port;
+		if (pargs->ShmMBytes != 0 && !shm.create(pargs->Port, pargs->ShmMBytes))
+			throw msg_exception("Cannot create the shared memory ring");
 		initListener();
 		doListen();
 	}
@@ -108,17 +110,18 @@ void devices::Stop()
 {
 	try
 	{
-		closesocket(clientSocket);
 		closesocket(listenSocket);
-		if (pd != 0 )
-		{
-			pd->ctrlThreadExitFlag = true;
-		}
+		closesocket(ctrlListenSocket);
+		if (specListenSocket != INVALID_SOCKET)
+			closesocket(specListenSocket);
+		for (size_t i = 0; i < channelListeners.size(); i++)
+			closesocket(channelListeners[i].listenSocket);
+		reactor.wakeup();
 		int sleep_ms = 2000;
 #ifdef __GNUC__
 		usleep(sleep_ms * 1000);
 #else
-		Sleep(sleep_ms); // let the controlThread terminate
+		Sleep(sleep_ms); // let the event loop terminate
 #endif
 		delete _crc32;
 		exit(-5);
@@ -128,22 +131,12 @@ void devices::Stop()
 		cout << "Exception when stopping: " << e.what() << endl;
 	}
 }
+
+// Called from the API event callback, the session ends in the event loop
 void devices::CloseClient()
 {
-	try
-	{
-		closesocket(clientSocket);
-		int sleep_ms = 2000; // let the controlThread terminate
-#ifdef __GNUC__
-		usleep(sleep_ms * 1000);
-#else
-		Sleep(sleep_ms);
-#endif
-	}
-	catch (const std::exception& e)
-	{
-		cout << "Exception when stopping: " << e.what() << endl;
-	}
+	closeRequested.store(true);
+	reactor.wakeup();
 }
 
 void devices::initListener()
@@ -172,64 +165,143 @@ void devices::initListener()
 		throw msg_exception(common::getSocketErrorString().c_str());
 
 }
+
+/// <summary>
+/// The control port (data port + 1), for the indications.
+/// It stays open while the server runs, a control client is accepted any time.
+/// </summary>
+void devices::initControlListener()
+{
+	struct sockaddr_in ctrlLocal;
+	memset(&ctrlLocal, 0, sizeof(ctrlLocal));
+	ctrlLocal.sin_family = AF_INET;
+	ctrlLocal.sin_port = htons((uint16_t)(listenerPort + 1));
+	ctrlLocal.sin_addr.s_addr = inet_addr(listenerAddress.sIPAddress.c_str());
+
+	ctrlListenSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (ctrlListenSocket == INVALID_SOCKET)
+		throw msg_exception("INVALID_SOCKET");
+	int r = 1;
+	struct linger ling = { 1,0 };
+	setsockopt(ctrlListenSocket, SOL_SOCKET, SO_REUSEADDR, (char *)&r, sizeof(int));
+	setsockopt(ctrlListenSocket, SOL_SOCKET, SO_LINGER, (char *)&ling, sizeof(ling));
+	if (::bind(ctrlListenSocket, (struct sockaddr *)&ctrlLocal, sizeof(ctrlLocal)) == SOCKET_ERROR ||
+		listen(ctrlListenSocket, 1) == SOCKET_ERROR)
+		throw msg_exception(common::getSocketErrorString().c_str());
+	common::setNonBlocking(ctrlListenSocket, true);
+	printf("\n\nlistening on Control port %d...\n", listenerPort + 1);
+}
+
+/// <summary>
+/// The spectrum port (data port + 2), only with the spectrum switched on.
+/// Like the control port it stays open while the server runs.
+/// </summary>
+void devices::initSpectrumListener()
+{
+	if (pargs->SpectrumSize == 0)
+		return;
+	struct sockaddr_in specLocal;
+	memset(&specLocal, 0, sizeof(specLocal));
+	specLocal.sin_family = AF_INET;
+	specLocal.sin_port = htons((uint16_t)pargs->spectrumPort());
+	specLocal.sin_addr.s_addr = inet_addr(listenerAddress.sIPAddress.c_str());
+
+	specListenSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (specListenSocket == INVALID_SOCKET)
+		throw msg_exception("INVALID_SOCKET");
+	int r = 1;
+	struct linger ling = { 1,0 };
+	setsockopt(specListenSocket, SOL_SOCKET, SO_REUSEADDR, (char *)&r, sizeof(int));
+	setsockopt(specListenSocket, SOL_SOCKET, SO_LINGER, (char *)&ling, sizeof(ling));
+	if (::bind(specListenSocket, (struct sockaddr *)&specLocal, sizeof(specLocal)) == SOCKET_ERROR ||
+		listen(specListenSocket, pargs->MaxClients) == SOCKET_ERROR)
+		throw msg_exception(common::getSocketErrorString().c_str());
+	common::setNonBlocking(specListenSocket, true);
+	printf("listening on Spectrum port %d...\n", pargs->spectrumPort());
+}
+
+/// <summary>
+/// One port per channel of the channelizer. They are watched only while a session runs.
+/// </summary>
+void devices::initChannelListeners()
+{
+	for (size_t i = 0; i < pargs->Channels.size(); i++)
+	{
+		int bin = pargs->Channels[i];
+		struct sockaddr_in chLocal;
+		memset(&chLocal, 0, sizeof(chLocal));
+		chLocal.sin_family = AF_INET;
+		chLocal.sin_port = htons((uint16_t)pargs->channelPort(bin));
+		chLocal.sin_addr.s_addr = inet_addr(listenerAddress.sIPAddress.c_str());
+
+		SOCKET s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		if (s == INVALID_SOCKET)
+			throw msg_exception("INVALID_SOCKET");
+		int r = 1;
+		struct linger ling = { 1,0 };
+		setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (char *)&r, sizeof(int));
+		setsockopt(s, SOL_SOCKET, SO_LINGER, (char *)&ling, sizeof(ling));
+		if (::bind(s, (struct sockaddr *)&chLocal, sizeof(chLocal)) == SOCKET_ERROR ||
+			listen(s, pargs->MaxClients) == SOCKET_ERROR)
+			throw msg_exception(common::getSocketErrorString().c_str());
+		common::setNonBlocking(s, true);
+		channelListener cl = { bin, s, false };
+		channelListeners.push_back(cl);
+	}
+}
+
+/// <summary>
+/// The event loop. While the maximum number of clients is connected, the listening socket
+/// is not watched, further clients wait in its backlog.
+/// </summary>
 void devices::doListen()
 {
-	/**/
 	try
 	{
-		int maxConnections = 1;
+		int maxConnections = pargs->MaxClients;
 		int res = listen(listenSocket, maxConnections);
 		if (res == SOCKET_ERROR)
 			throw msg_exception(common::getSocketErrorString());
+		common::setNonBlocking(listenSocket, true);
+		initControlListener();
+		initChannelListeners();
+		initSpectrumListener();
 
-		while (listenSocket != INVALID_SOCKET)
+		if (!reactor.init())
+			throw msg_exception("Cannot create the event loop");
+		updateListening();
+		reactor.add(ctrlListenSocket, EV_READ);
+		if (specListenSocket != INVALID_SOCKET)
+			reactor.add(specListenSocket, EV_READ);
+
+		nextIndication = std::chrono::steady_clock::now();
+		while (listenSocket != INVALID_SOCKET && !exitRequest)
 		{
-			pd = new sdrplay_device(pargs);
-			if (pd == 0)
-				throw "Cannot create device";
-
-			cout << "Listening to " << pargs->Address.sIPAddress << ":" << to_string(pargs->Port) << endl;
-			socklen_t rlen = sizeof(remote);
-			clientSocket = accept(listenSocket, (struct sockaddr*)&remote, &rlen);
-			if (clientSocket == INVALID_SOCKET || exitRequest)
-			{
-				cout << "Server socket accept error." << endl;
+			long long untilIndication = std::chrono::duration_cast<std::chrono::milliseconds>(
+				nextIndication - std::chrono::steady_clock::now()).count();
+			int timeoutMs = untilIndication > 0 ? (int)untilIndication : 0;
+			int txTimeoutMs = getTransmitTimeoutMs();
+			if (txTimeoutMs >= 0 && txTimeoutMs < timeoutMs)
+				timeoutMs = txTimeoutMs;
+			int reapTimeoutMs = reaper.getTimeoutMs();
+			if (reapTimeoutMs >= 0 && reapTimeoutMs < timeoutMs)
+				timeoutMs = reapTimeoutMs;
+			if (reactor.poll(this, timeoutMs) < 0)
+				throw msg_exception(common::getSocketErrorString());
+			if (exitRequest)
 				break;
+			reaper.service();
+
+			if (pd != 0 && closeRequested.exchange(false))
+				endSession();
+			// a batch waiting for more blocks is due
+			if (pd != 0 && getTransmitTimeoutMs() == 0)
+				distribute();
+			if (std::chrono::steady_clock::now() >= nextIndication)
+			{
+				sendIndications();
+				nextIndication = std::chrono::steady_clock::now() + std::chrono::milliseconds(c_indicationIntervalMs);
 			}
-			cout << "Client Accepted!\n" << endl;
-			int yes = 1;
-			int result = setsockopt(clientSocket,
-				IPPROTO_TCP,
-				TCP_NODELAY,
-				(char*)&yes,
-				sizeof(int));    // 1 - on, 0 - off
-			if (result < 0)
-				cout << "Error on setting TCP_NODELAY" << endl;
-
-			pd->start(clientSocket); // creates the receive and stream thread
-
-			void* status;
-			pthread_join(*pd->thrdRx, &status);
-			cout << endl << "++++ Rx thread terminated ++++" << endl;
-			pd->thrdRx = 0;
-			pd->stop();
-
-			pthread_join(*pd->thrdTx, &status);
-			cout << endl << "++++ Tx thread terminated ++++" << endl;
-			delete pd->thrdTx;
-			pd->thrdTx = 0;
-
-
-			/*###*/pthread_join(*pd->thrdCtrl, &status);
-			cout << endl << "++++ Ctrl thread terminated ++++" << endl;
-			delete pd->thrdCtrl;
-			pd->thrdCtrl = 0;
-
-			closesocket(clientSocket);
-			pd->remoteClient = INVALID_SOCKET;
-			cout << "Socket closed\n\n";
-			delete pd;
-			pd = 0;
 		}
 	}
 	catch (exception& e)
@@ -237,5 +309,507 @@ void devices::doListen()
 		cout << "*** Error starting listener: " << e.what() << endl;
 	}
 	cout << "*** Exiting listening loop" << endl;
-	/**/
+}
+
+void devices::onEvent(SOCKET s, int events)
+{
+	if (s == listenSocket)
+		acceptClient();
+	else if (s == ctrlListenSocket)
+		acceptControlClient();
+	else if (s == specListenSocket)
+		acceptSpectrumClient();
+	else if (s == ctrlSocket)
+	{
+		// nothing is expected from the control client but its disconnect
+		if (events & (EV_READ | EV_ERROR))
+		{
+			char buf[64];
+			int rcvd = recv(ctrlSocket, buf, sizeof(buf), 0);
+			if (rcvd == 0 || (rcvd == SOCKET_ERROR && !common::socketWouldBlock()))
+			{
+				closeControlClient();
+				return;
+			}
+		}
+		if (events & EV_WRITE)
+			flushControl();
+	}
+	else
+	{
+		for (size_t i = 0; i < spectrumClients.size(); i++)
+		{
+			if (spectrumClients[i].s != s)
+				continue;
+			// nothing is expected from a spectrum client but its disconnect
+			if (events & (EV_READ | EV_ERROR))
+			{
+				char buf[64];
+				int rcvd = recv(s, buf, sizeof(buf), 0);
+				if (rcvd == 0 || (rcvd == SOCKET_ERROR && !common::socketWouldBlock()))
+				{
+					closeSpectrumClient(i);
+					return;
+				}
+			}
+			if ((events & EV_WRITE) && flushSpectrum(i))
+				sendSpectrum();
+			return;
+		}
+		for (size_t i = 0; i < channelListeners.size(); i++)
+		{
+			if (channelListeners[i].listenSocket == s)
+			{
+				acceptChannelClient((int)i);
+				return;
+			}
+		}
+		for (size_t i = 0; i < clients.size(); i++)
+		{
+			StreamClient* c = clients[i];
+			if (c->getSocket() != s)
+				continue;
+			// EV_ERROR may also be a zero copy completion, recv tells a real error
+			if ((events & (EV_READ | EV_ERROR)) && !c->onReceive(pd, c == controller))
+				dropClient(c);
+			else if (events & (EV_WRITE | EV_ERROR))
+				distribute();
+			return;
+		}
+	}
+}
+
+// The callback queued blocks, or the spectrum worker has a frame
+void devices::onWakeup()
+{
+	distribute();
+	sendSpectrum();
+}
+
+/// <summary>
+/// Moves the queued blocks into the rings and lets each client continue from its cursor.
+/// Blocks read by all clients of a ring are released from it afterwards.
+/// </summary>
+void devices::distribute()
+{
+	// a second round if the ring was full in OVL_BLOCK mode and the clients made room
+	for (int round = 0; round < 2 && pd != 0; round++)
+	{
+		bool more = pd->fillRing();
+		if (udp != 0)
+			udp->onTransmit(pd->Ring, pd->getConverter(), pd->getSamplingRateHz());
+		shm.onTransmit(pd->Ring, pd->getSamplingRateHz());
+		for (size_t i = 0; i < clients.size(); )
+		{
+			StreamClient* c = clients[i];
+			if (!c->onTransmit(pd->getRing(c->getChannel())))
+			{
+				dropClient(c);	// may end the session
+				continue;
+			}
+			i++;
+		}
+		if (pd == 0)
+			return;
+		releaseRing();
+		if (!more)
+			break;
+	}
+}
+
+void devices::releaseRing()
+{
+	if (pd == 0)
+		return;
+	releaseRing(-1);
+	for (int i = 0; i < (int)pd->Channels.size(); i++)
+		releaseRing(i);
+}
+
+// A ring without clients is released completely
+void devices::releaseRing(int channel)
+{
+	BroadcastRing& ring = pd->getRing(channel);
+	uint64_t minCursor = ring.end();
+	if (channel < 0 && udp != 0)
+		minCursor = udp->getCursor();
+	if (channel < 0 && shm.isOpen() && shm.getCursor() < minCursor)
+		minCursor = shm.getCursor();
+	for (size_t i = 0; i < clients.size(); i++)
+		if (clients[i]->getChannel() == channel && clients[i]->getCursor() < minCursor)
+			minCursor = clients[i]->getCursor();
+	ring.releaseBefore(minCursor, pd->Pool);
+}
+
+int devices::countClients(int channel) const
+{
+	int n = 0;
+	for (size_t i = 0; i < clients.size(); i++)
+		if (clients[i]->getChannel() == channel)
+			n++;
+	return n;
+}
+
+int devices::getTransmitTimeoutMs() const
+{
+	int timeoutMs = udp != 0 ? udp->getTransmitTimeoutMs() : -1;
+	for (size_t i = 0; i < clients.size(); i++)
+	{
+		int t = clients[i]->getTransmitTimeoutMs();
+		if (t >= 0 && (timeoutMs < 0 || t < timeoutMs))
+			timeoutMs = t;
+	}
+	return timeoutMs;
+}
+
+/// <summary>
+/// The first client starts the session on the device, the others join it.
+/// Every client gets the welcome string and the stream from the newest block on.
+/// </summary>
+void devices::acceptClient()
+{
+	socklen_t rlen = sizeof(remote);
+	SOCKET s = accept(listenSocket, (struct sockaddr*)&remote, &rlen);
+	if (s == INVALID_SOCKET)
+	{
+		if (!common::socketWouldBlock())
+			cout << "Server socket accept error." << endl;
+		return;
+	}
+	int yes = 1;
+	int result = setsockopt(s,
+		IPPROTO_TCP,
+		TCP_NODELAY,
+		(char*)&yes,
+		sizeof(int));    // 1 - on, 0 - off
+	if (result < 0)
+		cout << "Error on setting TCP_NODELAY" << endl;
+
+	bool first = pd == 0;
+	if (first)
+	{
+		closeRequested.store(false);
+		pd = new sdrplay_device(pargs);
+	}
+	StreamClient* c = new StreamClient(s, remote, nextClientId++);
+	clients.push_back(c);
+	cout << "Client " << c->getId() << " Accepted from " << c->getAddress() << ", "
+		<< countClients(-1) << " of " << pargs->MaxClients << " clients" << endl << endl;
+
+	// preliminary in basic mode, the device is not initialized yet
+	common::setNonBlocking(s, false);
+	pd->writeWelcomeString(s);
+	if (first && !pd->start(&reactor))
+	{
+		endSession();
+		return;
+	}
+	if (first)
+		shm.beginSession(pd->Ring, pd->getBitWidth());
+	if (first && pargs->UdpPort != 0)
+	{
+		udp = new UdpStreamer(pd->Pool);
+		if (!udp->start(pd->Ring, pargs->UdpAddress, pargs->UdpPort, pargs->UdpMtu, pargs->UdpPacing, pd->getBitWidth()))
+		{
+			endSession();
+			return;
+		}
+	}
+	if (!c->start(&reactor, &reaper, pd->Pool, pd->Ring, pargs))
+	{
+		dropClient(c);
+		return;
+	}
+	assignController();
+	updateListening();
+}
+
+/// <summary>
+/// A client of a channel port joins the running session. It gets the welcome string
+/// and the stream of its channel from the newest block on.
+/// </summary>
+void devices::acceptChannelClient(int ix)
+{
+	channelListener& cl = channelListeners[ix];
+	socklen_t rlen = sizeof(remote);
+	SOCKET s = accept(cl.listenSocket, (struct sockaddr*)&remote, &rlen);
+	if (s == INVALID_SOCKET)
+		return;
+	if (pd == 0 || ix >= (int)pd->Channels.size())
+	{
+		closesocket(s);
+		return;
+	}
+	int yes = 1;
+	setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (char*)&yes, sizeof(int));
+
+	StreamClient* c = new StreamClient(s, remote, nextClientId++, ix);
+	clients.push_back(c);
+	cout << "Client " << c->getId() << " Accepted from " << c->getAddress() << " on channel " << cl.bin << ", "
+		<< countClients(ix) << " of " << pargs->MaxClients << " clients" << endl << endl;
+
+	common::setNonBlocking(s, false);
+	pd->writeWelcomeString(s, ix);
+	if (!c->start(&reactor, &reaper, pd->Pool, pd->getRing(ix), pargs))
+	{
+		dropClient(c);
+		return;
+	}
+	updateListening();
+}
+
+/// <summary>
+/// Removes a client which disconnected or failed. The session ends with the last client
+/// of the main port, the channel clients are disconnected then.
+/// </summary>
+void devices::dropClient(StreamClient* c)
+{
+	cout << "Client " << c->getId() << " (" << c->getAddress() << ") disconnected" << endl;
+	for (size_t i = 0; i < clients.size(); i++)
+	{
+		if (clients[i] == c)
+		{
+			clients.erase(clients.begin() + i);
+			break;
+		}
+	}
+	if (c == controller)
+	{
+		controller = 0;
+		pd->Controller = 0;
+	}
+	delete c;
+	if (countClients(-1) == 0)
+	{
+		endSession();
+		return;
+	}
+	// its cursor may have held the oldest blocks
+	releaseRing();
+	assignController();
+	updateListening();
+}
+
+/// <summary>
+/// The tuning authority: with a ControlAddress only a client from that address,
+/// else the current controller keeps it and on its leave the oldest client gets it.
+/// </summary>
+void devices::assignController()
+{
+	StreamClient* c = controller;
+	const string& designated = pargs->ControlAddress;
+	if (c == 0)
+	{
+		for (size_t i = 0; i < clients.size() && c == 0; i++)
+			if (clients[i]->getChannel() < 0 && (designated == "" || clients[i]->getAddress() == designated))
+				c = clients[i];
+	}
+	if (c == controller)
+		return;
+	controller = c;
+	pd->Controller = c;
+	cout << "Client " << c->getId() << " (" << c->getAddress() << ") has the tuning authority" << endl;
+}
+
+// The listening sockets are watched while another client may connect,
+// those of the channels only during a session
+void devices::updateListening()
+{
+	for (size_t i = 0; i < channelListeners.size(); i++)
+	{
+		channelListener& cl = channelListeners[i];
+		bool wantChannel = pd != 0 && !exitRequest && countClients((int)i) < pargs->MaxClients;
+		if (wantChannel == cl.listening)
+			continue;
+		if (wantChannel)
+			reactor.add(cl.listenSocket, EV_READ);
+		else
+			reactor.remove(cl.listenSocket);
+		cl.listening = wantChannel;
+	}
+
+	bool want = listenSocket != INVALID_SOCKET && !exitRequest && countClients(-1) < pargs->MaxClients;
+	if (want == listening)
+		return;
+	if (want)
+	{
+		reactor.add(listenSocket, EV_READ);
+		cout << "Listening to " << pargs->Address.sIPAddress << ":" << to_string(pargs->Port) << endl;
+	}
+	else
+		reactor.remove(listenSocket);
+	listening = want;
+}
+
+void devices::acceptControlClient()
+{
+	socklen_t rlen = sizeof(remote);
+	SOCKET s = accept(ctrlListenSocket, (struct sockaddr*)&remote, &rlen);
+	if (s == INVALID_SOCKET)
+		return;
+	// the latest control client wins
+	if (ctrlSocket != INVALID_SOCKET)
+		closeControlClient();
+	struct linger ling = { 1,0 };
+	setsockopt(s, SOL_SOCKET, SO_LINGER, (char *)&ling, sizeof(ling));
+	common::setNonBlocking(s, true);
+	ctrlSocket = s;
+	ctrlLen = ctrlSent = 0;
+	ctrlWriteInterest = false;
+	reactor.add(ctrlSocket, EV_READ);
+	printf("\nControl client accepted!\n");
+}
+
+void devices::acceptSpectrumClient()
+{
+	socklen_t rlen = sizeof(remote);
+	SOCKET s = accept(specListenSocket, (struct sockaddr*)&remote, &rlen);
+	if (s == INVALID_SOCKET)
+		return;
+	if ((int)spectrumClients.size() >= pargs->MaxClients)
+	{
+		closesocket(s);
+		return;
+	}
+	common::setNonBlocking(s, true);
+	spectrumClient c = { s, std::vector<uint8_t>(), 0, 0, false };
+	spectrumClients.push_back(c);
+	reactor.add(s, EV_READ);
+	cout << "Spectrum client accepted from " << inet_ntoa(remote.sin_addr) << endl;
+	sendSpectrum();
+}
+
+void devices::closeSpectrumClient(size_t ix)
+{
+	reactor.remove(spectrumClients[ix].s);
+	closesocket(spectrumClients[ix].s);
+	spectrumClients.erase(spectrumClients.begin() + ix);
+}
+
+/// <summary>
+/// Hands the newest frame to each spectrum client which has taken the previous one.
+/// Frames produced meanwhile are skipped for a slow client.
+/// </summary>
+void devices::sendSpectrum()
+{
+	if (spectrumClients.empty() || pd == 0)
+		return;
+	pd->Spectrum.getFrame(spectrumSeq, spectrumFrame);
+	if (spectrumFrame.empty())
+		return;
+	for (size_t i = 0; i < spectrumClients.size(); )
+	{
+		spectrumClient& c = spectrumClients[i];
+		if (c.sent == c.frame.size() && c.seq != spectrumSeq)
+		{
+			c.frame = spectrumFrame;
+			c.sent = 0;
+			c.seq = spectrumSeq;
+			if (!flushSpectrum(i))
+				continue;	// closed
+		}
+		i++;
+	}
+}
+
+// Returns false if the client was closed
+bool devices::flushSpectrum(size_t ix)
+{
+	spectrumClient& c = spectrumClients[ix];
+	while (c.sent < c.frame.size())
+	{
+		int sent = (int)send(c.s, (const char*)&c.frame[c.sent], (int)(c.frame.size() - c.sent), 0);
+		if (sent == SOCKET_ERROR)
+		{
+			if (!common::socketWouldBlock())
+			{
+				closeSpectrumClient(ix);
+				return false;
+			}
+			break;
+		}
+		c.sent += sent;
+	}
+	bool wantWrite = c.sent < c.frame.size();
+	if (wantWrite != c.writeInterest && reactor.modify(c.s, wantWrite ? EV_READ | EV_WRITE : EV_READ))
+		c.writeInterest = wantWrite;
+	return true;
+}
+
+void devices::closeControlClient()
+{
+	if (ctrlSocket == INVALID_SOCKET)
+		return;
+	reactor.remove(ctrlSocket);
+	closesocket(ctrlSocket);
+	ctrlSocket = INVALID_SOCKET;
+	ctrlLen = ctrlSent = 0;
+}
+
+/// <summary>
+/// Prepares and sends the indications. If the previous ones are not sent completely yet,
+/// this round is skipped.
+/// </summary>
+void devices::sendIndications()
+{
+	if (ctrlSocket == INVALID_SOCKET || pd == 0 || ctrlSent < ctrlLen)
+		return;
+	ctrlLen = buildIndications(pd, ctrlBuf);
+	ctrlSent = 0;
+	flushControl();
+}
+
+void devices::flushControl()
+{
+	while (ctrlSent < ctrlLen)
+	{
+		int sent = (int)send(ctrlSocket, (const char*)ctrlBuf + ctrlSent, ctrlLen - ctrlSent, 0);
+		if (sent == SOCKET_ERROR)
+		{
+			if (!common::socketWouldBlock())
+			{
+				closeControlClient();
+				return;
+			}
+			break;
+		}
+		ctrlSent += sent;
+	}
+	bool wantWrite = ctrlSent < ctrlLen;
+	if (wantWrite != ctrlWriteInterest && reactor.modify(ctrlSocket, wantWrite ? EV_READ | EV_WRITE : EV_READ))
+		ctrlWriteInterest = wantWrite;
+}
+
+/// <summary>
+/// Stops the device, sends the release indication and disconnects all clients.
+/// Then the next client starts a new session.
+/// </summary>
+void devices::endSession()
+{
+	cout << endl << "++++ Session terminating ++++" << endl;
+	pd->stop();
+	// the device released indication, the control client is closed with the session
+	ctrlLen = ctrlSent = 0;
+	sendIndications();
+	if (ctrlSocket != INVALID_SOCKET)
+	{
+		// no reset on close, that would discard the indication
+		struct linger ling = { 0,0 };
+		setsockopt(ctrlSocket, SOL_SOCKET, SO_LINGER, (char *)&ling, sizeof(ling));
+	}
+	closeControlClient();
+
+	// before the device, the senders return their blocks to its pool
+	for (size_t i = 0; i < clients.size(); i++)
+		delete clients[i];
+	clients.clear();
+	reaper.releaseAll();
+	delete udp;
+	udp = 0;
+	controller = 0;
+	cout << "Sockets closed\n\n";
+	delete pd;
+	pd = 0;
+
+	updateListening();
 }
@@ -0,0 +1,697 @@
+/**
+** RSP3_tcp - TCP/IP I/Q Data Server for the sdrplay RSP devices
+** Copyright (C) 2017-2024 Clem Schmidt, softsyst, http://qirx.softsyst.com
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**/
+
+#include "iqConvert.h"
+#include <iostream>
+#include <math.h>
+#if defined(_MSC_VER) && defined(IQ_X86)
+#include <intrin.h>
+#endif
+using namespace std;
+
+iqConverterEntry iqConvert::converters[NUM_BIT_WIDTHS][2];
+iqConverterEntry iqConvert::references[NUM_BIT_WIDTHS][2];
+const char* iqConvert::kernelName = "scalar";
+std::atomic<float> iqFloatScale::factor{ 1.0f / 32768 };
+
+void iqFloatScale::setGain(float gainDb)
+{
+	factor.store((float)(pow(10.0, -gainDb / 20.0) / 32768), std::memory_order_relaxed);
+}
+
+template <eBitWidth W, bool Adsb, bool LittleEndianHost>
+static iqConverterEntry scalarEntry(const char* name)
+{
+	typedef iqConverter<W, Adsb, LittleEndianHost> C;
+	iqConverterEntry e = { C::convert, C::bytesPerSample, C::samplesPerGroup, C::bytesPerGroup, name };
+	return e;
+}
+
+template <bool LittleEndianHost>
+void iqConvert::fillScalar()
+{
+	const char* name = LittleEndianHost ? "scalar (little endian)" : "scalar";
+	iqConverterEntry table[NUM_BIT_WIDTHS][2] =
+	{
+		{	// BITS_4
+			scalarEntry<BITS_4, false, LittleEndianHost>(name),
+			scalarEntry<BITS_4, true, LittleEndianHost>(name)
+		},
+		{	// BITS_8
+			scalarEntry<BITS_8, false, LittleEndianHost>(name),
+			scalarEntry<BITS_8, true, LittleEndianHost>(name)
+		},
+		{	// BITS_16
+			scalarEntry<BITS_16, false, LittleEndianHost>(name),
+			scalarEntry<BITS_16, true, LittleEndianHost>(name)
+		},
+		{	// BITS_BFP
+			scalarEntry<BITS_BFP, false, LittleEndianHost>(name),
+			scalarEntry<BITS_BFP, true, LittleEndianHost>(name)
+		},
+		{	// BITS_LOSSLESS, compressed from the 16 bit format after the conversion
+			scalarEntry<BITS_16, false, LittleEndianHost>(name),
+			scalarEntry<BITS_16, true, LittleEndianHost>(name)
+		},
+		{	// BITS_12
+			scalarEntry<BITS_12, false, LittleEndianHost>(name),
+			scalarEntry<BITS_12, true, LittleEndianHost>(name)
+		},
+		{	// BITS_CF32
+			scalarEntry<BITS_CF32, false, LittleEndianHost>(name),
+			scalarEntry<BITS_CF32, true, LittleEndianHost>(name)
+		}
+	};
+	memcpy(converters, table, sizeof(table));
+	memcpy(references, table, sizeof(table));
+	kernelName = name;
+}
+
+/// <summary>
+/// Installs a vectorized kernel for a format, if it passes a quick comparison with the
+/// scalar converter it replaces. The exhaustive one is verifyKernels, -b verify
+/// </summary>
+void iqConvert::setKernel(eBitWidth bitWidth, bool adsbMode, interleaveFn kernel, const char* name)
+{
+	const iqConverterEntry& ref = references[bitWidth][adsbMode ? 1 : 0];
+	if (!verify(kernel, ref.convert, ref.bytesPerSample, name, c_quickValues))
+		return;
+	converters[bitWidth][adsbMode ? 1 : 0].convert = kernel;
+	converters[bitWidth][adsbMode ? 1 : 0].kernel = name;
+	kernelName = name;
+}
+
+/// <summary>
+/// Builds the converter table for the host. Big endian hosts always use the
+/// byte-wise scalar 16 bit converter.
+/// </summary>
+void iqConvert::init()
+{
+	bool le = common::isLittleEndian();
+	if (le)
+		fillScalar<true>();
+	else
+		fillScalar<false>();
+
+#ifdef IQ_X86
+	// the 8 and 4 bit kernels compute on values, they don't depend on the host byte order
+	if (hasAvx2())
+	{
+		// no wider kernel for the block floating point groups
+		setKernel(BITS_BFP, false, bfp_sse2, "SSE2");
+		setKernel(BITS_BFP, true, bfp_sse2, "SSE2");
+		setKernel(BITS_12, false, pack12_sse2, "SSE2");
+		setKernel(BITS_12, true, pack12_sse2, "SSE2");
+		setKernel(BITS_8, false, requant8_avx2, "AVX2");
+		setKernel(BITS_8, true, requant8Adsb_avx2, "AVX2");
+		setKernel(BITS_4, false, pack4_avx2, "AVX2");
+		setKernel(BITS_4, true, pack4_avx2, "AVX2");
+		if (le)
+		{
+			setKernel(BITS_16, false, interleave16_avx2, "AVX2");
+			setKernel(BITS_16, true, interleave16_avx2, "AVX2");
+			setKernel(BITS_CF32, false, float32_avx2, "AVX2");
+			setKernel(BITS_CF32, true, float32_avx2, "AVX2");
+		}
+	}
+	else if (hasSse2())
+	{
+		setKernel(BITS_8, false, requant8_sse2, "SSE2");
+		setKernel(BITS_8, true, requant8Adsb_sse2, "SSE2");
+		setKernel(BITS_4, false, pack4_sse2, "SSE2");
+		setKernel(BITS_4, true, pack4_sse2, "SSE2");
+		setKernel(BITS_BFP, false, bfp_sse2, "SSE2");
+		setKernel(BITS_BFP, true, bfp_sse2, "SSE2");
+		setKernel(BITS_12, false, pack12_sse2, "SSE2");
+		setKernel(BITS_12, true, pack12_sse2, "SSE2");
+		if (le)
+		{
+			setKernel(BITS_16, false, interleave16_sse2, "SSE2");
+			setKernel(BITS_16, true, interleave16_sse2, "SSE2");
+			setKernel(BITS_CF32, false, float32_sse2, "SSE2");
+			setKernel(BITS_CF32, true, float32_sse2, "SSE2");
+		}
+	}
+#endif
+#ifdef IQ_NEON
+	setKernel(BITS_8, false, requant8_neon, "NEON");
+	setKernel(BITS_8, true, requant8Adsb_neon, "NEON");
+	setKernel(BITS_4, false, pack4_neon, "NEON");
+	setKernel(BITS_4, true, pack4_neon, "NEON");
+	setKernel(BITS_BFP, false, bfp_neon, "NEON");
+	setKernel(BITS_BFP, true, bfp_neon, "NEON");
+	setKernel(BITS_12, false, pack12_neon, "NEON");
+	setKernel(BITS_12, true, pack12_neon, "NEON");
+	if (le)
+	{
+		setKernel(BITS_16, false, interleave16_neon, "NEON");
+		setKernel(BITS_16, true, interleave16_neon, "NEON");
+		setKernel(BITS_CF32, false, float32_neon, "NEON");
+		setKernel(BITS_CF32, true, float32_neon, "NEON");
+	}
+#endif
+	converters[BITS_LOSSLESS][0] = converters[BITS_16][0];
+	converters[BITS_LOSSLESS][1] = converters[BITS_16][1];
+	std::cout << "I/Q conversion kernels: " << kernelName << endl;
+}
+
+const iqConverterEntry* iqConvert::select(eBitWidth bitWidth, bool adsbMode)
+{
+	int ix = (int)bitWidth;
+	if (ix < 0 || ix >= NUM_BIT_WIDTHS)
+		ix = BITS_8;
+	return &converters[ix][adsbMode ? 1 : 0];
+}
+
+/// <summary>
+/// Compares every installed kernel with its scalar reference over all possible 16 bit
+/// sample values. Returns the number of kernels which differ
+/// </summary>
+int iqConvert::verifyKernels()
+{
+	const char* formats[NUM_BIT_WIDTHS] = { "4 bit", "8 bit", "16 bit", "BFP", "lossless", "12 bit", "CF32" };
+	int failed = 0;
+	for (int f = 0; f < NUM_BIT_WIDTHS; f++)
+	{
+		for (int adsb = 0; adsb < 2; adsb++)
+		{
+			const iqConverterEntry& conv = converters[f][adsb];
+			const iqConverterEntry& ref = references[f][adsb];
+			bool ok = verify(conv.convert, ref.convert, ref.bytesPerSample, conv.kernel, c_allValues);
+			if (!ok)
+				failed++;
+			std::cout << formats[f] << (adsb ? ", ADS-B" : "") << ": " << conv.kernel
+				<< (conv.convert == ref.convert ? " (the reference)" : ok ? " identical" : " DIFFERS") << endl;
+		}
+	}
+	return failed;
+}
+
+/// <summary>
+/// Compares a kernel with its scalar reference, over numValues sample values spread
+/// across the 16 bit range and over lengths not being a multiple of the vector width.
+/// </summary>
+bool iqConvert::verify(interleaveFn kernel, interleaveFn reference, int bytesPerSample, const char* name, int numValues)
+{
+	if (kernel == reference)
+		return true;
+	const int n = numValues;
+	const int step = 0x10000 / n;
+	short* idata = new short[n];
+	short* qdata = new short[n];
+	BYTE* expected = new BYTE[n * bytesPerSample];
+	BYTE* actual = new BYTE[n * bytesPerSample];
+	for (int i = 0; i < n; i++)
+	{
+		idata[i] = (short)(i * step - 0x8000);
+		qdata[i] = (short)(0x7fff - i * step);
+	}
+	bool ok = true;
+	const int lengths[] = { n, n - 1, 37, 15, 1 };
+	for (int k = 0; k < 5 && ok; k++)
+	{
+		int len = lengths[k];
+		int offset = n - len;	// unaligned starts as well
+		memset(expected, 0x55, n * bytesPerSample);
+		memset(actual, 0x55, n * bytesPerSample);
+		reference(idata + offset, qdata + offset, len, expected);
+		kernel(idata + offset, qdata + offset, len, actual);
+		ok = memcmp(expected, actual, n * bytesPerSample) == 0;
+	}
+	if (!ok)
+		std::cout << "*** I/Q conversion kernel " << name << " differs from the reference, using the scalar kernel" << endl;
+	delete[] idata;
+	delete[] qdata;
+	delete[] expected;
+	delete[] actual;
+	return ok;
+}
+
+#ifdef IQ_X86
+bool iqConvert::hasSse2()
+{
+#if defined(__x86_64__) || defined(_M_X64)
+	return true;	// part of the x86-64 base
+#elif defined(__GNUC__)
+	return __builtin_cpu_supports("sse2") != 0;
+#else
+	int regs[4];
+	__cpuid(regs, 1);
+	return (regs[3] & (1 << 26)) != 0;
+#endif
+}
+
+bool iqConvert::hasAvx2()
+{
+#if defined(__GNUC__)
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") != 0;
+#else
+	int regs[4];
+	__cpuid(regs, 1);
+	bool osxsave = (regs[2] & (1 << 27)) != 0;
+	bool avx = (regs[2] & (1 << 28)) != 0;
+	if (!osxsave || !avx)
+		return false;
+	// OS must save the YMM registers
+	if ((_xgetbv(0) & 6) != 6)
+		return false;
+	__cpuidex(regs, 7, 0);
+	return (regs[1] & (1 << 5)) != 0;
+#endif
+}
+#else
+bool iqConvert::hasSse2() { return false; }
+bool iqConvert::hasAvx2() { return false; }
+#endif
+
+// The vector kernels use these identities of the scalar code:
+// ((x >> 4) + 2048) >> 4 == (x >> 8) + 128, i.e. the high byte of x with the sign bit inverted.
+// x / 64 truncates towards zero: (x + (x < 0 ? 63 : 0)) >> 6. The cast to BYTE keeps the low byte.
+
+#ifdef IQ_X86
+static inline __m128i adsb8_sse2(__m128i x)
+{
+	__m128i bias = _mm_and_si128(_mm_srai_epi16(x, 15), _mm_set1_epi16(63));
+	__m128i q = _mm_srai_epi16(_mm_add_epi16(x, bias), 6);
+	return _mm_add_epi16(q, _mm_set1_epi16(127));
+}
+
+IQ_TARGET_AVX2
+static inline __m256i adsb8_avx2(__m256i x)
+{
+	__m256i bias = _mm256_and_si256(_mm256_srai_epi16(x, 15), _mm256_set1_epi16(63));
+	__m256i q = _mm256_srai_epi16(_mm256_add_epi16(x, bias), 6);
+	return _mm256_add_epi16(q, _mm256_set1_epi16(127));
+}
+
+void iqConvert::requant8_sse2(const short* idata, const short* qdata, int numSamples, BYTE* out)
+{
+	const __m128i hiMask = _mm_set1_epi16((short)0xff00);
+	const __m128i signs = _mm_set1_epi16((short)0x8080);
+	int i = 0;
+	for (; i + 8 <= numSamples; i += 8)
+	{
+		__m128i vi = _mm_loadu_si128((const __m128i*)(idata + i));
+		__m128i vq = _mm_loadu_si128((const __m128i*)(qdata + i));
+		// low byte: high byte of I, high byte: high byte of Q
+		__m128i w = _mm_or_si128(_mm_srli_epi16(vi, 8), _mm_and_si128(vq, hiMask));
+		_mm_storeu_si128((__m128i*)(out + 2 * i), _mm_xor_si128(w, signs));
+	}
+	iqConverter<BITS_8, false, true>::convert(idata + i, qdata + i, numSamples - i, out + 2 * i);
+}
+
+IQ_TARGET_AVX2
+void iqConvert::requant8_avx2(const short* idata, const short* qdata, int numSamples, BYTE* out)
+{
+	const __m256i hiMask = _mm256_set1_epi16((short)0xff00);
+	const __m256i signs = _mm256_set1_epi16((short)0x8080);
+	int i = 0;
+	for (; i + 16 <= numSamples; i += 16)
+	{
+		__m256i vi = _mm256_loadu_si256((const __m256i*)(idata + i));
+		__m256i vq = _mm256_loadu_si256((const __m256i*)(qdata + i));
+		__m256i w = _mm256_or_si256(_mm256_srli_epi16(vi, 8), _mm256_and_si256(vq, hiMask));
+		_mm256_storeu_si256((__m256i*)(out + 2 * i), _mm256_xor_si256(w, signs));
+	}
+	requant8_sse2(idata + i, qdata + i, numSamples - i, out + 2 * i);
+}
+
+void iqConvert::requant8Adsb_sse2(const short* idata, const short* qdata, int numSamples, BYTE* out)
+{
+	const __m128i loMask = _mm_set1_epi16(0x00ff);
+	int i = 0;
+	for (; i + 8 <= numSamples; i += 8)
+	{
+		__m128i bi = adsb8_sse2(_mm_loadu_si128((const __m128i*)(idata + i)));
+		__m128i bq = adsb8_sse2(_mm_loadu_si128((const __m128i*)(qdata + i)));
+		__m128i w = _mm_or_si128(_mm_and_si128(bi, loMask), _mm_slli_epi16(bq, 8));
+		_mm_storeu_si128((__m128i*)(out + 2 * i), w);
+	}
+	iqConverter<BITS_8, true, true>::convert(idata + i, qdata + i, numSamples - i, out + 2 * i);
+}
+
+IQ_TARGET_AVX2
+void iqConvert::requant8Adsb_avx2(const short* idata, const short* qdata, int numSamples, BYTE* out)
+{
+	const __m256i loMask = _mm256_set1_epi16(0x00ff);
+	int i = 0;
+	for (; i + 16 <= numSamples; i += 16)
+	{
+		__m256i bi = adsb8_avx2(_mm256_loadu_si256((const __m256i*)(idata + i)));
+		__m256i bq = adsb8_avx2(_mm256_loadu_si256((const __m256i*)(qdata + i)));
+		__m256i w = _mm256_or_si256(_mm256_and_si256(bi, loMask), _mm256_slli_epi16(bq, 8));
+		_mm256_storeu_si256((__m256i*)(out + 2 * i), w);
+	}
+	requant8Adsb_sse2(idata + i, qdata + i, numSamples - i, out + 2 * i);
+}
+
+void iqConvert::pack4_sse2(const short* idata, const short* qdata, int numSamples, BYTE* out)
+{
+	const __m128i loNibble = _mm_set1_epi16(0x000f);
+	const __m128i hiNibble = _mm_set1_epi16(0x00f0);
+	int i = 0;
+	for (; i + 16 <= numSamples; i += 16)
+	{
+		__m128i bi0 = adsb8_sse2(_mm_loadu_si128((const __m128i*)(idata + i)));
+		__m128i bq0 = adsb8_sse2(_mm_loadu_si128((const __m128i*)(qdata + i)));
+		__m128i bi1 = adsb8_sse2(_mm_loadu_si128((const __m128i*)(idata + i + 8)));
+		__m128i bq1 = adsb8_sse2(_mm_loadu_si128((const __m128i*)(qdata + i + 8)));
+		// one byte per pair in the low byte of each word, so packus never saturates
+		__m128i p0 = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(bi0, 4), loNibble), _mm_and_si128(bq0, hiNibble));
+		__m128i p1 = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(bi1, 4), loNibble), _mm_and_si128(bq1, hiNibble));
+		_mm_storeu_si128((__m128i*)(out + i), _mm_packus_epi16(p0, p1));
+	}
+	iqConverter<BITS_4, false, true>::convert(idata + i, qdata + i, numSamples - i, out + i);
+}
+
+IQ_TARGET_AVX2
+void iqConvert::pack4_avx2(const short* idata, const short* qdata, int numSamples, BYTE* out)
+{
+	const __m256i loNibble = _mm256_set1_epi16(0x000f);
+	const __m256i hiNibble = _mm256_set1_epi16(0x00f0);
+	int i = 0;
+	for (; i + 32 <= numSamples; i += 32)
+	{
+		__m256i bi0 = adsb8_avx2(_mm256_loadu_si256((const __m256i*)(idata + i)));
+		__m256i bq0 = adsb8_avx2(_mm256_loadu_si256((const __m256i*)(qdata + i)));
+		__m256i bi1 = adsb8_avx2(_mm256_loadu_si256((const __m256i*)(idata + i + 16)));
+		__m256i bq1 = adsb8_avx2(_mm256_loadu_si256((const __m256i*)(qdata + i + 16)));
+		__m256i p0 = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(bi0, 4), loNibble), _mm256_and_si256(bq0, hiNibble));
+		__m256i p1 = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(bi1, 4), loNibble), _mm256_and_si256(bq1, hiNibble));
+		// packus works within the 128 bit lanes, restore the sample order
+		__m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(p0, p1), 0xd8);
+		_mm256_storeu_si256((__m256i*)(out + i), packed);
+	}
+	pack4_sse2(idata + i, qdata + i, numSamples - i, out + i);
+}
+
+void iqConvert::interleave16_sse2(const short* idata, const short* qdata, int numSamples, BYTE* out)
+{
+	int i = 0;
+	for (; i + 8 <= numSamples; i += 8)
+	{
+		__m128i vi = _mm_loadu_si128((const __m128i*)(idata + i));
+		__m128i vq = _mm_loadu_si128((const __m128i*)(qdata + i));
+		_mm_storeu_si128((__m128i*)(out + 4 * i), _mm_unpacklo_epi16(vi, vq));
+		_mm_storeu_si128((__m128i*)(out + 4 * i + 16), _mm_unpackhi_epi16(vi, vq));
+	}
+	iqConverter<BITS_16, false, true>::convert(idata + i, qdata + i, numSamples - i, out + 4 * i);
+}
+
+IQ_TARGET_AVX2
+void iqConvert::interleave16_avx2(const short* idata, const short* qdata, int numSamples, BYTE* out)
+{
+	int i = 0;
+	for (; i + 16 <= numSamples; i += 16)
+	{
+		__m256i vi = _mm256_loadu_si256((const __m256i*)(idata + i));
+		__m256i vq = _mm256_loadu_si256((const __m256i*)(qdata + i));
+		// unpack works within the 128 bit lanes: lo = pairs 0-3 | 8-11, hi = 4-7 | 12-15
+		__m256i lo = _mm256_unpacklo_epi16(vi, vq);
+		__m256i hi = _mm256_unpackhi_epi16(vi, vq);
+		_mm256_storeu_si256((__m256i*)(out + 4 * i), _mm256_permute2x128_si256(lo, hi, 0x20));
+		_mm256_storeu_si256((__m256i*)(out + 4 * i + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+	}
+	interleave16_sse2(idata + i, qdata + i, numSamples - i, out + 4 * i);
+}
+
+// Magnitude, -32768 saturates to 32767 like the scalar code
+static inline __m128i abs16_sse2(__m128i x)
+{
+	return _mm_max_epi16(x, _mm_subs_epi16(_mm_setzero_si128(), x));
+}
+
+// The rounding add saturates where the scalar code clamps the mantissa: this only happens
+// with exponent 8, and both yield 127
+void iqConvert::bfp_sse2(const short* idata, const short* qdata, int numSamples, BYTE* out)
+{
+	for (int g = 0; g + 16 <= numSamples; g += 16)
+	{
+		__m128i i0 = _mm_loadu_si128((const __m128i*)(idata + g));
+		__m128i i1 = _mm_loadu_si128((const __m128i*)(idata + g + 8));
+		__m128i q0 = _mm_loadu_si128((const __m128i*)(qdata + g));
+		__m128i q1 = _mm_loadu_si128((const __m128i*)(qdata + g + 8));
+		__m128i m = _mm_max_epi16(_mm_max_epi16(abs16_sse2(i0), abs16_sse2(i1)),
+			_mm_max_epi16(abs16_sse2(q0), abs16_sse2(q1)));
+		m = _mm_max_epi16(m, _mm_srli_si128(m, 8));
+		m = _mm_max_epi16(m, _mm_srli_si128(m, 4));
+		m = _mm_max_epi16(m, _mm_srli_si128(m, 2));
+		int e = bfpExponent(_mm_cvtsi128_si32(m) & 0xffff);
+		__m128i round = _mm_set1_epi16((short)(e == 0 ? 0 : 1 << (e - 1)));
+		__m128i shift = _mm_cvtsi32_si128(e);
+		// I0 Q0 I1 Q1 ...
+		__m128i p0 = _mm_sra_epi16(_mm_adds_epi16(_mm_unpacklo_epi16(i0, q0), round), shift);
+		__m128i p1 = _mm_sra_epi16(_mm_adds_epi16(_mm_unpackhi_epi16(i0, q0), round), shift);
+		__m128i p2 = _mm_sra_epi16(_mm_adds_epi16(_mm_unpacklo_epi16(i1, q1), round), shift);
+		__m128i p3 = _mm_sra_epi16(_mm_adds_epi16(_mm_unpackhi_epi16(i1, q1), round), shift);
+		out[0] = (BYTE)e;
+		_mm_storeu_si128((__m128i*)(out + 1), _mm_packs_epi16(p0, p1));
+		_mm_storeu_si128((__m128i*)(out + 17), _mm_packs_epi16(p2, p3));
+		out += 33;
+	}
+}
+
+// 32 bit lanes I | Q << 16 are moved to I | Q << 12, then pairs of them to 48 bits
+// in the 64 bit lanes. The 8 byte stores write 2 bytes beyond the 6 of their pair,
+// overwritten by the next store, so the loop leaves at least one sample for the scalar tail
+void iqConvert::pack12_sse2(const short* idata, const short* qdata, int numSamples, BYTE* out)
+{
+	const __m128i offset = _mm_set1_epi16(0x800);
+	const __m128i low12 = _mm_set1_epi32(0xfff);
+	const __m128i low24 = _mm_set_epi32(0, 0xffffff, 0, 0xffffff);
+	int i = 0;
+	for (; i + 8 < numSamples; i += 8)
+	{
+		// ((x >> 4) + 2048) & 0xfff
+		__m128i vi = _mm_xor_si128(_mm_srli_epi16(_mm_loadu_si128((const __m128i*)(idata + i)), 4), offset);
+		__m128i vq = _mm_xor_si128(_mm_srli_epi16(_mm_loadu_si128((const __m128i*)(qdata + i)), 4), offset);
+		__m128i w0 = _mm_unpacklo_epi16(vi, vq);
+		__m128i w1 = _mm_unpackhi_epi16(vi, vq);
+		w0 = _mm_or_si128(_mm_and_si128(w0, low12), _mm_andnot_si128(low12, _mm_srli_epi32(w0, 4)));
+		w1 = _mm_or_si128(_mm_and_si128(w1, low12), _mm_andnot_si128(low12, _mm_srli_epi32(w1, 4)));
+		w0 = _mm_or_si128(_mm_and_si128(w0, low24), _mm_andnot_si128(low24, _mm_srli_epi64(w0, 8)));
+		w1 = _mm_or_si128(_mm_and_si128(w1, low24), _mm_andnot_si128(low24, _mm_srli_epi64(w1, 8)));
+		BYTE* o = out + 3 * i;
+		_mm_storel_epi64((__m128i*)o, w0);
+		_mm_storel_epi64((__m128i*)(o + 6), _mm_srli_si128(w0, 8));
+		_mm_storel_epi64((__m128i*)(o + 12), w1);
+		_mm_storel_epi64((__m128i*)(o + 18), _mm_srli_si128(w1, 8));
+	}
+	iqConverter<BITS_12, false, true>::convert(idata + i, qdata + i, numSamples - i, out + 3 * i);
+}
+
+// Sign extension to 32 bit by unpacking into the high halves and shifting back.
+// One multiplication per value like the scalar code, so the results are identical
+void iqConvert::float32_sse2(const short* idata, const short* qdata, int numSamples, BYTE* out)
+{
+	const __m128 scale = _mm_set1_ps(iqFloatScale::get());
+	const __m128i zero = _mm_setzero_si128();
+	float* o = (float*)out;
+	int i = 0;
+	for (; i + 8 <= numSamples; i += 8)
+	{
+		__m128i vi = _mm_loadu_si128((const __m128i*)(idata + i));
+		__m128i vq = _mm_loadu_si128((const __m128i*)(qdata + i));
+		__m128 i0 = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(zero, vi), 16)), scale);
+		__m128 i1 = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(zero, vi), 16)), scale);
+		__m128 q0 = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(zero, vq), 16)), scale);
+		__m128 q1 = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(zero, vq), 16)), scale);
+		_mm_storeu_ps(o + 2 * i, _mm_unpacklo_ps(i0, q0));
+		_mm_storeu_ps(o + 2 * i + 4, _mm_unpackhi_ps(i0, q0));
+		_mm_storeu_ps(o + 2 * i + 8, _mm_unpacklo_ps(i1, q1));
+		_mm_storeu_ps(o + 2 * i + 12, _mm_unpackhi_ps(i1, q1));
+	}
+	iqConverter<BITS_CF32, false, true>::convert(idata + i, qdata + i, numSamples - i, out + 8 * i);
+}
+
+IQ_TARGET_AVX2
+void iqConvert::float32_avx2(const short* idata, const short* qdata, int numSamples, BYTE* out)
+{
+	const __m256 scale = _mm256_set1_ps(iqFloatScale::get());
+	float* o = (float*)out;
+	int i = 0;
+	for (; i + 8 <= numSamples; i += 8)
+	{
+		__m256 fi = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(idata + i)))), scale);
+		__m256 fq = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(qdata + i)))), scale);
+		// unpack works within the 128 bit lanes: I0 Q0 I1 Q1 | I4 Q4 I5 Q5 and I2 Q2 I3 Q3 | I6 Q6 I7 Q7
+		__m256 lo = _mm256_unpacklo_ps(fi, fq);
+		__m256 hi = _mm256_unpackhi_ps(fi, fq);
+		_mm256_storeu_ps(o + 2 * i, _mm256_permute2f128_ps(lo, hi, 0x20));
+		_mm256_storeu_ps(o + 2 * i + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+	}
+	float32_sse2(idata + i, qdata + i, numSamples - i, out + 8 * i);
+}
+#endif
+
+#ifdef IQ_NEON
+void iqConvert::interleave16_neon(const short* idata, const short* qdata, int numSamples, BYTE* out)
+{
+	int i = 0;
+	for (; i + 8 <= numSamples; i += 8)
+	{
+		int16x8x2_t iq;
+		iq.val[0] = vld1q_s16(idata + i);
+		iq.val[1] = vld1q_s16(qdata + i);
+		vst2q_s16((int16_t*)(out + 4 * i), iq);
+	}
+	iqConverter<BITS_16, false, true>::convert(idata + i, qdata + i, numSamples - i, out + 4 * i);
+}
+
+static inline int16x8_t adsb8_neon(int16x8_t x)
+{
+	int16x8_t bias = vandq_s16(vshrq_n_s16(x, 15), vdupq_n_s16(63));
+	int16x8_t q = vshrq_n_s16(vaddq_s16(x, bias), 6);
+	return vaddq_s16(q, vdupq_n_s16(127));
+}
+
+void iqConvert::requant8_neon(const short* idata, const short* qdata, int numSamples, BYTE* out)
+{
+	const uint8x8_t signs = vdup_n_u8(0x80);
+	int i = 0;
+	for (; i + 8 <= numSamples; i += 8)
+	{
+		uint8x8x2_t iq;
+		iq.val[0] = veor_u8(vreinterpret_u8_s8(vshrn_n_s16(vld1q_s16(idata + i), 8)), signs);
+		iq.val[1] = veor_u8(vreinterpret_u8_s8(vshrn_n_s16(vld1q_s16(qdata + i), 8)), signs);
+		vst2_u8(out + 2 * i, iq);
+	}
+	iqConverter<BITS_8, false, true>::convert(idata + i, qdata + i, numSamples - i, out + 2 * i);
+}
+
+void iqConvert::requant8Adsb_neon(const short* idata, const short* qdata, int numSamples, BYTE* out)
+{
+	int i = 0;
+	for (; i + 8 <= numSamples; i += 8)
+	{
+		uint8x8x2_t iq;
+		iq.val[0] = vreinterpret_u8_s8(vmovn_s16(adsb8_neon(vld1q_s16(idata + i))));
+		iq.val[1] = vreinterpret_u8_s8(vmovn_s16(adsb8_neon(vld1q_s16(qdata + i))));
+		vst2_u8(out + 2 * i, iq);
+	}
+	iqConverter<BITS_8, true, true>::convert(idata + i, qdata + i, numSamples - i, out + 2 * i);
+}
+
+void iqConvert::pack4_neon(const short* idata, const short* qdata, int numSamples, BYTE* out)
+{
+	const uint8x8_t hiNibble = vdup_n_u8(0xf0);
+	int i = 0;
+	for (; i + 8 <= numSamples; i += 8)
+	{
+		uint8x8_t bi = vreinterpret_u8_s8(vmovn_s16(adsb8_neon(vld1q_s16(idata + i))));
+		uint8x8_t bq = vreinterpret_u8_s8(vmovn_s16(adsb8_neon(vld1q_s16(qdata + i))));
+		vst1_u8(out + i, vorr_u8(vshr_n_u8(bi, 4), vand_u8(bq, hiNibble)));
+	}
+	iqConverter<BITS_4, false, true>::convert(idata + i, qdata + i, numSamples - i, out + i);
+}
+
+// vrshl rounds without overflow, vqmovn saturates like the scalar clamp
+void iqConvert::bfp_neon(const short* idata, const short* qdata, int numSamples, BYTE* out)
+{
+	for (int g = 0; g + 16 <= numSamples; g += 16)
+	{
+		int16x8_t i0 = vld1q_s16(idata + g);
+		int16x8_t i1 = vld1q_s16(idata + g + 8);
+		int16x8_t q0 = vld1q_s16(qdata + g);
+		int16x8_t q1 = vld1q_s16(qdata + g + 8);
+		int16x8_t m = vmaxq_s16(vmaxq_s16(vqabsq_s16(i0), vqabsq_s16(i1)), vmaxq_s16(vqabsq_s16(q0), vqabsq_s16(q1)));
+		int16x4_t h = vmax_s16(vget_low_s16(m), vget_high_s16(m));
+		h = vpmax_s16(h, h);
+		h = vpmax_s16(h, h);
+		int e = bfpExponent(vget_lane_s16(h, 0));
+		int16x8_t shift = vdupq_n_s16((int16_t)-e);
+		int8x8x2_t iq0, iq1;
+		iq0.val[0] = vqmovn_s16(vrshlq_s16(i0, shift));
+		iq0.val[1] = vqmovn_s16(vrshlq_s16(q0, shift));
+		iq1.val[0] = vqmovn_s16(vrshlq_s16(i1, shift));
+		iq1.val[1] = vqmovn_s16(vrshlq_s16(q1, shift));
+		out[0] = (BYTE)e;
+		vst2_s8((int8_t*)(out + 1), iq0);
+		vst2_s8((int8_t*)(out + 17), iq1);
+		out += 33;
+	}
+}
+
+void iqConvert::pack12_neon(const short* idata, const short* qdata, int numSamples, BYTE* out)
+{
+	const uint16x8_t offset = vdupq_n_u16(0x800);
+	int i = 0;
+	for (; i + 8 <= numSamples; i += 8)
+	{
+		uint16x8_t vi = veorq_u16(vshrq_n_u16(vreinterpretq_u16_s16(vld1q_s16(idata + i)), 4), offset);
+		uint16x8_t vq = veorq_u16(vshrq_n_u16(vreinterpretq_u16_s16(vld1q_s16(qdata + i)), 4), offset);
+		uint8x8x3_t b;
+		b.val[0] = vmovn_u16(vi);
+		b.val[1] = vmovn_u16(vorrq_u16(vshrq_n_u16(vi, 8), vshlq_n_u16(vq, 4)));
+		b.val[2] = vmovn_u16(vshrq_n_u16(vq, 4));
+		vst3_u8(out + 3 * i, b);
+	}
+	iqConverter<BITS_12, false, true>::convert(idata + i, qdata + i, numSamples - i, out + 3 * i);
+}
+
+void iqConvert::float32_neon(const short* idata, const short* qdata, int numSamples, BYTE* out)
+{
+	float scale = iqFloatScale::get();
+	float* o = (float*)out;
+	int i = 0;
+	for (; i + 4 <= numSamples; i += 4)
+	{
+		float32x4x2_t v;
+		v.val[0] = vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vld1_s16(idata + i))), scale);
+		v.val[1] = vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vld1_s16(qdata + i))), scale);
+		vst2q_f32(o + 2 * i, v);
+	}
+	iqConverter<BITS_CF32, false, true>::convert(idata + i, qdata + i, numSamples - i, out + 8 * i);
+}
+#endif
+
+int iqGroupCarry::convert(const iqConverterEntry* conv, const short* xi, const short* xq, int numSamples, BYTE* out)
+{
+	int group = conv->samplesPerGroup;
+	if (group == 1)
+	{
+		conv->convert(xi, xq, numSamples, out);
+		return numSamples;
+	}
+	int converted = 0;
+	int start = 0;
+	if (n > 0)
+	{
+		// complete the kept group first
+		start = group - n < numSamples ? group - n : numSamples;
+		memcpy(i + n, xi, start * sizeof(short));
+		memcpy(q + n, xq, start * sizeof(short));
+		n += start;
+		if (n < group)
+			return 0;
+		conv->convert(i, q, group, out);
+		out += conv->bytesPerGroup;
+		converted = group;
+		n = 0;
+	}
+	int whole = (numSamples - start) / group * group;
+	conv->convert(xi + start, xq + start, whole, out);
+	converted += whole;
+	n = numSamples - start - whole;
+	memcpy(i, xi + start + whole, n * sizeof(short));
+	memcpy(q, xq + start + whole, n * sizeof(short));
+	return converted;
+}
@@ -22,7 +22,13 @@
 #include "IPAddress.h"
 #include "rsp_cmdLineArgs.h"
 #include "common.h"
+#include "Channelizer.h"
+#include "SpectrumWorker.h"
+#include "UdpStreamer.h"
+#include "ShmRing.h"
 #include <string>
+#include <sstream>
+#include <algorithm>
 
 
 rsp_cmdLineArgs::rsp_cmdLineArgs(int argc, char** argv)
@@ -113,12 +119,30 @@ void rsp_cmdLineArgs::displayUsage()
 	cout << "\t[-p listen port, default is 7890]" << endl;
 	cout << "\t[-f frequency [Hz], default is 178352000Hz]" << endl;
 	cout << "\t[-s sampling rate [Hz], allowed values are 512000, 1024000, 2000000, 2048000, 4096000, 8192000, default is 2048000]" << endl;
+	cout << "\t\t other rates are converted in software from 2048000, 2400000, 2500000, 3000000, 4000000, 4096000, 6000000 or 8192000" << endl;
 	cout << "\t[-g gain value, initial value betwee 20 and 99, default is 25]" << endl;
 	cout << "\t[-d device index, value counts from 0 to number of devices -1, default is 0]" << endl;
-	cout << "\t[-W bit width, value of 1 means 8 bit, value of 2 means 16 bit, default is 16 bit]" << endl;
+	cout << "\t[-W bit width, value of 1 means 8 bit, value of 2 means 16 bit, 3 means block floating point\n\t   (8 bit mantissas with one exponent per 16 samples), 4 means 16 bit compressed losslessly\n\t   (frames of LosslessCodec.h), 5 means the 12 bit ADC values packed into 3 bytes per I/Q pair,\n\t   6 means complex float, the gain divided out, default is 16 bit]" << endl;
 	cout << "\t[-B basic mode (rtl_tcp compatible), value counts from 0 to 1, default is 0 == false]" << endl;
 	cout << "\t[-L LNA state, value counts from 0 (highest gain) to 15 (lowest gain), default is 3]" << endl;
 	cout << "\t[-T Antenna, RSPdx: A|B|C = 0|1|2; RSP2: A|B = 5|6; RSPduo: Basic mode only Tuner 1 = 5|6]" << endl;
+	cout << "\t[-m max bytes per transmit call, 4096 to 16777216, default is 262144]" << endl;
+	cout << "\t[-t max latency [us] to collect blocks for one transmit call, 0 to 1000000, default is 0 (send what is ready)]" << endl;
+	cout << "\t[-Q max bytes queued for transmission, 65536 to 2000000000, default is 33554432]" << endl;
+	cout << "\t[-P overload policy if the queue is full, 0: drop newest, 1: drop oldest, 2: block, default is 0]" << endl;
+	cout << "\t[-c max clients sharing the device, 1 to 64, default is 4]" << endl;
+	cout << "\t[-A address of the client with the tuning authority, default is the first client connected]" << endl;
+	cout << "\t[-Z zero copy transmit (Linux MSG_ZEROCOPY), value counts from 0 to 1, default is 0 == false]" << endl;
+	cout << "\t[-C channelizer bins, power of two from 4 to 64, channel rate is 2 * sampling rate / bins, default is 0 == off]" << endl;
+	cout << "\t[-K channelizer bins served, comma separated, e.g. 0,1,7. Bin k is on port + 10 + k, default is all bins]" << endl;
+	cout << "\t[-I software DC offset and IQ imbalance correction, value counts from 0 to 1, default is 0 == false]" << endl;
+	cout << "\t[-G adaptive gain for the 8 bit output, reported in the indications, value counts from 0 to 1, default is 0 == false]" << endl;
+	cout << "\t[-D requantization to 8 and 4 bit, 0: truncation, 1: dither, 2|3: dither and 1st|2nd order noise shaping, default is 0]" << endl;
+	cout << "\t[-H framed stream, each block with a header of sample index, count, format and event flags, value counts from 0 to 1, default is 0 == false]" << endl;
+	cout << "\t[-F spectrum on port + 2: size[,overlap %[,averages[,frames/s]]], size a power of two from 64 to 32768, default is off, then 50,4,10]" << endl;
+	cout << "\t[-U UDP stream instead of TCP: address:port[,mtu[,pacing % of the sampling rate]], unicast or multicast, default is off, then 1500,0 (no pacing)]" << endl;
+	cout << "\t[-X shared memory ring /rsp_tcp_<port> for local clients, size in MB from 1 to 1024, default is 0 == off]" << endl;
+	cout << "\t[-b benchmark name[:input], runs a benchmark without a device and exits. -b list shows the names]" << endl;
 }
 
 
@@ -129,6 +153,13 @@ int rsp_cmdLineArgs::parse()
 	int basicMode = false;
 	int lnaState = 3;
 	int antenna = 0;
+	int zeroCopy = 0;
+	string channels;
+	string spectrum;
+	string udp;
+	int iqCorrection = 0;
+	int autoScale = 0;
+	int framed = 0;
 	Master = 0;
 	map<char, int>::iterator it;
 	if (argc == 2 && argv[1][0] == '?')
@@ -140,7 +171,7 @@ int rsp_cmdLineArgs::parse()
 		switch (it->first) //key
 		{
 		case 's':
-			SamplingRate = intValue(it->second, "Invalid Sampling Rate ", 512000, 8192000);
+			SamplingRate = intValue(it->second, "Invalid Sampling Rate ", 8000, 8192000);
 			if (SamplingRate == -1)
 				goto exit;
 			break;
@@ -160,7 +191,7 @@ int rsp_cmdLineArgs::parse()
 				goto exit;
 			break;
 		case 'W':
-			BitWidth = intValue(it->second, "Invalid Bit Width ", 0, 2);
+			BitWidth = intValue(it->second, "Invalid Bit Width ", 0, 6);
 			if (BitWidth == -1)
 				goto exit;
 			break;
@@ -215,6 +246,103 @@ int rsp_cmdLineArgs::parse()
 			if (requestedDeviceIndex == -1)
 				goto exit;
 			break;
+		case 'm':
+			MaxSendBytes = intValue(it->second, "Invalid Max Bytes per Transmit ", 4096, 16777216);
+			if (MaxSendBytes == -1)
+				goto exit;
+			break;
+		case 't':
+			MaxSendLatencyUs = intValue(it->second, "Invalid Transmit Latency ", 0, 1000000);
+			if (MaxSendLatencyUs == -1)
+				goto exit;
+			break;
+		case 'Q':
+			MaxQueueBytes = intValue(it->second, "Invalid Max Queued Bytes ", 65536, 2000000000);
+			if (MaxQueueBytes == -1)
+				goto exit;
+			break;
+		case 'P':
+			OverloadPolicy = intValue(it->second, "Invalid Overload Policy ", 0, 2);
+			if (OverloadPolicy == -1)
+				goto exit;
+			break;
+		case 'Z':
+			zeroCopy = intValue(it->second, "Invalid Zero Copy Value ", 0, 1);
+			if (zeroCopy == -1)
+				goto exit;
+			ZeroCopy = zeroCopy == 1;
+			break;
+		case 'c':
+			MaxClients = intValue(it->second, "Invalid Max Clients ", 1, 64);
+			if (MaxClients == -1)
+				goto exit;
+			break;
+		case 'A':
+			ipa = ipAddValue(it->second, "Invalid IP Address ");
+			if (ipa == 0)
+				goto exit;
+			ControlAddress = ipa->sIPAddress;
+			delete ipa;
+			break;
+		case 'C':
+			ChannelizerBins = intValue(it->second, "Invalid Channelizer Bins ", Channelizer::c_minBins, Channelizer::c_maxBins);
+			if (ChannelizerBins == -1)
+				goto exit;
+			break;
+		case 'K':
+			channels = stringValue(it->second, "Invalid Channel List ", 1, 256);
+			if (channels == "")
+				goto exit;
+			break;
+		case 'I':
+			iqCorrection = intValue(it->second, "Invalid IQ Correction Value ", 0, 1);
+			if (iqCorrection == -1)
+				goto exit;
+			IqCorrection = iqCorrection == 1;
+			break;
+		case 'G':
+			autoScale = intValue(it->second, "Invalid Adaptive Scaling Value ", 0, 1);
+			if (autoScale == -1)
+				goto exit;
+			AutoScale8 = autoScale == 1;
+			break;
+		case 'D':
+			Requantization = intValue(it->second, "Invalid Requantization Mode ", 0, 3);
+			if (Requantization == -1)
+				goto exit;
+			break;
+		case 'H':
+			framed = intValue(it->second, "Invalid Framed Mode Value ", 0, 1);
+			if (framed == -1)
+				goto exit;
+			Framed = framed == 1;
+			break;
+		case 'F':
+			spectrum = stringValue(it->second, "Invalid Spectrum Settings ", 1, 64);
+			if (spectrum == "")
+				goto exit;
+			break;
+		case 'U':
+			udp = stringValue(it->second, "Invalid UDP Settings ", 1, 64);
+			if (udp == "")
+				goto exit;
+			break;
+		case 'X':
+			ShmMBytes = intValue(it->second, "Invalid Shared Memory Size ", ShmRingWriter::c_minMBytes, ShmRingWriter::c_maxMBytes);
+			if (ShmMBytes == -1)
+				goto exit;
+			break;
+		case 'b':
+			Benchmark = stringValue(it->second, "Invalid Benchmark Name ", 1, 260);
+			if (Benchmark == "")
+				goto exit;
+			// name:input, e.g. a capture file
+			if (Benchmark.find(':') != string::npos)
+			{
+				BenchmarkInput = Benchmark.substr(Benchmark.find(':') + 1);
+				Benchmark = Benchmark.substr(0, Benchmark.find(':'));
+			}
+			break;
 		case 'h':
 			goto exit;
 		case '?':
@@ -224,7 +352,153 @@ int rsp_cmdLineArgs::parse()
 			goto exit;
 		}
 	}
+	if (parseChannels(channels) != 0 || parseSpectrum(spectrum) != 0 || parseUdp(udp) != 0)
+		goto exit;
 	return 0;
 	exit:
 		return -1;
-}
\ No newline at end of file
+}
+/// <summary>
+/// The bins of -K, all bins if not given. Each bin has its own port.
+/// </summary>
+int rsp_cmdLineArgs::parseChannels(const string& list)
+{
+	Channels.clear();
+	if (ChannelizerBins == 0)
+	{
+		if (list == "")
+			return 0;
+		cout << "Channel list without channelizer bins (-C)" << endl << endl;
+		return -1;
+	}
+	if ((ChannelizerBins & (ChannelizerBins - 1)) != 0)
+	{
+		cout << "Invalid Channelizer Bins, not a power of two " << ChannelizerBins << endl << endl;
+		return -1;
+	}
+	if (list == "")
+	{
+		for (int bin = 0; bin < ChannelizerBins; bin++)
+			Channels.push_back(bin);
+		return 0;
+	}
+	stringstream ss(list);
+	string item;
+	while (getline(ss, item, ','))
+	{
+		int bin = -1;
+		try
+		{
+			bin = std::stoi(item);
+		}
+		catch (exception&)
+		{
+		}
+		if (!common::checkRange(bin, 0, ChannelizerBins - 1) ||
+			std::find(Channels.begin(), Channels.end(), bin) != Channels.end())
+		{
+			cout << "Invalid Channel " << item << endl << endl;
+			return -1;
+		}
+		Channels.push_back(bin);
+	}
+	return 0;
+}
+
+/// <summary>
+/// The settings of -F, size[,overlap[,averages[,frames per second]]]
+/// </summary>
+int rsp_cmdLineArgs::parseSpectrum(const string& settings)
+{
+	if (settings == "")
+		return 0;
+	int* values[] = { &SpectrumSize, &SpectrumOverlap, &SpectrumAverages, &SpectrumRate };
+	const int minValues[] = { SpectrumWorker::c_minSize, 0, 1, 1 };
+	const int maxValues[] = { SpectrumWorker::c_maxSize, SpectrumWorker::c_maxOverlap,
+		SpectrumWorker::c_maxAverages, SpectrumWorker::c_maxFrameRate };
+	stringstream ss(settings);
+	string item;
+	for (int i = 0; getline(ss, item, ','); i++)
+	{
+		int val = -1;
+		try
+		{
+			val = std::stoi(item);
+		}
+		catch (exception&)
+		{
+		}
+		if (i >= 4 || !common::checkRange(val, minValues[i], maxValues[i]))
+		{
+			cout << "Invalid Spectrum Setting " << item << endl << endl;
+			return -1;
+		}
+		*values[i] = val;
+	}
+	if ((SpectrumSize & (SpectrumSize - 1)) != 0)
+	{
+		cout << "Invalid Spectrum Size, not a power of two " << SpectrumSize << endl << endl;
+		return -1;
+	}
+	return 0;
+}
+
+/// <summary>
+/// The settings of -U, address:port[,mtu[,pacing]]
+/// </summary>
+int rsp_cmdLineArgs::parseUdp(const string& settings)
+{
+	if (settings == "")
+		return 0;
+	stringstream ss(settings);
+	string item;
+	for (int i = 0; getline(ss, item, ','); i++)
+	{
+		int val = -1;
+		if (i == 0)
+		{
+			size_t colon = item.find(':');
+			if (colon != string::npos)
+			{
+				UdpAddress = item.substr(0, colon);
+				try
+				{
+					val = std::stoi(item.substr(colon + 1));
+				}
+				catch (exception&)
+				{
+				}
+			}
+			if (colon == string::npos || !common::checkRange(val, 1, 65535) || !IPAddress(UdpAddress).valid)
+			{
+				cout << "Invalid UDP Destination " << item << endl << endl;
+				return -1;
+			}
+			UdpPort = val;
+			continue;
+		}
+		try
+		{
+			val = std::stoi(item);
+		}
+		catch (exception&)
+		{
+		}
+		if (i == 1 && common::checkRange(val, UdpStreamer::c_minMtu, UdpStreamer::c_maxMtu))
+			UdpMtu = val;
+		else if (i == 2 && (val == 0 || common::checkRange(val, c_minPacing, c_maxPacing)))
+			UdpPacing = val;
+		else
+		{
+			cout << "Invalid UDP Setting " << item << endl << endl;
+			return -1;
+		}
+	}
+	// a lossless frame is only decodable as a whole
+	if (BitWidth == BITS_LOSSLESS)
+	{
+		cout << "The UDP stream takes no lossless format (-W 4)" << endl << endl;
+		return -1;
+	}
+	return 0;
+}
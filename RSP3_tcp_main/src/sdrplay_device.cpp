@@ -22,8 +22,11 @@
 #include "devices.h"
 #include "sdrplay_device.h"
 #include "sdrGainTable.h"
+#include "iqConvert.h"
+#include "StreamClient.h"
 //#include "MeasTimeDiff.h"
 #include <string.h>
+#include <math.h>
 #include <iostream>
 //#include <MeasTimeDiff.h>
 using namespace std;
@@ -36,8 +39,12 @@ void streamCallback(short* xi, short* xq, sdrplay_api_StreamCbParamsT* params,
 
 sdrplay_device::~sdrplay_device()
 {
-	pthread_mutex_destroy(&mutex_rxThreadStarted);
-	pthread_cond_destroy(&started_cond);
+	Ring.clear(Pool);
+	for (size_t i = 0; i < Channels.size(); i++)
+	{
+		Channels[i]->ring.clear(Pool);
+		delete Channels[i];
+	}
 }
 
 sdrplay_device::sdrplay_device(rsp_cmdLineArgs* args) 
@@ -52,11 +59,6 @@ sdrplay_device::sdrplay_device(rsp_cmdLineArgs* args)
 	pargs = args;
 	init(pargs);
 
-	thrdRx = 0;
-	thrdTx = 0;
-	pthread_mutex_init(&mutex_rxThreadStarted, NULL);
-	pthread_cond_init(&started_cond, NULL);
-
 #ifdef TIME_MEAS
 	Count1.LowPart = Count2.LowPart = 0;
 	Count1.HighPart = Count2.HighPart = 0;
@@ -75,9 +77,34 @@ void sdrplay_device::init(rsp_cmdLineArgs* pargs)
 	RequestedGain = pargs->Gain;
 	currentSamplingRateHz = pargs->SamplingRate;
 	bitWidth = (eBitWidth)pargs->BitWidth;
+	selectConverter();
 	basicMode = pargs->BasicMode;
 	LNAstate = pargs->LNAstate;
 	Antenna = pargs->Antenna;
+	SafeQ.configure(pargs->MaxQueueBytes, (eOverloadPolicy)pargs->OverloadPolicy);
+	lossless.setEnabled(bitWidth == BITS_LOSSLESS);
+	if (lossless.isActive())
+		lossless.configure(pargs->MaxQueueBytes, (eOverloadPolicy)pargs->OverloadPolicy);
+	iqCorrector.setEnabled(pargs->IqCorrection);
+	scaler.setEnabled(pargs->AutoScale8);
+	requantizer.setMode((eRequantMode)pargs->Requantization);
+	decimator.setMixer(&nco);
+	Ring.configure(pargs->MaxQueueBytes);
+	frameHeaderLength = pargs->Framed ? StreamFrame::c_headerLength : 0;
+	framer.configure(pargs->Framed, bitWidth);
+	if (channelizer.configure(pargs->ChannelizerBins, pargs->Channels))
+	{
+		for (int i = 0; i < channelizer.getNumOutputs(); i++)
+		{
+			channelOutput* ch = new channelOutput(channelizer.getBin(i), c_channelQueueCapacity);
+			ch->queue.configure(pargs->MaxQueueBytes, (eOverloadPolicy)pargs->OverloadPolicy);
+			ch->ring.configure(pargs->MaxQueueBytes);
+			ch->framer.configure(pargs->Framed, bitWidth == BITS_LOSSLESS ? BITS_16 : bitWidth);
+			Channels.push_back(ch);
+		}
+	}
+	Spectrum.configure(pargs->SpectrumSize, pargs->SpectrumOverlap, pargs->SpectrumAverages, pargs->SpectrumRate);
+	Spectrum.setCenter(currentFrequencyHz);
 }
 
 
@@ -243,68 +270,63 @@ sdrplay_api_ErrT  sdrplay_device::selectDevice(uint32_t crc)
 	return sdrplay_api_Success;
 }
 
-void sdrplay_device::createCtrlThread(const char* addr, int port)
-{
-	std::cout << endl << "Creating ctrl thread..." << endl;
-	if (thrdCtrl != 0) // just in case..
-	{
-		pthread_cancel(*thrdCtrl);
-		delete thrdCtrl;
-		thrdCtrl = 0;
-	}
-	ctrlThreadExitFlag = false;
-	ctrlThreadData.addr = addr;
-	ctrlThreadData.port = port;
-	ctrlThreadData.pDoExit = &ctrlThreadExitFlag;
-	ctrlThreadData.wait = 500000; //0.5s
-	ctrlThreadData.dev = this;
-
-	thrdCtrl = new pthread_t();
-
-	pthread_attr_t attr;
-	pthread_attr_init(&attr);
-	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
-	/*int res = */pthread_create(thrdCtrl, &attr, &ctrl_thread_fn, &ctrlThreadData);
-	pthread_attr_destroy(&attr);
-}
-
-void sdrplay_device::start(SOCKET client)
+/// <summary>
+/// Starts the session for the first client. Its welcome string has been sent already.
+/// The callback wakes up the event loop, which distributes the blocks to the clients.
+/// </summary>
+/// <returns>false if the session could not be started</returns>
+bool sdrplay_device::start(Reactor* r)
 {
-	remoteClient = client;
+	reactor = r;
 
 	std::cout << endl << "Starting..." << endl;
-	// create the control thread and its socket communication
-	createCtrlThread(pargs->Address.sIPAddress.c_str(), pargs->Port + 1);
-
-	if (thrdRx != 0) // just in case..
+	doExitTxThread = false;
+	SafeQ.resetCounters();
+	lossless.resetCounters();
+	deviceLostSamples.store(0);
+	started = true;
+	try
 	{
-		pthread_cancel(*thrdRx);
-		delete thrdRx;
-		thrdRx = 0;
+		if (basicMode) // rtl_tcp compatiblity mode, no back channel
+		{
+			std::cout << "Entering basic mode (no user device selection) " << endl;
+			selectDevice(0);
+			createChannels();
+			if (Initialized)
+			{
+				CommState = ST_DEVICE_CREATED;
+				std::cout << "Basic Mode: Device created and initialized," << endl;
+			}
+			else
+			{
+				throw msg_exception("*** Basic Mode : Device Initialization failed. ");
+			}
+		}
 	}
-	thrdRx = new pthread_t();
-
-	pthread_attr_t attr;
-	pthread_attr_init(&attr);
-	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
-	/*int res = */pthread_create(thrdRx, &attr, &receive, this);
-	pthread_attr_destroy(&attr);
-
-
-	if (thrdTx != 0) // just in case..
+	catch (exception& e)
 	{
-		pthread_cancel(*thrdTx);
-		delete thrdTx;
-		thrdTx = 0;
+		std::cout << "*** Exception in start :" << e.what() << endl;
+		return false;
 	}
-	thrdTx = new pthread_t();
-	doExitTxThread = false;
-	pthread_attr_init(&attr);
-	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
-	/*res = */pthread_create(thrdTx, &attr, &sendStream, this);
-	pthread_attr_destroy(&attr);
 
-	started = true;
+	// the callback wakes up the event loop instead of a transmit thread
+	SafeQ.setNotifier(&Reactor::notify, reactor);
+	SafeQ.armNotify();
+	carry.clear();
+	frames.clear();
+	framer.reset();
+	lossless.start(&SafeQ);
+	for (size_t i = 0; i < Channels.size(); i++)
+	{
+		Channels[i]->carry.clear();
+		Channels[i]->frames.clear();
+		Channels[i]->framer.reset();
+		Channels[i]->queue.resetCounters();
+		Channels[i]->queue.setNotifier(&Reactor::notify, reactor);
+		Channels[i]->queue.armNotify();
+	}
+	Spectrum.start(&Reactor::notify, reactor);
+	return true;
 }
 
 void sdrplay_device::selectChannel(sdrplay_api_TunerSelectT tunerId)
@@ -328,40 +350,28 @@ void sdrplay_device::selectChannel(sdrplay_api_TunerSelectT tunerId)
 	}
 }
 
+// Runs in the context of the event loop, the only consumer of the Q
 void sdrplay_device::emptyQ()
 {
 	std::cout << "*** Emptying xmit Queue ***" << endl;
-	while (SafeQ.getNumEntries() > 0)
-	{
-		MemBlock* mb = SafeQ.dequeue();
-		delete mb;
-	}
-}
-
-void sdrplay_device::cleanup()
-{
-	if (thrdRx != 0) // just in case..
-	{
-		pthread_cancel(*thrdRx);
-		delete thrdRx;
-		thrdRx = 0;
-	}
-
-	//empty the tx Q
-	// Uninit must have run successfully here, to avoid newly filling the Q
-	 emptyQ();
-
-	//send exit message to transmitThread
-	BYTE* dummy = new BYTE[1];
-	MemBlock* mb = new MemBlock(dummy, 1, 0);
-	mb->exitMsg = true;
-	SafeQ.enqueue(mb);
-
-	//send exit message to transmitThread
-	doExitTxThread = true;
+	MemBlock* mb;
+	while (SafeQ.dequeueBatch(&mb, 1) > 0)
+		Pool.release(mb);
+	lossless.empty(Pool);
+	Ring.clear(Pool);
+	for (size_t i = 0; i < Channels.size(); i++)
+	{
+		while (Channels[i]->queue.dequeueBatch(&mb, 1) > 0)
+			Pool.release(mb);
+		Channels[i]->ring.clear(Pool);
+	}
+	std::cout << "MemBlock pool: " << Pool.getAllocationCount() << " heap allocations in total" << endl;
 }
 
-
+/// <summary>
+/// Ends the session: stops streaming, drops what was not sent and releases the device.
+/// The clients are disconnected by the caller.
+/// </summary>
 void sdrplay_device::stop()
 {
 	if (!started)
@@ -369,25 +379,53 @@ void sdrplay_device::stop()
 		std::cout << "Already Stopped. Nothing to do here." << endl;;
 		return;
 	}
-	cleanup();
-	ctrlThreadExitFlag = true;
+	// Uninit must have run here, to avoid newly filling the Q
+	doExitTxThread = true;
+	Spectrum.stop();
+	if (pDevice != 0 && pDevice->dev != 0)
+	{
+		std::cout << "Uninitializing... " << endl;
+		err = sdrplay_api_Uninit(pDevice->dev);
+		std::cout << "sdrplay_api_Uninit returned with: " << err << endl;
+	}
+	lossless.stop();
+	emptyQ();
 
+	err = sdrplay_api_ReleaseDevice(pDevice);
+	if (err == sdrplay_api_Success)
+	{
+		std::cout << "Device " << rxType << " released" << endl;
+		CommState = ST_DEVICE_RELEASED;
+	}
+	else
+		std::cout << "*** Error on releasing device: " << sdrplay_api_GetErrorString(err) << endl;
+	started = false;
 }
 
-void sdrplay_device::writeWelcomeString() const
+void sdrplay_device::writeWelcomeString(SOCKET s, int channel) const
 {
 	BYTE buf0[] = "RTL0";
 	BYTE* buf = new BYTE[c_welcomeMessageLength];
 	memset(buf, 0, c_welcomeMessageLength);
 	memcpy(buf, buf0, 4);
-	buf[6] = bitWidth;
+	// only the full stream is compressed, the channels are sent as 16 bit
+	buf[6] = (channel >= 0 && bitWidth == BITS_LOSSLESS) ? BITS_16 : bitWidth;
 	buf[7] = BYTE(rxType+7);	//7:RSP1, 8: RSP1A, 9: RSP2, 10:RSPduo, 11: RSPdx, 12:RSP1B, 13:RSPdxR2
 	buf[11] = 0;// gainConfiguration::GAIN_STEPS;
 	buf[15] = 0x52; buf[16] = 0x53; buf[17] = 0x50; buf[18] = (BYTE)(rxType + 0x30); //"RSP2", interpreted e.g. by qirx
-	send(remoteClient, (const char*)buf, c_welcomeMessageLength, 0);
+	buf[19] = frameHeaderLength != 0 ? 1 : 0;	// framed mode, see StreamFrame.h
+	send(s, (const char*)buf, c_welcomeMessageLength, 0);
 	delete[] buf;
 }
 
+uint64_t sdrplay_device::getDroppedSamples() const
+{
+	uint64_t n = SafeQ.getDroppedSamples() + lossless.getDroppedSamples();
+	if (Controller != 0)
+		n += Controller->getDroppedSamples();
+	return n;
+}
+
 int sdrplay_device::getRxString(char* s) const
 {
 	s[3] = (BYTE)(rxType + 0x30);
@@ -429,78 +467,51 @@ void minimax(const short* samples, int len, short& mini, short& maxi)
 	}
 }
 
-BYTE* sdrplay_device::mergeIQ(const short* idata, const short* qdata, int samplesPerPacket, int& buflen, int diff)
+/// <summary>
+/// Number of bytes of one I/Q sample in the current output format
+/// </summary>
+int sdrplay_device::bytesPerSample() const
 {
-	BYTE* buf = 0;
-	buflen = 0;
-
-	//short mini = 0, maxi = 0;
-	//minimax(idata, samplesPerPacket, mini, maxi);
-
-	if (bitWidth == BITS_16)
-	{
-		buflen = samplesPerPacket *4;
-		buf = new BYTE[buflen];
-		for (int i = 0, j = 0; i < samplesPerPacket; i++)
-		{
-			buf[j++] = (BYTE)(idata[i] & 0xff);			
-			buf[j++] = (BYTE)((idata[i] & 0xff00) >> 8);  
-
-			buf[j++] = (BYTE)(qdata[i] & 0xff);			
-			buf[j++] = (BYTE)((qdata[i] & 0xff00) >> 8); 
-		}
-	}
-	else if (bitWidth == BITS_8)
-	{
-		// assume the 12 Bit ADC values are mapped onto signed 16-Bit values covering the whole range
-		buflen = samplesPerPacket * 2;
-		buf = new BYTE[buflen];
-		for (int i = 0, j = 0; i < samplesPerPacket; i++)
-		{
-			if (_isAdsbMode == false)
-			{
-				//##//restore the unsigned 12-Bit signal
-				int tmpi = (idata[i] >> 4) + 2048;
-				int tmpq = (qdata[i] >> 4) + 2048;
+	return converter.load()->bytesPerSample;
+}
 
-				// cut the four low order bits
-				tmpi >>= 4;
-				tmpq >>= 4;
+/// <summary>
+/// Selects the converter for the current bit width and ADS-B mode.
+/// Called whenever one of them changes, the callback only follows the pointer.
+/// </summary>
+void sdrplay_device::selectConverter()
+{
+	const iqConverterEntry* conv = iqConvert::select(bitWidth, _isAdsbMode);
+	scaler.setEngaged(bitWidth == BITS_8 && !_isAdsbMode);
+	requantizer.setFormat(bitWidth, _isAdsbMode);
+	if (converter.exchange(conv) != conv)
+		std::cout << "Output conversion: " << bitWidth << " (bit width index), Adsb " << (_isAdsbMode ? "on" : "off")
+			<< ", kernel " << conv->kernel << endl;
+}
 
-				buf[j++] = (BYTE)tmpi;
-				buf[j++] = (BYTE)tmpq;
-			}
-			else
-			{
-				// 14 bit, for ADS-b
-				buf[j++] = (BYTE)(idata[i] / 64 + 127);
-				buf[j++] = (BYTE)(qdata[i] / 64 + 127);
-			}
-		}
-	}
-	else if (bitWidth == BITS_4)
-	{
-		buflen = samplesPerPacket * 1;
-		buf = new BYTE[buflen];
-		for (int i = 0, j = 0; i < samplesPerPacket; i++)
-		{
-			//I-Byte
-			BYTE b = (BYTE)(idata[i] / 64 + 127);
-			// Low order nibble
-			BYTE b2 = b >> 4;
-			b2 &= 0x0f;
-				
-			//Q-Byte
-			b = (BYTE)(qdata[i] / 64 + 127);
-			// High order nibble
-			BYTE b3 = b & 0xf0;
-
-			BYTE b4 = b2 | b3;
-			buf[j++] = b4;
-		}
-	}
-	return buf;
+/// <summary>
+/// Preallocates the MemBlocks for the sampling configuration about to be started.
+/// Called before sdrplay_api_Init, while the callback is not running
+/// </summary>
+void sdrplay_device::preparePool(int srTableIx)
+{
+	int samplesPerBlock = c_nominalSamplesPerCallback;
+	if (decimator.isActive())
+		samplesPerBlock = samplesPerBlock / decimator.getFactor() + 1;
+	if (resampler.isActive())
+		samplesPerBlock = resampler.maxOutput(samplesPerBlock);
+	int blockBytes = frameHeaderLength +
+		(lossless.isActive() ? LosslessCodec::maxFrameBytes(samplesPerBlock) : samplesPerBlock * bytesPerSample());
+	long long blocksPerSecond = samplingConfigs[srTableIx].samplingRateHz / c_nominalSamplesPerCallback + 1;
+	int numBlocks = (int)(blocksPerSecond * c_poolPreallocMs / 1000);
+	if (numBlocks < 32)
+		numBlocks = 32;
+	// each callback also queues one block per channel
+	numBlocks *= 1 + (int)Channels.size();
+	Pool.prepare(blockBytes, numBlocks);
+	_firstSampleNumValid = false;
 }
+
 void eventCallback(sdrplay_api_EventT eventId, sdrplay_api_TunerSelectT tuner, 
 	sdrplay_api_EventParamsT *params, void *cbContext)
 {
@@ -519,6 +530,8 @@ void eventCallback(sdrplay_api_EventT eventId, sdrplay_api_TunerSelectT tuner,
 		//	"sdrplay_api_GainChange", (tuner == sdrplay_api_Tuner_A) ? "sdrplay_api_Tuner_A" :
 		//	"sdrplay_api_Tuner_B", params->gainParams.gRdB, params->gainParams.lnaGRdB,
 		//	params->gainParams.currGain);
+		// the API reports the gain after the initialization and after each change
+		iqFloatScale::setGain((float)params->gainParams.currGain);
 		break;
 
 	case sdrplay_api_PowerOverloadChange:
@@ -624,13 +637,15 @@ unsigned int areDiffSamples(sdrplay_device* ctx, sdrplay_api_StreamCbParamsT *pa
 	int diff = 0;
 	ctx->_oldExpectedFirstSampleNum = ctx->_expectedFirstSampleNum;
 
-	if (par->fsChanged || par->rfChanged)
+	if (par->fsChanged || par->rfChanged || !ctx->_firstSampleNumValid)
 	{
-		ctx->_expectedFirstSampleNum = par->firstSampleNum;
+		ctx->_expectedFirstSampleNum = par->firstSampleNum + numSmpls;
+		ctx->_firstSampleNumValid = true;
 	}
 	else if (ctx->_expectedFirstSampleNum < par->firstSampleNum) // then callbacks lost?
 	{
 		diff = par->firstSampleNum  - ctx->_expectedFirstSampleNum;
+		ctx->deviceLostSamples.fetch_add(diff, std::memory_order_relaxed);
 		std::cout << "Expected 1st spl num = " << ctx->_expectedFirstSampleNum << ", rcvd was " << par->firstSampleNum << ", Diff = " << diff << endl;
 		ctx->_expectedFirstSampleNum = par->firstSampleNum + par->numSamples;
 	}
@@ -660,34 +675,27 @@ void streamCallback(short *xi, short *xq, sdrplay_api_StreamCbParamsT *params,
 #ifdef TIME_MEAS2
 		QueryPerformanceCounter(&Count1);
 #endif
-	unsigned int diff = areDiffSamples(md, params, numSamples);
+	unsigned int lostSamples = areDiffSamples(md, params, numSamples);
 
 	try
 	{
+		// numbers the output samples, lost ones included, and notes the events for the next block
+		int events = (params->rfChanged ? FRAME_RF_CHANGED : 0) | (params->fsChanged ? FRAME_FS_CHANGED : 0) |
+			(params->grChanged ? FRAME_GR_CHANGED : 0);
+		md->frames.onCallback(events, lostSamples, md->currentSoft.ratio());
+		for (size_t i = 0; i < md->Channels.size(); i++)
+			md->Channels[i]->frames.onCallback(events, lostSamples, 2.0 / md->channelizer.getNumBins());
 		if (params->rfChanged)
 		{
 			int fChgd = md->pCurCh->tunerParams.rfFreq.rfHz;
 			md->setFreqAfterCbkChange(fChgd);
+			md->Spectrum.setCenter(fChgd);
 			std::cout << "Rf (Hz) changed to " << fChgd << endl;
 
 		}
-		//In case of a socket error, don't process the data for one second
-		if (md->cbksPerSecond-- > 0)
-		{
-			if (!md->cbkTimerStarted)
-			{
-				md->cbkTimerStarted = true;
-				std::cout << "Discarding samples for one second\n";
-			}
-			goto out;
-		}
-		else if (md->cbkTimerStarted)
-		{
-			md->cbkTimerStarted = false;
-		} 
-		if (md->remoteClient == INVALID_SOCKET)
+		if (!md->started)
 		{
-			std::cout << "Invalid remote socket\n";
+			std::cout << "No session\n";
 			goto out;
 		}
 
@@ -700,10 +708,80 @@ void streamCallback(short *xi, short *xq, sdrplay_api_StreamCbParamsT *params,
 			QueryPerformanceCounter(&Count1);
 		}
 #endif
-		int buflen = 0;
-		BYTE* buf = md->mergeIQ(xi, xq, numSamples, buflen, diff);
-		MemBlock* mblock = new MemBlock(buf, buflen, numSamples);
-		md->SafeQ.enqueue(mblock);
+		const iqConverterEntry* conv = md->converter.load(std::memory_order_acquire);
+		if (md->iqCorrector.isActive())
+		{
+			const short* outI;
+			const short* outQ;
+			md->iqCorrector.process(xi, xq, numSamples, outI, outQ);
+			xi = (short*)outI;
+			xq = (short*)outQ;
+		}
+		if (md->Spectrum.isActive())
+			md->Spectrum.push(xi, xq, numSamples);
+		// the channels are cut from the full band, before the rate conversion
+		if (md->channelizer.isActive())
+			md->channelize(xi, xq, numSamples, conv);
+		if (md->decimator.isActive())
+		{
+			const short* outI;
+			const short* outQ;
+			numSamples = md->decimator.process(xi, xq, numSamples, outI, outQ);
+			if (numSamples == 0)
+				goto out;
+			// the converters only read the samples
+			xi = (short*)outI;
+			xq = (short*)outQ;
+		}
+		if (md->resampler.isActive())
+		{
+			const short* outI;
+			const short* outQ;
+			numSamples = md->resampler.process(xi, xq, numSamples, outI, outQ);
+			if (numSamples == 0)
+				goto out;
+			xi = (short*)outI;
+			xq = (short*)outQ;
+		}
+		if (md->scaler.isActive())
+		{
+			const short* outI;
+			const short* outQ;
+			md->scaler.process(xi, xq, numSamples, outI, outQ);
+			xi = (short*)outI;
+			xq = (short*)outQ;
+		}
+		if (md->requantizer.isActive())
+		{
+			const short* outI;
+			const short* outQ;
+			md->requantizer.process(xi, xq, numSamples, outI, outQ);
+			xi = (short*)outI;
+			xq = (short*)outQ;
+		}
+		// grouped formats keep the samples of an incomplete group for the next block
+		// the lossless stage compresses in place, the block is sized for its frame
+		// in framed mode the header is written in front of the samples by the transmit side
+		int h = md->frameHeaderLength;
+		MemBlock* mblock = md->Pool.acquire(h + (md->lossless.isActive() ?
+			LosslessCodec::maxFrameBytes(numSamples) : conv->maxBytes(numSamples)));
+		numSamples = md->carry.convert(conv, xi, xq, numSamples, mblock->Mem + h);
+		if (numSamples == 0)
+		{
+			md->Pool.recycle(mblock);
+			goto out;
+		}
+		mblock->headerLength = h;
+		mblock->length = h + conv->bytesFor(numSamples);
+		mblock->numSamples = numSamples;
+		// still counted at the device rate, gaps are detected from it
+		mblock->firstSampleNum = params->firstSampleNum;
+		md->frames.stamp(mblock);
+		// if the transmit side can't keep up, the overload policy decides what is discarded
+		if (md->lossless.isActive())
+			md->lossless.push(mblock, md->Pool, md->doExitTxThread);
+		else
+			md->SafeQ.push(mblock, md->Pool, md->doExitTxThread);
 	}
 	catch (exception& e)
 	{
@@ -719,7 +797,114 @@ out:
 	return;
 }
 
-sdrplay_api_ErrT sdrplay_device::createChannels(int srTableIx)
+/// <summary>
+/// Narrowest IF bandwidth passing the output rate of the software rate conversion
+/// </summary>
+static sdrplay_api_Bw_MHzT softResamplingBandwidth(int outputRateHz)
+{
+	if (outputRateHz <= 200000)
+		return sdrplay_api_BW_0_200;
+	if (outputRateHz <= 300000)
+		return sdrplay_api_BW_0_300;
+	if (outputRateHz <= 600000)
+		return sdrplay_api_BW_0_600;
+	if (outputRateHz <= 1536000)
+		return sdrplay_api_BW_1_536;
+	return sdrplay_api_BW_5_000;
+}
+
+/// <summary>
+/// Sets up the decimator and the resampler, while the callback is not running
+/// </summary>
+bool sdrplay_device::configureSoftResampling(const softResampling& soft)
+{
+	currentSoft = soft;
+	return decimator.configure(soft.decimation) && resampler.configure(soft.up, soft.down);
+}
+
+/// <summary>
+/// The channel of the offset tuning must lie inside the band the device delivers,
+/// which is limited by the callback rate and the IF bandwidth of the table entry.
+/// The decimator must run: its filters select the channel shifted to DC
+/// </summary>
+bool sdrplay_device::isValidOffset(int offsetHz) const
+{
+	if (offsetHz == 0)
+		return true;
+	if (currentConfigIx < 0 || currentSoft.decimation <= 1)
+		return false;
+	const samplingConfiguration& sc = samplingConfigs[currentConfigIx];
+	double band = sc.samplingRateHz;
+	if (band > sc.bandwidth * 1000.0)
+		band = sc.bandwidth * 1000.0;
+	return fabs((double)offsetHz) + currentSamplingRateHz / 2 <= band / 2;
+}
+
+/// <summary>
+/// Sets the NCO for the offset of the new configuration, the offset is dropped
+/// if the channel is outside the band now
+/// </summary>
+void sdrplay_device::configureOffsetTuning()
+{
+	if (!isValidOffset(offsetTuningHz))
+	{
+		std::cout << "Offset tuning " << offsetTuningHz << " Hz outside the band or not decimated, switched off" << endl;
+		offsetTuningHz = 0;
+	}
+	nco.setFrequency(offsetTuningHz == 0 ? 0 : (double)offsetTuningHz / samplingConfigs[currentConfigIx].samplingRateHz);
+}
+
+/// <summary>
+/// Callback thread. Queues one block per channel, numbered at the channel rate
+/// </summary>
+void sdrplay_device::channelize(const short* xi, const short* xq, int numSamples, const iqConverterEntry* conv)
+{
+	int n = channelizer.process(xi, xq, numSamples);
+	if (n == 0)
+		return;
+	for (size_t i = 0; i < Channels.size(); i++)
+	{
+		channelOutput* ch = Channels[i];
+		int h = frameHeaderLength;
+		MemBlock* mb = Pool.acquire(h + conv->maxBytes(n));
+		int converted = ch->carry.convert(conv, channelizer.getOutputI((int)i), channelizer.getOutputQ((int)i), n, mb->Mem + h);
+		if (converted == 0)
+		{
+			Pool.recycle(mb);
+			continue;
+		}
+		mb->headerLength = h;
+		mb->length = h + conv->bytesFor(converted);
+		mb->numSamples = converted;
+		mb->firstSampleNum = ch->nextSampleNum;
+		ch->nextSampleNum += converted;
+		ch->frames.stamp(mb);
+		ch->queue.push(mb, Pool, doExitTxThread);
+	}
+}
+
+void sdrplay_device::reportChannels(int rateHz) const
+{
+	for (size_t i = 0; i < Channels.size(); i++)
+	{
+		int bin = Channels[i]->bin;
+		std::cout << "Channel " << bin << ": offset " << Channelizer::binOffsetHz(bin, channelizer.getNumBins(), rateHz)
+			<< " Hz, " << 2 * rateHz / channelizer.getNumBins() << " S/s on port " << pargs->channelPort(bin) << endl;
+	}
+}
+
+/// <summary>
+/// The IF bandwidth: narrowed to the output rate of the software rate conversion,
+/// unless the offset tuning needs the full band of the table entry
+/// </summary>
+sdrplay_api_Bw_MHzT sdrplay_device::channelBandwidth() const
+{
+	if (currentSoft.isActive() && offsetTuningHz == 0)
+		return softResamplingBandwidth(int(currentSamplingRateHz));
+	return samplingConfigs[currentConfigIx].bandwidth;
+}
+
+sdrplay_api_ErrT sdrplay_device::createChannels(int srTableIx, const softResampling& soft)
 {
 	Initialized = false;
 
@@ -753,9 +938,15 @@ sdrplay_api_ErrT sdrplay_device::createChannels(int srTableIx)
 	}
 	else
 		_isAdsbMode = false;
+	selectConverter();
 
+	// the callback is not running, the software stages may be reconfigured
+	currentConfigIx = ix;
+	if (!configureSoftResampling(soft))
+		return sdrplay_api_InvalidParam;
+	configureOffsetTuning();
 	//// next doesn't work in master/slave mode, 
-	pCurCh->tunerParams.bwType = samplingConfigs[ix].bandwidth;
+	pCurCh->tunerParams.bwType = channelBandwidth();
 	BYTE decimationFactor = (BYTE)samplingConfigs[ix].decimationFactor;
 	pCurCh->ctrlParams.decimation.decimationFactor = decimationFactor;
 	pCurCh->ctrlParams.decimation.enable = decimationFactor == 1 ? 0 : 1;
@@ -782,6 +973,11 @@ sdrplay_api_ErrT sdrplay_device::createChannels(int srTableIx)
 	cbFns.StreamBCbFn = streamBCallback;
 	cbFns.EventCbFn = eventCallback;
 
+	reportChannels(samplingConfigs[ix].samplingRateHz);
+	Spectrum.setRate(samplingConfigs[ix].samplingRateHz);
+	iqCorrector.setRate(samplingConfigs[ix].samplingRateHz);
+	scaler.setRate(currentSamplingRateHz);
+	preparePool(ix);
 	sdrplay_api_ErrT errInit = sdrplay_api_Init(pDevice->dev, &cbFns, this);
 	std::cout << "\nsdrplay_api_StreamInit returned with: " << errInit << endl;
 	if (errInit == sdrplay_api_Success)
@@ -792,7 +988,10 @@ sdrplay_api_ErrT sdrplay_device::createChannels(int srTableIx)
 		{
 			err = setAdsbMode((srADSB)sr);
 			if (err != 0)
+			{
 				_isAdsbMode = false;
+				selectConverter();
+			}
 		}
 		Initialized = true;
 		printf("Adsb Mode = %s\n", _isAdsbMode ? "on" : "off");
@@ -833,15 +1032,22 @@ sdrplay_api_ErrT sdrplay_device::createChannels()
 	//pCurCh->tunerParams.ifType = sdrplay_api_IF_0_450;
 
 	deviceParams->devParams->fsFreq.fsHz = currentSamplingRateHz; // initially set in init
-	int ix = getSamplingConfigurationTableIndex(int(currentSamplingRateHz));
+	softResampling soft;
+	int ix = getSamplingConfiguration(int(currentSamplingRateHz), soft);
 	if (ix < 0)
 	{
 		std::cout << "Invalid sampling rate: " << currentSamplingRateHz << endl;
 		return sdrplay_api_InvalidParam;
 	}
 
+	if (soft.isActive())
+		deviceParams->devParams->fsFreq.fsHz = samplingConfigs[ix].deviceSamplingRateHz;
+	currentConfigIx = ix;
+	if (!configureSoftResampling(soft))
+		return sdrplay_api_InvalidParam;
+	configureOffsetTuning();
 	//// next doesn't work in master/slave mode, 
-	pCurCh->tunerParams.bwType = samplingConfigs[ix].bandwidth;
+	pCurCh->tunerParams.bwType = channelBandwidth();
 	BYTE decimationFactor = (BYTE)samplingConfigs[ix].decimationFactor;
 	pCurCh->ctrlParams.decimation.decimationFactor = decimationFactor;
 	pCurCh->ctrlParams.decimation.enable = decimationFactor == 1 ? 0 : 1;
@@ -868,6 +1074,12 @@ sdrplay_api_ErrT sdrplay_device::createChannels()
 	cbFns.StreamBCbFn = streamBCallback;
 	cbFns.EventCbFn = eventCallback;
 
+	selectConverter();
+	reportChannels(samplingConfigs[ix].samplingRateHz);
+	Spectrum.setRate(samplingConfigs[ix].samplingRateHz);
+	iqCorrector.setRate(samplingConfigs[ix].samplingRateHz);
+	scaler.setRate(currentSamplingRateHz);
+	preparePool(ix);
 	sdrplay_api_ErrT errInit = sdrplay_api_Init(pDevice->dev, &cbFns, this);
 	std::cout << "\nsdrplay_api_StreamInit returned with: " << errInit << endl;
 	if (errInit == sdrplay_api_Success)
@@ -903,10 +1115,45 @@ sdrplay_api_ErrT sdrplay_device::setFrequency(int valueHz)
 	else
 	{
 		currentFrequencyHz = valueHz;
+		Spectrum.setCenter(valueHz);
 		std::cout << "Frequency set to (Hz): " << valueHz << endl;
 	}
 	return err;
 }
+/// <summary>
+/// Moves the down converted channel to offsetHz from the tuner frequency.
+/// Only the NCO changes, the tuner is not touched: no PLL settling, the hop takes effect
+/// with the next callback. Switching on or off may change the IF bandwidth once
+/// </summary>
+sdrplay_api_ErrT sdrplay_device::setOffsetTuning(int offsetHz)
+{
+	if (!Initialized)
+	{
+		// checked when the channels are created
+		offsetTuningHz = offsetHz;
+		return sdrplay_api_Success;
+	}
+	if (!isValidOffset(offsetHz))
+	{
+		std::cout << "*** Offset tuning " << offsetHz << " Hz: the channel of " << currentSamplingRateHz
+			<< " Hz is outside the band or not decimated, request a lower sampling rate" << endl;
+		return sdrplay_api_OutOfRange;
+	}
+	sdrplay_api_Bw_MHzT bw = channelBandwidth();
+	offsetTuningHz = offsetHz;
+	if (channelBandwidth() != bw)
+	{
+		pCurCh->tunerParams.bwType = channelBandwidth();
+		err = sdrplay_api_Update(pDevice->dev, pDevice->tuner,
+			sdrplay_api_Update_Tuner_BwType, sdrplay_api_Update_Ext1_None);
+		if (err != sdrplay_api_Success)
+			std::cout << "*** Error on bandwidth setting: " << sdrplay_api_GetErrorString(err) << endl;
+	}
+	configureOffsetTuning();
+	std::cout << "Offset tuning (Hz): " << offsetTuningHz << endl;
+	return sdrplay_api_Success;
+}
+
 sdrplay_api_ErrT sdrplay_device::setGain(int value)
 {
 	err = sdrplay_api_Success;
@@ -1099,11 +1346,12 @@ sdrplay_api_ErrT sdrplay_device::setSamplingRate(int requestedSrHz)
 		else
 			std::cout << "Uninitialize successful!" << endl;
 	}
-	int ix = getSamplingConfigurationTableIndex(requestedSrHz);
+	softResampling soft;
+	int ix = getSamplingConfiguration(requestedSrHz, soft);
 	if (ix >= 0)
 	{
 		currentSamplingRateHz = requestedSrHz;
-		err = createChannels(ix);
+		err = createChannels(ix, soft);
 		return err;
 	}
 	else
@@ -1145,6 +1393,88 @@ int sdrplay_device::getSamplingConfigurationTableIndex(int requestedSrHz)
 	return -1;
 }
 
+static int greatestCommonDivisor(int a, int b)
+{
+	while (b != 0)
+	{
+		int t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+/// <summary>
+/// Gets the configuration for a requested sampling rate.
+/// Rates not in the table are converted in software from a table rate streamed without
+/// the decimation of the API:
+/// - an integer fraction of such a rate is decimated, from the lowest rate possible
+/// - otherwise the rate is decimated by a power of two as far as possible, then resampled
+///   by up / down. The rate with the smallest up is used, its phase bank is the smallest.
+/// </summary>
+/// <param name="requestedSrHz">Requested sampling rate in Hz</param>
+/// <param name="soft">Receives the software conversion, all 1 for a table rate</param>
+/// <returns>Index into the samplingConfigs table, -1 if the rate cannot be produced</returns>
+int sdrplay_device::getSamplingConfiguration(int requestedSrHz, softResampling& soft)
+{
+	soft = softResampling();
+	for (int i = 0; i < c_numSamplingConfigs; i++)
+		if (requestedSrHz == samplingConfigs[i].samplingRateHz)
+			return i;
+	if (requestedSrHz <= 0)
+		return getSamplingConfigurationTableIndex(requestedSrHz);
+
+	int ix = -1;
+	for (int i = 0; i < c_numSamplingConfigs; i++)
+	{
+		const samplingConfiguration& sc = samplingConfigs[i];
+		if (sc.doDecimation || sc.samplingRateHz == SR_ADSB_LOW || sc.samplingRateHz == SR_ADSB_HIGH)
+			continue;
+		if (sc.samplingRateHz < requestedSrHz)
+			continue;
+		softResampling candidate;
+		if (sc.samplingRateHz % requestedSrHz == 0)
+		{
+			candidate.decimation = sc.samplingRateHz / requestedSrHz;
+			if (candidate.decimation > Decimator::c_maxFactor)
+				continue;
+		}
+		else
+		{
+			// the decimator output keeps at least the requested rate
+			while (candidate.decimation * 2 <= Decimator::c_maxFactor &&
+				sc.samplingRateHz % (candidate.decimation * 2) == 0 &&
+				sc.samplingRateHz / (candidate.decimation * 2) >= requestedSrHz)
+				candidate.decimation *= 2;
+			int rateIn = sc.samplingRateHz / candidate.decimation;
+			int g = greatestCommonDivisor(requestedSrHz, rateIn);
+			candidate.up = requestedSrHz / g;
+			candidate.down = rateIn / g;
+			if (candidate.up > Resampler::c_maxUp)
+				continue;
+		}
+		bool better = ix < 0 || candidate.up < soft.up ||
+			(candidate.up == soft.up && sc.samplingRateHz < samplingConfigs[ix].samplingRateHz);
+		if (better)
+		{
+			ix = i;
+			soft = candidate;
+		}
+	}
+	if (ix >= 0)
+	{
+		std::cout << "Sampling rate " << requestedSrHz << " Hz: " << samplingConfigs[ix].samplingRateHz << " Hz";
+		if (soft.decimation > 1)
+			std::cout << ", decimated by " << soft.decimation;
+		if (soft.up != soft.down)
+			std::cout << ", resampled by " << soft.up << "/" << soft.down;
+		std::cout << " in software" << endl;
+		return ix;
+	}
+	// prints the valid table rates
+	return getSamplingConfigurationTableIndex(requestedSrHz);
+}
+
 //value is correction in ppm
 sdrplay_api_ErrT sdrplay_device::setFrequencyCorrection(int value)
 {
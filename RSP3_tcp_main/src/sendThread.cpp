@@ -27,86 +27,72 @@ using namespace std;
 static LARGE_INTEGER Count1, Count2;
 #endif
 
-//void emptyQ(sdrplay_device* p)
-//{
-//	cout << "*** Emptying xmit Queue ***" << endl;
-//	while (p->SafeQ.getNumEntries() > 0)
-//	{
-//		MemBlock* mb = p->SafeQ.dequeue();
-//		delete mb;
-//	}
-//}
 /// <summary>
-/// Send thread, to process blocks received possibly after some time from the callback,
-/// via a SafeQueue, to avoid timeouts.
+/// Transmit side of the event loop, taking the blocks queued by the callback
+/// via a lock-free SpscQueue, to avoid timeouts.
+/// The blocks are moved into the broadcast ring, where each client reads them with
+/// its own cursor (StreamClient::onTransmit). A full ring evicts its oldest block, only
+/// clients which did not read it yet lose it. In OVL_BLOCK mode the ring is not evicted,
+/// the blocks stay in the queue instead and the slowest client holds up the callback,
+/// so all clients get all samples or the API reports them lost.
+/// The queues of the channels are moved into their rings the same way.
+/// In framed mode the frame headers are written on the way, see StreamFrame.h.
 /// </summary>
-void* sendStream(void* p)
+/// <returns>true if blocks are left in a queue because its ring is full</returns>
+bool sdrplay_device::fillRing()
 {
-	sdrplay_device* md = (sdrplay_device*)p;
-	cout << "**** I/Q data transmit thread entered.   *****" << endl;
+	if (doExitTxThread)
+		return false;
+#if defined(TIME_MEAS2) && defined(_WIN32)
+	QueryPerformanceCounter(&Count1);
+#endif
+	bool more = fillRing(SafeQ, Ring, framer);
+	for (size_t i = 0; i < Channels.size(); i++)
+		if (fillRing(Channels[i]->queue, Channels[i]->ring, Channels[i]->framer))
+			more = true;
+#if defined(TIME_MEAS2) && defined(_WIN32)
+	QueryPerformanceCounter(&Count2);
+	double timeInMs = CMeasTimeDiff::calcTimeDiff_in_ms(Count2, Count1);
+	if (timeInMs > 90)
+	{
+		CMeasTimeDiff::formattedTimeOutput("Transmit time (ms) : ", timeInMs);
+		cout << "Queue size = " << SafeQ.getNumEntries() << endl;
+	}
+#endif
+	return more;
+}
 
+bool sdrplay_device::fillRing(TxQueue& q, BroadcastRing& ring, StreamFramer& framer)
+{
+	const int maxBatch = 64;
+	MemBlock* batch[maxBatch];
+
+	bool block = q.getPolicy() == OVL_BLOCK;
 	for (;;)
 	{
-		if (md->doExitTxThread)
-		{
-			cout << "*** Exit requested (1) ***" << endl;
-			break;
-		}
-#if defined(TIME_MEAS2) && defined(_WIN32)
-		QueryPerformanceCounter(&Count1);
-#endif
-		MemBlock* mb = md->SafeQ.dequeue();
-		if (mb->exitMsg)
+		int maxCount = maxBatch;
+		if (block)
 		{
-			cout << "*** Exit msg received. ***" << endl;
-			break;
+			// one at a time, the ring takes a block only if it fits
+			if (ring.full(Pool.getBlockBytes()))
+				return true;
+			maxCount = 1;
 		}
-		try
+		int numBlocks = q.dequeueBatch(batch, maxCount);
+		if (numBlocks > 0)
 		{
-			int remaining = mb->length;
-			int buflen = remaining;
-			BYTE* buf = mb->Mem;
-			//int numSamples = mb->numSamples;
-			int sent = 0;
-
-			if (md->doExitTxThread)
-			{
-				cout << "*** Exit requested (2) ***" << endl;
-				break;
-			}
-			while (remaining > 0)
-			{
-				sent = send(md->remoteClient, (const char*)buf + (buflen - remaining), remaining, 0);
-				remaining -= sent;
-				if (sent == SOCKET_ERROR)
-				{
-					std::cout << "Socket tx Error : " << GETSOCKETERRNO() << endl;
-					break;
-				}
-			}
-			delete mb;
-
-			if (sent == SOCKET_ERROR || md->doExitTxThread)
+			for (int ix = 0; ix < numBlocks; ix++)
 			{
-				cout << "*** Exit requested (3) ***" << endl;
-				break;
+				// in framed mode the header goes in front, before any client sends the block
+				if (framer.isEnabled())
+					framer.frame(batch[ix]);
+				ring.push(batch[ix], Pool);
 			}
+			continue;
 		}
-		catch (exception& e)
-		{
-			cout << "*** Error in transmit :" << e.what() << endl;
+		// the callback wakes the event loop with the next block
+		if (q.armNotify())
 			break;
-		}
-#if defined(TIME_MEAS2) && defined(_WIN32)
-		QueryPerformanceCounter(&Count2);
-		double timeInMs = CMeasTimeDiff::calcTimeDiff_in_ms(Count2, Count1);
-		if (timeInMs > 90)
-		{
-			CMeasTimeDiff::formattedTimeOutput("Transmit time (ms) : ", timeInMs);
-			cout << "Queue size = " << md->SafeQ.getNumEntries() << endl;
-		}
-#endif
 	}
-	cout << "*** Tx thread terminating" << endl;
-	return 0;
-}
\ No newline at end of file
+	return false;
+}